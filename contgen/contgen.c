@@ -95,6 +95,10 @@ void cblock()
     p("  }|");
     p("  return (_rettype (**)(void *~))n;|", ", _rt%");
     p("}|");
+    p("static inline heap _pool_##_name(heap h) {|");
+    p("  static struct closure_pool pool;|");
+    p("  return closure_pool_heap(&pool, h, sizeof(struct _closure_##_name));|");
+    p("}|");
     p("static _rettype _name(struct _closure_##_name *__self~)\n\n\n", ", _rt% _rn%");
 }
 
@@ -1,5 +1,6 @@
 #include <kernel.h>
 #include <lwip.h>
+#include <lwip/priv/tcp_priv.h>
 #include <tfs.h> // XXX fix headers
 #include <unix.h>
 #include <net.h>
@@ -24,6 +25,7 @@ typedef struct direct_conn {
     struct list l;              /* direct list */
     struct tcp_pcb *p;
     struct list sendq_head;
+    struct list inflight_head;  /* written buffers awaiting ack */
     buffer_handler receive_bh;
     err_t pending_err;          /* lwIP */
 } *direct_conn;
@@ -32,8 +34,25 @@ typedef struct direct_conn {
 typedef struct qbuf {
     struct list l;
     buffer b;
+    u32 end_seq;                /* when inflight */
 } *qbuf;
 
+/* Buffer contents are referenced by lwIP rather than copied, so a qbuf
+   is kept on the inflight list until the peer acknowledges its data. */
+static void direct_conn_release_inflight(direct_conn dc, boolean all)
+{
+    list next;
+    while ((next = list_get_next(&dc->inflight_head))) {
+        qbuf q = struct_from_list(next, qbuf, l);
+        if (!all && !TCP_SEQ_GEQ(dc->p->lastack, q->end_seq))
+            break;
+        direct_debug("release %p, end_seq %d\n", q->b, q->end_seq);
+        deallocate_buffer(q->b);
+        list_delete(&q->l);
+        deallocate(dc->d->h, q, sizeof(struct qbuf));
+    }
+}
+
 /* return true if sendq empty */
 static boolean direct_conn_send_internal(direct_conn dc)
 {
@@ -45,7 +64,17 @@ static boolean direct_conn_send_internal(direct_conn dc)
         if (!q->b) {
             /* close connection - should check error, but would need status handler... */
             direct_debug("connection close by sender\n");
-            tcp_close(dc->p);
+
+            /* No callback follows a close that completes normally (e.g.
+               through LAST_ACK), so let go of inflight buffers now. */
+            if (tcp_copy_referenced(dc->p)) {
+                tcp_close(dc->p);
+            } else {
+                msg_err("failed to copy inflight data; aborting connection\n");
+                tcp_err(dc->p, 0);
+                tcp_abort(dc->p);
+            }
+            direct_conn_release_inflight(dc, true);
             list_delete(&q->l);
             deallocate(dc->d->h, q, sizeof(struct qbuf));
             return true;
@@ -59,7 +88,7 @@ static boolean direct_conn_send_internal(direct_conn dc)
         /* Fix interface: can send with PSH flag clear
            (TCP_WRITE_FLAG_MORE) if we know more data is on the way... */
         direct_debug("write %p, len %d\n", buffer_ref(q->b, 0), write_len);
-        err_t err = tcp_write(dc->p, buffer_ref(q->b, 0), write_len, TCP_WRITE_FLAG_COPY);
+        err_t err = tcp_write(dc->p, buffer_ref(q->b, 0), write_len, 0);
         if (err == ERR_MEM)
             return false;
 
@@ -78,12 +107,11 @@ static boolean direct_conn_send_internal(direct_conn dc)
         buffer_consume(q->b, write_len);
         direct_debug("remaining %d\n", buffer_length(q->b));
 
-        /* pop off qbuf if work finished, else loop around to attempt to send more */
-        if (!q->b || buffer_length(q->b) == 0) {
-            if (q->b)
-                deallocate_buffer(q->b);
+        /* move qbuf to inflight if work finished, else loop around to attempt to send more */
+        if (buffer_length(q->b) == 0) {
+            q->end_seq = dc->p->snd_lbb;
             list_delete(&q->l);
-            deallocate(dc->d->h, q, sizeof(struct qbuf));
+            list_insert_before(&dc->inflight_head, &q->l);
         }
     }
     return true;
@@ -154,11 +182,21 @@ err_t direct_conn_input(void *z, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
     return ERR_OK;
 }
 
+static err_t direct_conn_sent(void *z, struct tcp_pcb *pcb, u16 len)
+{
+    direct_debug("dc %p, pcb %p, len %d\n", z, pcb, len);
+    direct_conn_release_inflight(z, false);
+    return ERR_OK;
+}
+
 static void direct_conn_err(void *z, err_t err)
 {
     direct_debug("dc %p, err %d\n", z, err);
     status s;
     direct_conn dc = z;
+
+    /* pcb is gone, and with it any references to inflight buffers */
+    direct_conn_release_inflight(dc, true);
     switch (err) {
     case ERR_ABRT:
     case ERR_RST:
@@ -191,6 +229,7 @@ static err_t direct_accept(void *z, struct tcp_pcb *pcb, err_t b)
     dc->running = false;
     dc->p = pcb;
     list_init(&dc->sendq_head);
+    list_init(&dc->inflight_head);
     buffer_handler bh = apply(d->new, closure(d->h, direct_conn_send, dc));
     if (bh == INVALID_ADDRESS)
         goto fail_dealloc;
@@ -200,6 +239,7 @@ static err_t direct_accept(void *z, struct tcp_pcb *pcb, err_t b)
     tcp_arg(pcb, dc);
     tcp_err(pcb, direct_conn_err);
     tcp_recv(pcb, direct_conn_input);
+    tcp_sent(pcb, direct_conn_sent);
     return ERR_OK;
   fail_dealloc:
     deallocate(d->h, dc, sizeof(struct direct_conn));
@@ -9,3 +9,5 @@
 #include <lwip/ip4_frag.h>
 #include <lwip/etharp.h>
 #include <lwip/dhcp.h>
+
+boolean tcp_copy_referenced(struct tcp_pcb *pcb);
@@ -49,13 +49,15 @@
 
 #define LWIP_WND_SCALE 1
 #define TCP_MSS 1460            /* Assuming ethernet; may want to derive this */
-#define TCP_WND 65535
+/* Upper bound on the receive window; sockets start smaller and grow
+   (see netsyscall.c) */
+#define TCP_WND (4 * 1024 * 1024)
 #define TCP_SND_BUF 65535
 #define TCP_SND_QUEUELEN TCP_SNDQUEUELEN_OVERFLOW
 #define TCP_OVERSIZE TCP_MSS
 #define TCP_QUEUE_OOSEQ 1
 
-#define TCP_RCV_SCALE 0         /* XXX check */
+#define TCP_RCV_SCALE 7         /* TCP_WND must fit in 16 bits after scaling */
 #define TCP_LISTEN_BACKLOG 1
 #define LWIP_DHCP 1
 // would prefer to set this dynamically...also,
@@ -112,6 +112,43 @@ int lwip_strncmp(const char *x, const char *y, unsigned long len)
     return 0;
 }
 
+static boolean tcp_copy_referenced_segs(struct tcp_seg *seg)
+{
+    for (; seg; seg = seg->next) {
+        struct pbuf *prev = seg->p;
+        struct pbuf *q = prev->next;
+        while (q) {
+            if (q->type_internal != PBUF_ROM) {
+                prev = q;
+                q = q->next;
+                continue;
+            }
+            struct pbuf *c = pbuf_alloc(PBUF_RAW, q->len, PBUF_RAM);
+            if (!c)
+                return false;
+            runtime_memcpy(c->payload, q->payload, q->len);
+            c->tot_len = q->tot_len;
+            c->next = q->next;
+            prev->next = c;
+            q->next = 0;
+            pbuf_free(q);
+            prev = c;
+            q = c->next;
+        }
+    }
+    return true;
+}
+
+/* Replace the by-reference (PBUF_ROM) payloads of data which lwIP has
+   yet to send or see acknowledged with private copies, so that the
+   referenced memory may be released. On failure, some payloads may
+   still be referenced; the caller should abort the connection. */
+boolean tcp_copy_referenced(struct tcp_pcb *pcb)
+{
+    return tcp_copy_referenced_segs(pcb->unsent) &&
+        tcp_copy_referenced_segs(pcb->unacked);
+}
+
 extern void lwip_init();
 
 void init_net(kernel_heaps kh)
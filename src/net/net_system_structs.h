@@ -32,6 +32,19 @@ enum protocol_type {
 // tuplify
 #define SOCK_NONBLOCK 00004000
 #define SOCK_CLOEXEC  02000000
+
+#define MSG_OOB         0x00000001
+#define MSG_DONTROUTE   0x00000004
+#define MSG_PROBE       0x00000010
+#define MSG_TRUNC       0x00000020
+#define MSG_CTRUNC      0x00000008
+#define MSG_DONTWAIT    0x00000040
+#define MSG_EOR         0x00000080
+#define MSG_CONFIRM     0x00000800
+#define MSG_NOSIGNAL    0x00004000
+#define MSG_MORE        0x00008000
+#define MSG_ERRQUEUE    0x00002000
+#define MSG_ZEROCOPY    0x04000000
 #define TCP_NODELAY		1	/* Turn off Nagle's algorithm. */
 #define TCP_MAXSEG		2	/* Limit MSS */
 #define TCP_CORK		3	/* Never send partially complete segments */
@@ -6,8 +6,10 @@
 */
 
 #include <unix_internal.h>
+#include <page.h>
 #include <lwip.h>
 #include <lwip/udp.h>
+#include <lwip/priv/tcp_priv.h>
 #include <net_system_structs.h>
 #include <socket.h>
 
@@ -104,19 +106,92 @@ enum udp_socket_state {
     UDP_SOCK_CREATED = 1,
 };
 
+/* A zero-copy transmit awaiting acknowledgement: either a MSG_ZEROCOPY
+   send, to be posted on the error queue, or a sendfile fragment holding
+   a reference to its (pagecache) source */
+typedef struct zc_pending {
+    struct list l;
+    u32 id;
+    u32 end_seq;                /* snd_lbb after the write */
+    boolean copied;
+    range user;                 /* referenced user buffer, if any */
+    refcount ref;               /* sendfile source, no notification */
+} *zc_pending;
+
+/* Sockets bound to the same address with SO_REUSEPORT share a single
+   lwIP pcb; incoming connections are spread across the listening
+   members by a hash of the remote endpoint. */
+typedef struct listen_group {
+    struct list l;              /* reuseport_groups */
+    struct list members;
+    struct tcp_pcb *lw;
+    ip_addr_t ip;
+    u16 port;
+    heap h;
+} *listen_group;
+
+static struct list reuseport_groups;
+
+/* connections lost before reaching an accept queue, reported in
+   /proc/net/netstat */
+static struct {
+    u64 overflows;              /* accept queue full */
+    u64 drops;                  /* failed to allocate socket */
+} listen_stats;
+
+/* As on Linux, drops include overflows. */
+void tcp_listen_stats(u64 *overflows, u64 *drops)
+{
+    *overflows = listen_stats.overflows;
+    *drops = listen_stats.overflows + listen_stats.drops;
+}
+
 typedef struct netsock {
     struct sock sock;            /* must be first */
     process p;
     queue incoming;
     err_t lwip_error;           /* lwIP error code; ERR_OK if normal */
+    boolean reuseport;          /* SO_REUSEPORT */
+    struct {
+        boolean enabled;        /* SO_ZEROCOPY */
+        u32 next_id;
+        struct list pending;    /* in sequence order */
+        u32 user_refs;          /* pending entries referencing user memory */
+        struct list user_l;     /* zerocopy_user_socks, while user_refs */
+        boolean ready;          /* completed range [lo, hi] on error queue */
+        boolean copied;
+        u32 lo, hi;
+    } zc;
     union {
 	struct {
 	    struct tcp_pcb *lw;
 	    enum tcp_socket_state state; // half open?
+	    u32 backlog;        /* bounds incoming when listening */
+	    listen_group group;
+	    struct list group_l;
+	    u32 rcvbuf;         /* receive window target */
+	    u32 sndbuf;         /* send buffer target */
+	    boolean rcvbuf_lock, sndbuf_lock; /* set by SO_RCVBUF / SO_SNDBUF */
+	    boolean wnd_init;   /* pcb window and send buffer follow targets */
+	    u32 rcv_debt;       /* withheld from tcp_recved after shrinking */
+	    u32 buf_charge;     /* autotuned growth, counted in tcp_buf_mem */
+	    u64 copied;         /* total bytes read by the application */
+	    struct pbuf *rx_tail; /* last pbuf enqueued on incoming */
+	    struct {
+	        timestamp time;
+	        u64 copied;
+	        u64 space;      /* most bytes copied in one RTT */
+	    } rcvq;
+	    struct {
+	        timestamp time;
+	        u32 seq;
+	        timestamp rtt;  /* receiver side estimate */
+	    } rcv_rtt;
 	} tcp;
 	struct {
 	    struct udp_pcb *lw;
 	    enum udp_socket_state state;
+	    u16 gso_size;       /* UDP_SEGMENT; 0 if disabled */
 	} udp;
     } info;
 } *netsock;
@@ -127,7 +202,8 @@ static sysreturn netsock_listen(struct sock *sock, int backlog);
 static sysreturn netsock_connect(struct sock *sock, struct sockaddr *addr,
         socklen_t addrlen);
 static sysreturn netsock_accept4(struct sock *sock, struct sockaddr *addr,
-        socklen_t *addrlen, int flags);
+        socklen_t *addrlen, int flags, thread t, boolean bh,
+        io_completion completion);
 static sysreturn netsock_sendto(struct sock *sock, void *buf, u64 len,
         int flags, struct sockaddr *dest_addr, socklen_t addrlen);
 static sysreturn netsock_recvfrom(struct sock *sock, void *buf, u64 len,
@@ -147,11 +223,12 @@ closure_function(1, 1, u32, socket_events,
             return in ? EPOLLIN : 0;
         } else if (s->info.tcp.state == TCP_SOCK_OPEN) {
             return (in ? EPOLLIN | EPOLLRDNORM : 0) |
+                (s->zc.ready ? EPOLLERR : 0) |
                 (s->info.tcp.lw->state == ESTABLISHED ?
                 (tcp_sndbuf(s->info.tcp.lw) ? EPOLLOUT | EPOLLWRNORM : 0) :
                 EPOLLIN | EPOLLHUP);
         } else {
-            return 0;
+            return s->zc.ready ? EPOLLERR : 0;
         }
     }
     assert(s->sock.type == SOCK_DGRAM);
@@ -250,6 +327,329 @@ struct udp_entry {
     u16 rport;
 };
 
+/* Zero-copy transmit (SO_ZEROCOPY / MSG_ZEROCOPY)
+
+   Data is handed to tcp_write() without TCP_WRITE_FLAG_COPY, so lwIP
+   builds PBUF_ROM pbufs which reference the source buffer directly. The
+   application is notified through the socket error queue once the peer
+   has acknowledged the data, at which point lwIP holds no more
+   references. Notification ids are assigned per send call, and ranges
+   of contiguous completions are coalesced as on Linux.
+
+   User pages are not pinned. Instead, sockets referencing user memory
+   are kept on zerocopy_user_socks, and zerocopy_unmap() is called
+   before user memory is unmapped or released; any socket referencing
+   the range then swaps its references for copies (or, failing that,
+   is aborted). */
+
+static struct list zerocopy_user_socks = { &zerocopy_user_socks, &zerocopy_user_socks };
+
+/* Per-connection buffer sizing. The receive window starts at
+   TCP_RCVBUF_DEFAULT and the send buffer at TCP_SND_BUF. Unless fixed
+   with SO_RCVBUF or SO_SNDBUF, both grow with the measured
+   bandwidth-delay product up to TCP_WND, while total growth across all
+   connections is capped at TCP_BUF_MEM_MAX. */
+#define TCP_RCVBUF_DEFAULT      65535
+#define TCP_BUF_MIN             (2 * TCP_MSS)
+#define TCP_BUF_MEM_MAX         (64 * MB)
+
+static u64 tcp_buf_mem;
+
+/* Returns the amount of growth, up to want, permitted by the global cap. */
+static u32 tcp_buf_charge(netsock s, u32 want)
+{
+    u32 n = tcp_buf_mem >= TCP_BUF_MEM_MAX ? 0 : MIN(want, TCP_BUF_MEM_MAX - tcp_buf_mem);
+    tcp_buf_mem += n;
+    s->info.tcp.buf_charge += n;
+    return n;
+}
+
+/* The pcb is closed or gone; buffer sizes no longer apply to it. */
+static void tcp_sock_drop_pcb(netsock s)
+{
+    s->info.tcp.lw = 0;
+    s->info.tcp.wnd_init = false;
+}
+
+static void tcp_set_rcvbuf(netsock s, u32 rcvbuf)
+{
+    u32 old = s->info.tcp.rcvbuf;
+    s->info.tcp.rcvbuf = rcvbuf;
+    if (!s->info.tcp.wnd_init || !s->info.tcp.lw)
+        return;
+    if (rcvbuf > old) {
+        u32 d = rcvbuf - old;
+        u32 r = MIN(d, s->info.tcp.rcv_debt);
+        s->info.tcp.rcv_debt -= r;
+        if (d > r)
+            tcp_recved(s->info.tcp.lw, d - r);
+    } else {
+        /* never retract an advertised window; close it as data is read */
+        s->info.tcp.rcv_debt += old - rcvbuf;
+    }
+}
+
+static void tcp_set_sndbuf(netsock s, u32 sndbuf)
+{
+    u32 old = s->info.tcp.sndbuf;
+    s->info.tcp.sndbuf = sndbuf;
+    if (!s->info.tcp.wnd_init || !s->info.tcp.lw)
+        return;
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    if (sndbuf > old)
+        lw->snd_buf += sndbuf - old;
+    else
+        lw->snd_buf -= MIN(old - sndbuf, lw->snd_buf);
+}
+
+/* Called once the connection is established, when lwIP has settled on
+   the maximum receive window (depending on whether the peer agreed to
+   window scaling), but before any ack has advertised it. */
+static void tcp_sock_init_window(netsock s)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    u32 rcvbuf = MIN(s->info.tcp.rcvbuf, TCP_WND_MAX(lw));
+    /* the SYN may have advertised up to 64KB already */
+    u32 wnd = MIN(MAX(rcvbuf, TCPWND_MIN16(TCP_WND)), lw->rcv_wnd);
+    lw->rcv_wnd = lw->rcv_ann_wnd = wnd;
+    s->info.tcp.rcvbuf = rcvbuf;
+    s->info.tcp.rcv_debt = wnd > rcvbuf ? wnd - rcvbuf : 0;
+    lw->snd_buf = s->info.tcp.sndbuf;
+    s->info.tcp.wnd_init = true;
+}
+
+/* Return read data to the receive window, less any pending shrink. */
+static void tcp_sock_recved(netsock s, u32 len)
+{
+    u32 r = MIN(len, s->info.tcp.rcv_debt);
+    s->info.tcp.rcv_debt -= r;
+    s->info.tcp.copied += len;
+    if (len > r && s->info.tcp.lw)
+        tcp_recved(s->info.tcp.lw, len - r);
+}
+
+/* Estimate the RTT from the receive side, as the time for the sender
+   to fill the window edge offered at the start of the sample. */
+static void tcp_rcv_rtt_measure(netsock s, struct tcp_pcb *pcb)
+{
+    timestamp t = now(CLOCK_ID_MONOTONIC);
+    if (s->info.tcp.rcv_rtt.time) {
+        if (TCP_SEQ_LT(pcb->rcv_nxt, s->info.tcp.rcv_rtt.seq))
+            return;
+        timestamp sample = t - s->info.tcp.rcv_rtt.time;
+        timestamp rtt = s->info.tcp.rcv_rtt.rtt;
+        /* samples are upper bounds; favor the minimum */
+        s->info.tcp.rcv_rtt.rtt = (rtt == 0 || sample < rtt) ? sample :
+            rtt - (rtt >> 3) + (sample >> 3);
+    }
+    s->info.tcp.rcv_rtt.seq = pcb->rcv_nxt + pcb->rcv_wnd;
+    s->info.tcp.rcv_rtt.time = t;
+}
+
+/* Once per RTT, grow the receive window to twice the amount the
+   application consumed, if that rate is the highest seen; a flow
+   limited by the window doubles its window each RTT, while one
+   limited by the application stays put. */
+static void tcp_rcvbuf_autotune(netsock s)
+{
+    timestamp rtt = s->info.tcp.rcv_rtt.rtt;
+    timestamp t = now(CLOCK_ID_MONOTONIC);
+    if (!s->info.tcp.lw || rtt == 0 || t - s->info.tcp.rcvq.time < rtt)
+        return;
+    u64 copied = s->info.tcp.copied - s->info.tcp.rcvq.copied;
+    s->info.tcp.rcvq.time = t;
+    s->info.tcp.rcvq.copied = s->info.tcp.copied;
+    if (s->info.tcp.rcvbuf_lock || copied <= s->info.tcp.rcvq.space)
+        return;
+    s->info.tcp.rcvq.space = copied;
+    u64 target = MIN(2 * copied, TCP_WND_MAX(s->info.tcp.lw));
+    if (target <= s->info.tcp.rcvbuf)
+        return;
+    u32 grow = tcp_buf_charge(s, target - s->info.tcp.rcvbuf);
+    if (grow) {
+        net_debug("sock %d, rcvbuf %d -> %d\n", s->sock.fd, s->info.tcp.rcvbuf,
+                  s->info.tcp.rcvbuf + grow);
+        tcp_set_rcvbuf(s, s->info.tcp.rcvbuf + grow);
+    }
+}
+
+/* Keep enough data queued to fill twice the usable send window. */
+static void tcp_sndbuf_autotune(netsock s, struct tcp_pcb *pcb)
+{
+    if (s->info.tcp.sndbuf_lock || !s->info.tcp.wnd_init)
+        return;
+    u64 target = MIN(2 * (u64)MIN(pcb->cwnd, pcb->snd_wnd_max), TCP_WND);
+    if (target <= s->info.tcp.sndbuf)
+        return;
+    u32 grow = tcp_buf_charge(s, target - s->info.tcp.sndbuf);
+    if (grow) {
+        net_debug("sock %d, sndbuf %d -> %d\n", s->sock.fd, s->info.tcp.sndbuf,
+                  s->info.tcp.sndbuf + grow);
+        tcp_set_sndbuf(s, s->info.tcp.sndbuf + grow);
+    }
+}
+
+#define TCP_TX_COPY             0
+#define TCP_TX_ZEROCOPY         1 /* reference source buffer, notify on ack */
+#define TCP_TX_ZEROCOPY_COPIED  2 /* zero-copy requested, but data copied */
+
+/* User pages must be present to be referenced by the transmit path. */
+static boolean zerocopy_buffer_mapped(void *buf, u64 len)
+{
+    u64 end = u64_from_pointer(buf) + len;
+    for (u64 va = u64_from_pointer(buf) & ~PAGEMASK; va < end; va += PAGESIZE) {
+        if (physical_from_virtual(pointer_from_u64(va)) == INVALID_PHYSICAL)
+            return false;
+    }
+    return true;
+}
+
+static void zerocopy_notify(netsock s, u32 id, boolean copied)
+{
+    if (s->zc.ready && s->zc.hi + 1 == id) {
+        s->zc.hi = id;
+        s->zc.copied |= copied;
+    } else {
+        /* Completions arrive in sequence, so a gap can only follow a
+           range which was already consumed. */
+        s->zc.ready = true;
+        s->zc.lo = s->zc.hi = id;
+        s->zc.copied = copied;
+    }
+}
+
+static zc_pending zerocopy_pending_add(netsock s, u32 end_seq)
+{
+    zc_pending zp = allocate(s->sock.h, sizeof(struct zc_pending));
+    if (zp == INVALID_ADDRESS)
+        return zp;
+    zp->id = 0;
+    zp->end_seq = end_seq;
+    zp->copied = false;
+    zp->user = irange(0, 0);
+    zp->ref = 0;
+    list_insert_before(&s->zc.pending, &zp->l);
+    return zp;
+}
+
+/* user is the referenced user buffer, or empty if the data was copied */
+static boolean zerocopy_track(netsock s, u32 end_seq, boolean copied, range user)
+{
+    zc_pending zp = zerocopy_pending_add(s, end_seq);
+    if (zp == INVALID_ADDRESS)
+        return false;
+    zp->id = s->zc.next_id++;
+    zp->copied = copied;
+    if (!range_empty(user)) {
+        zp->user = user;
+        if (s->zc.user_refs++ == 0)
+            list_insert_before(&zerocopy_user_socks, &s->zc.user_l);
+    }
+    return true;
+}
+
+static void zerocopy_user_release(netsock s, zc_pending zp)
+{
+    if (range_empty(zp->user))
+        return;
+    zp->user = irange(0, 0);
+    if (--s->zc.user_refs == 0)
+        list_delete(&s->zc.user_l);
+}
+
+/* Hold a reference to a referenced (sendfile) source until acked. */
+static boolean zerocopy_hold(netsock s, u32 end_seq, refcount ref)
+{
+    zc_pending zp = zerocopy_pending_add(s, end_seq);
+    if (zp == INVALID_ADDRESS)
+        return false;
+    refcount_reserve(ref);
+    zp->ref = ref;
+    return true;
+}
+
+/* Post completions for all transmits acknowledged by the peer, or for all
+   outstanding transmits if all is set (connection gone). */
+static boolean zerocopy_complete(netsock s, struct tcp_pcb *pcb, boolean all)
+{
+    boolean completed = false;
+    list l;
+    while ((l = list_get_next(&s->zc.pending))) {
+        zc_pending zp = struct_from_list(l, zc_pending, l);
+        if (!all && !TCP_SEQ_GEQ(pcb->lastack, zp->end_seq))
+            break;
+        net_debug("sock %d, id %d, end_seq %d, ref %p\n", s->sock.fd, zp->id, zp->end_seq, zp->ref);
+        zerocopy_user_release(s, zp);
+        if (zp->ref) {
+            refcount_release(zp->ref);
+        } else {
+            zerocopy_notify(s, zp->id, zp->copied);
+            completed = true;
+        }
+        list_delete(l);
+        deallocate(s->sock.h, zp, sizeof(struct zc_pending));
+    }
+    return completed;
+}
+
+/* The socket is going away before the peer acknowledged all zero-copy
+   data; lwIP may still need to (re)transmit it, but the application
+   won't be notified, so swap references to its buffers for copies.
+   Returns false if the pcb still references them. */
+static boolean zerocopy_release(netsock s)
+{
+    if (list_empty(&s->zc.pending))
+        return true;
+    boolean detached = !s->info.tcp.lw || tcp_copy_referenced(s->info.tcp.lw);
+    zerocopy_complete(s, 0, true);
+    return detached;
+}
+
+/* Called before the user range r is unmapped or its pages released. */
+void zerocopy_unmap(range r)
+{
+    list_foreach(&zerocopy_user_socks, l) {
+        netsock s = struct_from_list(l, netsock, zc.user_l);
+        boolean overlap = false;
+        list_foreach(&s->zc.pending, pl) {
+            if (ranges_intersect(struct_from_list(pl, zc_pending, l)->user, r)) {
+                overlap = true;
+                break;
+            }
+        }
+        if (!overlap)
+            continue;
+        net_debug("sock %d: user buffer in %R unmapped\n", s->sock.fd, r);
+        list_foreach(&s->zc.pending, pl)
+            zerocopy_user_release(s, struct_from_list(pl, zc_pending, l));
+        if (!tcp_copy_referenced(s->info.tcp.lw)) {
+            msg_err("sock %d: failed to copy zero-copy data; aborting connection\n",
+                    s->sock.fd);
+            tcp_abort(s->info.tcp.lw);  /* lwip_tcp_conn_err() completes pending */
+        }
+    }
+}
+
+/* source address of queued data p */
+static void sock_src_addr(netsock s, void *p, struct sockaddr *src_addr, socklen_t *addrlen)
+{
+    struct sockaddr sa;
+    zero(&sa, sizeof(sa));
+    struct sockaddr_in * sin = (struct sockaddr_in *)&sa;
+    sin->family = AF_INET;
+    if (s->sock.type == SOCK_STREAM) {
+        sin->address = ip4_addr_get_u32(&s->info.tcp.lw->remote_ip);
+        sin->port = htons(s->info.tcp.lw->remote_port);
+    } else {
+        struct udp_entry * e = p;
+        sin->address = e->raddr;
+        sin->port = htons(e->rport);
+    }
+    u32 len = MIN(sizeof(struct sockaddr), *addrlen);
+    *addrlen = sizeof(struct sockaddr);
+    runtime_memcpy(src_addr, sin, len);
+}
+
 static sysreturn sock_read_bh_internal(netsock s, thread t, void * dest,
                                        u64 length, struct sockaddr * src_addr,
                                        socklen_t * addrlen, io_completion completion, u64 flags)
@@ -293,23 +693,8 @@ static sysreturn sock_read_bh_internal(netsock s, thread t, void * dest,
         return BLOCKQ_BLOCK_REQUIRED;               /* back to chewing more cud */
     }
 
-    if (src_addr) {
-        struct sockaddr sa;
-        zero(&sa, sizeof(sa));
-        struct sockaddr_in * sin = (struct sockaddr_in *)&sa;
-        sin->family = AF_INET;
-        if (s->sock.type == SOCK_STREAM) {
-	    sin->address = ip4_addr_get_u32(&s->info.tcp.lw->remote_ip);
-	    sin->port = htons(s->info.tcp.lw->remote_port);
-        } else {
-            struct udp_entry * e = p;
-            sin->address = e->raddr;
-            sin->port = htons(e->rport);
-        }
-        u32 len = MIN(sizeof(struct sockaddr), *addrlen);
-        *addrlen = sizeof(struct sockaddr);
-        runtime_memcpy(src_addr, sin, len);
-    }
+    if (src_addr)
+        sock_src_addr(s, p, src_addr, addrlen);
 
     u64 xfer_total = 0;
 
@@ -328,7 +713,7 @@ static sysreturn sock_read_bh_internal(netsock s, thread t, void * dest,
                 xfer_total += xfer;
                 dest = (char *) dest + xfer;
                 if (s->sock.type == SOCK_STREAM)
-                    tcp_recved(s->info.tcp.lw, xfer);
+                    tcp_sock_recved(s, xfer);
             }
             if (cur_buf->len == 0)
                 cur_buf = cur_buf->next;
@@ -345,6 +730,8 @@ static sysreturn sock_read_bh_internal(netsock s, thread t, void * dest,
         }
     } while(s->sock.type == SOCK_STREAM && length > 0 && p != INVALID_ADDRESS); /* XXX simplify expression */
 
+    if (s->sock.type == SOCK_STREAM)
+        tcp_rcvbuf_autotune(s);
     rv = xfer_total;
   out:
     net_debug("   completion %p, rv %ld\n", completion, rv);
@@ -418,8 +805,143 @@ closure_function(1, 6, sysreturn, socket_read,
     return blockq_check(s->sock.rxbq, t, ba, bh);
 }
 
+/* Received pbufs lent to an sg_list (splice to a pipe); each
+   fragment is referenced until the sg_buf is released. */
+typedef struct pbuf_lease *pbuf_lease;
+
+declare_closure_struct(1, 0, void, pbuf_lease_release,
+                       pbuf_lease, l);
+
+struct pbuf_lease {
+    struct refcount refcount;
+    struct pbuf *p;
+    heap h;
+    closure_struct(pbuf_lease_release, release);
+};
+
+define_closure_function(1, 0, void, pbuf_lease_release,
+                        pbuf_lease, l)
+{
+    pbuf_lease l = bound(l);
+    pbuf_free(l->p);
+    deallocate(l->h, l, sizeof(struct pbuf_lease));
+}
+
+static boolean sock_lend_pbuf(netsock s, sg_list sg, struct pbuf *p, u64 length)
+{
+    pbuf_lease l = allocate(s->sock.h, sizeof(struct pbuf_lease));
+    if (l == INVALID_ADDRESS)
+        return false;
+    pbuf_ref(p);
+    l->p = p;
+    l->h = s->sock.h;
+    init_refcount(&l->refcount, 1, init_closure(&l->release, pbuf_lease_release, l));
+    sg_buf sgb = sg_list_tail_add(sg, length);
+    sgb->buf = p->payload;
+    sgb->length = length;
+    sgb->misc = 0;
+    sgb->refcount = &l->refcount;
+    return true;
+}
+
+closure_function(5, 1, sysreturn, socket_read_sg_bh,
+                 netsock, s, thread, t, sg_list, sg, u64, length, io_completion, completion,
+                 u64, flags)
+{
+    netsock s = bound(s);
+    thread t = bound(t);
+    u64 length = bound(length);
+    sysreturn rv = 0;
+    err_t err = get_lwip_error(s);
+    net_debug("sock %d, thread %ld, sg %p, len %ld, flags 0x%lx, lwip err %d\n",
+              s->sock.fd, t->tid, bound(sg), length, flags, err);
+
+    if (flags & BLOCKQ_ACTION_NULLIFY) {
+        rv = -EINTR;
+        goto out;
+    }
+
+    if (s->info.tcp.state != TCP_SOCK_OPEN) {
+        rv = -ENOTCONN;
+        goto out;
+    }
+
+    if (err != ERR_OK) {
+        rv = lwip_to_errno(err);
+        goto out;
+    }
+
+    struct pbuf *p = queue_peek(s->incoming);
+    if (p == INVALID_ADDRESS) {
+        if (s->info.tcp.lw->state != ESTABLISHED)
+            goto out;
+        if ((s->sock.f.flags & SOCK_NONBLOCK)) {
+            rv = -EAGAIN;
+            goto out;
+        }
+        return BLOCKQ_BLOCK_REQUIRED;
+    }
+
+    u64 xfer_total = 0;
+    do {
+        struct pbuf *cur_buf = p;
+        do {
+            if (cur_buf->len > 0) {
+                u64 xfer = MIN(length, cur_buf->len);
+                if (!sock_lend_pbuf(s, bound(sg), cur_buf, xfer))
+                    goto done;
+                pbuf_consume(cur_buf, xfer);
+                length -= xfer;
+                xfer_total += xfer;
+                tcp_sock_recved(s, xfer);
+            }
+            if (cur_buf->len == 0)
+                cur_buf = cur_buf->next;
+        } while (length > 0 && cur_buf);
+
+        if (!cur_buf) {
+            assert(dequeue(s->incoming) == p);
+            pbuf_free(p);
+            p = queue_peek(s->incoming);
+            if (p == INVALID_ADDRESS)
+                fdesc_notify_events(&s->sock.f); /* reset a triggered EPOLLIN condition */
+        }
+    } while (length > 0 && p != INVALID_ADDRESS);
+  done:
+    tcp_rcvbuf_autotune(s);
+    rv = xfer_total > 0 ? xfer_total : -ENOMEM;
+  out:
+    net_debug("   completion %p, rv %ld\n", bound(completion), rv);
+    blockq_handle_completion(s->sock.rxbq, flags, bound(completion), t, rv);
+    closure_finish();
+    return rv;
+}
+
+/* splice from a TCP socket: lend received pbufs without copying */
+closure_function(1, 6, sysreturn, socket_sg_read,
+                 netsock, s,
+                 sg_list, sg, u64, length, u64, offset, thread, t, boolean, bh, io_completion, completion)
+{
+    netsock s = bound(s);
+    net_debug("sock %d, thread %ld, sg %p, length %ld\n", s->sock.fd, t->tid, sg, length);
+    sysreturn rv;
+    if (s->info.tcp.state != TCP_SOCK_OPEN) {
+        rv = -ENOTCONN;
+        goto out;
+    }
+    if (length == 0) {
+        rv = 0;
+        goto out;
+    }
+    blockq_action ba = closure(s->sock.h, socket_read_sg_bh, s, t, sg, length, completion);
+    return blockq_check(s->sock.rxbq, t, ba, bh);
+  out:
+    apply(completion, t, rv);
+    return rv;
+}
+
 static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
-                                              u64 remain, io_completion completion, u64 flags)
+                                              u64 remain, int zc, io_completion completion, u64 flags)
 {
     sysreturn rv = 0;
     err_t err = get_lwip_error(s);
@@ -469,9 +991,24 @@ static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
     } else {
         n = remain;
     }
+    if (zc == TCP_TX_ZEROCOPY) {
+        if (zerocopy_buffer_mapped(buf, n))
+            apiflags &= ~TCP_WRITE_FLAG_COPY;
+        else
+            zc = TCP_TX_ZEROCOPY_COPIED;
+    }
 
     /* XXX need to pore over lwIP error conditions here */
     err = tcp_write(s->info.tcp.lw, buf, n, apiflags);
+    if (err == ERR_OK && zc != TCP_TX_COPY &&
+        !zerocopy_track(s, s->info.tcp.lw->snd_lbb, zc == TCP_TX_ZEROCOPY_COPIED,
+                        zc == TCP_TX_ZEROCOPY ? irange(u64_from_pointer(buf), u64_from_pointer(buf) + n) :
+                        irange(0, 0))) {
+        /* can't take back the write, but we can stop referencing the buffer */
+        msg_err("failed to track zero-copy transmit\n");
+        if (!tcp_copy_referenced(s->info.tcp.lw))
+            msg_err("failed to copy zero-copy data; buffer remains referenced\n");
+    }
     if (err == ERR_OK) {
         /* XXX prob add a flag to determine whether to continuously
            post data, e.g. if used by send/sendto... */
@@ -501,39 +1038,184 @@ static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
     return rv;
 }
 
-closure_function(5, 1, sysreturn, socket_write_tcp_bh,
-                 netsock, s, thread, t, void *, buf, u64, remain, io_completion, completion,
+closure_function(6, 1, sysreturn, socket_write_tcp_bh,
+                 netsock, s, thread, t, void *, buf, u64, remain, int, zc, io_completion, completion,
                  u64, flags)
 {
-    sysreturn rv = socket_write_tcp_bh_internal(bound(s), bound(t), bound(buf), bound(remain), bound(completion), flags);
+    sysreturn rv = socket_write_tcp_bh_internal(bound(s), bound(t), bound(buf), bound(remain), bound(zc),
+                                                bound(completion), flags);
     if (rv != BLOCKQ_BLOCK_REQUIRED)
         closure_finish();
     return rv;
 }
 
-static sysreturn socket_write_udp(netsock s, void *source, u64 length)
+/* Transmit up to remain bytes from the head of sg by reference. Each
+   fragment handed to lwIP holds a reference to its source until it is
+   acknowledged. Written data is consumed from the list; fully written
+   sg_bufs are removed and released. */
+static sysreturn socket_write_sg_bh_internal(netsock s, thread t, sg_list sg,
+                                             u64 remain, io_completion completion, u64 flags)
 {
-    err_t err = ERR_OK;
-
-    /* XXX check how much we can queue, maybe make udp bh */
-    /* XXX check if remote endpoint set? let LWIP check? */
-    struct pbuf * pbuf = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
+    sysreturn rv = 0;
+    u64 written = 0;
+    err_t err = get_lwip_error(s);
+    net_debug("fd %d, thread %ld, sg %p, remain %ld, flags 0x%lx, lwip err %d\n",
+              s->sock.fd, t->tid, sg, remain, flags, err);
+    assert(remain > 0);
 
-    if (!pbuf) {
-        msg_err("failed to allocate pbuf for udp_send()\n");
-        return -ENOBUFS;
+    if (flags & BLOCKQ_ACTION_NULLIFY) {
+        rv = -EINTR;
+        goto out;
     }
-    runtime_memcpy(pbuf->payload, source, length);
-    err = udp_send(s->info.udp.lw, pbuf);
+
     if (err != ERR_OK) {
-        net_debug("lwip error %d\n", err);
-        return lwip_to_errno(err);
+        rv = lwip_to_errno(err);
+        goto out;
+    }
+
+    if (s->info.tcp.state != TCP_SOCK_OPEN) {
+        rv = -ENOTCONN;
+        goto out;
+    }
+
+    while (remain > 0 && buffer_length(sg->b) >= sizeof(struct sg_buf)) {
+        sg_buf sgb = buffer_ref(sg->b, 0);
+        u64 avail = tcp_sndbuf(s->info.tcp.lw);
+        if (avail == 0)
+            break;
+        u64 n = MIN(MIN(remain, sgb->length), avail);
+        u8 apiflags = n < remain ? TCP_WRITE_FLAG_MORE : 0;
+        err = tcp_write(s->info.tcp.lw, sgb->buf, n, apiflags);
+        if (err == ERR_MEM)
+            break;
+        if (err != ERR_OK) {
+            net_debug(" tcp_write() lwip error: %d\n", err);
+            if (written == 0) {
+                rv = lwip_to_errno(err);
+                goto out;
+            }
+            break;
+        }
+        if (!zerocopy_hold(s, s->info.tcp.lw->snd_lbb, sgb->refcount)) {
+            msg_err("failed to track referenced transmit\n");
+            if (!tcp_copy_referenced(s->info.tcp.lw))
+                msg_err("failed to copy referenced data; source remains referenced\n");
+        }
+        written += n;
+        remain -= n;
+        if (n == sgb->length) {
+            sg_buf_release(sg_list_head_remove(sg));
+        } else {
+            sgb->buf += n;
+            sgb->length -= n;
+            fetch_and_add(&sg->count, -n);
+        }
     }
-    return length;
+
+    if (written == 0) {
+        if ((flags & BLOCKQ_ACTION_BLOCKED) == 0 &&
+                (s->sock.f.flags & SOCK_NONBLOCK)) {
+            net_debug(" send buf full and non-blocking, return EAGAIN\n");
+            rv = -EAGAIN;
+            goto out;
+        } else {
+            net_debug(" send buf full, sleep\n");
+            return BLOCKQ_BLOCK_REQUIRED;           /* block again */
+        }
+    }
+
+    err = tcp_output(s->info.tcp.lw);
+    if (err == ERR_OK) {
+        net_debug(" tcp_write and tcp_output successful for %ld bytes\n", written);
+        rv = written;
+        if (tcp_sndbuf(s->info.tcp.lw) == 0)
+            fdesc_notify_events(&s->sock.f); /* reset a triggered EPOLLOUT condition */
+    } else {
+        net_debug(" tcp_output() lwip error: %d\n", err);
+        rv = lwip_to_errno(err);
+    }
+  out:
+    net_debug("   completion %p, rv %ld\n", completion, rv);
+    blockq_handle_completion(s->sock.txbq, flags, completion, t, rv);
+    return rv;
+}
+
+closure_function(5, 1, sysreturn, socket_write_sg_bh,
+                 netsock, s, thread, t, sg_list, sg, u64, remain, io_completion, completion,
+                 u64, flags)
+{
+    sysreturn rv = socket_write_sg_bh_internal(bound(s), bound(t), bound(sg), bound(remain),
+                                               bound(completion), flags);
+    if (rv != BLOCKQ_BLOCK_REQUIRED)
+        closure_finish();
+    return rv;
+}
+
+#define UDP_MAX_SEGMENTS    64
+
+/* Send length bytes gathered from iov as a single datagram or, given a
+   segment size (UDP_SEGMENT), as a train of gso-sized datagrams with a
+   possibly shorter tail. Payload is copied from the iovecs straight into
+   the pbufs. With a null dst the datagrams go to the connected remote. */
+static sysreturn udp_send_iov(netsock s, const ip_addr_t *dst, u16 port,
+                              struct iovec *iov, u64 iovcnt, u64 length, u16 gso)
+{
+    if (gso && length > gso) {
+        if (length > (u64)gso * UDP_MAX_SEGMENTS)
+            return -EINVAL;
+        if (netif_default && gso > netif_default->mtu - IP_HLEN - UDP_HLEN)
+            return -EINVAL;
+    } else {
+        gso = length;
+    }
+
+    /* XXX check how much we can queue, maybe make udp bh */
+    sysreturn rv = 0;
+    u64 sent = 0;
+    u64 i = 0, iov_off = 0;
+    do {
+        u64 seglen = MIN(gso, length - sent);
+        struct pbuf * pbuf = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_RAM);
+        if (!pbuf) {
+            msg_err("failed to allocate pbuf for udp_send()\n");
+            rv = -ENOBUFS;
+            break;
+        }
+        u8 *dest = pbuf->payload;
+        for (u64 n = seglen; n > 0; ) {
+            assert(i < iovcnt);
+            u64 xfer = MIN(n, iov[i].iov_len - iov_off);
+            runtime_memcpy(dest, iov[i].iov_base + iov_off, xfer);
+            dest += xfer;
+            n -= xfer;
+            iov_off += xfer;
+            if (iov_off == iov[i].iov_len) {
+                i++;
+                iov_off = 0;
+            }
+        }
+        err_t err = dst ? udp_sendto(s->info.udp.lw, pbuf, dst, port) :
+            udp_send(s->info.udp.lw, pbuf);
+        pbuf_free(pbuf);        /* lwIP doesn't take the reference */
+        if (err != ERR_OK) {
+            net_debug("lwip error %d\n", err);
+            rv = lwip_to_errno(err);
+            break;
+        }
+        sent += seglen;
+    } while (sent < length);
+    return sent ? sent : rv;
+}
+
+static sysreturn socket_write_udp(netsock s, void *source, u64 length)
+{
+    /* XXX check if remote endpoint set? let LWIP check? */
+    struct iovec iov = { source, length };
+    return udp_send_iov(s, 0, 0, &iov, 1, length, s->info.udp.gso_size);
 }
 
 static sysreturn socket_write_internal(struct sock *sock, void *source,
-                                       u64 length,
+                                       u64 length, int zc,
                                        thread t, boolean bh, io_completion completion)
 {
     netsock s = (netsock) sock;
@@ -550,7 +1232,7 @@ static sysreturn socket_write_internal(struct sock *sock, void *source,
             goto out;
         }
         blockq_action ba = closure(sock->h, socket_write_tcp_bh, s, t,
-                                   source, length, completion);
+                                   source, length, zc, completion);
         return blockq_check(sock->txbq, t, ba, bh);
     } else if (sock->type == SOCK_DGRAM) {
         rv = socket_write_udp(s, source, length);
@@ -571,7 +1253,30 @@ closure_function(1, 6, sysreturn, socket_write,
     struct sock *s = (struct sock *) bound(s);
     net_debug("sock %d, type %d, thread %ld, source %p, length %ld, offset %ld\n",
 	      s->fd, s->type, t->tid, source, length, offset);
-    return socket_write_internal(s, source, length, t, bh, completion);
+    return socket_write_internal(s, source, length, TCP_TX_COPY, t, bh, completion);
+}
+
+/* sendfile to a TCP socket: transmit pagecache pages without copying */
+closure_function(1, 6, sysreturn, socket_sg_write,
+                 netsock, s,
+                 sg_list, sg, u64, length, u64, offset, thread, t, boolean, bh, io_completion, completion)
+{
+    netsock s = bound(s);
+    net_debug("sock %d, thread %ld, sg %p, length %ld\n", s->sock.fd, t->tid, sg, length);
+    sysreturn rv;
+    if (s->info.tcp.state != TCP_SOCK_OPEN) {
+        rv = -EPIPE;
+        goto out;
+    }
+    if (length == 0) {
+        rv = 0;
+        goto out;
+    }
+    blockq_action ba = closure(s->sock.h, socket_write_sg_bh, s, t, sg, length, completion);
+    return blockq_check(s->sock.txbq, t, ba, bh);
+  out:
+    apply(completion, t, rv);
+    return rv;
 }
 
 closure_function(1, 2, sysreturn, netsock_ioctl,
@@ -639,6 +1344,71 @@ closure_function(1, 2, sysreturn, netsock_ioctl,
 
 #define SOCK_QUEUE_LEN 128
 
+static boolean reuseport_group_create(netsock s)
+{
+    listen_group g = allocate(s->sock.h, sizeof(struct listen_group));
+    if (g == INVALID_ADDRESS)
+        return false;
+    list_init(&g->members);
+    g->lw = s->info.tcp.lw;
+    ip_addr_copy(g->ip, g->lw->local_ip);
+    g->port = g->lw->local_port;
+    g->h = s->sock.h;
+    list_insert_before(&reuseport_groups, &g->l);
+    list_insert_before(&g->members, &s->info.tcp.group_l);
+    s->info.tcp.group = g;
+    return true;
+}
+
+/* Join the group bound to ip:port, releasing the socket's own pcb. */
+static boolean reuseport_group_join(netsock s, ip_addr_t *ip, u16 port)
+{
+    list_foreach(&reuseport_groups, l) {
+        listen_group g = struct_from_list(l, listen_group, l);
+        if (g->port != port || !ip_addr_cmp(&g->ip, ip))
+            continue;
+        net_debug("sock %d joins group %p, port %d\n", s->sock.fd, g, port);
+        tcp_close(s->info.tcp.lw);
+        s->info.tcp.lw = g->lw;
+        list_insert_before(&g->members, &s->info.tcp.group_l);
+        s->info.tcp.group = g;
+        return true;
+    }
+    return false;
+}
+
+/* The lwIP backlog bounds connections not yet accepted across the group;
+   each member's own backlog is enforced on its accept queue. */
+static void reuseport_group_set_backlog(listen_group g)
+{
+    if (g->lw->state != LISTEN)
+        return;
+    u32 backlog = 0;
+    list_foreach(&g->members, l) {
+        netsock s = struct_from_list(l, netsock, info.tcp.group_l);
+        if (s->info.tcp.state == TCP_SOCK_LISTENING)
+            backlog += s->info.tcp.backlog;
+    }
+    tcp_backlog_set(g->lw, MIN(backlog, 0xff));
+}
+
+/* Returns true if the socket was the last member and the pcb should be
+   closed along with it. */
+static boolean reuseport_group_leave(netsock s)
+{
+    listen_group g = s->info.tcp.group;
+    list_delete(&s->info.tcp.group_l);
+    s->info.tcp.group = 0;
+    if (!list_empty(&g->members)) {
+        tcp_sock_drop_pcb(s);
+        reuseport_group_set_backlog(g);
+        return false;
+    }
+    list_delete(&g->l);
+    deallocate(g->h, g, sizeof(struct listen_group));
+    return true;
+}
+
 closure_function(1, 0, sysreturn, socket_close,
                  netsock, s)
 {
@@ -650,9 +1420,18 @@ closure_function(1, 0, sysreturn, socket_close,
          * prevent any lwIP callback that might be called after tcp_close() from
          * using a stale reference to the socket structure, set the callback
          * argument to NULL. */
+        boolean detached = zerocopy_release(s);
+        tcp_buf_mem -= s->info.tcp.buf_charge;
+        if (s->info.tcp.group && !reuseport_group_leave(s))
+            break;              /* pcb still in use by the group */
         if (s->info.tcp.lw) {
-            tcp_close(s->info.tcp.lw);
             tcp_arg(s->info.tcp.lw, 0);
+            if (detached) {
+                tcp_close(s->info.tcp.lw);
+            } else {
+                msg_err("failed to copy zero-copy data; aborting connection\n");
+                tcp_abort(s->info.tcp.lw);
+            }
         }
         break;
     case SOCK_DGRAM:
@@ -662,6 +1441,10 @@ closure_function(1, 0, sysreturn, socket_close,
     deallocate_queue(s->incoming);
     deallocate_closure(s->sock.f.read);
     deallocate_closure(s->sock.f.write);
+    if (s->sock.f.sg_read)
+        deallocate_closure(s->sock.f.sg_read);
+    if (s->sock.f.sg_write)
+        deallocate_closure(s->sock.f.sg_write);
     deallocate_closure(s->sock.f.close);
     deallocate_closure(s->sock.f.events);
     deallocate_closure(s->sock.f.ioctl);
@@ -695,11 +1478,16 @@ static sysreturn netsock_shutdown(struct sock *sock, int how)
         if (s->info.tcp.state != TCP_SOCK_OPEN) {
             return -ENOTCONN;
         }
+        if (shut_rx && shut_tx && !zerocopy_release(s)) {
+            msg_err("failed to copy zero-copy data; aborting connection\n");
+            tcp_abort(s->info.tcp.lw);  /* lwip_tcp_conn_err() drops the pcb */
+            break;
+        }
         tcp_shutdown(s->info.tcp.lw, shut_rx, shut_tx);
         if (shut_rx && shut_tx) {
             /* Shutting down both TX and RX is equivalent to calling
              * tcp_close(), so the pcb should not be referenced anymore. */
-            s->info.tcp.lw = 0;
+            tcp_sock_drop_pcb(s);
         }
         break;
     case SOCK_DGRAM:
@@ -757,7 +1545,7 @@ static int allocate_sock(process p, int type, u32 flags, netsock * rs)
     }
 
     heap h = heap_general((kernel_heaps)p->uh);
-    fd = socket_init(p, h, type, flags, &s->sock);
+    fd = socket_init(p, h, AF_INET, type, flags, &s->sock);
     if (fd < 0) {
         goto err_fd;
     }
@@ -782,6 +1570,11 @@ static int allocate_sock(process p, int type, u32 flags, netsock * rs)
     s->sock.recvfrom = netsock_recvfrom;
     s->sock.shutdown = netsock_shutdown;
     set_lwip_error(s, ERR_OK);
+    s->reuseport = false;
+    s->zc.enabled = false;
+    s->zc.next_id = 0;
+    list_init(&s->zc.pending);
+    s->zc.ready = false;
     *rs = s;
     return fd;
 
@@ -800,6 +1593,20 @@ static int allocate_tcp_sock(process p, struct tcp_pcb *pcb, u32 flags)
     if (fd >= 0) {
 	s->info.tcp.lw = pcb;
 	s->info.tcp.state = TCP_SOCK_CREATED;
+        s->info.tcp.backlog = 0;
+        s->info.tcp.group = 0;
+        s->info.tcp.rcvbuf = TCP_RCVBUF_DEFAULT;
+        s->info.tcp.sndbuf = TCP_SND_BUF;
+        s->info.tcp.rcvbuf_lock = s->info.tcp.sndbuf_lock = false;
+        s->info.tcp.wnd_init = false;
+        s->info.tcp.rcv_debt = 0;
+        s->info.tcp.buf_charge = 0;
+        s->info.tcp.copied = 0;
+        s->info.tcp.rx_tail = 0;
+        zero(&s->info.tcp.rcvq, sizeof(s->info.tcp.rcvq));
+        zero(&s->info.tcp.rcv_rtt, sizeof(s->info.tcp.rcv_rtt));
+        s->sock.f.sg_read = closure(s->sock.h, socket_sg_read, s);
+        s->sock.f.sg_write = closure(s->sock.h, socket_sg_write, s);
     }
     return fd;
 }
@@ -877,9 +1684,18 @@ static err_t tcp_input_lower(void *z, struct tcp_pcb *pcb, struct pbuf *p, err_t
 
     /* A null pbuf indicates connection closed. */
     if (p) {
+        tcp_rcv_rtt_measure(s, pcb);
         if (!enqueue(s->incoming, p)) {
-	    msg_err("incoming queue full\n");
-            return ERR_BUF;     /* XXX verify */
+            /* A large window can outrun the queue; chain onto the last
+               entry, which can't be dequeued while the queue is full. */
+            struct pbuf *tail = s->info.tcp.rx_tail;
+            if (!tail) {
+                msg_err("incoming queue full\n");
+                return ERR_BUF;     /* XXX verify */
+            }
+            pbuf_cat(tail, p);
+        } else {
+            s->info.tcp.rx_tail = p;
         }
         wakeup_sock(s, WAKEUP_SOCK_RX);
     } else {
@@ -904,6 +1720,12 @@ static sysreturn netsock_bind(struct sock *sock, struct sockaddr *addr,
         net_debug("calling tcp_bind, pcb %p, ip %x, port %d\n",
                   s->info.tcp.lw, *(u32*)&ipaddr, ntohs(sin->port));
 	err = tcp_bind(s->info.tcp.lw, &ipaddr, ntohs(sin->port));
+        if (s->reuseport) {
+            if (err == ERR_USE && reuseport_group_join(s, &ipaddr, ntohs(sin->port)))
+                err = ERR_OK;
+            else if (err == ERR_OK && !reuseport_group_create(s))
+                err = ERR_MEM;
+        }
 	if (err == ERR_OK)
 	    s->info.tcp.state = TCP_SOCK_OPEN;
     } else if (sock->type == SOCK_DGRAM) {
@@ -937,7 +1759,10 @@ static void lwip_tcp_conn_err(void * z, err_t err) {
     set_lwip_error(s, err);
 
     /* Don't try to use the pcb, it may have been deallocated already. */
-    s->info.tcp.lw = 0;
+    tcp_sock_drop_pcb(s);
+
+    /* lwIP has released any referenced zero-copy data */
+    zerocopy_complete(s, 0, true);
 
     wakeup_sock(s, WAKEUP_SOCK_EXCEPT);
 }
@@ -949,6 +1774,8 @@ static err_t lwip_tcp_sent(void * arg, struct tcp_pcb * pcb, u16 len)
     }
     netsock s = (netsock)arg;
     net_debug("fd %d, pcb %p, len %d\n", s->sock.fd, pcb, len);
+    zerocopy_complete(s, pcb, false);
+    tcp_sndbuf_autotune(s, pcb);
     wakeup_sock(s, WAKEUP_SOCK_TX);
     return ERR_OK;
 }
@@ -996,6 +1823,8 @@ static err_t connect_tcp_complete(void* arg, struct tcp_pcb* tpcb, err_t err)
    }
    assert(s->info.tcp.state == TCP_SOCK_IN_CONNECTION);
    s->info.tcp.state = TCP_SOCK_OPEN; /* XXX state handling needs fixing; this could indicate an error as well */
+   if (err == ERR_OK)
+       tcp_sock_init_window(s);
    set_lwip_error(s, err);
    blockq_wake_one(s->sock.rxbq);
    return ERR_OK;
@@ -1076,15 +1905,13 @@ sysreturn connect(int sockfd, struct sockaddr *addr, socklen_t addrlen)
     return sock->connect(sock, addr, addrlen);
 }
 
-#define MSG_OOB         0x00000001
-#define MSG_DONTROUTE   0x00000004
-#define MSG_PROBE       0x00000010
-#define MSG_TRUNC       0x00000020
-#define MSG_DONTWAIT    0x00000040
-#define MSG_EOR         0x00000080
-#define MSG_CONFIRM     0x00000800
-#define MSG_NOSIGNAL    0x00004000
-#define MSG_MORE        0x00008000
+static int zerocopy_mode(struct sock *sock, int flags)
+{
+    if (sock->domain != AF_INET || sock->type != SOCK_STREAM ||
+        !(flags & MSG_ZEROCOPY) || !((netsock)sock)->zc.enabled)
+        return TCP_TX_COPY;
+    return TCP_TX_ZEROCOPY;
+}
 
 static sysreturn sendto_prepare(struct sock *sock, int flags,
         struct sockaddr *dest_addr,
@@ -1140,8 +1967,8 @@ static sysreturn netsock_sendto(struct sock *sock, void *buf, u64 len,
     if (rv < 0) {
         return set_syscall_return(current, rv);
     }
-    return socket_write_internal(sock, buf, len, current, false,
-            syscall_io_complete);
+    return socket_write_internal(sock, buf, len, zerocopy_mode(sock, flags),
+                                 current, false, syscall_io_complete);
 }
 
 sysreturn sendto(int sockfd, void * buf, u64 len, int flags,
@@ -1204,6 +2031,54 @@ closure_function(3, 2, void, sendmsg_complete,
     closure_finish();
 }
 
+/* segment size from a UDP_SEGMENT control message, else the socket's */
+static sysreturn udp_msg_gso(netsock s, const struct msghdr *msg, u16 *gso)
+{
+    *gso = s->info.udp.gso_size;
+    if (!msg->msg_control)
+        return 0;
+    u64 off = 0;
+    while (off + sizeof(struct cmsghdr) <= msg->msg_controllen) {
+        struct cmsghdr *cmsg = msg->msg_control + off;
+        if (cmsg->cmsg_len < sizeof(struct cmsghdr) ||
+            cmsg->cmsg_len > msg->msg_controllen - off)
+            return -EINVAL;
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_SEGMENT) {
+            if (cmsg->cmsg_len != CMSG_LEN(sizeof(u16)))
+                return -EINVAL;
+            *gso = *(u16 *)CMSG_DATA(cmsg);
+        }
+        off += CMSG_ALIGN(cmsg->cmsg_len);
+    }
+    return 0;
+}
+
+/* Unlike sendto(), a destination given here applies to this message
+   only; the pcb is not connected to it. Flags are checked by the
+   caller. */
+static sysreturn udp_sendmsg(netsock s, const struct msghdr *msg)
+{
+    u16 gso;
+    sysreturn rv = udp_msg_gso(s, msg, &gso);
+    if (rv < 0)
+        return rv;
+    ip_addr_t ipaddr;
+    const ip_addr_t *dst = 0;
+    u16 port = 0;
+    if (msg->msg_name) {
+        struct sockaddr_in *sin = msg->msg_name;
+        if (msg->msg_namelen < sizeof(*sin))
+            return -EINVAL;
+        ip_addr_set_ip4_u32(&ipaddr, sin->address);
+        dst = &ipaddr;
+        port = ntohs(sin->port);
+    }
+    u64 len = 0;
+    for (u64 i = 0; i < msg->msg_iovlen; i++)
+        len += msg->msg_iov[i].iov_len;
+    return udp_send_iov(s, dst, port, msg->msg_iov, msg->msg_iovlen, len, gso);
+}
+
 sysreturn sendmsg(int sockfd, const struct msghdr *msg, int flags)
 {
     struct sock *s = resolve_socket(current->p, sockfd);
@@ -1212,12 +2087,28 @@ sysreturn sendmsg(int sockfd, const struct msghdr *msg, int flags)
     sysreturn rv;
 
     net_debug("sock %d, type %d, flags 0x%x\n", s->fd, s->type, flags);
+    if (s->domain == AF_INET && s->type == SOCK_DGRAM) {
+        rv = sendto_prepare(s, flags, 0, 0);
+        if (rv == 0)
+            rv = udp_sendmsg((netsock)s, msg);
+        return set_syscall_return(current, rv);
+    }
+    int zc = zerocopy_mode(s, flags);
+    if (zc == TCP_TX_ZEROCOPY && msg->msg_iovlen == 1) {
+        /* reference the user buffer directly */
+        rv = sendto_prepare(s, flags, msg->msg_name, msg->msg_namelen);
+        if (rv < 0)
+            return set_syscall_return(current, rv);
+        return socket_write_internal(s, msg->msg_iov[0].iov_base, msg->msg_iov[0].iov_len,
+                                     zc, current, false, syscall_io_complete);
+    }
     rv = sendmsg_prepare(s, msg, flags, &buf, &len);
     if (rv <= 0) {
         return set_syscall_return(current, rv);
     }
     io_completion completion = closure(s->h, sendmsg_complete, s, buf, len);
-    return socket_write_internal(s, buf, len, current, false, completion);
+    return socket_write_internal(s, buf, len, zc == TCP_TX_COPY ? TCP_TX_COPY : TCP_TX_ZEROCOPY_COPIED,
+                                 current, false, completion);
 }
 
 closure_function(3, 2, void, sendmmsg_buf_complete,
@@ -1237,10 +2128,11 @@ closure_function(7, 1, sysreturn, sendmmsg_tcp_bh,
     void * buf = bound(buf);
     u64 len = bound(len);
     struct mmsghdr * msgvec = bound(msgvec);
+    int zc = zerocopy_mode(&s->sock, bound(flags)) == TCP_TX_COPY ? TCP_TX_COPY : TCP_TX_ZEROCOPY_COPIED;
 
     io_completion completion = closure(s->sock.h, sendmmsg_buf_complete, s, buf,
             len);
-    sysreturn rv = socket_write_tcp_bh_internal(s, t, buf, len, completion, bqflags | BLOCKQ_ACTION_BLOCKED);
+    sysreturn rv = socket_write_tcp_bh_internal(s, t, buf, len, zc, completion, bqflags | BLOCKQ_ACTION_BLOCKED);
 
     while (true) {
         if (rv == BLOCKQ_BLOCK_REQUIRED) {
@@ -1260,7 +2152,7 @@ closure_function(7, 1, sysreturn, sendmmsg_tcp_bh,
                 bound(flags), &buf, &len);
         if (rv > 0) {
             completion = closure(s->sock.h, sendmmsg_buf_complete, s, buf, len);
-            rv = socket_write_tcp_bh_internal(s, t, buf, len, completion, bqflags | BLOCKQ_ACTION_BLOCKED);
+            rv = socket_write_tcp_bh_internal(s, t, buf, len, zc, completion, bqflags | BLOCKQ_ACTION_BLOCKED);
         }
     }
 
@@ -1283,6 +2175,22 @@ sysreturn sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
     net_debug("sock %d, type %d, flags 0x%x, vlen %d\n", sock->fd, sock->type,
             flags,
             vlen);
+    if (vlen > IOV_MAX)
+        vlen = IOV_MAX;
+    if (sock->domain == AF_INET && sock->type == SOCK_DGRAM) {
+        /* one pass over the vector, without staging each message */
+        unsigned int i;
+        rv = sendto_prepare(sock, flags, 0, 0);
+        for (i = 0; rv == 0 && i < vlen; i++) {
+            sysreturn len = udp_sendmsg(s, &msgvec[i].msg_hdr);
+            if (len < 0) {
+                rv = len;
+                break;
+            }
+            msgvec[i].msg_len = len;
+        }
+        return set_syscall_return(current, i > 0 ? i : rv);
+    }
     for (sock->msg_count = 0; sock->msg_count < vlen; sock->msg_count++) {
         struct msghdr *msg_hdr = &msgvec[sock->msg_count].msg_hdr;
 
@@ -1348,6 +2256,34 @@ sysreturn recvfrom(int sockfd, void * buf, u64 len, int flags,
     return sock->recvfrom(sock, buf, len, flags, src_addr, addrlen);
 }
 
+/* The error queue only carries zero-copy completions for now. */
+static sysreturn recvmsg_errqueue(netsock s, struct msghdr *msg)
+{
+    if (!s->zc.ready)
+        return -EAGAIN;
+    msg->msg_flags = 0;
+    if (!msg->msg_control || msg->msg_controllen < CMSG_SPACE(sizeof(struct sock_extended_err))) {
+        msg->msg_flags |= MSG_CTRUNC;
+        msg->msg_controllen = 0;
+    } else {
+        struct cmsghdr *cmsg = msg->msg_control;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(struct sock_extended_err));
+        cmsg->cmsg_level = SOL_IP;
+        cmsg->cmsg_type = IP_RECVERR;
+        struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+        zero(ee, sizeof(*ee));
+        ee->ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+        ee->ee_code = s->zc.copied ? SO_EE_CODE_ZEROCOPY_COPIED : 0;
+        ee->ee_info = s->zc.lo;
+        ee->ee_data = s->zc.hi;
+        msg->msg_controllen = CMSG_SPACE(sizeof(struct sock_extended_err));
+    }
+    msg->msg_flags |= MSG_ERRQUEUE;
+    s->zc.ready = false;
+    fdesc_notify_events(&s->sock.f); /* reset EPOLLERR */
+    return 0;
+}
+
 sysreturn recvmsg(int sockfd, struct msghdr *msg, int flags)
 {
     u64 total_len;
@@ -1357,6 +2293,9 @@ sysreturn recvmsg(int sockfd, struct msghdr *msg, int flags)
 
     net_debug("sock %d, type %d, thread %ld\n", sock->fd, sock->type,
             current->tid);
+    if (flags & MSG_ERRQUEUE)
+        return set_syscall_return(current, sock->domain == AF_INET ?
+                                  recvmsg_errqueue(s, msg) : -EAGAIN);
     if ((sock->type == SOCK_STREAM) && (s->info.tcp.state != TCP_SOCK_OPEN)) {
         return set_syscall_error(current, ENOTCONN);
     }
@@ -1376,23 +2315,171 @@ sysreturn recvmsg(int sockfd, struct msghdr *msg, int flags)
     return blockq_check(sock->rxbq, current, ba, false);
 }
 
-static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
+#define MSG_WAITFORONE  0x00010000
+
+/* Copy the next datagram, or for TCP as much queued data as fits,
+   directly into the message iovecs. Data must be queued on incoming. */
+static u64 sock_recv_msg(netsock s, struct msghdr *msg)
 {
-    if (!z) {
-        return ERR_CLSD;
+    void * p = queue_peek(s->incoming);
+    assert(p != INVALID_ADDRESS);
+    if (msg->msg_name)
+        sock_src_addr(s, p, msg->msg_name, &msg->msg_namelen);
+    msg->msg_controllen = 0;
+    msg->msg_flags = 0;
+
+    struct iovec *iov = msg->msg_iov;
+    u64 i = 0, iov_off = 0, xfer_total = 0;
+    do {
+        struct pbuf * pbuf = s->sock.type == SOCK_STREAM ? (struct pbuf *)p :
+            ((struct udp_entry *)p)->pbuf;
+        struct pbuf *cur_buf = pbuf;
+        while (cur_buf && i < msg->msg_iovlen) {
+            u64 xfer = MIN(iov[i].iov_len - iov_off, cur_buf->len);
+            if (xfer > 0) {
+                runtime_memcpy(iov[i].iov_base + iov_off, cur_buf->payload, xfer);
+                pbuf_consume(cur_buf, xfer);
+                iov_off += xfer;
+                xfer_total += xfer;
+                if (s->sock.type == SOCK_STREAM)
+                    tcp_sock_recved(s, xfer);
+            }
+            if (iov_off == iov[i].iov_len) {
+                i++;
+                iov_off = 0;
+            }
+            if (cur_buf->len == 0)
+                cur_buf = cur_buf->next;
+        }
+
+        if (s->sock.type == SOCK_DGRAM) {
+            for (; cur_buf; cur_buf = cur_buf->next) {
+                if (cur_buf->len > 0) {
+                    msg->msg_flags |= MSG_TRUNC;
+                    break;
+                }
+            }
+            cur_buf = 0;
+        }
+        if (!cur_buf) {
+            assert(dequeue(s->incoming) == p);
+            if (s->sock.type == SOCK_DGRAM)
+                deallocate(s->sock.h, p, sizeof(struct udp_entry));
+            pbuf_free(pbuf);
+            p = queue_peek(s->incoming);
+            if (p == INVALID_ADDRESS)
+                fdesc_notify_events(&s->sock.f); /* reset a triggered EPOLLIN condition */
+        }
+    } while (s->sock.type == SOCK_STREAM && i < msg->msg_iovlen && p != INVALID_ADDRESS);
+
+    if (s->sock.type == SOCK_STREAM)
+        tcp_rcvbuf_autotune(s);
+    return xfer_total;
+}
+
+/* Each wakeup drains whatever is queued into the remaining messages, so
+   a burst of datagrams is picked up in one pass. The call completes once
+   vlen messages are filled, after the first with MSG_WAITFORONE, or when
+   the timeout expires; the remaining time is written back to timeout. */
+closure_function(9, 1, sysreturn, recvmmsg_bh,
+                 netsock, s, thread, t, struct mmsghdr *, msgvec, unsigned int, vlen, int, flags,
+                 struct timespec *, timeout, timestamp, deadline, unsigned int, count, io_completion, completion,
+                 u64, bqflags)
+{
+    netsock s = bound(s);
+    thread t = bound(t);
+    sysreturn rv;
+
+    if (bqflags & BLOCKQ_ACTION_NULLIFY) {
+        rv = bound(count) ? bound(count) : -EINTR;
+        goto out;
     }
-    netsock s = z;
 
+    while (bound(count) < bound(vlen) && !queue_empty(s->incoming)) {
+        struct mmsghdr *m = &bound(msgvec)[bound(count)++];
+        m->msg_len = sock_recv_msg(s, &m->msg_hdr);
+    }
+    rv = bound(count);
+    if (rv == bound(vlen) || (rv > 0 && (bound(flags) & MSG_WAITFORONE)))
+        goto out;
+
+    err_t err = get_lwip_error(s);
+    if (err != ERR_OK) {
+        if (rv == 0)
+            rv = lwip_to_errno(err);
+        goto out;
+    }
+    if (s->sock.type == SOCK_STREAM && s->info.tcp.lw->state != ESTABLISHED)
+        goto out;
+    if ((bqflags & BLOCKQ_ACTION_TIMEDOUT) || (bound(flags) & MSG_DONTWAIT) ||
+        (s->sock.f.flags & SOCK_NONBLOCK)) {
+        if (rv == 0)
+            rv = -EAGAIN;
+        goto out;
+    }
+    return BLOCKQ_BLOCK_REQUIRED;
+  out:
+    if (bound(timeout)) {
+        timestamp here = now(CLOCK_ID_MONOTONIC);
+        timespec_from_time(bound(timeout), bound(deadline) > here ? bound(deadline) - here : 0);
+    }
+    net_debug("sock %d, %d messages, rv %ld\n", s->sock.fd, bound(count), rv);
+    blockq_handle_completion(s->sock.rxbq, bqflags, bound(completion), t, rv);
+    closure_finish();
+    return rv;
+}
+
+sysreturn recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+                   int flags, struct timespec *timeout)
+{
+    struct sock *sock = resolve_socket(current->p, sockfd);
+    netsock s = (netsock) sock;
+
+    net_debug("sock %d, type %d, vlen %d, flags 0x%x, timeout %p\n", sock->fd,
+              sock->type, vlen, flags, timeout);
+    if (sock->domain != AF_INET || (flags & MSG_ERRQUEUE))
+        return -EOPNOTSUPP;
+    if (sock->type == SOCK_STREAM && s->info.tcp.state != TCP_SOCK_OPEN)
+        return -ENOTCONN;
+    if (vlen > IOV_MAX)
+        vlen = IOV_MAX;
+    if (vlen == 0)
+        return 0;
+
+    timestamp tmo = 0;
+    if (timeout) {
+        tmo = time_from_timespec(timeout);
+        if (tmo == 0)
+            flags |= MSG_WAITFORONE;    /* take what is queued, or wait for one */
+    }
+    blockq_action ba = closure(sock->h, recvmmsg_bh, s, current, msgvec, vlen, flags,
+                               timeout, tmo ? now(CLOCK_ID_MONOTONIC) + tmo : 0, 0,
+                               syscall_io_complete);
+    return blockq_check_timeout(sock->rxbq, current, ba, false,
+                                CLOCK_ID_MONOTONIC, tmo, false);
+}
+
+static err_t accept_tcp_internal(netsock s, struct tcp_pcb * lw, err_t err)
+{
     if (err == ERR_MEM) {
         set_lwip_error(s, err);
         wakeup_sock(s, WAKEUP_SOCK_EXCEPT);
         return err;               /* lwIP doesn't care */
     }
 
+    if (queue_length(s->incoming) >= s->info.tcp.backlog) {
+        listen_stats.overflows++;
+        net_debug("sock %d accept queue full, %ld overflows\n", s->sock.fd,
+                  listen_stats.overflows);
+        return ERR_MEM;         /* lwIP will do tcp_abort */
+    }
+
     /* XXX such a thing as nonblock inherited from listen socket? */
     int fd = allocate_tcp_sock(s->p, lw, 0);
-    if (fd < 0)
+    if (fd < 0) {
+        listen_stats.drops++;
 	return ERR_MEM;
+    }
 
     // XXX - what if this has been closed in the meantime?
     // refcnt
@@ -1401,15 +2488,19 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     netsock sn = vector_get(s->p->files, fd);
     sn->info.tcp.state = TCP_SOCK_OPEN;
     sn->sock.fd = fd;
+    /* buffer sizes are inherited from the listener */
+    sn->info.tcp.rcvbuf = s->info.tcp.rcvbuf;
+    sn->info.tcp.sndbuf = s->info.tcp.sndbuf;
+    sn->info.tcp.rcvbuf_lock = s->info.tcp.rcvbuf_lock;
+    sn->info.tcp.sndbuf_lock = s->info.tcp.sndbuf_lock;
+    tcp_sock_init_window(sn);
     set_lwip_error(s, ERR_OK);
     tcp_arg(lw, sn);
     tcp_recv(lw, tcp_input_lower);
     tcp_err(lw, lwip_tcp_conn_err);
     tcp_sent(lw, lwip_tcp_sent);
-    if (!enqueue(s->incoming, sn)) {
-        msg_err("queue overrun; shouldn't happen with lwIP listen backlog\n");
-        return ERR_BUF;         /* lwIP will do tcp_abort */
-    }
+    boolean queued = enqueue(s->incoming, sn);
+    assert(queued);             /* room was checked against the backlog */
 
     /* consume a slot in the lwIP listen backlog */
     tcp_backlog_delayed(lw);
@@ -1418,20 +2509,105 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     return ERR_OK;
 }
 
+static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
+{
+    if (!z) {
+        return ERR_CLSD;
+    }
+    return accept_tcp_internal(z, lw, err);
+}
+
+/* Pick a listening member by hash of the remote endpoint, moving on to
+   the next member if its accept queue is full. */
+static err_t accept_tcp_reuseport(void * z, struct tcp_pcb * lw, err_t err)
+{
+    listen_group g = z;
+    if (!g) {
+        return ERR_CLSD;
+    }
+    int n = 0;
+    list_foreach(&g->members, l) {
+        if (struct_from_list(l, netsock, info.tcp.group_l)->info.tcp.state == TCP_SOCK_LISTENING)
+            n++;
+    }
+    if (n == 0)
+        return ERR_CLSD;
+    u32 h = 0;
+    if (lw) {
+        h = ip4_addr_get_u32(&lw->remote_ip) ^ (lw->remote_port << 16);
+        h *= 0x9e3779b1;        /* spread entropy into the high bits */
+        h >>= 16;
+    }
+    int i = h % n;
+    netsock first = 0;
+    list_foreach(&g->members, l) {
+        netsock s = struct_from_list(l, netsock, info.tcp.group_l);
+        if (s->info.tcp.state != TCP_SOCK_LISTENING || i-- > 0)
+            continue;
+        if (queue_length(s->incoming) < s->info.tcp.backlog)
+            return accept_tcp_internal(s, lw, err);
+        if (!first)
+            first = s;
+        i = 0;                  /* probe following members */
+    }
+    list_foreach(&g->members, l) {
+        netsock s = struct_from_list(l, netsock, info.tcp.group_l);
+        if (s == first)
+            break;
+        if (s->info.tcp.state == TCP_SOCK_LISTENING &&
+            queue_length(s->incoming) < s->info.tcp.backlog)
+            return accept_tcp_internal(s, lw, err);
+    }
+    return accept_tcp_internal(first, lw, err); /* counts the overflow */
+}
+
 static sysreturn netsock_listen(struct sock *sock, int backlog)
 {
     netsock s = (netsock) sock;
     if (s->sock.type != SOCK_STREAM)
 	return -EOPNOTSUPP;
-    backlog = MAX(backlog, SOCK_QUEUE_LEN);
-    struct tcp_pcb * lw = tcp_listen_with_backlog(s->info.tcp.lw, backlog);
+
+    /* as with Linux, a backlog beyond the queue limit is silently truncated */
+    s->info.tcp.backlog = MIN(MAX(backlog, 1), SOCK_QUEUE_LEN);
+    listen_group g = s->info.tcp.group;
+    if (s->info.tcp.state == TCP_SOCK_LISTENING) {
+        /* only update the backlog */
+        if (g)
+            reuseport_group_set_backlog(g);
+        else
+            tcp_backlog_set(s->info.tcp.lw, s->info.tcp.backlog);
+        return 0;
+    }
+
+    if (g) {
+        s->info.tcp.state = TCP_SOCK_LISTENING;
+        set_lwip_error(s, ERR_OK);
+        if (g->lw->state != LISTEN) {
+            struct tcp_pcb * lw = tcp_listen_with_backlog(g->lw, s->info.tcp.backlog);
+            if (!lw) {
+                s->info.tcp.state = TCP_SOCK_OPEN;
+                return -ENOMEM;
+            }
+            g->lw = lw;
+            list_foreach(&g->members, l)
+                struct_from_list(l, netsock, info.tcp.group_l)->info.tcp.lw = lw;
+            tcp_arg(lw, g);
+            tcp_accept(lw, accept_tcp_reuseport);
+        }
+        reuseport_group_set_backlog(g);
+        return 0;
+    }
+
+    struct tcp_pcb * lw = tcp_listen_with_backlog(s->info.tcp.lw, s->info.tcp.backlog);
+    if (!lw)
+        return -ENOMEM;
     s->info.tcp.lw = lw;
     s->info.tcp.state = TCP_SOCK_LISTENING;
     set_lwip_error(s, ERR_OK);
     tcp_arg(lw, s);
     tcp_accept(lw, accept_tcp_from_lwip);
     tcp_err(lw, lwip_tcp_conn_err);
-    return 0;    
+    return 0;
 }
 
 sysreturn listen(int sockfd, int backlog)
@@ -1444,8 +2620,9 @@ sysreturn listen(int sockfd, int backlog)
     return sock->listen(sock, backlog);
 }
 
-closure_function(5, 1, sysreturn, accept_bh,
+closure_function(6, 1, sysreturn, accept_bh,
                  netsock, s, thread, t, struct sockaddr *, addr, socklen_t *, addrlen, int, flags,
+                 io_completion, completion,
                  u64, bqflags)
 {
     netsock s = bound(s);
@@ -1496,16 +2673,14 @@ closure_function(5, 1, sysreturn, accept_bh,
 
     rv = child->sock.fd;
   out:
-    set_syscall_return(t, rv);
-    if (bqflags & BLOCKQ_ACTION_BLOCKED)
-        thread_wakeup(t);
-
+    blockq_handle_completion(s->sock.rxbq, bqflags, bound(completion), t, rv);
     closure_finish();
     return rv;
 }
 
 static sysreturn netsock_accept4(struct sock *sock, struct sockaddr *addr,
-        socklen_t *addrlen, int flags)
+        socklen_t *addrlen, int flags, thread t, boolean bh,
+        io_completion completion)
 {
     netsock s = (netsock) sock;
     if (sock->type != SOCK_STREAM)
@@ -1513,11 +2688,11 @@ static sysreturn netsock_accept4(struct sock *sock, struct sockaddr *addr,
 
     if ((s->info.tcp.state != TCP_SOCK_LISTENING) ||
             (flags & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)))
-	return set_syscall_error(current, EINVAL);
+	return -EINVAL;
 
-    blockq_action ba = closure(sock->h, accept_bh, s, current, addr, addrlen,
-            flags);
-    return blockq_check(sock->rxbq, current, ba, false);
+    blockq_action ba = closure(sock->h, accept_bh, s, t, addr, addrlen,
+            flags, completion);
+    return blockq_check(sock->rxbq, t, ba, bh);
 }
 
 sysreturn accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
@@ -1529,7 +2704,8 @@ sysreturn accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
     if (!sock->accept4) {
         return -EOPNOTSUPP;
     }
-    return sock->accept4(sock, addr, addrlen, flags);
+    return sock->accept4(sock, addr, addrlen, flags, current, false,
+            syscall_io_complete);
 }
 
 sysreturn accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
@@ -1579,6 +2755,60 @@ sysreturn setsockopt(int sockfd,
                      void *optval,
                      socklen_t optlen)
 {
+    netsock s = (netsock) resolve_socket(current->p, sockfd);
+    net_debug("sock %d, type %d, level %d, optname %d, optlen %d\n",
+        s->sock.fd, s->sock.type, level, optname, optlen);
+
+    if (level == SOL_SOCKET && optname == SO_ZEROCOPY) {
+        if (!optval || optlen < sizeof(int))
+            return -EINVAL;
+        if (s->sock.domain != AF_INET || s->sock.type != SOCK_STREAM)
+            return -EOPNOTSUPP;
+        s->zc.enabled = *(int *)optval != 0;
+        return 0;
+    }
+
+    if (level == SOL_SOCKET && (optname == SO_RCVBUF || optname == SO_SNDBUF) &&
+        s->sock.domain == AF_INET && s->sock.type == SOCK_STREAM) {
+        if (!optval || optlen < sizeof(int))
+            return -EINVAL;
+        int val = *(int *)optval;
+        u32 max = s->info.tcp.wnd_init && s->info.tcp.lw ? TCP_WND_MAX(s->info.tcp.lw) : TCP_WND;
+        u32 size = MIN(MAX(val, TCP_BUF_MIN), max);
+        if (optname == SO_RCVBUF) {
+            s->info.tcp.rcvbuf_lock = true;
+            tcp_set_rcvbuf(s, size);
+        } else {
+            s->info.tcp.sndbuf_lock = true;
+            tcp_set_sndbuf(s, size);
+        }
+        return 0;
+    }
+
+    if (level == SOL_SOCKET && optname == SO_REUSEPORT) {
+        if (!optval || optlen < sizeof(int))
+            return -EINVAL;
+        if (s->sock.domain != AF_INET)
+            return -EOPNOTSUPP;
+        /* accepted on any socket, but only TCP listeners are balanced */
+        if (s->sock.type == SOCK_STREAM && s->info.tcp.state != TCP_SOCK_CREATED)
+            return -EINVAL;     /* must be set before bind */
+        s->reuseport = *(int *)optval != 0;
+        return 0;
+    }
+
+    if (level == SOL_UDP && optname == UDP_SEGMENT) {
+        if (!optval || optlen < sizeof(int))
+            return -EINVAL;
+        if (s->sock.domain != AF_INET || s->sock.type != SOCK_DGRAM)
+            return -ENOPROTOOPT;
+        int val = *(int *)optval;
+        if (val < 0 || val > 0xffff)
+            return -EINVAL;
+        s->info.udp.gso_size = val;
+        return 0;
+    }
+
     msg_warn("setsockopt unimplemented: fd %d, level %d, optname %d\n",
 	    sockfd, level, optname);
     return 0;
@@ -1595,8 +2825,14 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
         int val;
     } ret_optval;
 
+    if (level == SOL_UDP && optname == UDP_SEGMENT &&
+        s->sock.domain == AF_INET && s->sock.type == SOCK_DGRAM) {
+        ret_optval.val = s->info.udp.gso_size;
+        goto out;
+    }
+
     /* Only socket options supported at the moment... */
-    if (level != 1)
+    if (level != SOL_SOCKET)
         return -EOPNOTSUPP;
 
     switch (optname) {
@@ -1607,7 +2843,23 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
         ret_optval.val = -lwip_to_errno(get_and_clear_lwip_error(s));
         break;
     case SO_SNDBUF:
-        ret_optval.val = 2048;  /* minimum value for this option in Linux */
+        if (s->sock.domain == AF_INET && s->sock.type == SOCK_STREAM)
+            ret_optval.val = s->info.tcp.sndbuf;
+        else
+            ret_optval.val = 2048;  /* minimum value for this option in Linux */
+        break;
+    case SO_RCVBUF:
+        if (s->sock.domain == AF_INET && s->sock.type == SOCK_STREAM)
+            ret_optval.val = s->info.tcp.rcvbuf;
+        else
+            ret_optval.val = 2304;  /* minimum value for this option in Linux */
+        break;
+    case SO_ZEROCOPY:
+        ret_optval.val = s->sock.domain == AF_INET && s->sock.type == SOCK_STREAM &&
+            s->zc.enabled;
+        break;
+    case SO_REUSEPORT:
+        ret_optval.val = s->sock.domain == AF_INET && s->reuseport;
         break;
     default:
         msg_err("getsockopt unimplemented optname: fd %d, level %d, optname %d\n",
@@ -1615,6 +2867,7 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
         return -ENOPROTOOPT;
     }
 
+  out:
     if (optval && optlen) {
         int ret_optlen = MIN(*optlen, sizeof(ret_optval));
         runtime_memcpy(optval, &ret_optval, ret_optlen);
@@ -1637,6 +2890,7 @@ void register_net_syscalls(struct syscall *map)
     register_syscall(map, sendmmsg, sendmmsg);
     register_syscall(map, recvfrom, recvfrom);
     register_syscall(map, recvmsg, recvmsg);
+    register_syscall(map, recvmmsg, recvmmsg);
     register_syscall(map, setsockopt, setsockopt);
     register_syscall(map, getsockname, getsockname);
     register_syscall(map, getpeername, getpeername);
@@ -1652,5 +2906,6 @@ boolean netsyscall_init(unix_heaps uh)
     if (socket_cache == INVALID_ADDRESS)
 	return false;
     uh->socket_cache = socket_cache;
+    list_init(&reuseport_groups);
     return true;
 }
@@ -7,6 +7,13 @@
 
    The bitmap length may be arbitrarily sized. The bitmap buffer is
    allocated in ALLOC_EXTEND_BITS / 8 byte increments as needed.
+
+   Two summary bitmaps, with a bit for each word of the map, let the
+   search skip over full words (for allocations within a word) and
+   check runs of empty words (for multi-word allocations) 64 words at
+   a time. In addition, each power-of-2 allocation size keeps a hint
+   below which no free, aligned run of that size exists; allocations
+   raise it past what they searched, and frees lower it.
 */
 
 #include <runtime.h>
@@ -74,6 +81,29 @@ static boolean for_range_in_map(u64 * base, u64 start, u64 nbits, boolean set, b
     return true;
 }
 
+static inline u64 *summary_base(buffer s)
+{
+    return buffer_ref(s, 0);
+}
+
+static void summarize_range(bitmap b, u64 start, u64 nbits)
+{
+    if (nbits == 0)
+        return;
+    for (u64 w = start >> BITMAP_WORDLEN_LOG; w <= (start + nbits - 1) >> BITMAP_WORDLEN_LOG; w++)
+        bitmap_summarize_word(b, w);
+}
+
+static void summarize_all(bitmap b)
+{
+    if (!b->full_words)
+        return;
+    bytes len = bitmap_summary_bytes(b->mapbits);
+    zero(summary_base(b->full_words), len);
+    zero(summary_base(b->used_words), len);
+    summarize_range(b, 0, b->mapbits);
+}
+
 /* Requesting beyond the end of maxbits isn't an error; the caller may
    use it to avoid an additional range check.
 
@@ -88,69 +118,147 @@ boolean bitmap_range_check_and_set(bitmap b, u64 start, u64 nbits, boolean valid
 
     bitmap_extend(b, start + nbits - 1);
     u64 * mapbase = bitmap_base(b);
-    return (!validate || for_range_in_map(mapbase, start, nbits, false, !set)) &&
-        for_range_in_map(mapbase, start, nbits, true, set);
+    if (validate && !for_range_in_map(mapbase, start, nbits, false, !set))
+        return false;
+    for_range_in_map(mapbase, start, nbits, true, set);
+    summarize_range(b, start, nbits);
+    if (!set)
+        bitmap_lower_hints(b, start);
+    return true;
 }
 
-static inline u64 bitmap_alloc_internal(bitmap b, u64 nbits, u64 startbit, u64 endbit)
+/* are the nbits at word-aligned bit free? */
+static inline boolean words_clear(bitmap b, u64 bit, u64 nbits)
 {
-    int order = find_order(nbits);
-    u64 stride = U64_FROM_BIT(order);
-    endbit = MIN(endbit, b->maxbits);
-
-    u64 bit = pad(startbit, stride);
-    if (bit + nbits > endbit)
-        return INVALID_PHYSICAL;
-
-    u64 * mapbase = bitmap_base(b);
-
-    endbit -= nbits;
-
-    if (nbits >= 64) {
-        /* multi-word */
-        while (bit <= endbit) {
-            if (bitmap_extend(b, bit + nbits))
-                mapbase = bitmap_base(b);
+    if (!b->full_words)
+        return for_range_in_map(bitmap_base(b), bit, nbits, false, false);
+    u64 w = bit >> BITMAP_WORDLEN_LOG;
+    u64 nwords = nbits >> BITMAP_WORDLEN_LOG;
+    u64 tail = nbits & BITMAP_WORDMASK;
+    return for_range_in_map(summary_base(b->used_words), w, nwords, false, false) &&
+        (tail == 0 || (bitmap_base(b)[w + nwords] & MASK(tail)) == 0);
+}
 
-            if (for_range_in_map(mapbase, bit, nbits, false, false)) {
-                for_range_in_map(mapbase, bit, nbits, true, true);
-                return bit;
+/* multi-word: stride and bit are multiples of the word length */
+static u64 alloc_words(bitmap b, u64 nbits, u64 stride, u64 bit, u64 endbit)
+{
+    u64 nwords = nbits >> BITMAP_WORDLEN_LOG;
+    u64 wstride = stride >> BITMAP_WORDLEN_LOG;
+    while (bit <= endbit) {
+        bitmap_extend(b, bit + nbits);
+
+        /* Rule out the candidates of a summary word at once: fold the
+           used bits so that each bit covers the candidate's whole
+           words. The fold shifts in zeros at the top, so a candidate
+           running into the next summary word is left to words_clear. */
+        if (b->full_words && wstride < BITMAP_WORDLEN) {
+            u64 w = bit >> BITMAP_WORDLEN_LOG;
+            u64 span = summary_base(b->used_words)[w >> 6];
+            u64 s;
+            for (s = 1; s * 2 <= nwords; s <<= 1)
+                span |= span >> s;
+            span |= span >> (nwords - s);
+            u64 free = ~span & (-1ull / MASK(wstride)) & ~MASK(w & 63);
+            if (free == 0) {
+                bit = ((w >> 6) + 1) << (2 * BITMAP_WORDLEN_LOG);
+                continue;
             }
-
-            bit += stride;
+            bit = ((w & ~63ull) + lsb(free)) << BITMAP_WORDLEN_LOG;
+            if (bit > endbit)
+                break;
+            bitmap_extend(b, bit + nbits);
         }
-    } else {
-        for (; bit <= endbit; bit += 64) {
-            /* get offset (for start bit, 0 otherwise) and align bit to word boundary */
-            int word_offset = bit & 63;
-            bit -= word_offset;
-            if (bitmap_extend(b, bit + 64))
-                mapbase = bitmap_base(b);
 
-            u64 mask = MASK(nbits) << word_offset;
-            u64 bw = *pointer_from_bit(mapbase, bit);
+        if (words_clear(b, bit, nbits)) {
+            for_range_in_map(bitmap_base(b), bit, nbits, true, true);
+            summarize_range(b, bit, nbits);
+            return bit;
+        }
+        bit += stride;
+    }
+    return INVALID_PHYSICAL;
+}
 
-            if (bw == -1ull)    /* skip full words */
+/* within a word: stride is less than the word length */
+static u64 alloc_in_word(bitmap b, u64 nbits, u64 stride, u64 bit, u64 endbit)
+{
+    while (bit <= endbit) {
+        /* get offset (for start bit, 0 otherwise) */
+        u64 w = bit >> BITMAP_WORDLEN_LOG;
+        int word_offset = bit & BITMAP_WORDMASK;
+        bitmap_extend(b, bit | BITMAP_WORDMASK);
+
+        /* skip full words */
+        if (b->full_words) {
+            u64 nonfull = ~summary_base(b->full_words)[w >> 6] & ~MASK(w & 63);
+            if (nonfull == 0) {
+                bit = ((w >> 6) + 1) << (2 * BITMAP_WORDLEN_LOG);
                 continue;
+            }
+            u64 nw = (w & ~63ull) + lsb(nonfull);
+            if (nw != w) {
+                w = nw;
+                word_offset = 0;
+                bit = w << BITMAP_WORDLEN_LOG;
+                if (bit > endbit)
+                    break;
+                bitmap_extend(b, bit | BITMAP_WORDMASK);
+            }
+        }
 
+        u64 mask = MASK(nbits) << word_offset;
+        u64 bw = bitmap_base(b)[w];
+        if (bw != -1ull) {
             do {
-                if (bit + word_offset > endbit)
+                u64 candidate = (w << BITMAP_WORDLEN_LOG) + word_offset;
+                if (candidate > endbit)
                     return INVALID_PHYSICAL;
 
                 if ((bw & mask) == 0) {
-                    assert(for_range_in_map(mapbase, bit + word_offset, nbits, true, true));
-                    return bit + word_offset;
+                    bitmap_base(b)[w] = bw | mask;
+                    bitmap_summarize_word(b, w);
+                    return candidate;
                 }
 
                 mask <<= stride;
                 word_offset += stride;
-            } while (word_offset < 64);
+            } while (word_offset < BITMAP_WORDLEN);
         }
+        bit = (w + 1) << BITMAP_WORDLEN_LOG;
     }
-
     return INVALID_PHYSICAL;
 }
 
+static inline u64 bitmap_alloc_internal(bitmap b, u64 nbits, u64 startbit, u64 endbit)
+{
+    int order = find_order(nbits);
+    u64 stride = U64_FROM_BIT(order);
+    endbit = MIN(endbit, b->maxbits);
+
+    u64 bit = pad(startbit, stride);
+    if (bit + nbits > endbit)
+        return INVALID_PHYSICAL;
+    endbit -= nbits;            /* last candidate */
+
+    /* Start from the hint if it lies within the search. Only a search
+       that covers the hint may move it. Hints only apply to exact
+       powers of 2; a smaller allocation may fit where one failed. */
+    u64 *hint = 0;
+    if (nbits == stride && order < BITMAP_HINT_ORDERS && bit <= b->hints[order]) {
+        hint = &b->hints[order];
+        bit = *hint;
+        if (bit > endbit)
+            return INVALID_PHYSICAL;
+    }
+
+    u64 result = nbits >= BITMAP_WORDLEN ? alloc_words(b, nbits, stride, bit, endbit) :
+        alloc_in_word(b, nbits, stride, bit, endbit);
+
+    if (hint)
+        *hint = result == INVALID_PHYSICAL ? pad(endbit + 1, stride) : result + stride;
+    return result;
+}
+
 u64 bitmap_alloc(bitmap b, u64 nbits)
 {
     return bitmap_alloc_internal(b, nbits, 0, b->maxbits);
@@ -187,6 +295,8 @@ boolean bitmap_dealloc(bitmap b, u64 bit, u64 size)
     }
 
     for_range_in_map(mapbase, bit, size, true, false);
+    summarize_range(b, bit, size);
+    bitmap_lower_hints(b, bit);
     return true;
 }
 
@@ -201,9 +311,32 @@ static inline bitmap allocate_bitmap_internal(heap meta, u64 length)
 	length = -1ull << 6; /* don't pad to 0 */
     b->maxbits = length;
     b->mapbits = MIN(ALLOC_EXTEND_BITS, pad(b->maxbits, 64));
+    b->full_words = 0;
+    b->used_words = 0;
+    zero(b->hints, sizeof(b->hints));
     return b;
 }
 
+static boolean allocate_summaries(bitmap b)
+{
+    bytes len = bitmap_summary_bytes(b->mapbits);
+    b->full_words = allocate_buffer(b->map, len);
+    if (b->full_words == INVALID_ADDRESS) {
+        b->full_words = 0;
+        return false;
+    }
+    b->used_words = allocate_buffer(b->map, len);
+    if (b->used_words == INVALID_ADDRESS) {
+        deallocate_buffer(b->full_words);
+        b->full_words = b->used_words = 0;
+        return false;
+    }
+    buffer_produce(b->full_words, len);
+    buffer_produce(b->used_words, len);
+    summarize_all(b);
+    return true;
+}
+
 bitmap allocate_bitmap(heap meta, heap map, u64 length)
 {
     bitmap b = allocate_bitmap_internal(meta, length);
@@ -216,6 +349,8 @@ bitmap allocate_bitmap(heap meta, heap map, u64 length)
 	return INVALID_ADDRESS;
     zero(bitmap_base(b), mapbytes);
     buffer_produce(b->alloc_map, mapbytes);
+    if (!allocate_summaries(b))
+	return INVALID_ADDRESS;
     return b;
 }
 
@@ -223,6 +358,10 @@ void deallocate_bitmap(bitmap b)
 {
     if (b->alloc_map)
 	deallocate_buffer(b->alloc_map);
+    if (b->full_words) {
+	deallocate_buffer(b->full_words);
+	deallocate_buffer(b->used_words);
+    }
     deallocate(b->meta, b, sizeof(struct bitmap));
 }
 
@@ -259,6 +398,9 @@ bitmap bitmap_clone(bitmap b)
     c->meta = b->meta;
     runtime_memcpy(buffer_ref(c->alloc_map, 0), buffer_ref(b->alloc_map, 0), mapbytes);
     buffer_produce(c->alloc_map, mapbytes);
+    if (!allocate_summaries(c))
+	return INVALID_ADDRESS;
+    runtime_memcpy(c->hints, b->hints, sizeof(c->hints));
     return c;
 }
 
@@ -276,4 +418,6 @@ void bitmap_copy(bitmap dest, bitmap src)
 	bytes len = (dest->mapbits - src->mapbits) >> 3;
 	zero(buffer_ref(dest->alloc_map, off), len);
     }
+    summarize_all(dest);
+    zero(dest->hints, sizeof(dest->hints));
 }
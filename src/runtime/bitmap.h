@@ -2,12 +2,21 @@
    page are b0rked */
 #define ALLOC_EXTEND_BITS	U64_FROM_BIT(12)
 
+/* allocation sizes (log2 of bits) with a free hint */
+#define BITMAP_HINT_ORDERS	16
+
 typedef struct bitmap {
     u64 maxbits;
     u64 mapbits;
     heap meta;
     heap map;
     buffer alloc_map;
+    /* Summaries of the map with a bit per map word, absent for
+       wrapped bitmaps. */
+    buffer full_words;		/* word is all ones */
+    buffer used_words;		/* word is non-zero */
+    /* No free, aligned run of 2^order bits starts below hints[order]. */
+    u64 hints[BITMAP_HINT_ORDERS];
 } *bitmap;
 
 boolean bitmap_range_check_and_set(bitmap b, u64 start, u64 nbits, boolean validate, boolean set);
@@ -37,17 +46,46 @@ static inline u64 *bitmap_base(bitmap b)
     return buffer_ref(b->alloc_map, 0);
 }
 
+static inline u64 bitmap_summary_bytes(u64 mapbits)
+{
+    return pad(mapbits >> 6, 64) >> 3;
+}
+
 /* no-op if i is within existing bounds, returns true if extended */
 static inline boolean bitmap_extend(bitmap b, u64 i)
 {
     if (i >= b->mapbits) {
 	b->mapbits = pad(i + 1, ALLOC_EXTEND_BITS);
 	extend_total(b->alloc_map, b->mapbits >> 3);
+	if (b->full_words) {
+	    extend_total(b->full_words, bitmap_summary_bytes(b->mapbits));
+	    extend_total(b->used_words, bitmap_summary_bytes(b->mapbits));
+	}
 	return true;
     }
     return false;
 }
 
+/* refresh the summary bits for map word w */
+static inline void bitmap_summarize_word(bitmap b, u64 w)
+{
+    if (!b->full_words)
+	return;
+    u64 v = bitmap_base(b)[w];
+    u64 mask = 1ull << (w & 63);
+    u64 *f = (u64 *)buffer_ref(b->full_words, 0) + (w >> 6);
+    u64 *u = (u64 *)buffer_ref(b->used_words, 0) + (w >> 6);
+    *f = v == -1ull ? *f | mask : *f & ~mask;
+    *u = v ? *u | mask : *u & ~mask;
+}
+
+/* bit was freed; it may start or join a free run of any order */
+static inline void bitmap_lower_hints(bitmap b, u64 bit)
+{
+    for (int order = 0; order < BITMAP_HINT_ORDERS; order++)
+	b->hints[order] = MIN(b->hints[order], bit & ~MASK(order));
+}
+
 static inline boolean bitmap_get(bitmap b, u64 i)
 {
     if (i >= b->mapbits)
@@ -61,8 +99,11 @@ static inline void bitmap_set(bitmap b, u64 i, int val)
 	bitmap_extend(b, i);
     u64 mask = 1ull << (i & 63);
     u64 * p = bitmap_base(b) + (i >> 6);
-    if (val)
+    if (val) {
 	*p |= mask;
-    else
+    } else {
 	*p &= ~mask;
+	bitmap_lower_hints(b, i);
+    }
+    bitmap_summarize_word(b, i >> 6);
 }
@@ -9,6 +9,13 @@
     struct _closure_##__name * __n = allocate(__h, sizeof(struct _closure_##__name)); \
     __closure(__h, __n, sizeof(struct _closure_##__name), __name, ##__VA_ARGS__);})
 
+/* Allocate from the free-list pool dedicated to the closure type (see
+   closure_pool_heap()), which spills to and refills from __h. */
+#define closure_from_pool(__h, __name, ...) ({                          \
+    heap __ph = _pool_##__name(__h);                                    \
+    struct _closure_##__name * __n = allocate(__ph, sizeof(struct _closure_##__name)); \
+    __closure(__ph, __n, sizeof(struct _closure_##__name), __name, ##__VA_ARGS__);})
+
 #define stack_closure(__name, ...)                                 \
     __closure(0, stack_allocate(sizeof(struct _closure_##__name)), \
               sizeof(struct _closure_##__name), __name, ##__VA_ARGS__)
@@ -53,4 +60,24 @@ static inline void deallocate_closure(void *p)
 
 #define closure_finish() do { deallocate_closure(__self); __self = 0; } while(0)
 
+#ifdef STAGE3
+#define CLOSURE_POOL_CPUS MAX_CPUS
+#else
+#define CLOSURE_POOL_CPUS 1
+#endif
+
+/* Each closure type gets a static pool, instantiated by contgen in
+   _pool_<name>() on first use. */
+typedef struct closure_pool {
+    struct heap h;
+    heap parent;
+    struct closure_pool_cpu {
+        void *free;
+        u64 count;
+    } cpu[CLOSURE_POOL_CPUS];
+} *closure_pool;
+
+heap closure_pool_heap(closure_pool p, heap parent, bytes size);
+void init_closure_pools_percpu(void);
+
 #include <closure_templates.h>
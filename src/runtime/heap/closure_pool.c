@@ -0,0 +1,94 @@
+/* closure pools
+
+   A closure pool is a heap of fixed-size closures kept on free lists
+   in front of a parent heap, one list per cpu. contgen gives each
+   closure type a pool sized for its bound arguments, reached with
+   closure_from_pool(). Since the pool is the closure's heap,
+   closure_finish() puts it back on the list of the finishing cpu;
+   past CLOSURE_POOL_MAX closures, it goes back to the parent.
+
+   A pool takes the parent heap of its first use. Closures of the type
+   requested from any other heap bypass the pool. Racing initializers
+   store the same methods, and only one of them sets the parent.
+
+   In the kernel, the lists are used with interrupts disabled, and
+   only once init_closure_pools_percpu() is called; before then the
+   pool passes through to the parent. Other builds are single-threaded
+   and use a single list. */
+
+#ifdef STAGE3
+#include <kernel.h>
+static boolean percpu_pools;
+#else
+#include <runtime.h>
+#endif
+
+#define CLOSURE_POOL_MAX 64     /* closures kept per cpu */
+
+static inline struct closure_pool_cpu *pool_cpu(closure_pool p)
+{
+#ifdef STAGE3
+    return percpu_pools ? &p->cpu[current_cpu()->id] : 0;
+#else
+    return &p->cpu[0];
+#endif
+}
+
+static u64 closure_pool_alloc(heap h, bytes b)
+{
+    closure_pool p = (closure_pool)h;
+    void *x = 0;
+    assert(b == h->pagesize);
+#ifdef STAGE3
+    u64 flags = irq_disable_save();
+#endif
+    struct closure_pool_cpu *c = pool_cpu(p);
+    if (c && c->free) {
+        x = c->free;
+        c->free = *(void **)x;
+        c->count--;
+    }
+#ifdef STAGE3
+    irq_restore(flags);
+#endif
+    return x ? u64_from_pointer(x) : allocate_u64(p->parent, b);
+}
+
+static void closure_pool_dealloc(heap h, u64 a, bytes b)
+{
+    closure_pool p = (closure_pool)h;
+    boolean pooled = false;
+#ifdef STAGE3
+    u64 flags = irq_disable_save();
+#endif
+    struct closure_pool_cpu *c = pool_cpu(p);
+    if (c && c->count < CLOSURE_POOL_MAX) {
+        *(void **)pointer_from_u64(a) = c->free;
+        c->free = pointer_from_u64(a);
+        c->count++;
+        pooled = true;
+    }
+#ifdef STAGE3
+    irq_restore(flags);
+#endif
+    if (!pooled)
+        deallocate_u64(p->parent, a, b);
+}
+
+heap closure_pool_heap(closure_pool p, heap parent, bytes size)
+{
+    if (!p->parent) {
+        p->h.alloc = closure_pool_alloc;
+        p->h.dealloc = closure_pool_dealloc;
+        p->h.pagesize = size;
+        compare_and_swap_word((word *)&p->parent, 0, u64_from_pointer(parent));
+    }
+    return p->parent == parent ? &p->h : parent;
+}
+
+#ifdef STAGE3
+void init_closure_pools_percpu(void)
+{
+    percpu_pools = true;
+}
+#endif
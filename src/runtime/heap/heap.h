@@ -25,6 +25,7 @@ heap wrap_freelist(heap meta, heap parent, bytes size);
 heap allocate_objcache(heap meta, heap parent, bytes objsize, bytes pagesize);
 boolean objcache_validate(heap h);
 heap objcache_from_object(u64 obj, bytes parent_pagesize);
+void init_objcache_percpu(void);
 heap allocate_mcache(heap meta, heap parent, int min_order, int max_order, bytes pagesize);
 
 // really internals
@@ -4,6 +4,13 @@
    object sizes. Object sizes are specified on heap creation. Allocations
    are made from the cache of the smallest object size equal to or greater
    than the alloc size.
+
+   Object sizes are consecutive powers of two, so the cache for a
+   given size is found by indexing on its order. The objcaches are
+   safe to use from multiple cpus, but share the parent heap, which
+   need not be; their page allocations are serialized through
+   parent_lock. Objcaches only call their parent with interrupts
+   disabled, so the lock doesn't need to disable them itself.
 */
 
 //#define MCACHE_DEBUG
@@ -14,11 +21,34 @@ typedef struct mcache {
     struct heap h;
     heap parent;
     heap meta;
-    vector caches;
+    struct heap locked_parent;	/* parent heap as seen by the caches */
+    struct spinlock parent_lock;
+    heap *caches;		/* indexed by order - min_order */
+    int min_order;
+    int max_order;
     u64 pagesize;
-    u64 allocated;
+    word allocated;
 } *mcache;
 
+#define mcache_from_parent(h) ((mcache)pointer_from_u64(u64_from_pointer(h) - offsetof(mcache, locked_parent)))
+
+static u64 mcache_parent_alloc(heap h, bytes b)
+{
+    mcache m = mcache_from_parent(h);
+    spin_lock(&m->parent_lock);
+    u64 a = allocate_u64(m->parent, b);
+    spin_unlock(&m->parent_lock);
+    return a;
+}
+
+static void mcache_parent_dealloc(heap h, u64 a, bytes b)
+{
+    mcache m = mcache_from_parent(h);
+    spin_lock(&m->parent_lock);
+    deallocate_u64(m->parent, a, b);
+    spin_unlock(&m->parent_lock);
+}
+
 u64 mcache_alloc(heap h, bytes b)
 {
     mcache m = (mcache)h;
@@ -30,38 +60,37 @@ u64 mcache_alloc(heap h, bytes b)
     print_u64(b);
     console(": ");
 #endif
-    /* Could become a binary search if search set is large... */
-    vector_foreach(m->caches, o) {
-	if (o && b <= o->pagesize) {
+    int order = find_order(b);
+    if (order > m->max_order) {
 #ifdef MCACHE_DEBUG
-	    console("match cache ");
-	    print_u64(u64_from_pointer(o));
-	    console(" obj size ");
-	    print_u64(o->pagesize);
-	    console(", pre validate...");
-	    if (objcache_validate((heap)o))
-		console("pass, alloc ");
-	    else
-		halt("failed!\n");
+	console("no matching cache; fail\n");
 #endif
-	    u64 a = allocate_u64(o, o->pagesize);
-	    if (a != INVALID_PHYSICAL)
-		m->allocated += o->pagesize;
+	return INVALID_PHYSICAL;
+    }
+    o = m->caches[MAX(order, m->min_order) - m->min_order];
 #ifdef MCACHE_DEBUG
-	    print_u64(a);
-	    console(", post validate...");
-	    if (objcache_validate((heap)o))
-		console("pass\n");
-	    else
-		halt("failed!\n");
+    console("match cache ");
+    print_u64(u64_from_pointer(o));
+    console(" obj size ");
+    print_u64(o->pagesize);
+    console(", pre validate...");
+    if (objcache_validate((heap)o))
+	console("pass, alloc ");
+    else
+	halt("failed!\n");
 #endif
-	    return a;
-	}
-    }
+    u64 a = allocate_u64(o, o->pagesize);
+    if (a != INVALID_PHYSICAL)
+	fetch_and_add(&m->allocated, o->pagesize);
 #ifdef MCACHE_DEBUG
-    console("no matching cache; fail\n");
+    print_u64(a);
+    console(", post validate...");
+    if (objcache_validate((heap)o))
+	console("pass\n");
+    else
+	halt("failed!\n");
 #endif
-    return INVALID_PHYSICAL;
+    return a;
 }
 
 void mcache_dealloc(heap h, u64 a, bytes b)
@@ -110,7 +139,7 @@ void mcache_dealloc(heap h, u64 a, bytes b)
 #endif
 
     assert(m->allocated >= o->pagesize);
-    m->allocated -= o->pagesize;
+    fetch_and_add(&m->allocated, -o->pagesize);
     deallocate(o, a, o->pagesize);
 #ifdef MCACHE_DEBUG
     console(", post validate...");
@@ -129,11 +158,13 @@ void destroy_mcache(heap h)
     console("\n");
 #endif
     mcache m = (mcache)h;
-    heap o;
-    vector_foreach(m->caches, o) {
+    int n = m->max_order - m->min_order + 1;
+    for (int i = 0; i < n; i++) {
+	heap o = m->caches[i];
 	if (o)
 	    o->destroy(o);
     }
+    deallocate(m->meta, m->caches, n * sizeof(heap));
     deallocate(m->meta, m, sizeof(struct mcache));
 }
 
@@ -179,13 +210,26 @@ heap allocate_mcache(heap meta, heap parent, int min_order, int max_order, bytes
     m->h.total = 0;
     m->meta = meta;
     m->parent = parent;
-    m->caches = allocate_vector(meta, 1);
+    m->locked_parent.alloc = mcache_parent_alloc;
+    m->locked_parent.dealloc = mcache_parent_dealloc;
+    m->locked_parent.destroy = 0;
+    m->locked_parent.allocated = 0;
+    m->locked_parent.total = 0;
+    m->locked_parent.pagesize = parent->pagesize;
+    spin_lock_init(&m->parent_lock);
+    m->min_order = min_order;
+    m->max_order = max_order;
     m->pagesize = pagesize;
     m->allocated = 0;
+    m->caches = allocate_zero(meta, (max_order - min_order + 1) * sizeof(heap));
+    if (m->caches == INVALID_ADDRESS) {
+	deallocate(meta, m, sizeof(struct mcache));
+	return INVALID_ADDRESS;
+    }
 
     for(int i=0, order = min_order; order <= max_order; i++, order++) {
 	u64 obj_size = U64_FROM_BIT(order);
-	heap h = allocate_objcache(meta, parent, obj_size, pagesize);
+	heap h = allocate_objcache(meta, &m->locked_parent, obj_size, pagesize);
 #ifdef MCACHE_DEBUG
 	console(" - cache size ");
 	print_u64(obj_size);
@@ -200,7 +244,7 @@ heap allocate_mcache(heap meta, heap parent, int min_order, int max_order, bytes
 	    destroy_mcache((heap)m);
 	    return INVALID_ADDRESS;
 	}
-	vector_set(m->caches, i, h);
+	m->caches[i] = h;
     }
     return (heap)m;
 }
@@ -4,12 +4,30 @@
    per-page free list. This can later expand into being a true
    slab-like object cache with object constructors, etc.
 
+   Free objects are cached in magazines in front of the pages, after
+   Bonwick's magazine allocator. Each cpu has a loaded and a previous
+   magazine which it uses with interrupts disabled and without taking
+   the cache lock. When both are exhausted (or full), a magazine is
+   exchanged with the depot, which holds full and empty magazines
+   under the cache lock. If the depot has nothing to offer, the loaded
+   magazine is refilled from (or flushed to) the pages in bulk, half a
+   magazine at a time.
+
+   Objects sitting in magazines remain allocated as far as the pages
+   are concerned; objcache_allocated() discounts them. Magazines are
+   sized to hold at most MAGAZINE_BYTES, and caches of larger objects
+   go straight to the pages under the lock.
+
+   In the kernel, a single set of magazines is used under the lock
+   until init_objcache_percpu() is called, as caches are created and
+   used before the cpuinfos are set up.
+
    issues / todo:
 
-   - Do we bother with locking or leave it up to the caller to
-     correctly synchronize accesses to the objcache instance?
+   - Per-page locks may reduce contention on the slow path.
 
-     - Per-page locks may reduce contention.
+   - Magazines are never drained, so pages stay pinned by objects
+     cached in them.
 
    - See notes in allocate_objcache() with regard to supporting
      multi-page parent head allocations.
@@ -18,10 +36,26 @@
 
 */
 
+#ifdef STAGE3
+#include <kernel.h>
+#define MAGAZINE_CPUS	MAX_CPUS
+static boolean percpu_magazines;
+#define magazine_irq_save()	irq_disable_save()
+#define magazine_irq_restore(f)	irq_restore(f)
+#else
 #include <runtime.h>
+#define MAGAZINE_CPUS	1
+#define percpu_magazines	false
+#define magazine_irq_save()	0
+#define magazine_irq_restore(f)	(void)(f)
+#endif
 
 #define FOOTER_MAGIC	(u16)(0xcafe)
 
+#define MAGAZINE_SIZE	32	/* max objects per magazine */
+#define MAGAZINE_BYTES	(16 * KB)
+#define DEPOT_MAGAZINES	8	/* magazines beyond the per-cpu pairs */
+
 typedef struct objcache *objcache;
 typedef struct footer {
     u16 magic;			/* try to detect corruption by overruns */
@@ -32,15 +66,35 @@ typedef struct footer {
     struct list list;		/* full list if avail == 0, free otherwise */
 } *footer;
 
+typedef struct magazine {
+    struct list l;		/* depot list */
+    u64 count;
+    u64 objs[0];
+} *magazine;
+
+typedef struct cpu_magazines {
+    magazine loaded;
+    magazine previous;
+} *cpu_magazines;
+
 typedef struct objcache {
     struct heap h;
     heap parent;
+    heap meta;
+    struct spinlock lock;	/* pages, depot and shared magazines */
     struct list free;		/* pages with available objects */
     struct list full;		/* fully-occupied pages */
     bytes pagesize;		/* allocation size for parent heap */
     u64 objs_per_page;		/* objects per page */
     u64 total_objs;		/* total objects in cache */
     u64 alloced_objs;		/* total cache occupancy (of total_objs) */
+    u64 magazine_size;		/* objects per magazine, 0 if unused */
+    struct list depot_full;
+    struct list depot_empty;
+    u64 depot_full_count;
+    void *magazines;		/* backing for all magazines */
+    bytes magazines_size;
+    struct cpu_magazines cpu[MAGAZINE_CPUS];
 } *objcache;
 
 typedef u64 page;
@@ -125,28 +179,20 @@ static inline boolean validate_page(objcache o, footer f)
     return true;
 }
 
-static void objcache_deallocate(heap h, u64 x, bytes size)
+#define objcache_lock(o) spin_lock(&(o)->lock)
+#define objcache_unlock(o) spin_unlock(&(o)->lock)
+
+/* return an object to its page; called with lock held */
+static void objcache_page_free(objcache o, u64 x)
 {
-    objcache o = (objcache)h;
     page p = page_from_obj(o, x);
     footer f = footer_from_page(o, p);
 
-    if (size != object_size(o)) {
-	msg_err("on heap %p: dealloc size (%d) doesn't match object size (%d); leaking\n",\
-            h, size, object_size(o));
-	return;
-    }
-
     msg_debug("*** heap %p: objsize %d, per page %ld, total %ld, alloced %ld\n",
-	      h, object_size(o), o->objs_per_page, o->total_objs, o->alloced_objs);
+	      o, object_size(o), o->objs_per_page, o->total_objs, o->alloced_objs);
     msg_debug(" -  obj %lx, page %p, footer: free %d, head %d, avail %d\n",
 	      x, p, f->free, f->head, f->avail);
 
-    if (!validate_page(o, f)) {
-	msg_err("leaking object\n");
-	return;
-    }
-
     if (f->avail == 0) {
 	assert(!is_valid_index(f->free));
 	/* Move from full to free list */
@@ -163,17 +209,11 @@ static void objcache_deallocate(heap h, u64 x, bytes size)
     o->alloced_objs--;
 }
 
-static u64 objcache_allocate(heap h, bytes size)
+/* take an object from the pages; called with lock held */
+static u64 objcache_page_alloc(objcache o)
 {
-    objcache o = (objcache)h;
-    if (size != object_size(o)) {
-	msg_err("on heap %p: alloc size (%d) doesn't match object size (%d)\n",
-            h, size, object_size(o));
-	return INVALID_PHYSICAL;
-    }
-
     msg_debug("*** heap %p: objsize %d, per page %ld, total %ld, alloced %ld\n",
-	      h, object_size(o), o->objs_per_page, o->total_objs, o->alloced_objs);
+	      o, object_size(o), o->objs_per_page, o->total_objs, o->alloced_objs);
     
     footer f;
     struct list * next_free = list_get_next(&o->free);
@@ -223,6 +263,146 @@ static u64 objcache_allocate(heap h, bytes size)
     return obj;
 }
 
+static inline cpu_magazines objcache_cpu(objcache o)
+{
+#ifdef STAGE3
+    if (percpu_magazines)
+	return &o->cpu[current_cpu()->id];
+#endif
+    return &o->cpu[0];
+}
+
+/* The loaded magazine is empty. Swap in the previous magazine if it
+   holds anything, else trade the (empty) previous magazine for a full
+   one from the depot, else refill the loaded magazine from the pages. */
+static boolean magazine_reload(objcache o, cpu_magazines c, boolean locked)
+{
+    magazine m = c->previous;
+    if (m->count > 0) {
+	c->previous = c->loaded;
+	c->loaded = m;
+	return true;
+    }
+
+    if (!locked)
+	objcache_lock(o);
+    list l = list_get_next(&o->depot_full);
+    if (l) {
+	list_delete(l);
+	o->depot_full_count--;
+	list_insert_before(&o->depot_empty, &m->l);
+	c->previous = c->loaded;
+	c->loaded = struct_from_list(l, magazine, l);
+    } else {
+	m = c->loaded;
+	while (m->count < o->magazine_size / 2) {
+	    u64 obj = objcache_page_alloc(o);
+	    if (obj == INVALID_PHYSICAL)
+		break;
+	    m->objs[m->count++] = obj;
+	}
+    }
+    if (!locked)
+	objcache_unlock(o);
+    return c->loaded->count > 0;
+}
+
+/* The loaded magazine is full. Swap in the previous magazine if it has
+   room, else trade the (full) previous magazine for an empty one from
+   the depot, else flush half the loaded magazine to the pages. */
+static void magazine_unload(objcache o, cpu_magazines c, boolean locked)
+{
+    magazine m = c->previous;
+    if (m->count < o->magazine_size) {
+	c->previous = c->loaded;
+	c->loaded = m;
+	return;
+    }
+
+    if (!locked)
+	objcache_lock(o);
+    list l = list_get_next(&o->depot_empty);
+    if (l) {
+	list_delete(l);
+	list_insert_before(&o->depot_full, &m->l);
+	o->depot_full_count++;
+	c->previous = c->loaded;
+	c->loaded = struct_from_list(l, magazine, l);
+    } else {
+	m = c->loaded;
+	while (m->count > o->magazine_size / 2)
+	    objcache_page_free(o, m->objs[--m->count]);
+    }
+    if (!locked)
+	objcache_unlock(o);
+}
+
+static void objcache_deallocate(heap h, u64 x, bytes size)
+{
+    objcache o = (objcache)h;
+    footer f = footer_from_page(o, page_from_obj(o, x));
+
+    if (size != object_size(o)) {
+	msg_err("on heap %p: dealloc size (%d) doesn't match object size (%d); leaking\n",\
+            h, size, object_size(o));
+	return;
+    }
+
+    if (!validate_page(o, f)) {
+	msg_err("leaking object\n");
+	return;
+    }
+
+    u64 flags = magazine_irq_save();
+    if (o->magazine_size == 0) {
+	objcache_lock(o);
+	objcache_page_free(o, x);
+	objcache_unlock(o);
+    } else {
+	boolean shared = !percpu_magazines;
+	if (shared)
+	    objcache_lock(o);
+	cpu_magazines c = objcache_cpu(o);
+	if (c->loaded->count == o->magazine_size)
+	    magazine_unload(o, c, shared);
+	c->loaded->objs[c->loaded->count++] = x;
+	if (shared)
+	    objcache_unlock(o);
+    }
+    magazine_irq_restore(flags);
+}
+
+static u64 objcache_allocate(heap h, bytes size)
+{
+    objcache o = (objcache)h;
+    if (size != object_size(o)) {
+	msg_err("on heap %p: alloc size (%d) doesn't match object size (%d)\n",
+            h, size, object_size(o));
+	return INVALID_PHYSICAL;
+    }
+
+    u64 obj;
+    u64 flags = magazine_irq_save();
+    if (o->magazine_size == 0) {
+	objcache_lock(o);
+	obj = objcache_page_alloc(o);
+	objcache_unlock(o);
+    } else {
+	boolean shared = !percpu_magazines;
+	if (shared)
+	    objcache_lock(o);
+	cpu_magazines c = objcache_cpu(o);
+	if (c->loaded->count > 0 || magazine_reload(o, c, shared))
+	    obj = c->loaded->objs[--c->loaded->count];
+	else
+	    obj = INVALID_PHYSICAL;
+	if (shared)
+	    objcache_unlock(o);
+    }
+    magazine_irq_restore(flags);
+    return obj;
+}
+
 static void objcache_destroy(heap h)
 {
     objcache o = (objcache)h;
@@ -234,17 +414,36 @@ static void objcache_destroy(heap h)
 	    o->alloced_objs, o);
     }
 
+    u64 flags = magazine_irq_save();
+    objcache_lock(o);
     footer f;
     foreach_page_footer(&o->free, f)
 	deallocate_u64(o->parent, page_from_footer(o, f), page_size(o));
     foreach_page_footer(&o->full, f)
 	deallocate_u64(o->parent, page_from_footer(o, f), page_size(o));
+    objcache_unlock(o);
+    magazine_irq_restore(flags);
+    if (o->magazines)
+	deallocate(o->meta, o->magazines, o->magazines_size);
+}
+
+/* objects held in magazines; a racy snapshot */
+static u64 objcache_cached_objs(objcache o)
+{
+    if (o->magazine_size == 0)
+	return 0;
+    u64 n = o->depot_full_count * o->magazine_size;
+    for (int i = 0; i < MAGAZINE_CPUS; i++)
+	n += o->cpu[i].loaded->count + o->cpu[i].previous->count;
+    return n;
 }
 
 static u64 objcache_allocated(heap h)
 {
     objcache o = (objcache)h;
-    return o->alloced_objs * object_size(o);
+    u64 alloced = o->alloced_objs;
+    u64 cached = objcache_cached_objs(o);
+    return alloced > cached ? (alloced - cached) * object_size(o) : 0;
 }
 
 static u64 objcache_total(heap h)
@@ -262,12 +461,8 @@ heap objcache_from_object(u64 obj, bytes parent_pagesize)
     return (heap)f->cache;
 }
 
-/* Sanity-checks the object cache, returning true if no discrepancies
-   are found. */
-boolean objcache_validate(heap h)
+static boolean objcache_validate_locked(objcache o)
 {
-    objcache o = (objcache)h;
-
     /* walk pages, checking:
        - reserved magic isn't clobbered
        - f->avail is nonzero and matches tally of free and uninit objs
@@ -392,6 +587,65 @@ boolean objcache_validate(heap h)
     return true;
 }
 
+/* Sanity-checks the object cache, returning true if no discrepancies
+   are found. */
+boolean objcache_validate(heap h)
+{
+    objcache o = (objcache)h;
+    u64 flags = magazine_irq_save();
+    objcache_lock(o);
+    boolean valid = objcache_validate_locked(o);
+    objcache_unlock(o);
+    magazine_irq_restore(flags);
+    return valid;
+}
+
+static boolean objcache_init_magazines(objcache o)
+{
+    o->magazine_size = MIN(MIN((u64)MAGAZINE_SIZE, o->objs_per_page / 2),
+			   MAGAZINE_BYTES / object_size(o));
+    list_init(&o->depot_full);
+    list_init(&o->depot_empty);
+    o->depot_full_count = 0;
+    o->magazines = 0;
+    if (o->magazine_size < 2) {
+	o->magazine_size = 0;
+	return true;
+    }
+
+    bytes msize = sizeof(struct magazine) + o->magazine_size * sizeof(u64);
+    int n = 2 * MAGAZINE_CPUS + DEPOT_MAGAZINES;
+    o->magazines_size = n * msize;
+    o->magazines = allocate(o->meta, o->magazines_size);
+    if (o->magazines == INVALID_ADDRESS) {
+	o->magazines = 0;
+	return false;
+    }
+
+    for (int i = 0; i < n; i++) {
+	magazine m = pointer_from_u64(u64_from_pointer(o->magazines) + i * msize);
+	m->count = 0;
+	if (i < 2 * MAGAZINE_CPUS) {
+	    if (i & 1)
+		o->cpu[i / 2].previous = m;
+	    else
+		o->cpu[i / 2].loaded = m;
+	} else {
+	    list_insert_before(&o->depot_empty, &m->l);
+	}
+    }
+    return true;
+}
+
+#ifdef STAGE3
+/* Called once current_cpu() is valid on the boot cpu; from here on,
+   each cpu works out of its own magazines. */
+void init_objcache_percpu(void)
+{
+    percpu_magazines = true;
+}
+#endif
+
 /* If the parent heap gives allocations that are aligned to size, the
    caller may choose a power-of-2 pagesize that is larger than the
    parent pagesize. Otherwise, pagesize must be equal to parent
@@ -438,6 +692,8 @@ heap allocate_objcache(heap meta, heap parent, bytes objsize, bytes pagesize)
     o->h.total = objcache_total;
     o->h.pagesize = objsize;
     o->parent = parent;
+    o->meta = meta;
+    spin_lock_init(&o->lock);
 
     list_init(&o->free);
     list_init(&o->full);
@@ -447,5 +703,11 @@ heap allocate_objcache(heap meta, heap parent, bytes objsize, bytes pagesize)
     o->total_objs = 0;
     o->alloced_objs = 0;
 
+    if (!objcache_init_magazines(o)) {
+	msg_err("unable to allocate magazines\n");
+	deallocate(meta, o, sizeof(struct objcache));
+	return INVALID_ADDRESS;
+    }
+
     return (heap)o;
 }
@@ -38,8 +38,8 @@ merge allocate_merge(heap h, status_handler completion)
 {
     merge m = allocate_zero(h, sizeof(struct merge));
     m->h = h;
-    status_handler sh = closure(h, merge_join, m);
-    m->apply = closure(h, merge_add, m, sh);
+    status_handler sh = closure_from_pool(h, merge_join, m);
+    m->apply = closure_from_pool(h, merge_add, m, sh);
     m->completion = completion;
     m->last_status = STATUS_OK;
     return m;
@@ -0,0 +1,300 @@
+#include <runtime.h>
+
+void init_rbtree(rbtree t, rb_key_compare key_compare)
+{
+    t->root = 0;
+    t->key_compare = key_compare;
+}
+
+static inline boolean is_red(rbnode n)
+{
+    return n && n->red;
+}
+
+/* point the parent of old (or the root) at new */
+static void replace_child(rbtree t, rbnode old, rbnode new)
+{
+    rbnode p = old->parent;
+    if (!p)
+        t->root = new;
+    else if (p->left == old)
+        p->left = new;
+    else
+        p->right = new;
+    if (new)
+        new->parent = p;
+}
+
+static void rotate_left(rbtree t, rbnode x)
+{
+    rbnode y = x->right;
+    x->right = y->left;
+    if (y->left)
+        y->left->parent = x;
+    replace_child(t, x, y);
+    y->left = x;
+    x->parent = y;
+}
+
+static void rotate_right(rbtree t, rbnode x)
+{
+    rbnode y = x->left;
+    x->left = y->right;
+    if (y->right)
+        y->right->parent = x;
+    replace_child(t, x, y);
+    y->right = x;
+    x->parent = y;
+}
+
+static void insert_fixup(rbtree t, rbnode n)
+{
+    rbnode p;
+    while ((p = n->parent) && p->red) {
+        rbnode g = p->parent;   /* the root is black, so p has a parent */
+        if (p == g->left) {
+            rbnode u = g->right;
+            if (is_red(u)) {
+                p->red = u->red = false;
+                g->red = true;
+                n = g;
+                continue;
+            }
+            if (n == p->right) {
+                rotate_left(t, p);
+                n = p;
+                p = n->parent;
+            }
+            p->red = false;
+            g->red = true;
+            rotate_right(t, g);
+        } else {
+            rbnode u = g->left;
+            if (is_red(u)) {
+                p->red = u->red = false;
+                g->red = true;
+                n = g;
+                continue;
+            }
+            if (n == p->left) {
+                rotate_right(t, p);
+                n = p;
+                p = n->parent;
+            }
+            p->red = false;
+            g->red = true;
+            rotate_left(t, g);
+        }
+    }
+    t->root->red = false;
+}
+
+/* fails if a node with an equal key is already present */
+boolean rbtree_insert_node(rbtree t, rbnode n)
+{
+    rbnode p = 0;
+    rbnode *link = &t->root;
+    while (*link) {
+        p = *link;
+        int c = t->key_compare(n, p);
+        if (c == 0)
+            return false;
+        link = c < 0 ? &p->left : &p->right;
+    }
+    n->parent = p;
+    n->left = n->right = 0;
+    n->red = true;
+    *link = n;
+    insert_fixup(t, n);
+    return true;
+}
+
+/* x, possibly empty, is short one black node; p is its parent */
+static void remove_fixup(rbtree t, rbnode x, rbnode p)
+{
+    while (x != t->root && !is_red(x)) {
+        if (x == p->left) {
+            rbnode w = p->right;
+            if (w->red) {
+                w->red = false;
+                p->red = true;
+                rotate_left(t, p);
+                w = p->right;
+            }
+            if (!is_red(w->left) && !is_red(w->right)) {
+                w->red = true;
+                x = p;
+                p = x->parent;
+                continue;
+            }
+            if (!is_red(w->right)) {
+                w->left->red = false;
+                w->red = true;
+                rotate_right(t, w);
+                w = p->right;
+            }
+            w->red = p->red;
+            p->red = false;
+            w->right->red = false;
+            rotate_left(t, p);
+        } else {
+            rbnode w = p->left;
+            if (w->red) {
+                w->red = false;
+                p->red = true;
+                rotate_right(t, p);
+                w = p->left;
+            }
+            if (!is_red(w->left) && !is_red(w->right)) {
+                w->red = true;
+                x = p;
+                p = x->parent;
+                continue;
+            }
+            if (!is_red(w->left)) {
+                w->right->red = false;
+                w->red = true;
+                rotate_left(t, w);
+                w = p->left;
+            }
+            w->red = p->red;
+            p->red = false;
+            w->left->red = false;
+            rotate_right(t, p);
+        }
+        x = t->root;
+    }
+    if (x)
+        x->red = false;
+}
+
+void rbtree_remove_node(rbtree t, rbnode n)
+{
+    rbnode x, p;
+    boolean removed_red;
+    if (!n->left || !n->right) {
+        x = n->left ? n->left : n->right;
+        p = n->parent;
+        removed_red = n->red;
+        replace_child(t, n, x);
+    } else {
+        /* splice out the successor and put it in n's place */
+        rbnode y = n->right;
+        while (y->left)
+            y = y->left;
+        removed_red = y->red;
+        x = y->right;
+        if (y->parent == n) {
+            p = y;
+        } else {
+            p = y->parent;
+            replace_child(t, y, x);
+            y->right = n->right;
+            y->right->parent = y;
+        }
+        replace_child(t, n, y);
+        y->left = n->left;
+        y->left->parent = y;
+        y->red = n->red;
+    }
+    if (!removed_red)
+        remove_fixup(t, x, p);
+}
+
+rbnode rbtree_lookup(rbtree t, rbnode k)
+{
+    rbnode n = t->root;
+    while (n) {
+        int c = t->key_compare(k, n);
+        if (c == 0)
+            return n;
+        n = c < 0 ? n->left : n->right;
+    }
+    return INVALID_ADDRESS;
+}
+
+/* the greatest node not after k */
+rbnode rbtree_lookup_max_lte(rbtree t, rbnode k)
+{
+    rbnode n = t->root;
+    rbnode match = INVALID_ADDRESS;
+    while (n) {
+        int c = t->key_compare(k, n);
+        if (c == 0)
+            return n;
+        if (c < 0) {
+            n = n->left;
+        } else {
+            match = n;
+            n = n->right;
+        }
+    }
+    return match;
+}
+
+/* the least node not before k */
+rbnode rbtree_lookup_min_gte(rbtree t, rbnode k)
+{
+    rbnode n = t->root;
+    rbnode match = INVALID_ADDRESS;
+    while (n) {
+        int c = t->key_compare(k, n);
+        if (c == 0)
+            return n;
+        if (c > 0) {
+            n = n->right;
+        } else {
+            match = n;
+            n = n->left;
+        }
+    }
+    return match;
+}
+
+rbnode rbtree_find_first(rbtree t)
+{
+    rbnode n = t->root;
+    if (!n)
+        return INVALID_ADDRESS;
+    while (n->left)
+        n = n->left;
+    return n;
+}
+
+rbnode rbtree_find_last(rbtree t)
+{
+    rbnode n = t->root;
+    if (!n)
+        return INVALID_ADDRESS;
+    while (n->right)
+        n = n->right;
+    return n;
+}
+
+rbnode rbtree_successor(rbtree t, rbnode n)
+{
+    if (n->right) {
+        n = n->right;
+        while (n->left)
+            n = n->left;
+        return n;
+    }
+    rbnode p;
+    while ((p = n->parent) && n == p->right)
+        n = p;
+    return p ? p : INVALID_ADDRESS;
+}
+
+rbnode rbtree_predecessor(rbtree t, rbnode n)
+{
+    if (n->left) {
+        n = n->left;
+        while (n->right)
+            n = n->right;
+        return n;
+    }
+    rbnode p;
+    while ((p = n->parent) && n == p->left)
+        n = p;
+    return p ? p : INVALID_ADDRESS;
+}
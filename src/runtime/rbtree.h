@@ -0,0 +1,40 @@
+/* Intrusive red-black tree
+
+   Nodes are embedded in the caller's structures, so the tree itself
+   never allocates. Keys are compared with a function of two nodes;
+   a lookup key is a (usually stack) node of the same type with just
+   the key fields filled in. Lookups return INVALID_ADDRESS on a
+   miss. */
+
+typedef struct rbnode {
+    struct rbnode *parent;
+    struct rbnode *left;
+    struct rbnode *right;
+    boolean red;
+} *rbnode;
+
+/* negative, zero or positive as a sorts before, with or after b */
+typedef int (*rb_key_compare)(rbnode a, rbnode b);
+
+typedef struct rbtree {
+    rbnode root;
+    rb_key_compare key_compare;
+} *rbtree;
+
+void init_rbtree(rbtree t, rb_key_compare key_compare);
+boolean rbtree_insert_node(rbtree t, rbnode n);
+void rbtree_remove_node(rbtree t, rbnode n);
+rbnode rbtree_lookup(rbtree t, rbnode k);
+rbnode rbtree_lookup_max_lte(rbtree t, rbnode k);
+rbnode rbtree_lookup_min_gte(rbtree t, rbnode k);
+rbnode rbtree_find_first(rbtree t);
+rbnode rbtree_find_last(rbtree t);
+rbnode rbtree_successor(rbtree t, rbnode n);
+rbnode rbtree_predecessor(rbtree t, rbnode n);
+
+static inline boolean rbtree_empty(rbtree t)
+{
+    return t->root == 0;
+}
+
+#define struct_from_rbnode(n, s, f) ((s)pointer_from_u64(u64_from_pointer(n) - offsetof(s, f)))
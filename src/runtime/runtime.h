@@ -168,6 +168,7 @@ typedef closure_type(thunk, void);
 #include <status.h>
 #include <pqueue.h>
 #include <range.h>
+#include <rbtree.h>
 #include <queue.h>
 #include <refcount.h>
 
@@ -3,3 +3,10 @@ static inline word fetch_and_add(word *variable, word value)
     asm volatile("lock; xadd %0, %1" : "+r" (value), "+m" (*variable) :: "memory", "cc");
     return value;
 }
+
+/* returns the prior value; the swap happened if it equals old */
+static inline word compare_and_swap_word(word *variable, word old, word new)
+{
+    asm volatile("lock; cmpxchg %2, %1" : "+a" (old), "+m" (*variable) : "r" (new) : "memory", "cc");
+    return old;
+}
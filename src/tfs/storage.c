@@ -0,0 +1,234 @@
+/* TFS storage allocator
+
+   Storage is handed out in exact lengths, padded to the block size,
+   rather than in the power-of-2 sizes and alignments of an id heap.
+
+   Free space is a set of extents indexed twice, each in a red-black
+   tree: by address, so that a freed extent coalesces with its
+   neighbors, and by (length, address), so that an allocation finds
+   the best fit in logarithmic time however fragmented the heap.
+
+   An allocation first tries the caller's hint, normally the storage
+   following the file's previous extent, so that a file written
+   sequentially stays contiguous on disk. Failing that, it takes the
+   smallest extent that fits, the lowest-addressed among equals. */
+
+#include <tfs_internal.h>
+
+typedef struct free_extent {
+    struct rbnode by_start;
+    struct rbnode by_length;
+    range r;
+} *free_extent;
+
+typedef struct storage_heap {
+    struct heap h;
+    heap meta;
+    u64 total;
+    u64 allocated;
+    struct rbtree starts;
+    struct rbtree lengths;
+} *storage_heap;
+
+#define free_extent_from_start(n) struct_from_rbnode(n, free_extent, by_start)
+#define free_extent_from_length(n) struct_from_rbnode(n, free_extent, by_length)
+
+static int compare_starts(rbnode a, rbnode b)
+{
+    u64 sa = free_extent_from_start(a)->r.start;
+    u64 sb = free_extent_from_start(b)->r.start;
+    return sa < sb ? -1 : sa > sb ? 1 : 0;
+}
+
+static int compare_lengths(rbnode a, rbnode b)
+{
+    range ra = free_extent_from_length(a)->r;
+    range rb = free_extent_from_length(b)->r;
+    if (range_span(ra) != range_span(rb))
+        return range_span(ra) < range_span(rb) ? -1 : 1;
+    return ra.start < rb.start ? -1 : ra.start > rb.start ? 1 : 0;
+}
+
+/* the free extent containing point, if any */
+static free_extent free_extent_lookup(storage_heap s, u64 point)
+{
+    struct free_extent k;
+    k.r.start = point;
+    rbnode n = rbtree_lookup_max_lte(&s->starts, &k.by_start);
+    if (n == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    free_extent fe = free_extent_from_start(n);
+    return point < fe->r.end ? fe : INVALID_ADDRESS;
+}
+
+static boolean free_extent_insert(storage_heap s, range r)
+{
+    free_extent fe = allocate(s->meta, sizeof(struct free_extent));
+    if (fe == INVALID_ADDRESS)
+        return false;
+    fe->r = r;
+    assert(rbtree_insert_node(&s->starts, &fe->by_start));
+    assert(rbtree_insert_node(&s->lengths, &fe->by_length));
+    return true;
+}
+
+static void free_extent_remove(storage_heap s, free_extent fe)
+{
+    rbtree_remove_node(&s->starts, &fe->by_start);
+    rbtree_remove_node(&s->lengths, &fe->by_length);
+    deallocate(s->meta, fe, sizeof(struct free_extent));
+}
+
+/* r lies within or adjoins the extent and overlaps no other, so its
+   place in the address order is unchanged */
+static void free_extent_resize(storage_heap s, free_extent fe, range r)
+{
+    rbtree_remove_node(&s->lengths, &fe->by_length);
+    fe->r = r;
+    assert(rbtree_insert_node(&s->lengths, &fe->by_length));
+}
+
+/* carve [start, start + length) out of fe */
+static boolean free_extent_take(storage_heap s, free_extent fe, u64 start, u64 length)
+{
+    range head = irange(fe->r.start, start);
+    range tail = irange(start + length, fe->r.end);
+    if (range_empty(head)) {
+        if (range_empty(tail))
+            free_extent_remove(s, fe);
+        else
+            free_extent_resize(s, fe, tail);
+    } else {
+        range r = fe->r;
+        free_extent_resize(s, fe, head);
+        if (!range_empty(tail) && !free_extent_insert(s, tail)) {
+            free_extent_resize(s, fe, r);
+            return false;
+        }
+    }
+    s->allocated += length;
+    return true;
+}
+
+u64 storage_heap_alloc_near(heap h, bytes length, u64 hint)
+{
+    storage_heap s = (storage_heap)h;
+    length = pad(length, h->pagesize);
+    if (length == 0)
+        return INVALID_PHYSICAL;
+
+    if (hint != INVALID_PHYSICAL) {
+        free_extent fe = free_extent_lookup(s, hint);
+        if (fe != INVALID_ADDRESS && hint + length <= fe->r.end)
+            return free_extent_take(s, fe, hint, length) ? hint : INVALID_PHYSICAL;
+    }
+
+    struct free_extent k;
+    k.r = irange(0, length);
+    rbnode n = rbtree_lookup_min_gte(&s->lengths, &k.by_length);
+    if (n == INVALID_ADDRESS)
+        return INVALID_PHYSICAL;
+    free_extent fe = free_extent_from_length(n);
+    u64 start = fe->r.start;
+    return free_extent_take(s, fe, start, length) ? start : INVALID_PHYSICAL;
+}
+
+static u64 storage_heap_alloc(heap h, bytes length)
+{
+    return storage_heap_alloc_near(h, length, INVALID_PHYSICAL);
+}
+
+static void storage_heap_dealloc(heap h, u64 a, bytes length)
+{
+    storage_heap s = (storage_heap)h;
+    length = pad(length, h->pagesize);
+    range r = irange(a, a + length);
+    if ((a & (h->pagesize - 1)) || r.end > s->total || r.end < r.start) {
+        msg_err("storage heap %p: invalid range %R; leaking\n", s, r);
+        return;
+    }
+
+    struct free_extent k;
+    k.r.start = a;
+    rbnode n = rbtree_lookup_max_lte(&s->starts, &k.by_start);
+    free_extent prev = n == INVALID_ADDRESS ? INVALID_ADDRESS : free_extent_from_start(n);
+    n = n == INVALID_ADDRESS ? rbtree_find_first(&s->starts) : rbtree_successor(&s->starts, n);
+    free_extent next = n == INVALID_ADDRESS ? INVALID_ADDRESS : free_extent_from_start(n);
+    if ((next != INVALID_ADDRESS && next->r.start < r.end) ||
+        (prev != INVALID_ADDRESS && prev->r.end > r.start)) {
+        msg_err("storage heap %p: range %R not allocated; leaking\n", s, r);
+        return;
+    }
+
+    /* coalesce with free neighbors */
+    boolean join_prev = prev != INVALID_ADDRESS && prev->r.end == r.start;
+    boolean join_next = next != INVALID_ADDRESS && next->r.start == r.end;
+    if (join_prev && join_next) {
+        r = irange(prev->r.start, next->r.end);
+        free_extent_remove(s, next);
+        free_extent_resize(s, prev, r);
+    } else if (join_prev) {
+        free_extent_resize(s, prev, irange(prev->r.start, r.end));
+    } else if (join_next) {
+        free_extent_resize(s, next, irange(r.start, next->r.end));
+    } else if (!free_extent_insert(s, r)) {
+        msg_err("storage heap %p: out of meta; leaking range %R\n", s, r);
+        return;
+    }
+    s->allocated -= length;
+}
+
+boolean storage_heap_reserve(heap h, u64 start, bytes length)
+{
+    storage_heap s = (storage_heap)h;
+    if (start & (h->pagesize - 1))
+        return false;
+    length = pad(length, h->pagesize);
+    free_extent fe = free_extent_lookup(s, start);
+    if (fe == INVALID_ADDRESS || start + length > fe->r.end)
+        return false;
+    return free_extent_take(s, fe, start, length);
+}
+
+static bytes storage_heap_allocated(heap h)
+{
+    return ((storage_heap)h)->allocated;
+}
+
+static bytes storage_heap_total(heap h)
+{
+    return ((storage_heap)h)->total;
+}
+
+static void storage_heap_destroy(heap h)
+{
+    storage_heap s = (storage_heap)h;
+    rbnode n;
+    while ((n = rbtree_find_first(&s->starts)) != INVALID_ADDRESS)
+        free_extent_remove(s, free_extent_from_start(n));
+    deallocate(s->meta, s, sizeof(struct storage_heap));
+}
+
+heap create_storage_heap(heap meta, u64 size, bytes blocksize)
+{
+    assert((blocksize & (blocksize - 1)) == 0);
+    storage_heap s = allocate(meta, sizeof(struct storage_heap));
+    if (s == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    zero(s, sizeof(struct storage_heap));
+    s->h.alloc = storage_heap_alloc;
+    s->h.dealloc = storage_heap_dealloc;
+    s->h.destroy = storage_heap_destroy;
+    s->h.allocated = storage_heap_allocated;
+    s->h.total = storage_heap_total;
+    s->h.pagesize = blocksize;
+    s->meta = meta;
+    s->total = size & ~(blocksize - 1);
+    init_rbtree(&s->starts, compare_starts);
+    init_rbtree(&s->lengths, compare_lengths);
+    if (s->total && !free_extent_insert(s, irange(0, s->total))) {
+        deallocate(meta, s, sizeof(struct storage_heap));
+        return INVALID_ADDRESS;
+    }
+    return &s->h;
+}
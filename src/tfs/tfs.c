@@ -481,25 +481,26 @@ static tuple soft_create(filesystem fs, tuple t, symbol a, merge m)
    optimization, adjacent extents on the disk could be joined into
    larger extents with only a meta update.
 
+   Storage is allocated at the hint, if given and free, so that an
+   extent may follow the file's previous extent on disk.
 */
 
-static extent create_extent(filesystem fs, range r, boolean uninited)
+static extent create_extent(filesystem fs, range r, boolean uninited, u64 hint)
 {
     heap h = fs->h;
     u64 length = range_span(r);
     u64 alignment = fs->alignment;
-    u64 alloc_order = find_order(pad(length, alignment));
-    u64 alloc_bytes = MAX(1 << alloc_order, MIN_EXTENT_SIZE);
+    u64 alloc_bytes = MAX(pad(length, alignment), MIN_EXTENT_SIZE);
 
 #ifdef BOOT
     /* No writes from the bootloader, please. */
     return INVALID_ADDRESS;
 #endif
 
-    tfs_debug("create_extent: align %d, offset %ld, length %ld, alloc_order %ld, alloc_bytes %ld\n",
-              alignment, r.start, length, alloc_order, alloc_bytes);
+    tfs_debug("create_extent: align %d, offset %ld, length %ld, alloc_bytes %ld, hint 0x%lx\n",
+              alignment, r.start, length, alloc_bytes, hint);
 
-    u64 block_start = allocate_u64((heap)fs->storage, alloc_bytes);
+    u64 block_start = storage_heap_alloc_near(fs->storage, alloc_bytes, hint);
     if (block_start == u64_from_pointer(INVALID_ADDRESS)) {
         msg_err("out of storage");
         return INVALID_ADDRESS;
@@ -516,7 +517,7 @@ static extent create_extent(filesystem fs, range r, boolean uninited)
 
 static void destroy_extent(filesystem fs, extent ex)
 {
-    deallocate_u64((heap)fs->storage, ex->block_start, ex->allocated);
+    deallocate_u64(fs->storage, ex->block_start, ex->allocated);
     deallocate(fs->h, ex, sizeof(*ex));
 }
 
@@ -570,28 +571,37 @@ static void remove_extent_from_file(fsfile f, extent ex, merge m)
     filesystem_write_eav(f->fs, extents, offs, 0, apply_merge(m));
 }
 
+static inline u64 extent_storage_end(extent ex)
+{
+    return ex->block_start + ex->allocated;
+}
+
 static extent fs_new_extent(fsfile f, range r, boolean uninited, merge m)
 {
-    extent ex = create_extent(f->fs, r, uninited);
+    rmnode prev = r.start > 0 ? rangemap_lookup(f->extentmap, r.start - 1) : INVALID_ADDRESS;
+    u64 hint = prev != INVALID_ADDRESS ? extent_storage_end((extent)prev) : INVALID_PHYSICAL;
+    extent ex = create_extent(f->fs, r, uninited, hint);
     if (ex != INVALID_ADDRESS) {
         add_extent_to_file(f, ex, m);
     }
     return ex;
 }
 
-static boolean add_extents(filesystem fs, range i, rangemap rm)
+/* hint is the storage following the file's extent before i, if any */
+static boolean add_extents(filesystem fs, range i, rangemap rm, u64 hint)
 {
     while (range_span(i) >= MAX_EXTENT_SIZE) {
         range r = {.start = i.start, .end = i.start + MAX_EXTENT_SIZE};
-        extent ex = create_extent(fs, r, true);
+        extent ex = create_extent(fs, r, true, hint);
         if (ex == INVALID_ADDRESS) {
             return false;
         }
         assert(rangemap_insert(rm, &ex->node));
+        hint = extent_storage_end(ex);
         i.start += MAX_EXTENT_SIZE;
     }
     if (range_span(i)) {
-        extent ex = create_extent(fs, i, true);
+        extent ex = create_extent(fs, i, true, hint);
         if (ex == INVALID_ADDRESS) {
             return false;
         }
@@ -629,7 +639,7 @@ boolean filesystem_reserve_storage(filesystem fs, u64 start, u64 length)
 {
 #ifndef BOOT
     if (fs->w)
-        return id_heap_set_area(fs->storage, start, length, true, true);
+        return storage_heap_reserve(fs->storage, start, length);
 #endif
     return true;
 }
@@ -749,18 +759,15 @@ closure_function(5, 1, void, filesystem_write_data_complete,
    being filled with content. However, there are at least two
    differing ways that we can do this function:
 
-   1) Use only single page-sized extents when writing. The reasons are
-      two-fold: With our storage allocator, larger, non power-of-2
-      sizes will lead to more wasted allocated space, and larger,
-      varied allocations leads to more fragmentation of storage space.
+   1) Use only single page-sized extents when writing. Larger,
+      varied allocations lead to more fragmentation of storage space,
+      though the storage allocator now sizes extents exactly and
+      coalesces freed space, so no space is lost to rounding.
 
       This comes at the cost of meta for every page worth of file
       data. However, extent meta for contiguous areas can be
-      aggregated. This is aided by the storage allocator issuing
-      allocations in-order when possible. (Note that we can add a
-      "release" function to the id heap to complement reserve. This
-      would allow us to arbitrarily deallocate blocks - and not
-      necessarily in allocation alignments (as with reserve).)
+      aggregated. This is aided by the storage allocator placing a
+      new extent after the file's previous one when possible.
 
    2) An alternative approach is to break large extent requests into
       allocation sizes that can be filled completely, descending in
@@ -982,24 +989,26 @@ void filesystem_alloc(filesystem fs, tuple t, long offset, long len,
     fs_status status = FS_STATUS_OK;
 
     u64 lastedge = q.start;
+    u64 hint = INVALID_PHYSICAL;
     rmnode curr = rangemap_first_node(f->extentmap);
     while (curr != INVALID_ADDRESS) {
         u64 edge = curr->r.start;
         range i = range_intersection(irange(lastedge, edge), q);
         if (range_span(i)) {
-            if (!add_extents(fs, i, &new_rm)) {
+            if (!add_extents(fs, i, &new_rm, hint)) {
                 status = FS_STATUS_NOSPACE;
                 goto error;
             }
         }
         lastedge = curr->r.end;
+        hint = extent_storage_end((extent)curr);
         curr = rangemap_next_node(f->extentmap, curr);
     }
 
     /* check for a gap between the last node and q.end */
     range i = range_intersection(irange(lastedge, q.end), q);
     if (range_span(i)) {
-        if (!add_extents(fs, i, &new_rm)) {
+        if (!add_extents(fs, i, &new_rm, hint)) {
             status = FS_STATUS_NOSPACE;
             goto error;
         }
@@ -1321,7 +1330,7 @@ void create_filesystem(heap h,
     assert((blocksize & (blocksize - 1)) == 0); /* power of 2 */
     fs->blocksize_order = find_order(blocksize);
 #ifndef BOOT
-    fs->storage = create_id_heap(h, h, 0, size, fs_blocksize(fs));
+    fs->storage = create_storage_heap(h, size, fs_blocksize(fs));
     assert(fs->storage != INVALID_ADDRESS);
 #endif
     fs->tl = log_create(h, fs, initialize, closure(h, log_complete, complete, fs));
@@ -1339,10 +1348,10 @@ u64 fs_blocksize(filesystem fs)
 
 u64 fs_totalblocks(filesystem fs)
 {
-    return fs->storage->total >> fs->blocksize_order;
+    return heap_total(fs->storage) >> fs->blocksize_order;
 }
 
 u64 fs_freeblocks(filesystem fs)
 {
-    return (fs->storage->total - fs->storage->allocated) >> fs->blocksize_order;
+    return (heap_total(fs->storage) - heap_allocated(fs->storage)) >> fs->blocksize_order;
 }
@@ -10,7 +10,7 @@
 typedef struct log *log;
 
 typedef struct filesystem {
-    id_heap storage;
+    heap storage;
     u64 size;
     heap h;
     int alignment;
@@ -34,6 +34,10 @@ void log_flush(log tl);
 void log_flush_complete(log tl, status_handler completion);
 void flush(filesystem fs, status_handler);
 boolean filesystem_reserve_storage(filesystem fs, u64 start, u64 length);
+
+heap create_storage_heap(heap meta, u64 size, bytes blocksize);
+u64 storage_heap_alloc_near(heap h, bytes length, u64 hint);
+boolean storage_heap_reserve(heap h, u64 start, bytes length);
     
 typedef closure_type(buffer_status, buffer, status);
 fsfile allocate_fsfile(filesystem fs, tuple md);
@@ -1,89 +1,166 @@
 #include <unix_internal.h>
 
+/* Futexes live in a global hash of buckets keyed by process and user
+   address, each bucket with its own lock, so that wakers on unrelated
+   futexes do not contend. A futex is created by the first waiter and
+   freed lazily: idle entries met while searching a bucket are
+   released. Each waiter is recorded on its futex, in blockq order,
+   with the bitset it waits on; wakes pick matching waiters and
+   requeues move blockq items without waking them. */
+
+#define FUTEX_HASH_BITS         8
+#define FUTEX_HASH_SIZE         U64_FROM_BIT(FUTEX_HASH_BITS)
+#define FUTEX_BITSET_MATCH_ANY  0xffffffff
+
+typedef struct futex_bucket {
+    struct spinlock lock;
+    struct list futexes;
+} *futex_bucket;
+
 struct futex {
-    heap h;
+    process p;
+    int *uaddr;
+    futex_bucket b;
     blockq bq;
+    struct list l;              /* bucket membership */
+    struct list waiters;
 };
 
-static u64 futex_key_function(void *x)
+typedef struct futex_waiter {
+    struct list l;              /* on futex waiters, in blockq order */
+    struct futex *f;
+    thread t;
+    u32 bitset;
+} *futex_waiter;
+
+static heap futex_heap;
+static struct futex_bucket *futex_buckets;
+
+static futex_bucket futex_get_bucket(process p, int *uaddr)
 {
-    return u64_from_pointer(x);
+    u64 k = (u64_from_pointer(uaddr) >> 2) ^ u64_from_pointer(p);
+    k *= 0x9e3779b97f4a7c15ull;
+    return &futex_buckets[k >> (64 - FUTEX_HASH_BITS)];
 }
 
-static boolean futex_key_equal(void *a, void *b)
+static void futex_free(struct futex *f)
 {
-    return a == b;
+    list_delete(&f->l);
+    deallocate_blockq(f->bq);
+    deallocate(futex_heap, f, sizeof(struct futex));
 }
 
-static struct futex * soft_create_futex(process p, u64 key)
+/* called with bucket locked */
+static struct futex *futex_lookup(futex_bucket b, process p, int *uaddr, boolean create)
 {
-    heap h = heap_general(get_kernel_heaps());
-    struct futex * f;
-
-    // XXX make this all atomic wrt p->futices
-
-    f = table_find(p->futices, pointer_from_u64(key));
-    if (f)
-        return f;
+    struct futex *found = 0;
+    list_foreach(&b->futexes, l) {
+        struct futex *f = struct_from_list(l, struct futex *, l);
+        if (f->p == p && f->uaddr == uaddr)
+            found = f;
+        else if (list_empty(&f->waiters))
+            futex_free(f);
+    }
+    if (found || !create)
+        return found;
 
-    f = allocate(h, sizeof(struct futex));
-    if (!f) {
+    struct futex *f = allocate(futex_heap, sizeof(struct futex));
+    if (f == INVALID_ADDRESS) {
         msg_err("failed to allocate futex\n");
         return INVALID_ADDRESS;
     }
-
-    f->h = h;
-    f->bq = allocate_blockq(f->h, "futex");
+    f->bq = allocate_blockq(futex_heap, "futex");
     if (f->bq == INVALID_ADDRESS) {
         msg_err("failed to allocate futex blockq\n");
-        deallocate(f->h, f, sizeof(struct futex));
+        deallocate(futex_heap, f, sizeof(struct futex));
         return INVALID_ADDRESS;
     }
-
-    table_set(p->futices, pointer_from_u64(key), f);
+    f->p = p;
+    f->uaddr = uaddr;
+    f->b = b;
+    list_init(&f->waiters);
+    list_insert_before(&b->futexes, &f->l);
     return f;
 }
 
-static thread futex_wake_one(struct futex * f)
+/* lock two buckets in address order */
+static void futex_lock_pair(futex_bucket b1, futex_bucket b2)
 {
-    thread w;
-
-    w = blockq_wake_one(f->bq);
-    if (w == INVALID_ADDRESS)
-        return w;
+    if (b1 > b2) {
+        futex_bucket tmp = b1;
+        b1 = b2;
+        b2 = tmp;
+    }
+    spin_lock(&b1->lock);
+    if (b2 != b1)
+        spin_lock(&b2->lock);
+}
 
-    /* w must be awake */
-    assert(w->blocked_on != f->bq);
-    return w;
+static void futex_unlock_pair(futex_bucket b1, futex_bucket b2)
+{
+    spin_unlock(&b1->lock);
+    if (b2 != b1)
+        spin_unlock(&b2->lock);
 }
 
 /*
- * Wake up to 'val' waiters
+ * Wake up to 'val' waiters whose bitset intersects 'bitset'
  * Return the number woken
+ * Called with bucket locked
  */
-static int futex_wake_many(struct futex * f, int val)
+static int futex_wake_many(struct futex *f, int val, u32 bitset)
 {
-    int nr_woken;
+    int nr_woken = 0;
 
-    for (nr_woken = 0; nr_woken < val; nr_woken++) {
-        thread w = futex_wake_one(f);
-        if (w == INVALID_ADDRESS)
+    list_foreach(&f->waiters, l) {
+        if (nr_woken >= val)
             break;
+        futex_waiter w = struct_from_list(l, futex_waiter, l);
+        if (!(w->bitset & bitset))
+            continue;
+        thread t = w->t;
+        if (blockq_wake_one_for_thread(f->bq, t)) {
+            /* t must be awake */
+            assert(t->blocked_on != f->bq);
+            nr_woken++;
+        }
     }
-
     return nr_woken;
 }
 
-boolean futex_wake_many_by_uaddr(process p, int *uaddr, int val)
+static int futex_wake(process p, int *uaddr, int val, u32 bitset)
 {
-    struct futex * f;
+    futex_bucket b = futex_get_bucket(p, uaddr);
+    spin_lock(&b->lock);
+    struct futex *f = futex_lookup(b, p, uaddr, false);
+    int woken = f ? futex_wake_many(f, val, bitset) : 0;
+    spin_unlock(&b->lock);
+    return woken;
+}
 
-    f = table_find(p->futices, (void *)uaddr);
-    if (!f)
-        return false;
+boolean futex_wake_many_by_uaddr(process p, int *uaddr, int val)
+{
+    futex_bucket b = futex_get_bucket(p, uaddr);
+    spin_lock(&b->lock);
+    struct futex *f = futex_lookup(b, p, uaddr, false);
+    if (f)
+        futex_wake_many(f, val, FUTEX_BITSET_MATCH_ANY);
+    spin_unlock(&b->lock);
+    return f != 0;
+}
 
-    futex_wake_many(f, val);
-    return true;
+/* Move up to n waiters from one futex to another without waking
+   them. Called with both buckets locked. */
+static int futex_requeue_waiters(struct futex *from, struct futex *to, int n)
+{
+    int requeued = blockq_transfer_waiters(to->bq, from->bq, n);
+    for (int i = 0; i < requeued; i++) {
+        futex_waiter w = struct_from_list(list_get_next(&from->waiters), futex_waiter, l);
+        list_delete(&w->l);
+        w->f = to;
+        list_insert_before(&to->waiters, &w->l);
+    }
+    return requeued;
 }
 
 /*
@@ -97,9 +174,10 @@ boolean futex_wake_many_by_uaddr(process p, int *uaddr, int val)
  *  0: thread woken up
  */
 closure_function(2, 1, sysreturn, futex_bh,
-                 struct futex *, f, thread, t,
+                 futex_waiter, w, thread, t,
                  u64, flags)
 {
+    futex_waiter w = bound(w);
     thread t = bound(t);
     sysreturn rv;
 
@@ -108,17 +186,106 @@ closure_function(2, 1, sysreturn, futex_bh,
     else if (flags & BLOCKQ_ACTION_TIMEDOUT)
         rv = -ETIMEDOUT;
     else if (current == t) {
+        thread_log(t, "%s: struct futex: %p, blocking\n", __func__, w->f);
         return BLOCKQ_BLOCK_REQUIRED;
-        thread_log(t, "%s: struct futex: %p, blocking\n", __func__, bound(f));
     } else
         rv = 0; /* no timer expire + not us --> actual wakeup */
 
-    thread_log(t, "%s: struct futex: %p, flags 0x%lx, rv %ld\n", __func__, bound(f), flags, rv);
+    thread_log(t, "%s: struct futex: %p, flags 0x%lx, rv %ld\n", __func__, w->f, flags, rv);
+
+    /* a waker already holds the bucket lock */
+    futex_bucket b = w->f->b;
+    boolean lock = (flags & (BLOCKQ_ACTION_NULLIFY | BLOCKQ_ACTION_TIMEDOUT)) != 0;
+    if (lock)
+        spin_lock(&b->lock);
+    list_delete(&w->l);
+    if (lock)
+        spin_unlock(&b->lock);
+    deallocate(futex_heap, w, sizeof(struct futex_waiter));
+
     thread_wakeup(t);
     closure_finish();
     return set_syscall_return(t, rv);
 }
 
+static sysreturn futex_wait(int *uaddr, int val, u32 bitset, clock_id clkid,
+                            timestamp ts, boolean absolute)
+{
+    thread t = current;
+    sysreturn rv;
+    futex_bucket b = futex_get_bucket(t->p, uaddr);
+    spin_lock(&b->lock);
+    if (*uaddr != val) {
+        spin_unlock(&b->lock);
+        return set_syscall_error(t, EAGAIN);
+    }
+    struct futex *f = futex_lookup(b, t->p, uaddr, true);
+    futex_waiter w = f == INVALID_ADDRESS ? INVALID_ADDRESS :
+        allocate(futex_heap, sizeof(struct futex_waiter));
+    if (w == INVALID_ADDRESS) {
+        spin_unlock(&b->lock);
+        return set_syscall_error(t, ENOMEM);
+    }
+    w->f = f;
+    w->t = t;
+    w->bitset = bitset;
+    list_insert_before(&f->waiters, &w->l);
+    spin_unlock(&b->lock);
+
+    // if we resume we are woken up
+    set_syscall_return(t, 0);
+
+    blockq_action ba = closure(futex_heap, futex_bh, w, t);
+    if (ba == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto fail;
+    }
+
+    /* only returns on failure to queue */
+    rv = blockq_check_timeout(f->bq, t, ba, false, clkid, ts, absolute);
+    deallocate_closure(ba);
+  fail:
+    spin_lock(&b->lock);
+    list_delete(&w->l);
+    spin_unlock(&b->lock);
+    deallocate(futex_heap, w, sizeof(struct futex_waiter));
+    return set_syscall_return(t, rv);
+}
+
+/* wake up to val waiters on uaddr and move up to n2 of the rest to uaddr2 */
+static sysreturn futex_requeue(int *uaddr, int val, int n2, int *uaddr2,
+                               boolean cmp, int val3)
+{
+    process p = current->p;
+    futex_bucket b = futex_get_bucket(p, uaddr);
+    futex_bucket b2 = futex_get_bucket(p, uaddr2);
+    sysreturn rv;
+
+    futex_lock_pair(b, b2);
+    if (cmp && *uaddr != val3) {
+        rv = -EAGAIN;
+        goto out;
+    }
+    struct futex *f = futex_lookup(b, p, uaddr, false);
+    if (!f) {
+        rv = 0;
+        goto out;
+    }
+    rv = futex_wake_many(f, val, FUTEX_BITSET_MATCH_ANY);
+    if (n2 > 0 && !list_empty(&f->waiters)) {
+        struct futex *f2 = futex_lookup(b2, p, uaddr2, true);
+        if (f2 == INVALID_ADDRESS) {
+            rv = rv ? rv : -ENOMEM;
+            goto out;
+        }
+        if (f2 != f)
+            rv += futex_requeue_waiters(f, f2, n2);
+    }
+  out:
+    futex_unlock_pair(b, b2);
+    return set_syscall_return(current, rv);
+}
+
 static timestamp get_timeout_timestamp(int futex_op, u64 val2)
 {
     switch (futex_op) {
@@ -135,17 +302,12 @@ static timestamp get_timeout_timestamp(int futex_op, u64 val2)
 sysreturn futex(int *uaddr, int futex_op, int val,
                 u64 val2, int *uaddr2, int val3)
 {
-    struct futex * f;
     timestamp ts;
     int op;
 
     boolean verbose = table_find(current->p->process_root, sym(futex_trace))
         ? true : false;
 
-    f = soft_create_futex(current->p, u64_from_pointer(uaddr));
-    if (f == INVALID_ADDRESS)
-        return set_syscall_error(current, ENOMEM);
-    
     op = futex_op & 127; // chuck the private bit
     ts = get_timeout_timestamp(op, val2);
     clock_id clkid = (futex_op & FUTEX_CLOCK_REALTIME) ? CLOCK_ID_REALTIME :
@@ -157,47 +319,27 @@ sysreturn futex(int *uaddr, int futex_op, int val,
             thread_log(current, "futex_wait [%ld %p %d] %d 0x%ld",
                 current->tid, uaddr, *uaddr, val, val2);
 
-        if (*uaddr != val)
-            return set_syscall_error(current, EAGAIN);
-
-        // if we resume we are woken up
-        set_syscall_return(current, 0);
-
-        return blockq_check_timeout(f->bq, current, 
-                                    closure(f->h, futex_bh, f, current),
-                                    false, clkid, ts, false);
+        return futex_wait(uaddr, val, FUTEX_BITSET_MATCH_ANY, clkid, ts, false);
     }
 
     case FUTEX_WAKE: {
         if (verbose)
             thread_log(current, "futex_wake [%ld %p %d] %d",
                 current->tid, uaddr, *uaddr, val);
-        return set_syscall_return(current, futex_wake_many(f, val));
+        return set_syscall_return(current, futex_wake(current->p, uaddr, val,
+                                                      FUTEX_BITSET_MATCH_ANY));
     }
 
+    case FUTEX_REQUEUE:
     case FUTEX_CMP_REQUEUE: {
-        int woken, requeued;
-
         if (verbose)
-            thread_log(current, "futex_cmp_requeue [%ld %p %d] val: %d val2: %d uaddr2: %p %d val3: %d",
-                       current->tid, uaddr, *uaddr, val, val2, uaddr2, *uaddr2, val3);
-
-        if (*uaddr != val3)
-            return set_syscall_error(current, EAGAIN);
-
-        woken = futex_wake_many(f, val);
-
-        requeued = 0;
-        if (val2 > 0) {
-            struct futex * new = soft_create_futex(current->p, u64_from_pointer(uaddr2));
-            if (new == INVALID_ADDRESS)
-                return set_syscall_error(current, ENOMEM);
-            int requeued = blockq_transfer_waiters(new->bq, f->bq, val2);
-            if (verbose)
-                thread_log(current, " awoken: %d, re-queued %d", woken, requeued);
-        }
+            thread_log(current, "futex_%srequeue [%ld %p %d] val: %d val2: %d uaddr2: %p %d val3: %d",
+                       op == FUTEX_CMP_REQUEUE ? "cmp_" : "", current->tid, uaddr, *uaddr,
+                       val, val2, uaddr2, *uaddr2, val3);
 
-        return set_syscall_return(current, woken + requeued);
+        if (val < 0 || (s32)val2 < 0)
+            return set_syscall_error(current, EINVAL);
+        return futex_requeue(uaddr, val, (s32)val2, uaddr2, op == FUTEX_CMP_REQUEUE, val3);
     }
 
     case FUTEX_WAKE_OP: {
@@ -222,7 +364,7 @@ sysreturn futex(int *uaddr, int futex_op, int val,
         case FUTEX_OP_XOR:   *uaddr2 ^= oparg; break;
         }
 
-        wake1 = futex_wake_many(f, val);
+        wake1 = futex_wake(current->p, uaddr, val, FUTEX_BITSET_MATCH_ANY);
         
         c = 0;
         switch (cmp) {
@@ -234,16 +376,7 @@ sysreturn futex(int *uaddr, int futex_op, int val,
         case FUTEX_OP_CMP_GE: c = (oldval >= cmparg) ; break;
         }
         
-        wake2 = 0;
-        if (c) {
-            struct futex * f2 = 
-                soft_create_futex(current->p, u64_from_pointer(uaddr2));
-            if (f2 == INVALID_ADDRESS)
-                return set_syscall_error(current, ENOMEM);
-
-            wake2 = futex_wake_many(f2, val2);
-        }
-
+        wake2 = c ? futex_wake(current->p, uaddr2, val2, FUTEX_BITSET_MATCH_ANY) : 0;
         return set_syscall_return(current, wake1 + wake2);
     }
 
@@ -252,17 +385,21 @@ sysreturn futex(int *uaddr, int futex_op, int val,
             thread_log(current, "futex_wait_bitset [%ld %p %d] %d 0x%ld %d",
                 current->tid, uaddr, *uaddr, val, val2, val3);
 
-        if (*uaddr != val)
-            return set_syscall_error(current, EAGAIN);
+        if (val3 == 0)
+            return set_syscall_error(current, EINVAL);
+        return futex_wait(uaddr, val, val3, clkid, ts, true);
+    }
+
+    case FUTEX_WAKE_BITSET: {
+        if (verbose)
+            thread_log(current, "futex_wake_bitset [%ld %p %d] %d %d",
+                current->tid, uaddr, *uaddr, val, val3);
 
-        set_syscall_return(current, 0);
-        return blockq_check_timeout(f->bq, current, 
-                                    closure(f->h, futex_bh, f, current),
-                                    false, clkid, ts, true);
+        if (val3 == 0)
+            return set_syscall_error(current, EINVAL);
+        return set_syscall_return(current, futex_wake(current->p, uaddr, val, val3));
     }
 
-    case FUTEX_REQUEUE: rprintf("futex_requeue not implemented\n"); break;
-    case FUTEX_WAKE_BITSET: rprintf("futex_wake_bitset not implemented\n"); break;
     case FUTEX_LOCK_PI: rprintf("futex_lock_pi not implemented\n"); break;
     case FUTEX_TRYLOCK_PI: rprintf("futex_trylock_pi not implemented\n"); break;
     case FUTEX_UNLOCK_PI: rprintf("futex_unlock_pi not implemented\n"); break;
@@ -274,15 +411,15 @@ sysreturn futex(int *uaddr, int futex_op, int val,
     return set_syscall_error(current, ENOSYS);
 }
 
-void
-init_futices(process p)
+boolean futex_init(unix_heaps uh)
 {
-    p->futices = allocate_table(
-        heap_general((kernel_heaps)p->uh),
-        futex_key_function,
-        futex_key_equal
-    );
-    if (p->futices == INVALID_ADDRESS)
-        halt("failed to allocate futex table\n");
-
+    futex_heap = heap_general((kernel_heaps)uh);
+    futex_buckets = allocate(futex_heap, FUTEX_HASH_SIZE * sizeof(struct futex_bucket));
+    if (futex_buckets == INVALID_ADDRESS)
+        return false;
+    for (int i = 0; i < FUTEX_HASH_SIZE; i++) {
+        spin_lock_init(&futex_buckets[i].lock);
+        list_init(&futex_buckets[i].futexes);
+    }
+    return true;
 }
@@ -0,0 +1,1042 @@
+#include <net_system_structs.h>
+#include <unix_internal.h>
+#include <page.h>
+#include <socket.h>
+
+//#define IO_URING_DEBUG
+#ifdef IO_URING_DEBUG
+#define iour_debug(x, ...) do {log_printf("IOUR", "%s: " x, __func__, ##__VA_ARGS__);} while(0)
+#else
+#define iour_debug(x, ...)
+#endif
+
+#define IO_URING_ENTRIES_MAX    4096
+#define IO_URING_FILES_MAX      1024
+#define IO_URING_BUFS_MAX       1024
+#define IO_URING_SQ_IDLE_MS     1000
+
+#define IO_URING_SETUP_FLAGS    (IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF | IORING_SETUP_CQSIZE)
+
+#define iour_lock(r)    u64 _irqflags = spin_lock_irq(&(r)->lock)
+#define iour_unlock(r)  spin_unlock_irq(&(r)->lock, _irqflags)
+
+/* Ring header shared with the process. SQ and CQ live in a single
+   mapping (IORING_FEAT_SINGLE_MMAP): the header is followed by the CQE
+   array and then the SQ index array. SQEs are mapped separately. */
+struct io_rings {
+    u32 sq_head;
+    u32 sq_tail;
+    u32 sq_ring_mask;
+    u32 sq_ring_entries;
+    u32 sq_flags;
+    u32 sq_dropped;
+    u32 cq_head;
+    u32 cq_tail;
+    u32 cq_ring_mask;
+    u32 cq_ring_entries;
+    u32 cq_overflow;
+    u32 cq_flags;
+    struct io_uring_cqe cqes[0];
+};
+
+typedef struct io_uring {
+    struct fdesc f;             /* must be first */
+    heap h;
+    kernel_heaps kh;
+    process p;
+    thread t;                   /* submitter context for SQPOLL */
+    struct spinlock lock;
+    u32 flags;
+    struct io_rings *rings;
+    u64 rings_size;
+    u32 *sq_array;
+    struct io_uring_sqe *sqes;
+    u64 sqes_size;
+    u32 sq_entries;
+    u32 cq_entries;
+    u64 cq_posted;              /* completions posted, for timeout counts */
+    blockq bq;                  /* io_uring_enter waiters */
+    struct list inflight;
+    struct list timeouts;       /* timeouts waiting on a completion count */
+    fdesc *files;
+    u32 nr_files;
+    struct iovec *bufs;
+    u32 nr_bufs;
+    thunk sqpoll;
+    boolean sqpoll_running;
+    timestamp sq_idle;
+    timestamp sq_active;
+    boolean closed;
+    boolean draining;
+} *io_uring;
+
+typedef struct iou_req {
+    struct list l;              /* on inflight list */
+    struct list tl;             /* on timeouts list */
+    io_uring r;
+    thread t;
+    fdesc f;
+    u64 user_data;
+    u8 opcode;
+    boolean issuing;
+    boolean completed;
+    sysreturn result;
+    io_completion completion;
+
+    /* read, write, send, recv */
+    void *buf;
+    u64 len;
+    u64 offset;
+    struct iovec *iov;
+    int iovcnt;
+    int iov_curr;
+    u64 total;
+
+    /* accept */
+    struct sockaddr *addr;
+    socklen_t *addrlen;
+    int accept_flags;
+
+    /* poll_add, and readiness wait after -EAGAIN */
+    u32 poll_events;
+    notify_entry poll;
+    event_handler poll_handler;
+
+    /* timeout */
+    timer tmr;
+    timer_handler tmr_handler;
+    u64 target;
+} *iou_req;
+
+static void iou_issue(iou_req req);
+
+static void iou_maybe_free(io_uring r);
+
+closure_function(1, 0, void, iou_fdesc_close,
+                 fdesc, f)
+{
+    apply(bound(f)->close);
+    closure_finish();
+}
+
+/* Drop a reference taken on behalf of a request or the file table. The
+   final close is deferred, as we may be running inside one of the
+   descriptor's own handlers. */
+static void iou_fdesc_release(io_uring r, fdesc f)
+{
+    if (fetch_and_add(&f->refcnt, -1) != 1 || !f->close)
+        return;
+    thunk t = closure(r->h, iou_fdesc_close, f);
+    if (t == INVALID_ADDRESS) {
+        msg_err("failed to allocate close thunk; leaking fdesc\n");
+        return;
+    }
+    enqueue(runqueue, t);
+}
+
+static void iou_check_timeouts(io_uring r);
+
+static void iou_post_cqe(io_uring r, u64 user_data, sysreturn res)
+{
+    struct io_rings *rings = r->rings;
+    iour_debug("r %p, user_data 0x%lx, res %ld\n", r, user_data, res);
+    iour_lock(r);
+    u32 tail = rings->cq_tail;
+    if (tail - rings->cq_head >= r->cq_entries) {
+        rings->cq_overflow++;
+    } else {
+        struct io_uring_cqe *cqe = &rings->cqes[tail & rings->cq_ring_mask];
+        cqe->user_data = user_data;
+        cqe->res = res;
+        cqe->flags = 0;
+        write_barrier();
+        rings->cq_tail = tail + 1;
+    }
+    r->cq_posted++;
+    iour_unlock(r);
+    iou_check_timeouts(r);
+    blockq_wake_one(r->bq);
+    fdesc_notify_events(&r->f);
+}
+
+static void iou_req_free(iou_req req)
+{
+    io_uring r = req->r;
+    list_delete(&req->l);
+    if (req->f)
+        iou_fdesc_release(r, req->f);
+    thread_release(req->t);
+    if (req->iov)
+        deallocate(r->h, req->iov, req->iovcnt * sizeof(struct iovec));
+    deallocate(r->h, req, sizeof(*req));
+    iou_maybe_free(r);
+}
+
+static void iou_req_complete(iou_req req, sysreturn rv)
+{
+    if (!req->r->closed)
+        iou_post_cqe(req->r, req->user_data, rv);
+    iou_req_free(req);
+}
+
+static void iou_timeout_cancel(iou_req req)
+{
+    /* disabled timers never invoke their handler */
+    remove_timer(req->tmr, 0);
+    deallocate_closure(req->tmr_handler);
+    req->tmr = 0;
+}
+
+static void iou_check_timeouts(io_uring r)
+{
+    iou_req req;
+    do {
+        req = 0;
+        list_foreach(&r->timeouts, l) {
+            iou_req t = struct_from_list(l, iou_req, tl);
+            if (r->cq_posted >= t->target) {
+                req = t;
+                break;
+            }
+        }
+        if (req) {
+            list_delete(&req->tl);
+            req->target = 0;
+            iou_timeout_cancel(req);
+            iou_req_complete(req, 0);
+        }
+    } while (req);
+}
+
+closure_function(1, 1, void, iou_timeout_expire,
+                 iou_req, req,
+                 u64, overruns)
+{
+    iou_req req = bound(req);
+    closure_finish();
+    req->tmr = 0;
+    if (req->target)
+        list_delete(&req->tl);
+    iou_req_complete(req, -ETIME);
+}
+
+/* Load the current iovec into buf/len, skipping empty ones. */
+static boolean iou_iov_load(iou_req req)
+{
+    while (req->iov_curr < req->iovcnt && req->iov[req->iov_curr].iov_len == 0)
+        req->iov_curr++;
+    if (req->iov_curr == req->iovcnt)
+        return false;
+    req->buf = req->iov[req->iov_curr].iov_base;
+    req->len = req->iov[req->iov_curr].iov_len;
+    return true;
+}
+
+static boolean iou_iov_next(iou_req req)
+{
+    if (req->offset != infinity)
+        req->offset += req->len;
+    req->iov_curr++;
+    return iou_iov_load(req);
+}
+
+closure_function(1, 0, void, iou_req_retry,
+                 iou_req, req)
+{
+    iou_req req = bound(req);
+    closure_finish();
+    if (req->r->closed)
+        iou_req_complete(req, -ECANCELED);
+    else if (req->opcode == IORING_OP_POLL_ADD)
+        iou_req_complete(req, req->result);
+    else
+        iou_issue(req);
+}
+
+static void iou_req_defer(iou_req req)
+{
+    thunk t = closure(req->r->h, iou_req_retry, req);
+    if (t == INVALID_ADDRESS) {
+        iou_req_complete(req, -ENOMEM);
+        return;
+    }
+    enqueue(runqueue, t);
+}
+
+static void iou_poll_disarm(iou_req req)
+{
+    notify_remove(req->f->ns, req->poll, false);
+    deallocate_closure(req->poll_handler);
+    req->poll = 0;
+}
+
+/* Readiness is acted upon from the runqueue rather than from within
+   the descriptor's notify dispatch. */
+closure_function(1, 2, boolean, iou_poll_wake,
+                 iou_req, req,
+                 u64, events, thread, t)
+{
+    iou_req req = bound(req);
+    if (events == NOTIFY_EVENTS_RELEASE) {
+        req->poll = 0;
+        closure_finish();
+        req->result = -ECANCELED;
+        req->opcode = IORING_OP_POLL_ADD;
+        iou_req_defer(req);
+        return false;
+    }
+    u32 mask = req->poll_events | EPOLLERR | EPOLLHUP;
+    if ((events & mask) == 0)
+        return false;
+    iou_poll_disarm(req);
+    req->result = events & mask;
+    iou_req_defer(req);
+    return true;
+}
+
+static boolean iou_poll_arm(iou_req req, u32 events)
+{
+    fdesc f = req->f;
+    if (!f->events)
+        return false;
+    req->poll_events = events;
+    req->poll_handler = closure(req->r->h, iou_poll_wake, req);
+    if (req->poll_handler == INVALID_ADDRESS)
+        return false;
+    req->poll = notify_add(f->ns, events | EPOLLERR | EPOLLHUP, req->poll_handler);
+    if (req->poll == INVALID_ADDRESS) {
+        deallocate_closure(req->poll_handler);
+        req->poll = 0;
+        return false;
+    }
+
+    /* catch an event which arrived before the entry was added */
+    u32 ready = apply(f->events, req->t) & (events | EPOLLERR | EPOLLHUP);
+    if (ready) {
+        iou_poll_disarm(req);
+        req->result = ready;
+        iou_req_defer(req);
+    }
+    return true;
+}
+
+/* A read or write on a non-blocking descriptor which returns -EAGAIN
+   is retried once the descriptor becomes ready. */
+static void iou_step_done(iou_req req, sysreturn rv)
+{
+    iour_debug("req %p, op %d, rv %ld\n", req, req->opcode, rv);
+    if (rv == -EAGAIN) {
+        u32 events = (req->opcode == IORING_OP_WRITEV ||
+                      req->opcode == IORING_OP_WRITE_FIXED ||
+                      req->opcode == IORING_OP_WRITE ||
+                      req->opcode == IORING_OP_SEND) ? EPOLLOUT : EPOLLIN;
+        if (iou_poll_arm(req, events))
+            return;
+    }
+    if (req->iov) {
+        if (rv > 0)
+            req->total += rv;
+        if (rv == req->len && iou_iov_next(req)) {
+            iou_issue(req);
+            return;
+        }
+        if (req->total > 0)
+            rv = req->total;
+    }
+    iou_req_complete(req, rv);
+}
+
+closure_function(1, 2, void, iou_io_complete,
+                 iou_req, req,
+                 thread, t, sysreturn, rv)
+{
+    iou_req req = bound(req);
+    closure_finish();
+    if (req->issuing) {
+        req->completed = true;
+        req->result = rv;
+        return;
+    }
+    iou_step_done(req, rv);
+}
+
+/* Not every io method applies the completion on early error returns,
+   so a direct return without completion is treated as the result. */
+static void iou_issue(iou_req req)
+{
+    fdesc f = req->f;
+    sysreturn rv;
+    req->completion = closure(req->r->h, iou_io_complete, req);
+    if (req->completion == INVALID_ADDRESS) {
+        iou_req_complete(req, -ENOMEM);
+        return;
+    }
+    req->issuing = true;
+    req->completed = false;
+    switch (req->opcode) {
+    case IORING_OP_READV:
+    case IORING_OP_READ_FIXED:
+    case IORING_OP_READ:
+    case IORING_OP_RECV:
+        rv = apply(f->read, req->buf, req->len, req->offset, req->t, true, req->completion);
+        break;
+    case IORING_OP_WRITEV:
+    case IORING_OP_WRITE_FIXED:
+    case IORING_OP_WRITE:
+    case IORING_OP_SEND:
+        rv = apply(f->write, req->buf, req->len, req->offset, req->t, true, req->completion);
+        break;
+    case IORING_OP_ACCEPT: {
+        struct sock *s = (struct sock *)f;
+        rv = s->accept4(s, req->addr, req->addrlen, req->accept_flags, req->t, true,
+                        req->completion);
+        break;
+    }
+    default:
+        halt("%s: unexpected opcode %d\n", __func__, req->opcode);
+    }
+    req->issuing = false;
+    if (req->completed) {
+        rv = req->result;
+    } else if (rv == SYSRETURN_CONTINUE_BLOCKING) {
+        return;
+    } else {
+        deallocate_closure(req->completion);
+    }
+    iou_step_done(req, rv);
+}
+
+closure_function(1, 1, void, iou_fsync_complete,
+                 iou_req, req,
+                 status, s)
+{
+    iou_req req = bound(req);
+    closure_finish();
+    iou_req_complete(req, is_ok(s) ? 0 : -EIO);
+}
+
+static sysreturn iou_prep_rw(iou_req req, struct io_uring_sqe *sqe)
+{
+    io_uring r = req->r;
+    fdesc f = req->f;
+    boolean write;
+    switch (req->opcode) {
+    case IORING_OP_WRITEV:
+    case IORING_OP_WRITE_FIXED:
+    case IORING_OP_WRITE:
+    case IORING_OP_SEND:
+        write = true;
+        break;
+    default:
+        write = false;
+    }
+    if (write ? !f->write : !f->read)
+        return -EINVAL;
+    req->buf = pointer_from_u64(sqe->addr);
+    req->len = sqe->len;
+    req->offset = (sqe->off == -1ull) ? infinity : sqe->off;
+
+    switch (req->opcode) {
+    case IORING_OP_READV:
+    case IORING_OP_WRITEV:
+        if (sqe->len > IOV_MAX)
+            return -EINVAL;
+        if (!req->buf)
+            return -EFAULT;
+        if (sqe->len == 0)
+            return 0;
+        /* the submitter may reuse its iovecs once the sqe is consumed
+           (IORING_FEAT_SUBMIT_STABLE) */
+        req->iov = allocate(r->h, sqe->len * sizeof(struct iovec));
+        if (req->iov == INVALID_ADDRESS) {
+            req->iov = 0;
+            return -ENOMEM;
+        }
+        runtime_memcpy(req->iov, req->buf, sqe->len * sizeof(struct iovec));
+        req->iovcnt = sqe->len;
+        req->iov_curr = 0;
+        req->total = 0;
+        if (!iou_iov_load(req))
+            return 0;
+        break;
+    case IORING_OP_READ_FIXED:
+    case IORING_OP_WRITE_FIXED: {
+        if (sqe->buf_index >= r->nr_bufs)
+            return -EFAULT;
+        struct iovec *b = &r->bufs[sqe->buf_index];
+        if (sqe->addr < u64_from_pointer(b->iov_base) ||
+            sqe->addr + sqe->len > u64_from_pointer(b->iov_base) + b->iov_len)
+            return -EFAULT;
+        break;
+    }
+    case IORING_OP_SEND:
+    case IORING_OP_RECV:
+        if (f->type != FDESC_TYPE_SOCKET)
+            return -ENOTSOCK;
+        /* socket writes never raise SIGPIPE; no other flag is supported */
+        if (sqe->msg_flags & ~(req->opcode == IORING_OP_SEND ? MSG_NOSIGNAL : 0))
+            return -EINVAL;
+        req->offset = 0;
+        break;
+    }
+    return SYSRETURN_CONTINUE_BLOCKING;
+}
+
+static void iou_submit_sqe(io_uring r, struct io_uring_sqe *sqe, thread t)
+{
+    iour_debug("r %p, op %d, fd %d, user_data 0x%lx\n", r, sqe->opcode, sqe->fd,
+               sqe->user_data);
+    iou_req req = allocate(r->h, sizeof(*req));
+    if (req == INVALID_ADDRESS) {
+        iou_post_cqe(r, sqe->user_data, -ENOMEM);
+        return;
+    }
+    runtime_memset((u8 *)req, 0, sizeof(*req));
+    req->r = r;
+    req->t = t;
+    thread_reserve(t);
+    req->user_data = sqe->user_data;
+    req->opcode = sqe->opcode;
+    list_insert_before(&r->inflight, &req->l);
+
+    sysreturn rv;
+    if (sqe->flags & ~IOSQE_FIXED_FILE) {
+        rv = -EINVAL;
+        goto out;
+    }
+    if (req->opcode != IORING_OP_NOP && req->opcode != IORING_OP_TIMEOUT) {
+        fdesc f;
+        if (sqe->flags & IOSQE_FIXED_FILE)
+            f = (sqe->fd >= 0 && sqe->fd < r->nr_files) ? r->files[sqe->fd] : 0;
+        else
+            f = resolve_fd_noret(r->p, sqe->fd);
+        if (!f) {
+            rv = -EBADF;
+            goto out;
+        }
+        fetch_and_add(&f->refcnt, 1);
+        req->f = f;
+    }
+
+    switch (req->opcode) {
+    case IORING_OP_NOP:
+        rv = 0;
+        break;
+    case IORING_OP_READV:
+    case IORING_OP_WRITEV:
+    case IORING_OP_READ_FIXED:
+    case IORING_OP_WRITE_FIXED:
+    case IORING_OP_READ:
+    case IORING_OP_WRITE:
+    case IORING_OP_SEND:
+    case IORING_OP_RECV:
+        rv = iou_prep_rw(req, sqe);
+        if (rv == SYSRETURN_CONTINUE_BLOCKING) {
+            iou_issue(req);
+            return;
+        }
+        break;
+    case IORING_OP_ACCEPT:
+        if (req->f->type != FDESC_TYPE_SOCKET) {
+            rv = -ENOTSOCK;
+            break;
+        }
+        if (!((struct sock *)req->f)->accept4) {
+            rv = -EOPNOTSUPP;
+            break;
+        }
+        req->addr = pointer_from_u64(sqe->addr);
+        req->addrlen = pointer_from_u64(sqe->addr2);
+        req->accept_flags = sqe->accept_flags;
+        iou_issue(req);
+        return;
+    case IORING_OP_FSYNC: {
+        if ((sqe->fsync_flags & ~IORING_FSYNC_DATASYNC) ||
+            req->f->type != FDESC_TYPE_REGULAR) {
+            rv = -EINVAL;
+            break;
+        }
+        status_handler sh = closure(r->h, iou_fsync_complete, req);
+        if (sh == INVALID_ADDRESS) {
+            rv = -ENOMEM;
+            break;
+        }
+        filesystem_flush(r->p->fs, ((file)req->f)->n, sh);
+        return;
+    }
+    case IORING_OP_POLL_ADD: {
+        u32 mask = sqe->poll_events | EPOLLERR | EPOLLHUP;
+        u32 ready = req->f->events ? apply(req->f->events, t) & mask : 0;
+        if (ready) {
+            rv = ready;
+            break;
+        }
+        if (!iou_poll_arm(req, sqe->poll_events)) {
+            rv = -EINVAL;
+            break;
+        }
+        return;
+    }
+    case IORING_OP_TIMEOUT: {
+        struct timespec *ts = pointer_from_u64(sqe->addr);
+        if (sqe->len != 1 || (sqe->timeout_flags & ~IORING_TIMEOUT_ABS)) {
+            rv = -EINVAL;
+            break;
+        }
+        if (!ts) {
+            rv = -EFAULT;
+            break;
+        }
+        req->tmr_handler = closure(r->h, iou_timeout_expire, req);
+        if (req->tmr_handler == INVALID_ADDRESS) {
+            rv = -ENOMEM;
+            break;
+        }
+        req->tmr = register_timer(runloop_timers, CLOCK_ID_MONOTONIC, time_from_timespec(ts),
+                                  (sqe->timeout_flags & IORING_TIMEOUT_ABS) != 0, 0,
+                                  req->tmr_handler);
+        if (req->tmr == INVALID_ADDRESS) {
+            deallocate_closure(req->tmr_handler);
+            req->tmr = 0;
+            rv = -ENOMEM;
+            break;
+        }
+        if (sqe->off) {
+            req->target = r->cq_posted + sqe->off;
+            list_insert_before(&r->timeouts, &req->tl);
+        }
+        return;
+    }
+    default:
+        rv = -EINVAL;
+    }
+  out:
+    iou_req_complete(req, rv);
+}
+
+/* Consume up to n entries from the submission ring. */
+static u32 iou_submit(io_uring r, u32 n, thread t)
+{
+    struct io_rings *rings = r->rings;
+    u32 head = rings->sq_head;
+    u32 tail = rings->sq_tail;
+    u32 submitted = 0;
+    read_barrier();
+    while (submitted < n && head != tail) {
+        u32 idx = r->sq_array[head & rings->sq_ring_mask];
+        head++;
+        if (idx >= r->sq_entries) {
+            rings->sq_dropped++;
+            continue;
+        }
+        /* copy out so that the entry may be reused once head advances */
+        struct io_uring_sqe sqe;
+        runtime_memcpy(&sqe, &r->sqes[idx], sizeof(sqe));
+        rings->sq_head = head;
+        iou_submit_sqe(r, &sqe, t);
+        submitted++;
+    }
+    rings->sq_head = head;
+    return submitted;
+}
+
+/* SQPOLL: a runqueue thunk consumes submissions on behalf of the ring
+   owner, going idle (and asking for a wakeup) after sq_idle without
+   work. */
+closure_function(1, 0, void, iou_sqpoll,
+                 io_uring, r)
+{
+    io_uring r = bound(r);
+    if (r->closed) {
+        r->sqpoll_running = false;
+        iou_maybe_free(r);
+        return;
+    }
+    timestamp here = now(CLOCK_ID_MONOTONIC);
+    if (iou_submit(r, r->sq_entries, r->t) > 0) {
+        r->sq_active = here;
+    } else if (here - r->sq_active >= r->sq_idle) {
+        r->rings->sq_flags |= IORING_SQ_NEED_WAKEUP;
+        memory_barrier();
+        if (r->rings->sq_tail == r->rings->sq_head) {
+            iour_debug("r %p idle\n", r);
+            r->sqpoll_running = false;
+            return;
+        }
+        r->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
+    }
+    enqueue(runqueue, closure_self());
+}
+
+static void iou_sqpoll_wake(io_uring r)
+{
+    if (r->sqpoll_running)
+        return;
+    r->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
+    r->sq_active = now(CLOCK_ID_MONOTONIC);
+    r->sqpoll_running = true;
+    enqueue(runqueue, r->sqpoll);
+}
+
+static void iou_unregister_files(io_uring r)
+{
+    for (u32 i = 0; i < r->nr_files; i++) {
+        if (r->files[i])
+            iou_fdesc_release(r, r->files[i]);
+    }
+    deallocate(r->h, r->files, r->nr_files * sizeof(fdesc));
+    r->files = 0;
+    r->nr_files = 0;
+}
+
+static void iou_unregister_bufs(io_uring r)
+{
+    deallocate(r->h, r->bufs, r->nr_bufs * sizeof(struct iovec));
+    r->bufs = 0;
+    r->nr_bufs = 0;
+}
+
+static void iou_free(io_uring r)
+{
+    iour_debug("r %p\n", r);
+    heap backed = heap_backed(r->kh);
+
+    /* tear down any mappings which outlived the descriptor */
+    unmap_prealloc(r->p, physical_from_virtual(r->rings), r->rings_size);
+    unmap_prealloc(r->p, physical_from_virtual(r->sqes), r->sqes_size);
+    deallocate(backed, r->rings, r->rings_size);
+    deallocate(backed, r->sqes, r->sqes_size);
+    if (r->sqpoll)
+        deallocate_closure(r->sqpoll);
+    thread_release(r->t);
+    deallocate_blockq(r->bq);
+    deallocate_closure(r->f.events);
+    deallocate_closure(r->f.close);
+    release_fdesc(&r->f);
+    deallocate(r->h, r, sizeof(*r));
+}
+
+static void iou_maybe_free(io_uring r)
+{
+    if (r->closed && !r->draining && !r->sqpoll_running && list_empty(&r->inflight))
+        iou_free(r);
+}
+
+closure_function(1, 1, u32, iou_events,
+                 io_uring, r,
+                 thread, t)
+{
+    io_uring r = bound(r);
+    struct io_rings *rings = r->rings;
+    u32 events = 0;
+    if (rings->cq_tail != rings->cq_head)
+        events |= EPOLLIN;
+    if (rings->sq_tail - rings->sq_head < r->sq_entries)
+        events |= EPOLLOUT;
+    return events;
+}
+
+/* Requests blocked in another descriptor's blockq cannot be recalled;
+   they complete in their own time and the ring is freed after the last
+   of them. */
+closure_function(1, 0, sysreturn, iou_close,
+                 io_uring, r)
+{
+    io_uring r = bound(r);
+    iour_debug("r %p\n", r);
+    r->closed = true;
+    r->draining = true;
+    list_foreach(&r->inflight, l) {
+        iou_req req = struct_from_list(l, iou_req, l);
+        if (req->poll) {
+            iou_poll_disarm(req);
+            iou_req_free(req);
+        } else if (req->tmr) {
+            if (req->target)
+                list_delete(&req->tl);
+            iou_timeout_cancel(req);
+            iou_req_free(req);
+        }
+    }
+    r->draining = false;
+    if (r->files)
+        iou_unregister_files(r);
+    if (r->bufs)
+        iou_unregister_bufs(r);
+    iou_maybe_free(r);
+    return 0;
+}
+
+sysreturn io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+    if (!params)
+        return -EFAULT;
+    if (entries == 0 || entries > IO_URING_ENTRIES_MAX)
+        return -EINVAL;
+    if ((params->flags & ~IO_URING_SETUP_FLAGS) ||
+        params->resv[0] || params->resv[1] || params->resv[2])
+        return -EINVAL;
+
+    u32 sq_entries = U64_FROM_BIT(find_order(entries));
+    u32 cq_entries = 2 * sq_entries;
+    if (params->flags & IORING_SETUP_CQSIZE) {
+        if (params->cq_entries == 0 || params->cq_entries > 2 * IO_URING_ENTRIES_MAX)
+            return -EINVAL;
+        cq_entries = U64_FROM_BIT(find_order(params->cq_entries));
+        if (cq_entries < sq_entries)
+            return -EINVAL;
+    }
+
+    kernel_heaps kh = get_kernel_heaps();
+    heap h = heap_general(kh);
+    heap backed = heap_backed(kh);
+    io_uring r = allocate(h, sizeof(*r));
+    if (r == INVALID_ADDRESS)
+        return -ENOMEM;
+    runtime_memset((u8 *)r, 0, sizeof(*r));
+    r->h = h;
+    r->kh = kh;
+    r->p = current->p;
+    r->flags = params->flags;
+    r->sq_entries = sq_entries;
+    r->cq_entries = cq_entries;
+    spin_lock_init(&r->lock);
+    list_init(&r->inflight);
+    list_init(&r->timeouts);
+
+    u64 sq_array_off = sizeof(struct io_rings) + cq_entries * sizeof(struct io_uring_cqe);
+    r->rings_size = pad(sq_array_off + sq_entries * sizeof(u32), PAGESIZE);
+    r->rings = allocate(backed, r->rings_size);
+    if (r->rings == INVALID_ADDRESS)
+        goto err_rings;
+    zero(r->rings, r->rings_size);
+    r->sq_array = (void *)r->rings + sq_array_off;
+    r->sqes_size = pad(sq_entries * sizeof(struct io_uring_sqe), PAGESIZE);
+    r->sqes = allocate(backed, r->sqes_size);
+    if (r->sqes == INVALID_ADDRESS)
+        goto err_sqes;
+    zero(r->sqes, r->sqes_size);
+
+    r->rings->sq_ring_mask = sq_entries - 1;
+    r->rings->sq_ring_entries = sq_entries;
+    r->rings->cq_ring_mask = cq_entries - 1;
+    r->rings->cq_ring_entries = cq_entries;
+
+    r->bq = allocate_blockq(h, "io_uring");
+    if (r->bq == INVALID_ADDRESS)
+        goto err_bq;
+
+    if (params->flags & IORING_SETUP_SQPOLL) {
+        r->sqpoll = closure(h, iou_sqpoll, r);
+        if (r->sqpoll == INVALID_ADDRESS)
+            goto err_sqpoll;
+        r->sq_idle = milliseconds(params->sq_thread_idle ? params->sq_thread_idle :
+                                  IO_URING_SQ_IDLE_MS);
+    }
+
+    init_fdesc(h, &r->f, FDESC_TYPE_IORING);
+    r->f.events = closure(h, iou_events, r);
+    r->f.close = closure(h, iou_close, r);
+    u64 fd = allocate_fd(r->p, r);
+    if (fd == INVALID_PHYSICAL)
+        goto err_fd;
+    r->t = current;
+    thread_reserve(r->t);
+    if (r->sqpoll)
+        iou_sqpoll_wake(r);
+
+    params->sq_entries = sq_entries;
+    params->cq_entries = cq_entries;
+    params->features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_SUBMIT_STABLE |
+        IORING_FEAT_RW_CUR_POS;
+    params->sq_off.head = offsetof(struct io_rings *, sq_head);
+    params->sq_off.tail = offsetof(struct io_rings *, sq_tail);
+    params->sq_off.ring_mask = offsetof(struct io_rings *, sq_ring_mask);
+    params->sq_off.ring_entries = offsetof(struct io_rings *, sq_ring_entries);
+    params->sq_off.flags = offsetof(struct io_rings *, sq_flags);
+    params->sq_off.dropped = offsetof(struct io_rings *, sq_dropped);
+    params->sq_off.array = sq_array_off;
+    params->cq_off.head = offsetof(struct io_rings *, cq_head);
+    params->cq_off.tail = offsetof(struct io_rings *, cq_tail);
+    params->cq_off.ring_mask = offsetof(struct io_rings *, cq_ring_mask);
+    params->cq_off.ring_entries = offsetof(struct io_rings *, cq_ring_entries);
+    params->cq_off.overflow = offsetof(struct io_rings *, cq_overflow);
+    params->cq_off.cqes = offsetof(struct io_rings *, cqes);
+    params->cq_off.flags = offsetof(struct io_rings *, cq_flags);
+    return fd;
+
+  err_fd:
+    deallocate_closure(r->f.events);
+    deallocate_closure(r->f.close);
+    release_fdesc(&r->f);
+    if (r->sqpoll)
+        deallocate_closure(r->sqpoll);
+  err_sqpoll:
+    deallocate_blockq(r->bq);
+  err_bq:
+    deallocate(backed, r->sqes, r->sqes_size);
+  err_sqes:
+    deallocate(backed, r->rings, r->rings_size);
+  err_rings:
+    deallocate(h, r, sizeof(*r));
+    return -ENOMEM;
+}
+
+sysreturn io_uring_mmap(fdesc f, u64 len, u64 offset, u64 *phys)
+{
+    io_uring r = (io_uring)f;
+    void *region;
+    u64 size;
+    switch (offset) {
+    case IORING_OFF_SQ_RING:
+    case IORING_OFF_CQ_RING:
+        region = r->rings;
+        size = r->rings_size;
+        break;
+    case IORING_OFF_SQES:
+        region = r->sqes;
+        size = r->sqes_size;
+        break;
+    default:
+        return -EINVAL;
+    }
+    if (len > size)
+        return -EINVAL;
+    *phys = physical_from_virtual(region);
+    return 0;
+}
+
+static inline u32 iou_cq_ready(io_uring r)
+{
+    return r->rings->cq_tail - r->rings->cq_head;
+}
+
+closure_function(5, 1, sysreturn, iou_wait_bh,
+                 io_uring, r, thread, t, u32, min_complete, sysreturn, submitted, io_completion, completion,
+                 u64, flags)
+{
+    io_uring r = bound(r);
+    thread t = bound(t);
+    sysreturn rv = bound(submitted);
+    if (flags & BLOCKQ_ACTION_NULLIFY) {
+        if (rv == 0)
+            rv = -EINTR;
+        goto out;
+    }
+    if (iou_cq_ready(r) < bound(min_complete))
+        return BLOCKQ_BLOCK_REQUIRED;
+  out:
+    blockq_handle_completion(r->bq, flags, bound(completion), t, rv);
+    iou_fdesc_release(r, &r->f);
+    closure_finish();
+    return rv;
+}
+
+/* The signal mask argument is not applied during the wait. */
+sysreturn io_uring_enter(int fd, unsigned int to_submit,
+        unsigned int min_complete, unsigned int flags, sigset_t *sig,
+        u64 sigsz)
+{
+    fdesc f = resolve_fd(current->p, fd);
+    if (f->type != FDESC_TYPE_IORING)
+        return -EOPNOTSUPP;
+    if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+        return -EINVAL;
+    io_uring r = (io_uring)f;
+    sysreturn submitted;
+
+    /* hold the ring across any wait */
+    fetch_and_add(&f->refcnt, 1);
+    if (r->flags & IORING_SETUP_SQPOLL) {
+        if (flags & IORING_ENTER_SQ_WAKEUP)
+            iou_sqpoll_wake(r);
+        submitted = to_submit;
+    } else {
+        submitted = iou_submit(r, MIN(to_submit, r->sq_entries), current);
+    }
+    if (!(flags & IORING_ENTER_GETEVENTS) || min_complete == 0 ||
+        iou_cq_ready(r) >= MIN(min_complete, r->cq_entries)) {
+        iou_fdesc_release(r, f);
+        return submitted;
+    }
+    blockq_action ba = closure(r->h, iou_wait_bh, r, current, MIN(min_complete, r->cq_entries),
+                               submitted, syscall_io_complete);
+    if (ba == INVALID_ADDRESS) {
+        iou_fdesc_release(r, f);
+        return -ENOMEM;
+    }
+    return blockq_check(r->bq, current, ba, false);
+}
+
+sysreturn io_uring_register(int fd, unsigned int opcode, void *arg,
+        unsigned int nr_args)
+{
+    fdesc f = resolve_fd(current->p, fd);
+    if (f->type != FDESC_TYPE_IORING)
+        return -EOPNOTSUPP;
+    io_uring r = (io_uring)f;
+
+    switch (opcode) {
+    case IORING_REGISTER_BUFFERS: {
+        if (r->bufs)
+            return -EBUSY;
+        if (!arg)
+            return -EFAULT;
+        if (nr_args == 0 || nr_args > IO_URING_BUFS_MAX)
+            return -EINVAL;
+        struct iovec *iov = arg;
+        for (u32 i = 0; i < nr_args; i++) {
+            if (!iov[i].iov_base && iov[i].iov_len)
+                return -EFAULT;
+        }
+        r->bufs = allocate(r->h, nr_args * sizeof(struct iovec));
+        if (r->bufs == INVALID_ADDRESS) {
+            r->bufs = 0;
+            return -ENOMEM;
+        }
+        runtime_memcpy(r->bufs, iov, nr_args * sizeof(struct iovec));
+        r->nr_bufs = nr_args;
+        return 0;
+    }
+    case IORING_UNREGISTER_BUFFERS:
+        if (!r->bufs)
+            return -ENXIO;
+        iou_unregister_bufs(r);
+        return 0;
+    case IORING_REGISTER_FILES: {
+        if (r->files)
+            return -EBUSY;
+        if (!arg)
+            return -EFAULT;
+        if (nr_args == 0 || nr_args > IO_URING_FILES_MAX)
+            return -EINVAL;
+        s32 *fds = arg;
+        r->files = allocate(r->h, nr_args * sizeof(fdesc));
+        if (r->files == INVALID_ADDRESS) {
+            r->files = 0;
+            return -ENOMEM;
+        }
+        runtime_memset((u8 *)r->files, 0, nr_args * sizeof(fdesc));
+        r->nr_files = nr_args;
+        for (u32 i = 0; i < nr_args; i++) {
+            if (fds[i] == -1)
+                continue;
+            fdesc rf = resolve_fd_noret(current->p, fds[i]);
+            if (!rf || rf == f) {
+                iou_unregister_files(r);
+                return -EBADF;
+            }
+            fetch_and_add(&rf->refcnt, 1);
+            r->files[i] = rf;
+        }
+        return 0;
+    }
+    case IORING_UNREGISTER_FILES:
+        if (!r->files)
+            return -ENXIO;
+        iou_unregister_files(r);
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
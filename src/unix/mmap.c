@@ -19,29 +19,149 @@ static inline u64 page_map_flags(u64 vmflags)
 #define vmap_lock(p) u64 _savedflags = spin_lock_irq(&(p)->vmap_lock)
 #define vmap_unlock(p) spin_unlock_irq(&(p)->vmap_lock, _savedflags)
 
-boolean do_demand_page(u64 vaddr, vmap vm)
+/* Only demand-paged anonymous memory can be given back or prefaulted;
+   file mappings are read in whole at mmap time and are private copies
+   with nothing to refault from. */
+static inline boolean vmap_is_anonymous(vmap vm)
 {
-    if ((vm->flags & VMAP_FLAG_MMAP) == 0) {
-        msg_err("vaddr 0x%lx matched vmap with invalid flags (0x%x)\n",
-                vaddr, vm->flags);
+    return (vm->flags & (VMAP_FLAG_MMAP | VMAP_FLAG_ANONYMOUS | VMAP_FLAG_PREALLOC)) ==
+        (VMAP_FLAG_MMAP | VMAP_FLAG_ANONYMOUS);
+}
+
+static boolean vmap_huge_pages(process p, vmap vm)
+{
+    if (!vmap_is_anonymous(vm) || (vm->flags & VMAP_FLAG_NOHUGEPAGE))
+        return false;
+    switch (p->thp_mode) {
+    case THP_ALWAYS:
+        return true;
+    case THP_MADVISE:
+        return (vm->flags & VMAP_FLAG_HUGEPAGE) != 0;
+    default:
         return false;
     }
+}
 
-    /* XXX make free list */
-    kernel_heaps kh = get_kernel_heaps();
-    u64 paddr = allocate_u64((heap)heap_physical(kh), PAGESIZE);
-    if (paddr == INVALID_PHYSICAL) {
-        msg_err("cannot get physical page; OOM\n");
+closure_function(0, 3, boolean, pte_unmapped,
+                 int, level, u64, vaddr, u64 *, entry)
+{
+    return !pt_entry_is_present(*entry) || !pt_entry_is_pte(level, *entry);
+}
+
+/* Map the whole 2M block around vaddr with a single fat pte if the
+   vmap covers it, none of it is mapped yet and an aligned physical
+   block is available. */
+static boolean demand_huge_page(process p, kernel_heaps kh, u64 vaddr, vmap vm)
+{
+    u64 vaddr_2m = vaddr & ~MASK(PAGELOG_2M);
+    if (!vmap_huge_pages(p, vm) ||
+        !range_contains(vm->node.r, irange(vaddr_2m, vaddr_2m + PAGESIZE_2M)) ||
+        !traverse_ptes(vaddr_2m, PAGESIZE_2M, stack_closure(pte_unmapped)))
+        return false;
+
+    heap physical = (heap)heap_physical(kh);
+    u64 paddr = allocate_u64(physical, PAGESIZE_2M);
+    if (paddr == INVALID_PHYSICAL)
+        return false;
+    if (paddr & MASK(PAGELOG_2M)) {
+        deallocate_u64(physical, paddr, PAGESIZE_2M);
         return false;
     }
 
+    map(vaddr_2m, paddr, PAGESIZE_2M, page_map_flags(vm->flags) & ~PAGE_NO_FAT, heap_pages(kh));
+    zero(pointer_from_u64(vaddr_2m), PAGESIZE_2M);
+    return true;
+}
+
+closure_function(2, 3, boolean, fault_around_mapped,
+                 u64, start, u64 *, mapped,
+                 int, level, u64, vaddr, u64 *, entry)
+{
+    u64 e = *entry;
+    if (!pt_entry_is_present(e) || !pt_entry_is_pte(level, e))
+        return true;
+    if (pt_entry_is_fat(level, e))
+        *bound(mapped) = -1ull;     /* the window lies within one 2M page */
+    else
+        *bound(mapped) |= U64_FROM_BIT((vaddr - bound(start)) >> PAGELOG);
+    return true;
+}
+
+/* Map the faulting page along with the unmapped pages around it in
+   the same fault_around_pages-aligned window of the vmap, saving the
+   faults a sequential first touch would take on each of them. */
+static boolean demand_fault_around(process p, kernel_heaps kh, u64 vaddr, vmap vm)
+{
     u64 vaddr_aligned = vaddr & ~MASK(PAGELOG);
-    map(vaddr_aligned, paddr, PAGESIZE, page_map_flags(vm->flags), heap_pages(kh));
-    zero(pointer_from_u64(vaddr_aligned), PAGESIZE);
+    range r = irange(vaddr_aligned, vaddr_aligned + PAGESIZE);
+    if (vmap_is_anonymous(vm) && (vm->flags & VMAP_FLAG_RANDOM) == 0) {
+        u64 window = p->fault_around_pages * PAGESIZE;
+        u64 start = vaddr & ~(window - 1);
+        r = range_intersection(vm->node.r, irange(start, start + window));
+    }
+
+    u64 mapped = 0;
+    traverse_ptes(r.start, range_span(r), stack_closure(fault_around_mapped, r.start, &mapped));
+
+    u64 phys[FAULT_AROUND_MAX];
+    int npages = range_span(r) >> PAGELOG;
+    int fault_page = (vaddr_aligned - r.start) >> PAGELOG;
+    for (int i = 0; i < npages; i++)
+        phys[i] = INVALID_PHYSICAL;
+    if ((mapped & U64_FROM_BIT(fault_page)) == 0) {
+        phys[fault_page] = allocate_zero_page();
+        if (phys[fault_page] == INVALID_PHYSICAL) {
+            msg_err("cannot get physical page; OOM\n");
+            return false;
+        }
+    }
 
+    /* neighbors are best effort */
+    for (int i = 0; i < npages; i++) {
+        if (i == fault_page || (mapped & U64_FROM_BIT(i)))
+            continue;
+        phys[i] = allocate_zero_page();
+        if (phys[i] == INVALID_PHYSICAL)
+            break;
+    }
+    map_pages(r.start, phys, npages, page_map_flags(vm->flags), heap_pages(kh));
     return true;
 }
 
+/* Demote fat pages straddling the ends of r, so that a page table
+   operation on r leaves the rest of them mapped. Fat pages never
+   cross a vmap boundary, so callers split at the ends of the request
+   before changing any vmaps and fail the operation if this returns
+   false (out of page table memory). */
+static boolean split_huge_pages_at(range r)
+{
+    heap pages = heap_pages(get_kernel_heaps());
+    if ((r.start & MASK(PAGELOG_2M)) && !split_fat_page(r.start, pages))
+        return false;
+    if ((r.end & MASK(PAGELOG_2M)) && !split_fat_page(r.end, pages))
+        return false;
+    return true;
+}
+
+static boolean demand_page(process p, u64 vaddr, vmap vm)
+{
+    if ((vm->flags & VMAP_FLAG_MMAP) == 0) {
+        msg_err("vaddr 0x%lx matched vmap with invalid flags (0x%x)\n",
+                vaddr, vm->flags);
+        return false;
+    }
+
+    kernel_heaps kh = get_kernel_heaps();
+    if (demand_huge_page(p, kh, vaddr, vm))
+        return true;
+    return demand_fault_around(p, kh, vaddr, vm);
+}
+
+boolean do_demand_page(u64 vaddr, vmap vm)
+{
+    return demand_page(current->p, vaddr, vm);
+}
+
 static inline vmap vmap_from_vaddr_locked(process p, u64 vaddr)
 {
     return (vmap)rangemap_lookup(p->vmaps, vaddr);
@@ -55,6 +175,28 @@ vmap vmap_from_vaddr(process p, u64 vaddr)
     return vm;
 }
 
+/* Check that [addr, addr + length) lies within the process vmaps, with
+   write permission if requested, and fault in any pages not yet
+   present. For kernel accesses to user memory outside of a syscall,
+   where current may not be the thread whose memory is touched. */
+boolean fault_in_user_range(process p, u64 addr, u64 length, boolean write)
+{
+    if (length == 0 || addr + length < addr)
+        return false;
+    for (u64 v = addr & ~MASK(PAGELOG); v < addr + length; v += PAGESIZE) {
+        vmap vm = vmap_from_vaddr(p, v);
+        if (vm == INVALID_ADDRESS)
+            return false;
+        if (write && !(vm->flags & VMAP_FLAG_WRITABLE))
+            return false;
+        if (physical_from_virtual(pointer_from_u64(v)) != INVALID_PHYSICAL)
+            continue;
+        if (!demand_page(p, v, vm))
+            return false;
+    }
+    return true;
+}
+
 void vmap_iterator(process p, vmap_handler vmh)
 {
     vmap_lock(p);
@@ -120,6 +262,7 @@ sysreturn mremap(void *old_address, u64 old_size, u64 new_size, int flags, void
     old_size = pad(old_size, vh->pagesize);
     if (new_size <= old_size)
         return sysreturn_from_pointer(old_address);
+    zerocopy_unmap(irange(old_addr, old_addr + old_size));
 
     /* begin locked portion...no direct returns */
     vmap_lock(p);
@@ -142,13 +285,6 @@ sysreturn mremap(void *old_address, u64 old_size, u64 new_size, int flags, void
         goto unlock_out;
     }
 
-    /* remove old mapping, preserving attributes */
-    u64 vmflags = old_vm->flags;
-
-    /* we're moving the vmap to a new address region, so we can safely remove
-     * the old node entirely */
-    rangemap_remove_node(p->vmaps, &old_vm->node);
-
     /* new virtual allocation */
     u64 maplen = pad(new_size, vh->pagesize);
     u64 vnew = allocate_u64(vh, maplen);
@@ -158,6 +294,24 @@ sysreturn mremap(void *old_address, u64 old_size, u64 new_size, int flags, void
         goto unlock_out;
     }
 
+    /* fat pages can only move between 2M-congruent addresses; split
+       before touching the old vmap so that failure leaves it intact */
+    if ((vnew - old_addr) & MASK(PAGELOG_2M)) {
+        for (u64 v = old_addr & ~MASK(PAGELOG_2M); v < old_addr + old_size; v += PAGESIZE_2M) {
+            if (!split_fat_page(v, pages))
+                goto split_fail;
+        }
+    } else if (!split_huge_pages_at(irange(old_addr, old_addr + old_size))) {
+        goto split_fail;
+    }
+
+    /* remove old mapping, preserving attributes */
+    u64 vmflags = old_vm->flags;
+
+    /* we're moving the vmap to a new address region, so we can safely remove
+     * the old node entirely */
+    rangemap_remove_node(p->vmaps, &old_vm->node);
+
     /* create new vm with old attributes */
     vmap vm = allocate_vmap(p->vmaps, irange(vnew, vnew + maplen), vmflags);
     if (vm == INVALID_ADDRESS) {
@@ -197,6 +351,10 @@ sysreturn mremap(void *old_address, u64 old_size, u64 new_size, int flags, void
     zero(pointer_from_u64(vnew + old_size), dlen);
     vmap_unlock(p);
     return sysreturn_from_pointer(vnew);
+  split_fail:
+    msg_err("failed to split huge pages for move\n");
+    deallocate_u64(vh, vnew, maplen);
+    rv = -ENOMEM;
   unlock_out:
     vmap_unlock(p);
     return rv;
@@ -328,15 +486,15 @@ static void vmap_dump(rangemap pvmap)
 #endif
 
 /* XXX refactor */
-closure_function(3, 1, void, vmap_attribute_update_intersection,
-                 heap, h, rangemap, pvmap, vmap, q,
+closure_function(4, 1, void, vmap_attribute_update_intersection,
+                 heap, h, rangemap, pvmap, vmap, q, u64, mask,
                  rmnode, node)
 {
     rangemap pvmap = bound(pvmap);
     vmap q = bound(q);
 
     vmap match = (vmap)node;
-    if (vmap_attr_equal(q, match))
+    if ((match->flags & bound(mask)) == q->flags)
         return;
 
     range rn = node->r;
@@ -373,7 +531,7 @@ closure_function(3, 1, void, vmap_attribute_update_intersection,
 
     */
 
-    u64 newflags = (match->flags & ~(VMAP_FLAG_WRITABLE | VMAP_FLAG_EXEC)) | q->flags;
+    u64 newflags = (match->flags & ~bound(mask)) | q->flags;
 
     if (head) {
         u64 rtend = rn.end;
@@ -406,17 +564,16 @@ closure_function(3, 1, void, vmap_attribute_update_intersection,
     }
 }
 
-static void vmap_attribute_update(heap h, rangemap pvmap, vmap q)
+/* replace the flags in mask with those of q over the range of q */
+static void vmap_attribute_update(heap h, rangemap pvmap, vmap q, u64 mask)
 {
     range rq = q->node.r;
     assert((rq.start & MASK(PAGELOG)) == 0);
     assert((rq.end & MASK(PAGELOG)) == 0);
     assert(range_span(rq) > 0);
 
-    rmnode_handler nh = stack_closure(vmap_attribute_update_intersection, h, pvmap, q);
+    rmnode_handler nh = stack_closure(vmap_attribute_update_intersection, h, pvmap, q, mask);
     rangemap_range_lookup(pvmap, rq, nh);
-
-    update_map_flags(rq.start, range_span(rq), page_map_flags(q->flags));
 }
 
 sysreturn mprotect(void * addr, u64 len, int prot)
@@ -445,11 +602,126 @@ sysreturn mprotect(void * addr, u64 len, int prot)
 
     process p = current->p;
     vmap_lock(p);
-    vmap_attribute_update(h, p->vmaps, &q);
+    if (!split_huge_pages_at(r)) {
+        vmap_unlock(p);
+        return -ENOMEM;
+    }
+    vmap_attribute_update(h, p->vmaps, &q, VMAP_FLAG_WRITABLE | VMAP_FLAG_EXEC);
+    update_map_flags(r.start, range_span(r), page_map_flags(q.flags));
     vmap_unlock(p);
     return 0;
 }
 
+closure_function(1, 1, void, madvise_check_anonymous,
+                 boolean *, anonymous,
+                 rmnode, node)
+{
+    if (!vmap_is_anonymous((vmap)node))
+        *bound(anonymous) = false;
+}
+
+/* invoked with vmap lock taken */
+closure_function(2, 1, void, madvise_apply,
+                 range, q, int, advice,
+                 rmnode, node)
+{
+    vmap vm = (vmap)node;
+    range ri = range_intersection(bound(q), node->r);
+    if (!vmap_is_anonymous(vm))
+        return;
+
+    switch (bound(advice)) {
+    case MADV_DONTNEED:
+    case MADV_FREE:
+        /* return the pages now; the next touch faults in a zero page */
+        unmap_and_free_phys(ri.start, range_span(ri));
+        break;
+    case MADV_WILLNEED:
+        for (u64 v = ri.start; v < ri.end; v += PAGESIZE) {
+            if (physical_from_virtual(pointer_from_u64(v)) != INVALID_PHYSICAL)
+                continue;
+            if (!do_demand_page(v, vm))
+                return;         /* only a hint; leave the rest to fault */
+        }
+        break;
+    }
+}
+
+closure_function(0, 1, void, madvise_vmap_gap,
+                 range, r)
+{
+    thread_log(current, "   found gap [0x%lx, 0x%lx)", r.start, r.end);
+}
+
+static sysreturn madvise(void *addr, u64 len, int advice)
+{
+    thread_log(current, "madvise: addr %p, len 0x%lx, advice %d", addr, len, advice);
+
+    u64 where = u64_from_pointer(addr);
+    if (where & MASK(PAGELOG))
+        return -EINVAL;
+    if (len == 0)
+        return 0;
+    range r = irange(where, where + pad(len, PAGESIZE));
+
+    switch (advice) {
+    case MADV_NORMAL:
+    case MADV_RANDOM:
+    case MADV_SEQUENTIAL:
+    case MADV_DONTFORK:
+    case MADV_DOFORK:
+    case MADV_MERGEABLE:
+    case MADV_UNMERGEABLE:
+    case MADV_DONTDUMP:
+    case MADV_DODUMP:
+    case MADV_WILLNEED:
+    case MADV_DONTNEED:
+    case MADV_FREE:
+    case MADV_HUGEPAGE:
+    case MADV_NOHUGEPAGE:
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    process p = current->p;
+    heap h = heap_general(get_kernel_heaps());
+    if (advice == MADV_DONTNEED || advice == MADV_FREE)
+        zerocopy_unmap(r);
+    vmap_lock(p);
+    if (advice == MADV_FREE) {
+        boolean anonymous = true;
+        rangemap_range_lookup(p->vmaps, r, stack_closure(madvise_check_anonymous, &anonymous));
+        if (!anonymous) {
+            vmap_unlock(p);
+            return -EINVAL;
+        }
+    }
+    if ((advice == MADV_DONTNEED || advice == MADV_FREE) && !split_huge_pages_at(r)) {
+        vmap_unlock(p);
+        return -ENOMEM;
+    }
+
+    if (advice == MADV_HUGEPAGE || advice == MADV_NOHUGEPAGE) {
+        struct vmap q;
+        q.node.r = r;
+        q.flags = advice == MADV_HUGEPAGE ? VMAP_FLAG_HUGEPAGE : VMAP_FLAG_NOHUGEPAGE;
+        vmap_attribute_update(h, p->vmaps, &q, VMAP_FLAG_HUGEPAGE | VMAP_FLAG_NOHUGEPAGE);
+    } else if (advice == MADV_NORMAL || advice == MADV_RANDOM || advice == MADV_SEQUENTIAL) {
+        struct vmap q;
+        q.node.r = r;
+        q.flags = advice == MADV_RANDOM ? VMAP_FLAG_RANDOM : 0;
+        vmap_attribute_update(h, p->vmaps, &q, VMAP_FLAG_RANDOM);
+    } else {
+        rangemap_range_lookup(p->vmaps, r, stack_closure(madvise_apply, r, advice));
+    }
+
+    /* as on Linux, advice is applied to the mapped part of a range with holes */
+    boolean gaps = rangemap_range_find_gaps(p->vmaps, r, stack_closure(madvise_vmap_gap));
+    vmap_unlock(p);
+    return gaps ? -ENOMEM : 0;
+}
+
 /* If we can re-use a node (range is exact match), just update the
    flags. Otherwise trim back any vmap(s) that overlap with q,
    creating a new node if necessary. After this point, new nodes can
@@ -509,17 +781,19 @@ closure_function(3, 1, void, vmap_paint_gap,
     assert(mt != INVALID_ADDRESS);
 }
 
-static void vmap_paint(heap h, rangemap pvmap, vmap q)
+static boolean vmap_paint(heap h, rangemap pvmap, vmap q)
 {
     range rq = q->node.r;
     assert((rq.start & MASK(PAGELOG)) == 0);
     assert((rq.end & MASK(PAGELOG)) == 0);
     assert(range_span(rq) > 0);
 
+    if (!split_huge_pages_at(rq))
+        return false;
     rangemap_range_lookup(pvmap, rq, stack_closure(vmap_paint_intersection, h, pvmap, q));
     rangemap_range_find_gaps(pvmap, rq, stack_closure(vmap_paint_gap, h, pvmap, q));
-
     update_map_flags(rq.start, range_span(rq), page_map_flags(q->flags));
+    return true;
 }
 
 typedef struct varea {
@@ -544,23 +818,31 @@ static varea allocate_varea(heap h, rangemap vareas, range r, id_heap vh, boolea
 }
 
 /* XXX defaulting to leniency; revisit */
-static boolean mmap_reserve_range(process p, range q)
+static boolean mmap_fixed_allowed(process p, range q)
 {
     /* XXX can tweak rangemap range lookup to terminate if a callback
        fails...kind of tired of messing with that interface */
     varea a = (varea)rangemap_first_node(p->vareas);
     while (a != INVALID_ADDRESS) {
-        if (ranges_intersect(q, a->node.r)) {
-            if (!a->allow_fixed)
-                return false;
-            if (a->h)
-                id_heap_set_area(a->h, q.start, range_span(q), false, true);
-        }
+        if (ranges_intersect(q, a->node.r) && !a->allow_fixed)
+            return false;
         a = (varea)rangemap_next_node(p->vareas, (rmnode)a);
     }
     return true;
 }
 
+static void mmap_reserve_range(process p, range q)
+{
+    varea a = (varea)rangemap_first_node(p->vareas);
+    while (a != INVALID_ADDRESS) {
+        if (ranges_intersect(q, a->node.r) && a->h)
+            id_heap_set_area(a->h, q.start, range_span(q), false, true);
+        a = (varea)rangemap_next_node(p->vareas, (rmnode)a);
+    }
+}
+
+static boolean process_unmap_range(process p, range q);
+
 static sysreturn mmap(void *target, u64 size, int prot, int flags, int fd, u64 offset)
 {
     process p = current->p;
@@ -579,6 +861,20 @@ static sysreturn mmap(void *target, u64 size, int prot, int flags, int fd, u64 o
     if ((prot & PROT_WRITE))
         vmflags |= VMAP_FLAG_WRITABLE;
 
+    /* Kernel objects which export their own pages (io_uring rings)
+       supply the physical backing directly. */
+    fdesc desc = 0;
+    u64 prealloc_phys = INVALID_PHYSICAL;
+    if (!(flags & MAP_ANONYMOUS)) {
+        desc = resolve_fd(p, fd);
+        if (desc->type == FDESC_TYPE_IORING) {
+            sysreturn rv = io_uring_mmap(desc, len, offset, &prealloc_phys);
+            if (rv < 0)
+                return rv;
+            vmflags |= VMAP_FLAG_PREALLOC;
+        }
+    }
+
     /* Don't really try to honor a hint, only fixed. */
     boolean fixed = (flags & MAP_FIXED) != 0;
     u64 where = fixed ? u64_from_pointer(target) : 0;
@@ -598,10 +894,17 @@ static sysreturn mmap(void *target, u64 size, int prot, int flags, int fd, u64 o
         /* A specified address is only allowed in certain areas. Programs may specify
            a fixed address to augment some existing mapping. */
         range q = irange(where, where + len);
-        if (!mmap_reserve_range(p, q)) {
+        if (!mmap_fixed_allowed(p, q)) {
 	    thread_log(current, "   fail: fixed address range %R outside of lowmem or virtual_page heap\n", q);
 	    return -ENOMEM;
         }
+
+        /* Tear down any existing mappings as munmap would, so that
+           pages owned by a kernel object are unmapped rather than
+           freed or zeroed, before the range is repainted. */
+        if (!process_unmap_range(p, q))
+            return -ENOMEM;
+        mmap_reserve_range(p, q);
     }
 
     /* Allocate from virtual heap if no address specified or hint unavailable */
@@ -626,17 +929,23 @@ static sysreturn mmap(void *target, u64 size, int prot, int flags, int fd, u64 o
     q.flags = vmflags;
     q.node.r = irange(where, where + len);
     vmap_lock(p);
-    vmap_paint(h, p->vmaps, &q);
+    boolean painted = vmap_paint(h, p->vmaps, &q);
     vmap_unlock(p);
+    if (!painted)
+        return -ENOMEM;
 
     if (flags & MAP_ANONYMOUS) {
         thread_log(current, "   anon target: 0x%lx, len: 0x%lx (given size: 0x%lx)", where, len, size);
-        /* If mmap this intersects an existing one, zero any mapped pages. */
-        zero_mapped_pages(where, len);
         return where;
     }
 
-    file f = resolve_fd(p, fd);
+    if (vmflags & VMAP_FLAG_PREALLOC) {
+        thread_log(current, "   prealloc target: 0x%lx, len: 0x%lx", where, len);
+        map(where, prealloc_phys, len, page_map_flags(vmflags), heap_pages(kh));
+        return where;
+    }
+
+    file f = (file)desc;
     u64 flen = MIN(pad(f->length, PAGESIZE), len);
     heap mh = heap_backed(kh);
     buffer b = allocate_buffer(mh, pad(flen, mh->pagesize));
@@ -661,6 +970,7 @@ closure_function(2, 1, void, process_unmap_intersection,
     /* similar logic to attribute update above */
     boolean head = ri.start > rn.start;
     boolean tail = ri.end < rn.end;
+    boolean prealloc = (match->flags & VMAP_FLAG_PREALLOC) != 0;
 
 //    rprintf("unmap q %R, node %R, head %d, tail %d\n", bound(rq), node->r, head, tail);
 
@@ -686,9 +996,13 @@ closure_function(2, 1, void, process_unmap_intersection,
         rangemap_remove_node(p->vmaps, node);
     }
 
-    /* unmap any mapped pages and return to physical heap */
+    /* unmap any mapped pages and return to physical heap, unless the
+       pages belong to a kernel object */
     u64 len = range_span(ri);
-    unmap_and_free_phys(ri.start, len);
+    if (prealloc)
+        unmap(ri.start, len, heap_pages(get_kernel_heaps()));
+    else
+        unmap_and_free_phys(ri.start, len);
 
     /* return virtual mapping to heap, if any ... assuming a vmap cannot span heaps!
        XXX: this shouldn't be a lookup per, so consider stashing a link to varea or heap in vmap
@@ -699,12 +1013,19 @@ closure_function(2, 1, void, process_unmap_intersection,
         id_heap_set_area(v->h, ri.start, len, false, false);
 }
 
-static void process_unmap_range(process p, range q)
+/* unmap and release everything mapped in q, honoring PREALLOC */
+static boolean process_unmap_range(process p, range q)
 {
+    zerocopy_unmap(q);
     vmap_lock(p);
+    if (!split_huge_pages_at(q)) {
+        vmap_unlock(p);
+        return false;
+    }
     rmnode_handler nh = stack_closure(process_unmap_intersection, p, q);
     rangemap_range_lookup(p->vmaps, q, nh);
     vmap_unlock(p);
+    return true;
 }
 
 static sysreturn munmap(void *addr, u64 length)
@@ -720,8 +1041,42 @@ static sysreturn munmap(void *addr, u64 length)
     range q = irange(where, where + padlen);
 
     /* clear out any mapped areas in our meta */
-    process_unmap_range(p, q);
-    return 0;
+    return process_unmap_range(p, q) ? 0 : -ENOMEM;
+}
+
+/* collects runs of pages mapping [phys, phys + len) into found */
+closure_function(3, 1, void, prealloc_find,
+                 u64, phys, u64, len, buffer, found,
+                 vmap, vm)
+{
+    buffer found = bound(found);
+    if (!(vm->flags & VMAP_FLAG_PREALLOC))
+        return;
+    for (u64 v = vm->node.r.start; v < vm->node.r.end; v += PAGESIZE) {
+        physical pa = physical_from_virtual(pointer_from_u64(v));
+        if (pa == INVALID_PHYSICAL || pa < bound(phys) || pa >= bound(phys) + bound(len))
+            continue;
+        range *last = buffer_length(found) ? buffer_ref(found, buffer_length(found) - sizeof(range)) : 0;
+        if (last && last->end == v) {
+            last->end += PAGESIZE;
+        } else {
+            range r = irange(v, v + PAGESIZE);
+            buffer_write(found, &r, sizeof(range));
+        }
+    }
+}
+
+/* Remove any user mappings of the given kernel-owned pages; used when
+   the owning object is destroyed while the process still maps them. */
+void unmap_prealloc(process p, u64 phys, u64 len)
+{
+    buffer found = allocate_buffer(heap_general(get_kernel_heaps()), 4 * sizeof(range));
+    assert(found != INVALID_ADDRESS);
+    vmap_iterator(p, stack_closure(prealloc_find, phys, len, found));
+    range r;
+    while (buffer_read(found, &r, sizeof(range)))
+        process_unmap_range(p, r);
+    deallocate_buffer(found);
 }
 
 /* kernel start */
@@ -737,10 +1092,23 @@ static void add_varea(process p, u64 start, u64 end, id_heap vheap, boolean allo
         id_heap_set_area(vheap, start, end - start, true, true);
 }
 
-void mmap_process_init(process p)
+void mmap_process_init(process p, tuple root)
 {
     kernel_heaps kh = &p->uh->kh;
     heap h = heap_general(kh);
+    value thp = table_find(root, sym(transparent_hugepage));
+    if (thp && buffer_compare_with_cstring(thp, "never"))
+        p->thp_mode = THP_NEVER;
+    else if (thp && buffer_compare_with_cstring(thp, "madvise"))
+        p->thp_mode = THP_MADVISE;
+    else
+        p->thp_mode = THP_ALWAYS;
+    value fa = table_find(root, sym(fault_around_pages));
+    u64 pages;
+    if (fa && u64_from_value(fa, &pages) && pages > 0)
+        p->fault_around_pages = U64_FROM_BIT(msb(MIN(pages, FAULT_AROUND_MAX)));
+    else
+        p->fault_around_pages = FAULT_AROUND_DEFAULT;
     range identity_map = irange(kh->identity_reserved_start, kh->identity_reserved_end);
     spin_lock_init(&p->vmap_lock);
     p->vareas = allocate_rangemap(h);
@@ -806,5 +1174,5 @@ void register_mmap_syscalls(struct syscall *map)
     register_syscall(map, mremap, mremap);
     register_syscall(map, munmap, munmap);
     register_syscall(map, mprotect, mprotect);
-    register_syscall(map, madvise, syscall_ignore);
+    register_syscall(map, madvise, madvise);
 }
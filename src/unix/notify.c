@@ -3,6 +3,7 @@
 struct notify_entry {
     u64 eventmask;
     event_handler eh;
+    boolean exclusive;
     struct list l;
 };
 
@@ -37,6 +38,7 @@ notify_entry notify_add(notify_set s, u64 eventmask, event_handler eh)
         return n;
     n->eventmask = eventmask;
     n->eh = eh;
+    n->exclusive = false;
     /* XXX take mutex */
     list_insert_before(&s->entries, &n->l);
     /* XXX release mutex */
@@ -51,6 +53,11 @@ void notify_remove(notify_set s, notify_entry e, boolean release)
     deallocate(s->h, e, sizeof(struct notify_entry));
 }
 
+void notify_entry_set_exclusive(notify_entry n)
+{
+    n->exclusive = true;
+}
+
 // XXX poll waiters too
 void notify_entry_update_eventmask(notify_entry n, u64 eventmask)
 {
@@ -70,8 +77,11 @@ u64 notify_get_eventmask_union(notify_set s)
     return u;
 }
 
+/* Exclusive entries (EPOLLEXCLUSIVE) are dispatched only until one of
+   them wakes a waiter; the others are always dispatched. */
 void notify_dispatch_for_thread(notify_set s, u64 events, thread t)
 {
+    boolean exclusive_woken = false;
     /* XXX take mutex */
     list_foreach(&s->entries, l) {
         notify_entry n = struct_from_list(l, notify_entry, l);
@@ -79,7 +89,13 @@ void notify_dispatch_for_thread(notify_set s, u64 events, thread t)
         /* no guarantee that a transition is represented here; event
            handler needs to keep track itself if edge trigger is used */
         assert(n->eh);
-        apply(n->eh, events & n->eventmask, t);
+        if (n->exclusive) {
+            if (exclusive_woken)
+                continue;
+            exclusive_woken = apply(n->eh, events & n->eventmask, t);
+        } else {
+            apply(n->eh, events & n->eventmask, t);
+        }
     }
     /* XXX release mutex */
 }
@@ -2,8 +2,9 @@ typedef struct notify_set *notify_set;
 typedef struct notify_entry *notify_entry;
 
 /* notify handlers receive event changes, including falling edges,
-   which are relevant only for waiters on thread t if t is nonzero */
-typedef closure_type(event_handler, void, u64 events, thread t);
+   which are relevant only for waiters on thread t if t is nonzero;
+   they return true if a waiter was woken */
+typedef closure_type(event_handler, boolean, u64 events, thread t);
 
 /* NOTIFY_EVENTS_RELEASE is a special value of events to signal to the
    event_handler that a notify_set is being deallocated.
@@ -19,6 +20,8 @@ notify_entry notify_add(notify_set s, u64 eventmask, event_handler eh);
 
 void notify_remove(notify_set s, notify_entry e, boolean release);
 
+void notify_entry_set_exclusive(notify_entry n);
+
 void notify_entry_update_eventmask(notify_entry n, u64 eventmask);
 
 u64 notify_get_eventmask_union(notify_set s);
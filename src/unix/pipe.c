@@ -7,8 +7,9 @@
 #define pipe_debug(x, ...)
 #endif
 
-#define INITIAL_PIPE_DATA_SIZE  100
 #define DEFAULT_PIPE_MAX_SIZE   (16 * PAGESIZE) /* see pipe(7) */
+#define PIPE_MAX_SIZE           (1024 * KB)     /* as /proc/sys/fs/pipe-max-size */
+#define PIPE_INITIAL_BUFS       16      /* ring size; grows as needed */
 #define PIPE_READ               0
 #define PIPE_WRITE              1
 
@@ -23,24 +24,46 @@ struct pipe_file {
     blockq bq;
 };
 
+/* Pipe data is held in a ring of page references (sg_bufs). A buffer
+   either refers to a page allocated by the pipe and filled by write(),
+   or is lent by a splice source - a pagecache page, a received pbuf or
+   another pipe's buffer - and pinned by the source's refcount. Splices
+   move these references between pipes and to sg_write methods rather
+   than copying the data. Capacity is accounted in bytes; the ring is
+   grown if many small lent buffers outnumber its slots.
+
+   Small writes are batched into the free part of the tail page while
+   it is not shared. A page drained by the reader is kept as a spare
+   for the next write, so a streaming pipe cycles between a few pages
+   without allocating. */
 struct pipe {
     struct pipe_file files[2];
     process proc;
     heap h;
+    heap backed;
     u64 ref_cnt;
-    u64 max_size;               /* XXX: can change with F_SETPIPE_SZ */
-    buffer data;
+    u64 max_size;               /* capacity, set with F_SETPIPE_SZ */
+    u64 length;                 /* bytes buffered */
+    u64 reserved;               /* space claimed by splices in progress */
+    struct sg_buf *bufs;
+    u32 nbufs;                  /* ring size, a power of 2 */
+    u32 head, tail;             /* free running ring indices */
+    struct pipe_page *spare;    /* last drained page, kept for reuse */
 };
 
-#define BUFFER_DEBUG(BUF,LENGTH) do { \
-    pipe_debug("%s:%d - requested %d -- contents %p start/end %d/%d  -- len %d %d\n", \
-        __func__, __LINE__, \
-        (LENGTH), \
-        (BUF)->contents, \
-        (BUF)->start, \
-        (BUF)->end, \
-        (BUF)->length, buffer_length((BUF))); \
-} while(0)
+#define PIPE_BUF_OWNED  1       /* sg_buf misc: a pipe_page */
+
+typedef struct pipe_page *pipe_page;
+
+declare_closure_struct(1, 0, void, pipe_page_free,
+                       pipe_page, pp);
+
+struct pipe_page {
+    struct refcount refcount;   /* must be first */
+    void *data;
+    heap h, backed;
+    closure_struct(pipe_page_free, free);
+};
 
 boolean pipe_init(unix_heaps uh)
 {
@@ -51,6 +74,223 @@ boolean pipe_init(unix_heaps uh)
     return (uh->pipe_cache == INVALID_ADDRESS ? false : true);
 }
 
+define_closure_function(1, 0, void, pipe_page_free,
+                        pipe_page, pp)
+{
+    pipe_page pp = bound(pp);
+    deallocate(pp->backed, pp->data, PAGESIZE);
+    deallocate(pp->h, pp, sizeof(struct pipe_page));
+}
+
+static pipe_page pipe_page_alloc(pipe p)
+{
+    pipe_page pp = p->spare;
+    if (pp) {
+        p->spare = 0;
+        return pp;
+    }
+    pp = allocate(p->h, sizeof(struct pipe_page));
+    if (pp == INVALID_ADDRESS)
+        return pp;
+    pp->data = allocate(p->backed, PAGESIZE);
+    if (pp->data == INVALID_ADDRESS) {
+        deallocate(p->h, pp, sizeof(struct pipe_page));
+        return INVALID_ADDRESS;
+    }
+    pp->h = p->h;
+    pp->backed = p->backed;
+    init_refcount(&pp->refcount, 1, init_closure(&pp->free, pipe_page_free, pp));
+    return pp;
+}
+
+static inline sg_buf pipe_buf(pipe p, u32 i)
+{
+    return &p->bufs[i & (p->nbufs - 1)];
+}
+
+static inline boolean pipe_ring_full(pipe p)
+{
+    return p->tail - p->head == p->nbufs;
+}
+
+static inline u64 pipe_space(pipe p)
+{
+    u64 used = p->length + p->reserved;
+    return used < p->max_size ? p->max_size - used : 0;
+}
+
+static boolean pipe_resize_ring(pipe p, u32 nbufs)
+{
+    u32 used = p->tail - p->head;
+    sg_buf bufs = allocate(p->h, nbufs * sizeof(struct sg_buf));
+    if (bufs == INVALID_ADDRESS)
+        return false;
+    for (u32 i = 0; i < used; i++)
+        bufs[i] = *pipe_buf(p, p->head + i);
+    deallocate(p->h, p->bufs, p->nbufs * sizeof(struct sg_buf));
+    p->bufs = bufs;
+    p->nbufs = nbufs;
+    p->head = 0;
+    p->tail = used;
+    return true;
+}
+
+static inline boolean pipe_grow(pipe p)
+{
+    return pipe_resize_ring(p, p->nbufs * 2);
+}
+
+/* release a drained buffer, keeping an unshared pipe page as spare */
+static void pipe_buf_drained(pipe p, sg_buf b)
+{
+    if (!p->spare && (b->misc & PIPE_BUF_OWNED) && b->refcount->c == 1)
+        p->spare = (pipe_page)b->refcount;
+    else
+        sg_buf_release(b);
+}
+
+/* append a buffer, taking over the caller's reference */
+static boolean pipe_push(pipe p, void *buf, u32 length, refcount r, u32 flags)
+{
+    if (pipe_ring_full(p) && !pipe_grow(p))
+        return false;
+    sg_buf b = pipe_buf(p, p->tail);
+    b->buf = buf;
+    b->length = length;
+    b->misc = flags;
+    b->refcount = r;
+    p->tail++;
+    p->length += length;
+    return true;
+}
+
+/* return buffers taken for a splice but not written back to the head */
+static void pipe_unget_sg(pipe p, sg_list sg)
+{
+    sg_buf bufs = buffer_ref(sg->b, 0);
+    for (u64 n = buffer_length(sg->b) / sizeof(struct sg_buf); n > 0; n--) {
+        sg_buf b = &bufs[n - 1];
+        if (pipe_ring_full(p) && !pipe_grow(p)) {
+            msg_err("failed to grow pipe ring; dropping %d bytes\n", b->length);
+            sg_buf_release(b);
+            continue;
+        }
+        p->head--;
+        *pipe_buf(p, p->head) = *b;
+        p->length += b->length;
+    }
+    buffer_clear(sg->b);
+    sg->count = 0;
+}
+
+/* room remaining in the tail page if it is ours and not shared */
+static u64 pipe_tail_room(pipe p)
+{
+    if (p->head == p->tail)
+        return 0;
+    sg_buf b = pipe_buf(p, p->tail - 1);
+    if (!(b->misc & PIPE_BUF_OWNED) || b->refcount->c != 1)
+        return 0;
+    pipe_page pp = (pipe_page)b->refcount;
+    return pp->data + PAGESIZE - (b->buf + b->length);
+}
+
+static u64 pipe_copy_in(pipe p, void *src, u64 length)
+{
+    u64 done = MIN(pipe_tail_room(p), length);
+    if (done > 0) {
+        sg_buf b = pipe_buf(p, p->tail - 1);
+        runtime_memcpy(b->buf + b->length, src, done);
+        b->length += done;
+        p->length += done;
+    }
+    while (done < length) {
+        pipe_page pp = pipe_page_alloc(p);
+        if (pp == INVALID_ADDRESS)
+            break;
+        u64 n = MIN(PAGESIZE, length - done);
+        runtime_memcpy(pp->data, src + done, n);
+        if (!pipe_push(p, pp->data, n, &pp->refcount, PIPE_BUF_OWNED)) {
+            refcount_release(&pp->refcount);
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static u64 pipe_copy_out(pipe p, void *dest, u64 length)
+{
+    u64 done = 0;
+    while (done < length && p->head != p->tail) {
+        sg_buf b = pipe_buf(p, p->head);
+        u64 n = MIN(b->length, length - done);
+        runtime_memcpy(dest + done, b->buf, n);
+        b->buf += n;
+        b->length -= n;
+        p->length -= n;
+        if (b->length == 0) {
+            p->head++;
+            pipe_buf_drained(p, b);
+        }
+        done += n;
+    }
+    return done;
+}
+
+/* move references to up to length bytes from the head onto sg */
+static u64 pipe_take(pipe p, sg_list sg, u64 length)
+{
+    u64 done = 0;
+    while (done < length && p->head != p->tail) {
+        sg_buf b = pipe_buf(p, p->head);
+        u64 n = MIN(b->length, length - done);
+        sg_buf sgb = sg_list_tail_add(sg, n);
+        *sgb = *b;
+        sgb->length = n;
+        if (n < b->length) {
+            /* remainder stays in the pipe */
+            refcount_reserve(b->refcount);
+            b->buf += n;
+            b->length -= n;
+        } else {
+            p->head++;
+        }
+        p->length -= n;
+        done += n;
+    }
+    return done;
+}
+
+/* Reference up to length bytes at the head of in from the tail of
+   out. With consume (splice) the data leaves in, otherwise (tee) it
+   remains there too. */
+static u64 pipe_link(pipe in, pipe out, u64 length, boolean consume)
+{
+    u64 done = 0;
+    for (u32 i = in->head; done < length && i != in->tail; i++) {
+        sg_buf b = pipe_buf(in, i);
+        u64 n = MIN(b->length, length - done);
+        boolean move = consume && n == b->length;
+        if (!move)
+            refcount_reserve(b->refcount);
+        if (!pipe_push(out, b->buf, n, b->refcount, b->misc)) {
+            if (!move)
+                refcount_release(b->refcount);
+            break;
+        }
+        if (consume) {
+            b->buf += n;
+            b->length -= n;
+            in->length -= n;
+            if (move)
+                in->head++;
+        }
+        done += n;
+    }
+    return done;
+}
+
 static inline void pipe_notify_reader(pipe_file pf, int events)
 {
     pipe_file read_pf = &pf->pipe->files[PIPE_READ];
@@ -75,6 +315,22 @@ static inline void pipe_notify_writer(pipe_file pf, int events)
     }
 }
 
+/* data was removed from the pipe */
+static void pipe_drained(pipe_file pf)
+{
+    pipe_notify_writer(pf, EPOLLOUT);
+    if (pf->pipe->length == 0)
+        notify_dispatch(pf->pipe->files[PIPE_READ].f.ns, 0); /* for edge trigger */
+}
+
+/* data was added to the pipe */
+static void pipe_filled(pipe_file pf)
+{
+    if (pipe_space(pf->pipe) == 0)
+        notify_dispatch(pf->pipe->files[PIPE_WRITE].f.ns, 0); /* for edge trigger */
+    pipe_notify_reader(pf, EPOLLIN);
+}
+
 static void pipe_file_release(pipe_file pf)
 {
     release_fdesc(&(pf->f));
@@ -97,8 +353,13 @@ static void pipe_release(pipe p)
 {
     if (!p->ref_cnt || (fetch_and_add(&p->ref_cnt, -1) == 1)) {
         pipe_debug("%s(%p): deallocating pipe\n", __func__, p);
-        if (p->data != INVALID_ADDRESS)
-            deallocate_buffer(p->data);
+        if (p->bufs != INVALID_ADDRESS) {
+            while (p->head != p->tail)
+                sg_buf_release(pipe_buf(p, p->head++));
+            deallocate(p->h, p->bufs, p->nbufs * sizeof(struct sg_buf));
+        }
+        if (p->spare)
+            refcount_release(&p->spare->refcount);
 
         pipe_file_release(&(p->files[PIPE_READ]));
         pipe_file_release(&(p->files[PIPE_WRITE]));
@@ -148,10 +409,10 @@ closure_function(5, 1, sysreturn, pipe_read_bh,
         goto out;
     }
 
-    buffer b = pf->pipe->data;
-    rv = MIN(buffer_length(b), bound(length));
-    if (rv == 0) {
-        if (pf->pipe->files[PIPE_WRITE].fd == -1)
+    pipe p = pf->pipe;
+    if (p->length == 0) {
+        rv = 0;
+        if (p->files[PIPE_WRITE].fd == -1)
             goto out;
         if (pf->f.flags & O_NONBLOCK) {
             rv = -EAGAIN;
@@ -160,15 +421,8 @@ closure_function(5, 1, sysreturn, pipe_read_bh,
         return BLOCKQ_BLOCK_REQUIRED;
     }
 
-    buffer_read(b, bound(dest), rv);
-    pipe_notify_writer(pf, EPOLLOUT);
-
-    // If we have consumed all of the buffer, reset it. This might prevent future writes to allocte new buffer
-    // in buffer_write/buffer_extend. Can improve things until a proper circular buffer is available
-    if (buffer_length(b) == 0) {
-        buffer_clear(b);
-        notify_dispatch(pf->f.ns, 0); /* for edge trigger */
-    }
+    rv = pipe_copy_out(p, bound(dest), bound(length));
+    pipe_drained(pf);
   out:
     blockq_handle_completion(pf->bq, flags, bound(completion), bound(t), rv);
     closure_finish();
@@ -203,8 +457,7 @@ closure_function(5, 1, sysreturn, pipe_write_bh,
 
     u64 length = bound(length);
     pipe p = pf->pipe;
-    buffer b = p->data;
-    u64 avail = p->max_size - buffer_length(b);
+    u64 avail = pipe_space(p);
 
     if (avail == 0) {
         if (pf->pipe->files[PIPE_READ].fd == -1) {
@@ -218,14 +471,12 @@ closure_function(5, 1, sysreturn, pipe_write_bh,
         return BLOCKQ_BLOCK_REQUIRED;
     }
 
-    u64 real_length = MIN(length, avail);
-    buffer_write(b, bound(dest), real_length);
-    if (avail == length)
-        notify_dispatch(pf->f.ns, 0); /* for edge trigger */
-
-    pipe_notify_reader(pf, EPOLLIN);
-
-    rv = real_length;
+    rv = pipe_copy_in(p, bound(dest), MIN(length, avail));
+    if (rv == 0) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    pipe_filled(pf);
   out:
     blockq_handle_completion(pf->bq, flags, bound(completion), bound(t), rv);
     closure_finish();
@@ -251,7 +502,7 @@ closure_function(1, 1, u32, pipe_read_events,
 {
     pipe_file pf = bound(pf);
     assert(pf->f.read);
-    u32 events = buffer_length(pf->pipe->data) ? EPOLLIN : 0;
+    u32 events = pf->pipe->length ? EPOLLIN : 0;
     if (pf->pipe->files[PIPE_WRITE].fd == -1)
         events |= EPOLLIN | EPOLLHUP;
     return events;
@@ -263,12 +514,421 @@ closure_function(1, 1, u32, pipe_write_events,
 {
     pipe_file pf = bound(pf);
     assert(pf->f.write);
-    u32 events = buffer_length(pf->pipe->data) < pf->pipe->max_size ? EPOLLOUT : 0;
+    u32 events = pipe_space(pf->pipe) ? EPOLLOUT : 0;
     if (pf->pipe->files[PIPE_READ].fd == -1)
         events |= EPOLLHUP;
     return events;
 }
 
+/* F_GETPIPE_SZ */
+sysreturn pipe_get_capacity(fdesc f)
+{
+    return ((pipe_file)f)->pipe->max_size;
+}
+
+/* F_SETPIPE_SZ: capacity is rounded up to a power of 2 pages */
+sysreturn pipe_set_capacity(fdesc f, s64 capacity)
+{
+    pipe p = ((pipe_file)f)->pipe;
+    if (capacity < 0)
+        return -EINVAL;
+    if (capacity > PIPE_MAX_SIZE)
+        return -EPERM;
+    u64 npages = capacity < PAGESIZE ? 1 : pad(capacity, PAGESIZE) / PAGESIZE;
+    u64 size = U64_FROM_BIT(find_order(npages)) * PAGESIZE;
+    if (size < p->length + p->reserved)
+        return -EBUSY;
+    u32 nbufs = size / PAGESIZE;
+    if (nbufs > p->nbufs && !pipe_resize_ring(p, nbufs))
+        return -ENOMEM;
+    boolean grown = size > p->max_size;
+    p->max_size = size;
+    pipe_debug("%s(%p): capacity %ld\n", __func__, p, size);
+    if (grown)
+        pipe_notify_writer(&p->files[PIPE_WRITE], EPOLLOUT);
+    return size;
+}
+
+/* Splice and tee
+
+   The calling thread waits on the pipe end's blockq for data (pipe
+   input) or space (pipe output), then the operation moves buffer
+   references: between two pipes directly, from the pipe to the
+   output's sg_write method (TCP transmits the pages in place), or
+   into the pipe from the input's sg_read method (pagecache pages,
+   received pbufs). Other descriptors are written from, or read into,
+   the pipe's buffers. All steps are issued in bottom-half mode and
+   the syscall sleeps until the final completion. */
+
+typedef struct splice_op {
+    heap h;
+    thread t;
+    pipe_file in, out;          /* pipe ends, if pipes */
+    fdesc fin, fout;
+    s64 *off_in, *off_out;
+    u64 len;
+    u64 n;                      /* bytes taken from or claimed in the pipe */
+    u64 done;
+    boolean nonblock;
+    boolean tee;
+    boolean issuing, completed;
+    sysreturn result;
+    blockq bq;                  /* queue currently waited on */
+    sg_list sg;
+    pipe_page pp;               /* page for a copying read */
+    io_completion io_done;
+} *splice_op;
+
+static void splice_written(splice_op op, sysreturn rv);
+static void splice_read_done(splice_op op, sysreturn rv);
+
+static void splice_op_free(splice_op op)
+{
+    if (op->in)
+        pipe_release(op->in->pipe);
+    if (op->out)
+        pipe_release(op->out->pipe);
+    if (op->sg != INVALID_ADDRESS) {
+        sg_list_release(op->sg);
+        deallocate_sg_list(op->sg);
+    }
+    if (op->io_done)
+        deallocate_closure(op->io_done);
+    deallocate(op->h, op, sizeof(struct splice_op));
+}
+
+static void splice_done(splice_op op, sysreturn rv)
+{
+    thread t = op->t;
+    splice_op_free(op);
+    apply(syscall_io_complete, t, rv);
+}
+
+closure_function(1, 2, void, splice_io_done,
+                 splice_op, op,
+                 thread, t, sysreturn, rv)
+{
+    splice_op op = bound(op);
+    if (op->issuing) {
+        op->completed = true;
+        op->result = rv;
+        return;
+    }
+    if (op->in)
+        splice_written(op, rv);
+    else
+        splice_read_done(op, rv);
+}
+
+static inline u64 splice_offset(s64 *off, u64 done)
+{
+    return off ? *off + done : infinity;
+}
+
+static inline void splice_issue_begin(splice_op op)
+{
+    op->issuing = true;
+    op->completed = false;
+}
+
+/* direct return, with or without a completion */
+static inline boolean splice_issue_end(splice_op op, sysreturn *rv)
+{
+    op->issuing = false;
+    if (op->completed)
+        *rv = op->result;
+    return op->completed || *rv != SYSRETURN_CONTINUE_BLOCKING;
+}
+
+static void splice_write(splice_op op)
+{
+    sysreturn rv;
+    u64 offset = splice_offset(op->off_out, op->done);
+    splice_issue_begin(op);
+    if (op->fout->sg_write) {
+        rv = apply(op->fout->sg_write, op->sg, op->n - op->done, offset,
+                   op->t, true, op->io_done);
+    } else {
+        sg_buf sgb = buffer_ref(op->sg->b, 0);
+        rv = apply(op->fout->write, sgb->buf, sgb->length, offset,
+                   op->t, true, op->io_done);
+    }
+    if (splice_issue_end(op, &rv))
+        splice_written(op, rv);
+}
+
+static void splice_written(splice_op op, sysreturn rv)
+{
+    if (rv > 0) {
+        if (!op->fout->sg_write) {
+            sg_buf sgb = buffer_ref(op->sg->b, 0);
+            if (rv < sgb->length) {
+                sgb->buf += rv;
+                sgb->length -= rv;
+                fetch_and_add(&op->sg->count, -rv);
+            } else {
+                sg_buf_release(sg_list_head_remove(op->sg));
+            }
+        }
+        op->done += rv;
+        if (op->done < op->n) {
+            splice_write(op);
+            return;
+        }
+    }
+
+    pipe_file pf = op->in;
+    pipe p = pf->pipe;
+    p->reserved -= op->n;
+    pipe_unget_sg(p, op->sg);
+    if (op->done > 0) {
+        if (op->off_out)
+            *op->off_out += op->done;
+        pipe_drained(pf);
+        rv = op->done;
+    }
+    if (p->length > 0)
+        pipe_notify_reader(pf, EPOLLIN);
+    splice_done(op, rv);
+}
+
+static void splice_read(splice_op op)
+{
+    sysreturn rv;
+    u64 offset = splice_offset(op->off_in, 0);
+    if (op->fin->sg_read) {
+        splice_issue_begin(op);
+        rv = apply(op->fin->sg_read, op->sg, op->n, offset, op->t, true, op->io_done);
+    } else {
+        op->pp = pipe_page_alloc(op->out->pipe);
+        if (op->pp == INVALID_ADDRESS) {
+            op->pp = 0;
+            splice_read_done(op, -ENOMEM);
+            return;
+        }
+        splice_issue_begin(op);
+        rv = apply(op->fin->read, op->pp->data, MIN(op->n, PAGESIZE), offset,
+                   op->t, true, op->io_done);
+    }
+    if (splice_issue_end(op, &rv))
+        splice_read_done(op, rv);
+}
+
+static void splice_read_done(splice_op op, sysreturn rv)
+{
+    pipe_file pf = op->out;
+    pipe p = pf->pipe;
+    p->reserved -= op->n;
+    if (op->pp) {
+        if (rv <= 0 || !pipe_push(p, op->pp->data, rv, &op->pp->refcount, PIPE_BUF_OWNED)) {
+            refcount_release(&op->pp->refcount);
+            if (rv > 0)
+                rv = -ENOMEM;
+        }
+        op->pp = 0;
+    } else {
+        u64 pushed = 0;
+        sg_buf sgb;
+        while ((sgb = sg_list_head_remove(op->sg)) != INVALID_ADDRESS) {
+            if (sgb->length > 0 && pipe_push(p, sgb->buf, sgb->length, sgb->refcount, 0))
+                pushed += sgb->length;
+            else
+                sg_buf_release(sgb);
+        }
+        if (rv > 0)
+            rv = pushed > 0 ? pushed : -ENOMEM;
+    }
+    if (rv > 0) {
+        if (op->off_in)
+            *op->off_in += rv;
+        pipe_filled(pf);
+    } else if (pipe_space(p) > 0) {
+        pipe_notify_writer(pf, EPOLLOUT);   /* release the claimed space */
+    }
+    splice_done(op, rv);
+}
+
+closure_function(1, 1, sysreturn, splice_bh,
+                 splice_op, op,
+                 u64, flags)
+{
+    splice_op op = bound(op);
+    blockq bq = op->bq;
+    thread t = op->t;
+    blockq wait = 0;
+    sysreturn rv;
+
+    if (flags & BLOCKQ_ACTION_NULLIFY) {
+        rv = -EINTR;
+        goto out;
+    }
+
+    if (op->in && op->in->pipe->length == 0) {
+        rv = 0;
+        if (op->in->pipe->files[PIPE_WRITE].fd == -1)
+            goto out;
+        wait = op->in->bq;
+    } else if (op->out && pipe_space(op->out->pipe) == 0) {
+        rv = -EPIPE;
+        if (op->out->pipe->files[PIPE_READ].fd == -1)
+            goto out;
+        wait = op->out->bq;
+    }
+    if (wait) {
+        if (op->nonblock) {
+            rv = -EAGAIN;
+            goto out;
+        }
+        if (wait == bq)
+            return BLOCKQ_BLOCK_REQUIRED;
+        /* wait on the other end's queue instead */
+        op->bq = wait;
+        blockq_check(wait, t, (blockq_action)closure_self(), true);
+        return 0;
+    }
+    closure_finish();
+
+    /* Leaving the blockq, the remaining steps wait on I/O
+       completions or other queues. */
+    if (flags & BLOCKQ_ACTION_BLOCKED)
+        t->blocked_on = INVALID_ADDRESS;
+
+    if (op->in && op->out) {
+        pipe pi = op->in->pipe, po = op->out->pipe;
+        rv = pipe_link(pi, po, MIN(op->len, pipe_space(po)), !op->tee);
+        if (rv == 0) {
+            rv = -ENOMEM;
+        } else {
+            if (!op->tee)
+                pipe_drained(op->in);
+            pipe_filled(op->out);
+        }
+        /* bq may belong to a pipe the op holds the last reference to */
+        blockq_handle_completion(bq, flags, syscall_io_complete, t, rv);
+        splice_op_free(op);
+        return rv;
+    }
+
+    if (op->in) {
+        pipe p = op->in->pipe;
+        op->n = pipe_take(p, op->sg, op->len);
+        p->reserved += op->n;       /* space stays claimed until written */
+        splice_write(op);
+    } else {
+        pipe p = op->out->pipe;
+        op->n = MIN(op->len, pipe_space(p));
+        p->reserved += op->n;
+        splice_read(op);
+    }
+    return 0;
+  out:
+    closure_finish();
+    blockq_handle_completion(bq, flags, syscall_io_complete, t, rv);
+    splice_op_free(op);
+    return rv;
+}
+
+static sysreturn splice_sleep(thread t)
+{
+    u64 flags = irq_disable_save();
+    if (!t->file_op_is_complete && thread_in_interruptible_sleep(t))
+        thread_sleep_interruptible();   /* no return */
+    irq_restore(flags);
+    return file_op_maybe_sleep(t);
+}
+
+static pipe_file splice_pipe_end(fdesc f, int end)
+{
+    if (f->type != FDESC_TYPE_PIPE)
+        return 0;
+    pipe_file pf = (pipe_file)f;
+    return pf == &pf->pipe->files[end] ? pf : INVALID_ADDRESS;
+}
+
+static sysreturn splice_start(fdesc fin, s64 *off_in, fdesc fout, s64 *off_out,
+                              u64 len, unsigned int flags, boolean tee)
+{
+    pipe_file in = splice_pipe_end(fin, PIPE_READ);
+    pipe_file out = splice_pipe_end(fout, PIPE_WRITE);
+    if (in == INVALID_ADDRESS || out == INVALID_ADDRESS)
+        return -EBADF;
+    if ((in && off_in) || (out && off_out))
+        return -ESPIPE;
+    if ((!in && !out) || (in && out && in->pipe == out->pipe))
+        return -EINVAL;
+    if ((off_in && *off_in < 0) || (off_out && *off_out < 0))
+        return -EINVAL;
+    if ((!in && !fin->sg_read && !fin->read) || (!out && !fout->sg_write && !fout->write))
+        return -EBADF;
+    if (len == 0)
+        return 0;
+
+    heap h = heap_general(get_kernel_heaps());
+    splice_op op = allocate(h, sizeof(struct splice_op));
+    if (op == INVALID_ADDRESS)
+        return -ENOMEM;
+    op->h = h;
+    op->t = current;
+    op->in = in;
+    op->out = out;
+    op->fin = fin;
+    op->fout = fout;
+    op->off_in = off_in;
+    op->off_out = off_out;
+    op->len = len;
+    op->n = op->done = 0;
+    op->nonblock = (flags & SPLICE_F_NONBLOCK) != 0;
+    op->tee = tee;
+    op->issuing = op->completed = false;
+    op->pp = 0;
+    op->io_done = 0;
+    op->sg = INVALID_ADDRESS;
+    if (in)
+        fetch_and_add(&in->pipe->ref_cnt, 1);
+    if (out)
+        fetch_and_add(&out->pipe->ref_cnt, 1);
+    if (!(in && out)) {
+        op->sg = allocate_sg_list();
+        op->io_done = closure(h, splice_io_done, op);
+        if (op->sg == INVALID_ADDRESS || op->io_done == INVALID_ADDRESS) {
+            if (op->io_done == INVALID_ADDRESS)
+                op->io_done = 0;
+            splice_op_free(op);
+            return -ENOMEM;
+        }
+    }
+    blockq_action ba = closure(h, splice_bh, op);
+    if (ba == INVALID_ADDRESS) {
+        splice_op_free(op);
+        return -ENOMEM;
+    }
+
+    op->bq = in ? in->bq : out->bq;
+    file_op_begin(current);
+    blockq_check(op->bq, current, ba, true);
+    return splice_sleep(current);
+}
+
+sysreturn splice(int fd_in, s64 *off_in, int fd_out, s64 *off_out, u64 len, unsigned int flags)
+{
+    fdesc fin = resolve_fd(current->p, fd_in);
+    fdesc fout = resolve_fd(current->p, fd_out);
+    if (flags & ~SPLICE_F_ALL)
+        return -EINVAL;
+    return splice_start(fin, off_in, fout, off_out, len, flags, false);
+}
+
+sysreturn tee(int fd_in, int fd_out, u64 len, unsigned int flags)
+{
+    fdesc fin = resolve_fd(current->p, fd_in);
+    fdesc fout = resolve_fd(current->p, fd_out);
+    if (flags & ~SPLICE_F_ALL)
+        return -EINVAL;
+    if (fin->type != FDESC_TYPE_PIPE || fout->type != FDESC_TYPE_PIPE)
+        return -EINVAL;
+    return splice_start(fin, 0, fout, 0, len, flags, true);
+}
+
 int do_pipe2(int fds[2], int flags)
 {
     unix_heaps uh = get_unix_heaps();
@@ -288,7 +948,8 @@ int do_pipe2(int fds[2], int flags)
     }
 
     pipe->h = heap_general((kernel_heaps)uh);
-    pipe->data = INVALID_ADDRESS;
+    pipe->backed = heap_backed((kernel_heaps)uh);
+    pipe->bufs = INVALID_ADDRESS;
     pipe->proc = current->p;
 
     pipe->files[PIPE_READ].fd = -1;
@@ -301,10 +962,14 @@ int do_pipe2(int fds[2], int flags)
 
     pipe->ref_cnt = 0;
     pipe->max_size = DEFAULT_PIPE_MAX_SIZE;
+    pipe->length = pipe->reserved = 0;
+    pipe->head = pipe->tail = 0;
+    pipe->nbufs = PIPE_INITIAL_BUFS;
+    pipe->spare = 0;
 
-    pipe->data = allocate_buffer(pipe->h, INITIAL_PIPE_DATA_SIZE);
-    if (pipe->data == INVALID_ADDRESS) {
-        msg_err("failed to allocate pipe's data buffer\n");
+    pipe->bufs = allocate(pipe->h, PIPE_INITIAL_BUFS * sizeof(struct sg_buf));
+    if (pipe->bufs == INVALID_ADDRESS) {
+        msg_err("failed to allocate pipe's buffer ring\n");
         goto err;
     }
 
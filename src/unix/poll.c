@@ -14,7 +14,7 @@ declare_closure_struct(1, 0, void, epollfd_free,
 
 typedef struct epollfd {
     int fd;
-    u32 eventmask;  /* epoll events registered - XXX need lock */
+    u32 eventmask;  /* epoll events registered; e->lock */
     u32 lastevents; /* retain last received events; for edge trigger */
     u64 data;	    /* may be multiple versions of data? */
     struct refcount refcount;
@@ -22,6 +22,9 @@ typedef struct epollfd {
     epoll e;
     boolean registered;
     boolean zombie;		/* freed or masked by oneshot */
+    boolean onready;		/* on e->ready_head */
+    boolean per_thread;		/* events depend on the polling thread (signalfd) */
+    struct list ready_list;
     notify_entry notify_handle;
 } *epollfd;
 
@@ -57,6 +60,7 @@ struct epoll_blocked {
 	};
     };
     struct list blocked_list;
+    boolean woken;              /* epoll: wakeup pending, skip for dispatch */
 };
 
 declare_closure_struct(1, 0, void, epoll_free,
@@ -65,7 +69,9 @@ declare_closure_struct(1, 0, void, epoll_free,
 /* we call it an epoll, but these structs are used for select and poll too */
 struct epoll {
     struct fdesc f;             /* must be first */
+    struct spinlock lock;       /* protects blocked_head and ready_head */
     struct list blocked_head;   /* an epoll_blocked per thread (in epoll_wait)  */
+    struct list ready_head;     /* epollfds with (possibly) pending events */
     struct refcount refcount;
     closure_struct(epoll_free, free);
     heap h;
@@ -92,7 +98,9 @@ static epoll epoll_alloc_internal(void)
     if (e == INVALID_ADDRESS)
 	return e;
 
+    spin_lock_init(&e->lock);
     list_init(&e->blocked_head);
+    list_init(&e->ready_head);
     init_refcount(&e->refcount, 1, init_closure(&e->free, epoll_free, e));
     e->h = heap_general(get_kernel_heaps());
     e->events = allocate_vector(e->h, 8);
@@ -135,6 +143,8 @@ static epollfd alloc_epollfd(epoll e, int fd, u32 eventmask, u64 data)
     init_refcount(&efd->refcount, 1, init_closure(&efd->free, epollfd_free, efd));
     efd->registered = false;
     efd->zombie = false;
+    efd->onready = false;
+    efd->per_thread = false;
     vector_set(e->events, fd, efd);
     bitmap_set(e->fds, fd, 1);
     if (fd >= e->nfds)
@@ -163,6 +173,12 @@ static void release_epollfd(epollfd efd)
     vector_set(e->events, fd, 0);
     bitmap_set(e->fds, fd, 0);
     efd->zombie = true;
+    spin_lock(&e->lock);
+    if (efd->onready) {
+        list_delete(&efd->ready_list);
+        efd->onready = false;
+    }
+    spin_unlock(&e->lock);
     if (efd->registered)
         unregister_epollfd(efd);
     refcount_release(&efd->refcount); /* alloc */
@@ -184,6 +200,8 @@ static boolean register_epollfd(epollfd efd, event_handler eh)
     epoll_debug("fd %d, eventmask 0x%x, handler %p\n", efd->fd, efd->eventmask, eh);
     efd->notify_handle = notify_add(f->ns, efd->eventmask | (EPOLLERR | EPOLLHUP), eh);
     assert(efd->notify_handle != INVALID_ADDRESS);
+    if (efd->eventmask & EPOLLEXCLUSIVE)
+        notify_entry_set_exclusive(efd->notify_handle);
     return true;
 }
 
@@ -254,16 +272,25 @@ define_closure_function(1, 0, void, epoll_blocked_free,
 static void epoll_blocked_release(epoll_blocked w)
 {
     epoll_debug("w %p\n", w);
+    spin_lock(&w->e->lock);
     assert(!list_empty(&w->blocked_list));
     list_delete(&w->blocked_list);
     list_init(&w->blocked_list);
+    spin_unlock(&w->e->lock);
     refcount_release(&w->refcount);
 }
 
-static inline u32 report_from_notify_events(epollfd efd, u64 notify_events)
+static void epollfd_set_eventmask(epollfd efd, u32 eventmask)
+{
+    spin_lock(&efd->e->lock);
+    efd->eventmask = eventmask;
+    spin_unlock(&efd->e->lock);
+}
+
+static inline u32 report_from_notify_events(epollfd efd, u32 eventmask, u64 notify_events)
 {
     u32 events = (u32)notify_events;
-    boolean edge_detect = (efd->eventmask & EPOLLET) != 0;
+    boolean edge_detect = (eventmask & EPOLLET) != 0;
 
     /* catch falling edges for EPOLLET */
     if (edge_detect) {
@@ -276,55 +303,150 @@ static inline u32 report_from_notify_events(epollfd efd, u64 notify_events)
     return edge_detect ? ~efd->lastevents & events : events;
 }
 
-closure_function(1, 2, void, epoll_wait_notify,
+/* Wake one waiter that isn't already being woken, preferring one on
+   thread t if given. Called with e->lock held, which is dropped before
+   waking as the waiter's action runs synchronously. */
+static boolean epoll_wake_one_locked(epoll e, thread t)
+{
+    epoll_blocked w = 0;
+    list_foreach(&e->blocked_head, l) {
+        epoll_blocked i = struct_from_list(l, epoll_blocked, blocked_list);
+        if (i->woken)
+            continue;
+        if (t && i->t != t) {
+            if (!w)
+                w = i;
+            continue;
+        }
+        w = i;
+        break;
+    }
+    if (!w) {
+        spin_unlock(&e->lock);
+        return false;
+    }
+    w->woken = true;
+    thread wt = w->t;
+    spin_unlock(&e->lock);
+    epoll_debug("   waking tid %d\n", wt->tid);
+    blockq_wake_one(wt->thread_bq);
+    return true;
+}
+
+/* Queue efd on the ready list and wake a waiter. Events are collected
+   by the waiter, so notifications cost O(1) regardless of how many
+   threads are in epoll_wait. Returns true if a waiter was woken. */
+static boolean epollfd_notify(epollfd efd, u32 events, thread t)
+{
+    epoll e = efd->e;
+    spin_lock(&e->lock);
+    u32 report = report_from_notify_events(efd, efd->eventmask, events);
+    epoll_debug("efd->fd %d, events 0x%x, report 0x%x, zombie %d\n",
+                efd->fd, events, report, efd->zombie);
+    if (report == 0 || efd->zombie) {
+        spin_unlock(&e->lock);
+        return false;
+    }
+
+    if (!efd->onready) {
+        list_insert_before(&e->ready_head, &efd->ready_list);
+        efd->onready = true;
+    }
+    return epoll_wake_one_locked(e, t);
+}
+
+closure_function(1, 2, boolean, epoll_wait_notify,
                  epollfd, efd,
                  u64, notify_events,
                  thread, t)
 {
     epollfd efd = bound(efd);
-    list l = list_get_next(&efd->e->blocked_head);
 
     /* only path to freedom - even fd removals trigger release */
     if (notify_events == NOTIFY_EVENTS_RELEASE) {
         epoll_debug("efd->fd %d unregistered\n", efd->fd);
         efd->registered = false;
         closure_finish();
-        return;
+        return false;
     }
 
-    epoll_blocked w = l ? struct_from_list(l, epoll_blocked, blocked_list) : 0;
-    u32 events = (u32)notify_events;
-    u32 report = report_from_notify_events(efd, events);
     assert(efd->registered);
-    epoll_debug("efd->fd %d, events 0x%x, report 0x%x, blocked %p, zombie %d\n",
-                efd->fd, events, report, w, efd->zombie);
-
-    /* XXX need to do some work to properly dole out to multiple epoll_waits (threads)... */
-    if (report == 0 || !w || efd->zombie)
-        return;
+    return epollfd_notify(efd, (u32)notify_events, t);
+}
 
-    if (t && t != w->t)
-        return;
+/* Collect events from the ready list into the waiter's buffer, polling
+   each fd for its current state. Level-triggered epollfds which
+   reported events are requeued, to be polled again on the next call;
+   anything no longer ready is dropped. Per-thread epollfds with nothing
+   pending for this thread stay queued, as the events may be directed
+   at another thread which will collect them on its next wait. */
+static int epoll_collect(epoll_blocked w, thread t)
+{
+    epoll e = w->e;
+    buffer b = w->user_events;
+    boolean full = false;
+
+    spin_lock(&e->lock);
+    int n = 0;
+    list_foreach(&e->ready_head, l)
+        n++;
+    while (n-- > 0) {
+        if (b->length - b->end < sizeof(struct epoll_event)) {
+            full = true;
+            break;
+        }
+        list l = list_get_next(&e->ready_head);
+        epollfd efd = struct_from_list(l, epollfd, ready_list);
+        list_delete(l);
+        efd->onready = false;
+        if (efd->zombie || !efd->registered)
+            continue;
+        u32 eventmask = efd->eventmask;
+        spin_unlock(&e->lock);
+
+        u32 report = 0;
+        boolean requeue = false;
+        fdesc f = resolve_fd_noret(t->p, efd->fd);
+        if (f) {
+            u32 events = apply(f->events, t) & eventmask;
+            if (events)
+                report = report_from_notify_events(efd, eventmask, events);
+            else
+                requeue = efd->per_thread;
+        }
+        if (report) {
+            struct epoll_event *ev = buffer_ref(b, b->end);
+            ev->data = efd->data;
+            ev->events = report;
+            b->end += sizeof(struct epoll_event);
+            epoll_debug("   fd %d, data 0x%lx, events 0x%x\n", efd->fd, ev->data, ev->events);
+
+            /* now that we've reported these events, update last */
+            efd->lastevents |= report;
+        }
 
-    if (!w->user_events || (w->user_events->length - w->user_events->end) <= 0) {
-        /* XXX here we should advance to the next blocked head, probably */
-        epoll_debug("   user_events null or full\n");
-        return;
+        spin_lock(&e->lock);
+        if (!report) {
+            if (requeue && !efd->onready) {
+                list_insert_before(&e->ready_head, &efd->ready_list);
+                efd->onready = true;
+            }
+            continue;
+        }
+        if (eventmask & EPOLLONESHOT)
+            efd->zombie = true;
+        else if (!(eventmask & EPOLLET) && !efd->onready) {
+            list_insert_before(&e->ready_head, &efd->ready_list);
+            efd->onready = true;
+        }
     }
 
-    struct epoll_event *e = buffer_ref(w->user_events, w->user_events->end);
-    e->data = efd->data;
-    e->events = report;
-    w->user_events->end += sizeof(struct epoll_event);
-    epoll_debug("   epoll_event %p, data 0x%lx, events 0x%x\n", e, e->data, e->events);
-
-    /* XXX check this */
-    if (efd->eventmask & EPOLLONESHOT)
-        efd->zombie = true;
-
-    /* now that we've reported these events, update last */
-    efd->lastevents |= report;
-    blockq_wake_one(w->t->thread_bq);
+    /* left over events go to another waiter */
+    if (full)
+        epoll_wake_one_locked(e, 0);
+    else
+        spin_unlock(&e->lock);
+    return user_event_count(w);
 }
 
 static epoll_blocked alloc_epoll_blocked(epoll e)
@@ -339,8 +461,11 @@ static epoll_blocked alloc_epoll_blocked(epoll e)
     w->t = current;
     thread_reserve(w->t);
     w->e = e;
+    w->woken = false;
     refcount_reserve(&e->refcount);
+    spin_lock(&e->lock);
     list_insert_after(&e->blocked_head, &w->blocked_list); /* push */
+    spin_unlock(&e->lock);
     return w;
 }
 
@@ -364,6 +489,9 @@ closure_function(3, 1, sysreturn, epoll_wait_bh,
     epoll_debug("w %p on tid %d, blockable %d, flags 0x%lx, event count %d\n",
                 w, t->tid, bound(blockable), flags, eventcount);
 
+    if (eventcount == 0 && !(flags & BLOCKQ_ACTION_NULLIFY))
+        eventcount = epoll_collect(w, t);
+
     if (!bound(blockable) || (flags & BLOCKQ_ACTION_TIMEDOUT) || eventcount) {
         rv = eventcount;
         goto out_wakeup;
@@ -376,6 +504,7 @@ closure_function(3, 1, sysreturn, epoll_wait_bh,
     }
 
     epoll_debug("  continue blocking\n");
+    w->woken = false;
     return BLOCKQ_BLOCK_REQUIRED;
   out_wakeup:
     if (flags & BLOCKQ_ACTION_BLOCKED)
@@ -389,12 +518,14 @@ closure_function(3, 1, sysreturn, epoll_wait_bh,
 }
 
 /* Depending on the epoll flags given, we may:
-   - notify all waiters on a match (default)
-   - notify on a match only once until condition is reset (EPOLLET)
-   - notify once before removing the registration, handled upstream (EPOLLONESHOT)
-   - notify only one matching waiter, even across multiple epoll instances (EPOLLEXCLUSIVE)
-     - XXX Not implemented; will require tracking reported events on a per fd - not per
-           registration - basis.
+   - report a match until the condition is cleared (default)
+   - report a match only once until condition is reset (EPOLLET)
+   - report once before masking the registration (EPOLLONESHOT)
+   - wake only one waiting epoll instance among those registered with
+     EPOLLEXCLUSIVE on the same fd (see notify_dispatch_for_thread)
+
+   Each event wakes a single waiter; a waiter that can't take all ready
+   events passes the remainder on to the next.
 */
 sysreturn epoll_wait(int epfd,
                      struct epoll_event *events,
@@ -411,27 +542,6 @@ sysreturn epoll_wait(int epfd,
     w->user_events = wrap_buffer(e->h, events, maxevents * sizeof(struct epoll_event));
     w->user_events->end = 0;
 
-    bitmap_foreach_set(e->fds, fd) {
-	epollfd efd = vector_get(e->events, fd);
-	assert(efd);
-        assert(efd->fd == fd);
-
-        if (efd->zombie)
-            continue;
-
-        fdesc f = resolve_fd_noret(current->p, efd->fd);
-        if (!f) {
-            epoll_debug("   x fd %d\n", efd->fd);
-            release_epollfd(efd);
-            continue;
-        }
-
-        /* event transitions may in some cases need to be polled for
-           (e.g. due to change in lwIP internal state), so request a check */
-        if (efd->registered)
-            check_fdesc(f, current);
-    }
-
     return blockq_check_timeout(w->t->thread_bq, current,
                                 closure(e->h, epoll_wait_bh, w, current, timeout != 0), false,
                                 CLOCK_ID_MONOTONIC, timeout > 0 ? milliseconds(timeout) : 0, false);
@@ -446,22 +556,6 @@ static epollfd epollfd_from_fd(epoll e, int fd)
     return efd;
 }
 
-static void epollfd_update(epollfd efd, fdesc f)
-{
-    /* It may seem excessive to perform a check for all
-       waiters. However, thanks to thread-specific fd events (thanks
-       in turn to signalfd), we could have independent events for
-       multiple threads that require waking - even on the same fd. */
-
-    /* XXX take lock */
-    list_foreach(&efd->e->blocked_head, l) {
-        epoll_blocked w = struct_from_list(l, epoll_blocked, blocked_list);
-        epoll_debug("   posting check for blocked waiter (tid %d)\n", w->t->tid);
-        check_fdesc(f, w->t);
-    }
-    /* XXX release lock */
-}
-
 static sysreturn epoll_add_fd(epoll e, int fd, u32 events, u64 data)
 {
     if (epollfd_from_fd(e, fd) != INVALID_ADDRESS) {
@@ -477,10 +571,14 @@ static sysreturn epoll_add_fd(epoll e, int fd, u32 events, u64 data)
     assert(efd != INVALID_ADDRESS);
     fdesc f = resolve_fd_noret(current->p, efd->fd);
     assert(f);
+    efd->per_thread = f->type == FDESC_TYPE_SIGNALFD;
     register_epollfd(efd, closure(e->h, epoll_wait_notify, efd));
 
-    /* apply check(s) for any current waiters */
-    epollfd_update(efd, f);
+    /* queue any events already pending; a per-thread epollfd is queued
+       regardless, as its events may be pending for a thread other than
+       the caller and are collected by each waiter for itself */
+    u32 pending = efd->per_thread ? efd->eventmask : apply(f->events, current) & efd->eventmask;
+    epollfd_notify(efd, pending, 0);
     return 0;
 }
 
@@ -495,6 +593,9 @@ static sysreturn remove_fd(epoll e, int fd)
     return 0;
 }
 
+#define EPOLLEXCLUSIVE_OK_BITS (EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLWAKEUP | \
+                                EPOLLET | EPOLLEXCLUSIVE)
+
 sysreturn epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
 {
     epoll e = resolve_fd(current->p, epfd);    
@@ -506,10 +607,17 @@ sysreturn epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
         return set_syscall_error(current, EFAULT);
     }
 
-    /* EPOLLEXCLUSIVE not yet implemented */
+    /* as with Linux, EPOLLEXCLUSIVE is only valid with EPOLL_CTL_ADD and
+       a limited set of events, and can't be modified once set */
     if (event && (event->events & EPOLLEXCLUSIVE)) {
-        msg_err("add: EPOLLEXCLUSIVE not supported\n");
-        return set_syscall_error(current, EINVAL);
+        if (op == EPOLL_CTL_MOD || f->type == FDESC_TYPE_EPOLL ||
+            (event->events & ~EPOLLEXCLUSIVE_OK_BITS))
+            return set_syscall_error(current, EINVAL);
+    }
+    if (op == EPOLL_CTL_MOD) {
+        epollfd efd = epollfd_from_fd(e, fd);
+        if (efd != INVALID_ADDRESS && (efd->eventmask & EPOLLEXCLUSIVE))
+            return set_syscall_error(current, EINVAL);
     }
 
     if ((f->type == FDESC_TYPE_REGULAR) || (f->type == FDESC_TYPE_DIRECTORY)) {
@@ -542,7 +650,7 @@ sysreturn epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
 #define POLLFDMASK_WRITE	(EPOLLOUT | EPOLLHUP | EPOLLERR)
 #define POLLFDMASK_EXCEPT	(EPOLLPRI)
 
-closure_function(1, 2, void, select_notify,
+closure_function(1, 2, boolean, select_notify,
                  epollfd, efd,
                  u64, notify_events,
                  thread, t)
@@ -554,7 +662,7 @@ closure_function(1, 2, void, select_notify,
         epoll_debug("efd->fd %d unregistered\n", efd->fd);
         efd->registered = false;
         closure_finish();
-        return;
+        return false;
     }
 
     epoll_blocked w = l ? struct_from_list(l, epoll_blocked, blocked_list) : 0;
@@ -563,10 +671,10 @@ closure_function(1, 2, void, select_notify,
 	    efd->fd, events, w, efd->zombie);
 
     if (efd->zombie || !w || efd->fd >= w->nfds)
-        return;
+        return false;
 
     if (t && t != w->t)
-        return;
+        return false;
 
     assert(w->epoll_type == EPOLL_TYPE_SELECT);
     int count = 0;
@@ -588,7 +696,9 @@ closure_function(1, 2, void, select_notify,
         fetch_and_add(&w->retcount, count);
         epoll_debug("   event on %d, events 0x%x\n", efd->fd, events);
         blockq_wake_one(w->t->thread_bq);
+        return true;
     }
+    return false;
 }
 
 closure_function(3, 1, sysreturn, select_bh,
@@ -740,7 +850,7 @@ static sysreturn select_internal(int nfds,
                     assert(efd != INVALID_ADDRESS);
 		} else {
 		    epoll_debug("   updating\n");
-		    efd->eventmask = eventmask;
+		    epollfd_set_eventmask(efd, eventmask);
 		}
 	    }
 
@@ -779,7 +889,7 @@ sysreturn select(int nfds,
     return select_internal(nfds, readfds, writefds, exceptfds, timeout ? time_from_timeval(timeout) : infinity, 0);
 }
 
-closure_function(1, 2, void, poll_notify,
+closure_function(1, 2, boolean, poll_notify,
                  epollfd, efd,
                  u64, notify_events,
                  thread, t)
@@ -791,7 +901,7 @@ closure_function(1, 2, void, poll_notify,
         epoll_debug("efd->fd %d unregistered\n", efd->fd);
         efd->registered = false;
         closure_finish();
-        return;
+        return false;
     }
 
     epoll_blocked w = l ? struct_from_list(l, epoll_blocked, blocked_list) : 0;
@@ -801,16 +911,17 @@ closure_function(1, 2, void, poll_notify,
     assert(efd->registered);
 
     if (events == 0 || !w || efd->zombie)
-        return;
+        return false;
 
     if (t && t != w->t)
-        return;
+        return false;
 
     struct pollfd *pfd = buffer_ref(w->poll_fds, efd->data * sizeof(struct pollfd));
     fetch_and_add(&w->poll_retcount, 1);
     pfd->revents = events;
     epoll_debug("   event on %d (%d), events 0x%x\n", efd->fd, pfd->fd, pfd->revents);
     blockq_wake_one(w->t->thread_bq);
+    return true;
 }
 
 closure_function(3, 1, sysreturn, poll_bh,
@@ -879,7 +990,7 @@ static sysreturn poll_internal(struct pollfd *fds, nfds_t nfds,
         if (efd != INVALID_ADDRESS) {
             if (!efd->registered) {
                 epoll_debug("   = fd %d (registering)\n", pfd->fd);
-                efd->eventmask = pfd->events;
+                epollfd_set_eventmask(efd, pfd->events);
                 efd->data = i;
                 register_epollfd(efd, closure(e->h, poll_notify, efd));
             } else {
@@ -0,0 +1,618 @@
+#include <unix_internal.h>
+
+/* User thread scheduling
+
+   Runnable contexts arrive on the lock-free thread queues - the shared
+   thread_queue and the per-cpu queues of bound threads - by way of
+   schedule_frame. When a cpu enters the runloop, sched_pick charges
+   the thread that last ran there for its run, moves arrivals onto the
+   run queues of their scheduling class and picks the next thread.
+
+   The real-time class (SCHED_FIFO, SCHED_RR) is always served first,
+   in priority order. The fair class (SCHED_OTHER, SCHED_BATCH,
+   SCHED_IDLE) runs the thread with the least vruntime, its runtime
+   scaled by the weight of its nice value. A fair thread that shares
+   the cpu with others is given a timeslice, enforced by the runloop
+   timer, so that every runnable thread gets a turn within the
+   scheduling latency. Wakeups kick an idle cpu or one running a
+   thread that the woken thread should preempt.
+
+   The run queues do not allocate, so that picking a thread doesn't
+   depend on holding the kernel lock. */
+
+#define SCHED_LATENCY               milliseconds(6)
+#define SCHED_MIN_GRANULARITY       microseconds(750)
+#define SCHED_WAKEUP_GRANULARITY    milliseconds(1)
+#define SCHED_RR_TIMESLICE          milliseconds(100)
+#define NICE_0_WEIGHT               1024
+#define SCHED_IDLE_WEIGHT           3
+
+enum {
+    SCHED_CLASS_RT,
+    SCHED_CLASS_FAIR,
+    SCHED_CLASSES
+};
+
+typedef struct sched_rq {
+    struct list queue[SCHED_CLASSES];
+    u64 nr_fair;
+    u64 fair_load;              /* sum of queued fair thread weights */
+} *sched_rq;
+
+typedef struct sched_class {
+    /* preempted if the thread was interrupted rather than gave up the cpu */
+    void (*enqueue)(sched_rq rq, thread t, boolean preempted);
+    void (*dequeue)(sched_rq rq, thread t);
+    /* whether a should run ahead of b */
+    boolean (*before)(thread a, thread b);
+    void (*charge)(thread t, timestamp delta);
+    /* length of the next run, 0 for no limit */
+    timestamp (*timeslice)(thread t, u64 nr_fair, u64 fair_load);
+} *sched_class;
+
+static struct spinlock sched_lock;
+static struct sched_rq global_rq;
+static struct sched_rq cpu_rqs[MAX_CPUS];
+static u64 min_vruntime;
+
+/* each nice level is worth about 10% of cpu time against its neighbour */
+static const u32 nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548, 7620, 6100, 4904, 3906,
+    /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+    /*   0 */ 1024, 820, 655, 526, 423,
+    /*   5 */ 335, 272, 215, 172, 137,
+    /*  10 */ 110, 87, 70, 56, 45,
+    /*  15 */ 36, 29, 23, 18, 15,
+};
+
+static inline thread sched_entry(struct list *l)
+{
+    return struct_from_list(l, thread, se.l);
+}
+
+static inline int sched_class_of(thread t)
+{
+    return (t->se.policy == SCHED_FIFO || t->se.policy == SCHED_RR) ?
+        SCHED_CLASS_RT : SCHED_CLASS_FAIR;
+}
+
+static inline u32 sched_weight(int policy, int nice)
+{
+    return policy == SCHED_IDLE ? SCHED_IDLE_WEIGHT : nice_to_weight[nice - NICE_MIN];
+}
+
+static void rt_enqueue(sched_rq rq, thread t, boolean preempted)
+{
+    sched_entity se = &t->se;
+
+    /* a preempted thread goes ahead of its peers unless its round-robin slice is spent */
+    boolean head = preempted && (se->policy == SCHED_FIFO || se->slice_left > 0);
+    if (se->policy == SCHED_RR && se->slice_left == 0)
+        se->slice_left = SCHED_RR_TIMESLICE;
+
+    struct list *q = &rq->queue[SCHED_CLASS_RT];
+    struct list *p;
+    for (p = list_begin(q); p != list_end(q); p = p->next) {
+        thread n = sched_entry(p);
+        if (n->se.priority < se->priority || (head && n->se.priority == se->priority))
+            break;
+    }
+    list_insert_before(p, &se->l);
+}
+
+static void rt_dequeue(sched_rq rq, thread t)
+{
+    list_delete(&t->se.l);
+}
+
+static boolean rt_before(thread a, thread b)
+{
+    return a->se.priority > b->se.priority;
+}
+
+static void rt_charge(thread t, timestamp delta)
+{
+    sched_entity se = &t->se;
+    if (se->policy == SCHED_RR)
+        se->slice_left = se->slice_left > delta ? se->slice_left - delta : 0;
+}
+
+static timestamp rt_timeslice(thread t, u64 nr_fair, u64 fair_load)
+{
+    return t->se.policy == SCHED_RR ? t->se.slice_left : 0;
+}
+
+static void fair_enqueue(sched_rq rq, thread t, boolean preempted)
+{
+    sched_entity se = &t->se;
+    struct list *q = &rq->queue[SCHED_CLASS_FAIR];
+
+    /* a yielding thread goes behind every queued thread */
+    if (se->yielded && !list_empty(q)) {
+        thread last = sched_entry(q->prev);
+        se->vruntime = MAX(se->vruntime, last->se.vruntime);
+    }
+
+    /* most arrivals have just run and sort near the back */
+    struct list *p;
+    for (p = q->prev; p != q; p = p->prev) {
+        if (sched_entry(p)->se.vruntime <= se->vruntime)
+            break;
+    }
+    list_insert_after(p, &se->l);
+    rq->nr_fair++;
+    rq->fair_load += se->weight;
+}
+
+static void fair_dequeue(sched_rq rq, thread t)
+{
+    list_delete(&t->se.l);
+    rq->nr_fair--;
+    rq->fair_load -= t->se.weight;
+}
+
+static boolean fair_before(thread a, thread b)
+{
+    return a->se.vruntime < b->se.vruntime;
+}
+
+static void fair_charge(thread t, timestamp delta)
+{
+    t->se.vruntime += delta * NICE_0_WEIGHT / t->se.weight;
+}
+
+/* divide the latency period among runnable threads by weight */
+static timestamp fair_timeslice(thread t, u64 nr_fair, u64 fair_load)
+{
+    if (nr_fair == 0)
+        return 0;               /* nothing to share the cpu with */
+    u64 period = MAX(SCHED_LATENCY, (nr_fair + 1) * SCHED_MIN_GRANULARITY);
+    return MAX(period * t->se.weight / (fair_load + t->se.weight), SCHED_MIN_GRANULARITY);
+}
+
+static struct sched_class sched_classes[SCHED_CLASSES] = {
+    [SCHED_CLASS_RT] = {
+        .enqueue = rt_enqueue,
+        .dequeue = rt_dequeue,
+        .before = rt_before,
+        .charge = rt_charge,
+        .timeslice = rt_timeslice,
+    },
+    [SCHED_CLASS_FAIR] = {
+        .enqueue = fair_enqueue,
+        .dequeue = fair_dequeue,
+        .before = fair_before,
+        .charge = fair_charge,
+        .timeslice = fair_timeslice,
+    },
+};
+
+/* the following are called with sched_lock held */
+
+static void sched_dequeue(thread t)
+{
+    sched_classes[sched_class_of(t)].dequeue(t->se.rq, t);
+    t->se.rq = 0;
+}
+
+static void sched_enqueue(sched_rq rq, thread t, boolean preempted)
+{
+    if (t->se.rq)
+        sched_dequeue(t);       /* requeued with a newer context */
+    sched_classes[sched_class_of(t)].enqueue(rq, t, preempted);
+    t->se.rq = rq;
+    t->se.yielded = false;
+}
+
+static void sched_charge(thread t, timestamp here)
+{
+    sched_entity se = &t->se;
+    if (here > se->start)
+        sched_classes[sched_class_of(t)].charge(t, here - se->start);
+    se->start = 0;
+}
+
+static void sched_drain(queue q, sched_rq rq, thread prev, timestamp here)
+{
+    context f;
+    while ((f = dequeue(q)) != INVALID_ADDRESS) {
+        thread t = pointer_from_u64(f[FRAME_THREAD]);
+
+        /* stopped running on another cpu before that cpu got back to the runloop */
+        if (t->se.start)
+            sched_charge(t, here);
+        t->se.frame = f;
+        sched_enqueue(rq, t, t == prev && !f[FRAME_IS_SYSCALL]);
+    }
+}
+
+static inline thread sched_first(sched_rq rq, int c)
+{
+    struct list *q = &rq->queue[c];
+    return list_empty(q) ? 0 : sched_entry(list_begin(q));
+}
+
+closure_function(0, 0, context, sched_pick)
+{
+    cpuinfo ci = current_cpu();
+    sched_rq local = &cpu_rqs[ci->id];
+    timestamp here = now(CLOCK_ID_MONOTONIC);
+    thread t = 0;
+
+    spin_lock(&sched_lock);
+    thread prev = ci->current_thread;
+    if (prev && prev->se.start && prev->se.cpu == ci->id)
+        sched_charge(prev, here);
+    else
+        prev = 0;
+    sched_drain(thread_queue, &global_rq, prev, here);
+    sched_drain(ci->thread_queue, local, prev, here);
+
+    for (int c = 0; c < SCHED_CLASSES && !t; c++) {
+        thread a = sched_first(local, c);
+        thread b = sched_first(&global_rq, c);
+        t = (!a || (b && sched_classes[c].before(b, a))) ? b : a;
+    }
+    if (!t) {
+        spin_unlock(&sched_lock);
+        return INVALID_ADDRESS;
+    }
+
+    sched_dequeue(t);
+    sched_entity se = &t->se;
+    se->start = here;
+    se->cpu = ci->id;
+    if (sched_class_of(t) == SCHED_CLASS_FAIR && se->vruntime > min_vruntime)
+        min_vruntime = se->vruntime;
+    timestamp slice = sched_classes[sched_class_of(t)].timeslice(t,
+        local->nr_fair + global_rq.nr_fair, local->fair_load + global_rq.fair_load);
+    boolean more = global_rq.nr_fair || !list_empty(&global_rq.queue[SCHED_CLASS_RT]);
+    context f = se->frame;
+    spin_unlock(&sched_lock);
+
+    if (slice)
+        set_timeslice(slice);
+
+    /* hand remaining shared work to an idle cpu */
+    u64 idle = idle_cpu_mask & ~U64_FROM_BIT(ci->id);
+    if (more && idle)
+        wakeup_cpu(msb(idle));
+    return f;
+}
+
+/* whether waking thread t should take the cpu from running thread r */
+static boolean sched_preempts(thread t, thread r, timestamp here)
+{
+    int ct = sched_class_of(t);
+    int cr = sched_class_of(r);
+    if (ct != cr)
+        return ct < cr;
+    if (ct == SCHED_CLASS_RT)
+        return t->se.priority > r->se.priority;
+    if (t->se.policy != SCHED_OTHER)
+        return false;           /* batch and idle threads wait their turn */
+    if (r->se.policy == SCHED_IDLE)
+        return true;
+    u64 vruntime = r->se.vruntime;
+    if (here > r->se.start)
+        vruntime += (here - r->se.start) * NICE_0_WEIGHT / r->se.weight;
+    return t->se.vruntime + SCHED_WAKEUP_GRANULARITY < vruntime;
+}
+
+/* Kick a permitted cpu that is idle or runs a thread that t should
+   preempt. Reads of other cpus' state are racy; a missed kick only
+   delays t to the next timeslice or interrupt. */
+static void sched_kick(thread t)
+{
+    u64 allowed = t->affinity.mask[0] & MASK(total_processors);
+    u64 idle = allowed & idle_cpu_mask & ~U64_FROM_BIT(current_cpu()->id);
+    if (idle) {
+        /* bound threads already kicked their cpu when queued */
+        if (t->default_frame[FRAME_QUEUE] == u64_from_pointer(thread_queue))
+            wakeup_cpu(msb(idle));
+        return;
+    }
+
+    timestamp here = now(CLOCK_ID_MONOTONIC);
+    while (allowed) {
+        u64 cpu = lsb(allowed);
+        allowed &= ~U64_FROM_BIT(cpu);
+        thread r = cpuinfo_from_id(cpu)->current_thread;
+        if (r && r != t && r->se.start && r->se.cpu == cpu && sched_preempts(t, r, here)) {
+            wakeup_cpu(cpu);
+            return;
+        }
+    }
+}
+
+/* Called when a sleeping thread becomes runnable. A fair thread may
+   not bank more than half a latency period of credit while asleep. */
+void sched_wakeup(thread t)
+{
+    sched_entity se = &t->se;
+    if (sched_class_of(t) == SCHED_CLASS_FAIR) {
+        spin_lock(&sched_lock);
+        if (min_vruntime > SCHED_LATENCY / 2)
+            se->vruntime = MAX(se->vruntime, min_vruntime - SCHED_LATENCY / 2);
+        spin_unlock(&sched_lock);
+    }
+    sched_kick(t);
+}
+
+void sched_thread_init(thread t, thread parent)
+{
+    sched_entity se = &t->se;
+    se->rq = 0;
+    se->frame = 0;
+    se->slice_left = 0;
+    se->start = 0;
+    se->cpu = 0;
+    se->yielded = false;
+    if (parent && !parent->se.reset_on_fork) {
+        se->policy = parent->se.policy;
+        se->priority = parent->se.priority;
+        se->nice = parent->se.nice;
+        se->vruntime = parent->se.vruntime;
+    } else {
+        se->policy = SCHED_OTHER;
+        se->priority = 0;
+        se->nice = parent ? MAX(parent->se.nice, 0) : 0;
+        se->vruntime = parent ? parent->se.vruntime : min_vruntime;
+    }
+    se->reset_on_fork = false;
+    se->weight = sched_weight(se->policy, se->nice);
+}
+
+void sched_thread_exit(thread t)
+{
+    spin_lock(&sched_lock);
+    if (t->se.rq)
+        sched_dequeue(t);
+    spin_unlock(&sched_lock);
+}
+
+static void sched_update(thread t, int policy, int priority, int nice)
+{
+    sched_entity se = &t->se;
+    boolean was_fair = sched_class_of(t) == SCHED_CLASS_FAIR;
+
+    spin_lock(&sched_lock);
+    sched_rq rq = se->rq;
+    if (rq)
+        sched_dequeue(t);
+
+    /* charge a running thread under its old class */
+    if (se->start) {
+        timestamp here = now(CLOCK_ID_MONOTONIC);
+        sched_charge(t, here);
+        se->start = here;
+    }
+    se->policy = policy;
+    se->priority = priority;
+    se->nice = nice;
+    se->weight = sched_weight(policy, nice);
+    se->slice_left = 0;
+    if (!was_fair && sched_class_of(t) == SCHED_CLASS_FAIR)
+        se->vruntime = MAX(se->vruntime, min_vruntime);
+    if (rq)
+        sched_enqueue(rq, t, false);
+    spin_unlock(&sched_lock);
+
+    if (rq)
+        sched_kick(t);
+}
+
+static thread sched_lookup(int pid)
+{
+    if (pid < 0)
+        return INVALID_ADDRESS;
+    return pid == 0 ? current : thread_from_tid(current->p, pid);
+}
+
+static sysreturn sched_set_policy(thread t, int policy, int priority)
+{
+    switch (policy) {
+    case SCHED_FIFO:
+    case SCHED_RR:
+        if (priority < SCHED_RT_PRIO_MIN || priority > SCHED_RT_PRIO_MAX)
+            return set_syscall_error(current, EINVAL);
+        break;
+    case SCHED_OTHER:
+    case SCHED_BATCH:
+    case SCHED_IDLE:
+        if (priority != 0)
+            return set_syscall_error(current, EINVAL);
+        break;
+    default:
+        return set_syscall_error(current, EINVAL);
+    }
+    sched_update(t, policy, priority, t->se.nice);
+    return 0;
+}
+
+sysreturn sched_setscheduler(int pid, int policy, struct sched_param *param)
+{
+    thread_log(current, "sched_setscheduler: pid %d, policy 0x%x, param %p", pid, policy, param);
+    if (!param || pid < 0)
+        return set_syscall_error(current, EINVAL);
+    thread t = sched_lookup(pid);
+    if (t == INVALID_ADDRESS)
+        return set_syscall_error(current, ESRCH);
+    boolean reset_on_fork = (policy & SCHED_RESET_ON_FORK) != 0;
+    sysreturn rv = sched_set_policy(t, policy & ~SCHED_RESET_ON_FORK, param->sched_priority);
+    if (rv == 0)
+        t->se.reset_on_fork = reset_on_fork;
+    return rv;
+}
+
+sysreturn sched_getscheduler(int pid)
+{
+    thread t = sched_lookup(pid);
+    if (t == INVALID_ADDRESS)
+        return set_syscall_error(current, pid < 0 ? EINVAL : ESRCH);
+    return t->se.policy | (t->se.reset_on_fork ? SCHED_RESET_ON_FORK : 0);
+}
+
+sysreturn sched_setparam(int pid, struct sched_param *param)
+{
+    if (!param || pid < 0)
+        return set_syscall_error(current, EINVAL);
+    thread t = sched_lookup(pid);
+    if (t == INVALID_ADDRESS)
+        return set_syscall_error(current, ESRCH);
+    return sched_set_policy(t, t->se.policy, param->sched_priority);
+}
+
+sysreturn sched_getparam(int pid, struct sched_param *param)
+{
+    if (!param || pid < 0)
+        return set_syscall_error(current, EINVAL);
+    thread t = sched_lookup(pid);
+    if (t == INVALID_ADDRESS)
+        return set_syscall_error(current, ESRCH);
+    param->sched_priority = t->se.priority;
+    return 0;
+}
+
+sysreturn sched_get_priority_max(int policy)
+{
+    switch (policy) {
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return SCHED_RT_PRIO_MAX;
+    case SCHED_OTHER:
+    case SCHED_BATCH:
+    case SCHED_IDLE:
+        return 0;
+    default:
+        return set_syscall_error(current, EINVAL);
+    }
+}
+
+sysreturn sched_get_priority_min(int policy)
+{
+    switch (policy) {
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return SCHED_RT_PRIO_MIN;
+    case SCHED_OTHER:
+    case SCHED_BATCH:
+    case SCHED_IDLE:
+        return 0;
+    default:
+        return set_syscall_error(current, EINVAL);
+    }
+}
+
+sysreturn sched_rr_get_interval(int pid, struct timespec *tp)
+{
+    if (!tp || pid < 0)
+        return set_syscall_error(current, EINVAL);
+    thread t = sched_lookup(pid);
+    if (t == INVALID_ADDRESS)
+        return set_syscall_error(current, ESRCH);
+    timestamp slice;
+    switch (t->se.policy) {
+    case SCHED_RR:
+        slice = SCHED_RR_TIMESLICE;
+        break;
+    case SCHED_FIFO:
+        slice = 0;
+        break;
+    default:
+        spin_lock(&sched_lock);
+        slice = fair_timeslice(t, global_rq.nr_fair, global_rq.fair_load);
+        spin_unlock(&sched_lock);
+        if (!slice)
+            slice = SCHED_LATENCY;
+    }
+    timespec_from_time(tp, slice);
+    return 0;
+}
+
+/* Nice values are kept per thread, as on Linux. A process or process
+   group target applies to every thread of the process. */
+static boolean prio_target_process(int which, int who)
+{
+    switch (which) {
+    case PRIO_PGRP:
+        return who == 0 || who == current->p->pid;
+    case PRIO_USER:
+        return who == 0;        /* everything runs as uid 0 */
+    default:
+        return false;
+    }
+}
+
+sysreturn getpriority(int which, int who)
+{
+    thread t;
+    if (which == PRIO_PROCESS) {
+        if ((t = sched_lookup(who)) == INVALID_ADDRESS)
+            return set_syscall_error(current, ESRCH);
+        return 20 - t->se.nice;
+    }
+    if (which != PRIO_PGRP && which != PRIO_USER)
+        return set_syscall_error(current, EINVAL);
+    if (!prio_target_process(which, who))
+        return set_syscall_error(current, ESRCH);
+
+    /* the highest priority among the threads */
+    int nice = NICE_MAX;
+    vector_foreach(current->p->threads, t) {
+        if (t && t->se.nice < nice)
+            nice = t->se.nice;
+    }
+    return 20 - nice;
+}
+
+sysreturn setpriority(int which, int who, int prio)
+{
+    thread t;
+    int nice = MIN(MAX(prio, NICE_MIN), NICE_MAX);
+    if (which == PRIO_PROCESS) {
+        if ((t = sched_lookup(who)) == INVALID_ADDRESS)
+            return set_syscall_error(current, ESRCH);
+        sched_update(t, t->se.policy, t->se.priority, nice);
+        return 0;
+    }
+    if (which != PRIO_PGRP && which != PRIO_USER)
+        return set_syscall_error(current, EINVAL);
+    if (!prio_target_process(which, who))
+        return set_syscall_error(current, ESRCH);
+    vector_foreach(current->p->threads, t) {
+        if (t)
+            sched_update(t, t->se.policy, t->se.priority, nice);
+    }
+    return 0;
+}
+
+void register_sched_syscalls(struct syscall *map)
+{
+    register_syscall(map, getpriority, getpriority);
+    register_syscall(map, setpriority, setpriority);
+    register_syscall(map, sched_setparam, sched_setparam);
+    register_syscall(map, sched_getparam, sched_getparam);
+    register_syscall(map, sched_setscheduler, sched_setscheduler);
+    register_syscall(map, sched_getscheduler, sched_getscheduler);
+    register_syscall(map, sched_get_priority_max, sched_get_priority_max);
+    register_syscall(map, sched_get_priority_min, sched_get_priority_min);
+    register_syscall(map, sched_rr_get_interval, sched_rr_get_interval);
+}
+
+boolean sched_init(unix_heaps uh)
+{
+    spin_lock_init(&sched_lock);
+    for (int c = 0; c < SCHED_CLASSES; c++) {
+        list_init(&global_rq.queue[c]);
+        for (int i = 0; i < MAX_CPUS; i++)
+            list_init(&cpu_rqs[i].queue[c]);
+    }
+    context_scheduler s = closure(heap_general((kernel_heaps)uh), sched_pick);
+    if (s == INVALID_ADDRESS)
+        return false;
+    set_context_scheduler(s);
+    return true;
+}
@@ -947,7 +947,7 @@ closure_function(1, 0, sysreturn, signalfd_close,
     return 0;
 }
 
-closure_function(1, 2, void, signalfd_notify,
+closure_function(1, 2, boolean, signalfd_notify,
                  signal_fd, sfd,
                  u64, events,
                  thread, t)
@@ -956,14 +956,16 @@ closure_function(1, 2, void, signalfd_notify,
     if (events == NOTIFY_EVENTS_RELEASE) {
         sig_debug("%d released\n", sfd->fd);
         closure_finish();
+        return false;
     }
 
     if ((events & sfd->mask) == 0) {
         sig_debug("%d spurious notify\n", sfd->fd);
-        return;
+        return false;
     }
-    blockq_wake_one_for_thread(sfd->bq, t);
+    boolean woken = blockq_wake_one_for_thread(sfd->bq, t);
     notify_dispatch_for_thread(sfd->f.ns, EPOLLIN, t);
+    return woken;
 }
 
 static void signalfd_update_siginterest(thread t)
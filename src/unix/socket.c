@@ -419,8 +419,9 @@ static sysreturn unixsock_connect(struct sock *sock, struct sockaddr *addr,
     return blockq_check(sock->txbq, current, ba, false);
 }
 
-closure_function(5, 1, sysreturn, accept_bh,
+closure_function(6, 1, sysreturn, accept_bh,
                  unixsock, s, thread, t, struct sockaddr *, addr, socklen_t *, addrlen, int, flags,
+                 io_completion, completion,
                  u64, bqflags)
 {
     unixsock s = bound(s);
@@ -458,16 +459,14 @@ closure_function(5, 1, sysreturn, accept_bh,
     child->peer->peer = child;
     unixsock_notify_writer(child->peer);
 out:
-    set_syscall_return(t, rv);
-    if (bqflags & BLOCKQ_ACTION_BLOCKED) {
-        thread_wakeup(t);
-    }
+    blockq_handle_completion(s->sock.rxbq, bqflags, bound(completion), t, rv);
     closure_finish();
     return rv;
 }
 
 static sysreturn unixsock_accept4(struct sock *sock, struct sockaddr *addr,
-        socklen_t *addrlen, int flags)
+        socklen_t *addrlen, int flags, thread t, boolean bh,
+        io_completion completion)
 {
     unixsock s = (unixsock) sock;
     if (addr && !addrlen) {
@@ -476,9 +475,9 @@ static sysreturn unixsock_accept4(struct sock *sock, struct sockaddr *addr,
     if (!s->conn_q) {
         return -EINVAL;
     }
-    blockq_action ba = closure(sock->h, accept_bh, s, current, addr, addrlen,
-            flags);
-    return blockq_check(sock->rxbq, current, ba, false);
+    blockq_action ba = closure(sock->h, accept_bh, s, t, addr, addrlen,
+            flags, completion);
+    return blockq_check(sock->rxbq, t, ba, bh);
 }
 
 sysreturn unixsock_sendto(struct sock *sock, void *buf, u64 len, int flags,
@@ -513,7 +512,7 @@ static unixsock unixsock_alloc(heap h, int type, u32 flags)
         msg_err("failed to allocate data buffer\n");
         goto err_queue;
     }
-    if (socket_init(current->p, h, type, flags, &s->sock) < 0) {
+    if (socket_init(current->p, h, AF_UNIX, type, flags, &s->sock) < 0) {
         msg_err("failed to initialize socket\n");
         goto err_socket;
     }
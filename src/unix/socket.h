@@ -20,7 +20,8 @@ struct sock {
     sysreturn (*connect)(struct sock *sock, struct sockaddr *addr,
             socklen_t addrlen);
     sysreturn (*accept4)(struct sock *sock, struct sockaddr *addr,
-            socklen_t *addrlen, int flags);
+            socklen_t *addrlen, int flags, thread t, boolean bh,
+            io_completion completion);
     sysreturn (*sendto)(struct sock *sock, void *buf, u64 len, int flags,
              struct sockaddr *dest_addr, socklen_t addrlen);
     sysreturn (*recvfrom)(struct sock *sock, void *buf, u64 len, int flags,
@@ -28,7 +29,7 @@ struct sock {
     sysreturn (*shutdown)(struct sock *sock, int how);
 };
 
-static inline int socket_init(process p, heap h, int type, u32 flags,
+static inline int socket_init(process p, heap h, int domain, int type, u32 flags,
         struct sock *s)
 {
     runtime_memset((u8 *) s, 0, sizeof(*s));
@@ -49,6 +50,7 @@ static inline int socket_init(process p, heap h, int type, u32 flags,
     }
     init_fdesc(h, &s->f, FDESC_TYPE_SOCKET);
     s->f.flags = flags;
+    s->domain = domain;
     s->type = type;
     s->h = h;
     return s->fd;
@@ -82,6 +82,24 @@ static u32 maps_events(file f)
     return EPOLLIN;
 }
 
+static sysreturn netstat_read(file f, void *dest, u64 length, u64 offset)
+{
+    heap h = heap_general(get_kernel_heaps());
+    buffer b = allocate_buffer(h, 128);
+    if (b == INVALID_ADDRESS)
+        return -ENOMEM;
+    u64 overflows, drops;
+    tcp_listen_stats(&overflows, &drops);
+    bprintf(b, "TcpExt: ListenOverflows ListenDrops\nTcpExt: %ld %ld\n", overflows, drops);
+    sysreturn rv = 0;
+    if (offset < buffer_length(b)) {
+        rv = MIN(length, buffer_length(b) - offset);
+        runtime_memcpy(dest, buffer_ref(b, offset), rv);
+    }
+    deallocate_buffer(b);
+    return rv;
+}
+
 static sysreturn text_read(const char *text, bytes text_len, file f, void *dest, u64 length, u64 offset)
 {
     if (text_len <= offset)
@@ -116,6 +134,7 @@ static special_file special_files[] = {
     { "/dev/urandom", .read = urandom_read, .write = 0, .events = urandom_events },
     { "/dev/null", .read = null_read, .write = null_write, .events = null_events },
     { "/proc/self/maps", .read = maps_read, .events = maps_events, },
+    { "/proc/net/netstat", .read = netstat_read, .events = maps_events, },
     { "/sys/devices/system/cpu/online", .read = cpu_online_read, .write = null_write, .events = cpu_online_events },
     FTRACE_SPECIAL_FILES
 };
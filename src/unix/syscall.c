@@ -66,15 +66,6 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, personality, 0);
     register_syscall(map, ustat, 0);
     register_syscall(map, sysfs, 0);
-    register_syscall(map, getpriority, 0);
-    register_syscall(map, setpriority, 0);
-    register_syscall(map, sched_setparam, 0);
-    register_syscall(map, sched_getparam, 0);
-    register_syscall(map, sched_setscheduler, 0);
-    register_syscall(map, sched_getscheduler, 0);
-    register_syscall(map, sched_get_priority_max, 0);
-    register_syscall(map, sched_get_priority_min, 0);
-    register_syscall(map, sched_rr_get_interval, 0);
     register_syscall(map, mlock, 0);
     register_syscall(map, munlock, 0);
     register_syscall(map, mlockall, 0);
@@ -163,17 +154,13 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, unshare, 0);
     register_syscall(map, set_robust_list, 0);
     register_syscall(map, get_robust_list, 0);
-    register_syscall(map, splice, 0);
-    register_syscall(map, tee, 0);
     register_syscall(map, sync_file_range, 0);
-    register_syscall(map, vmsplice, 0);
     register_syscall(map, move_pages, 0);
     register_syscall(map, utimensat, 0);
     register_syscall(map, inotify_init1, 0);
     register_syscall(map, preadv, 0);
     register_syscall(map, pwritev, 0);
     register_syscall(map, perf_event_open, 0);
-    register_syscall(map, recvmmsg, 0);
     register_syscall(map, fanotify_init, 0);
     register_syscall(map, fanotify_mark, 0);
     register_syscall(map, name_to_handle_at, 0);
@@ -181,7 +168,6 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, clock_adjtime, 0);
     register_syscall(map, syncfs, 0);
     register_syscall(map, setns, 0);
-    register_syscall(map, getcpu, 0);
     register_syscall(map, process_vm_readv, 0);
     register_syscall(map, process_vm_writev, 0);
     register_syscall(map, kcmp, 0);
@@ -436,6 +422,18 @@ sysreturn writev(int fd, struct iovec *iov, int iovcnt)
     return iov_op(f, f->write, iov, iovcnt, syscall_io_complete);
 }
 
+/* User pages cannot be pinned and lent to the pipe, so vmsplice
+   copies as writev (or readv, on the read end) would. */
+sysreturn vmsplice(int fd, struct iovec *iov, u64 nr_segs, unsigned int flags)
+{
+    fdesc f = resolve_fd(current->p, fd);
+    if (f->type != FDESC_TYPE_PIPE)
+        return set_syscall_error(current, EBADF);
+    if (nr_segs > IOV_MAX || (flags & ~SPLICE_F_ALL))
+        return set_syscall_error(current, EINVAL);
+    return iov_op(f, f->write ? f->write : f->read, iov, nr_segs, syscall_io_complete);
+}
+
 static boolean is_special(tuple n)
 {
     return table_find(n, sym(special)) ? true : false;
@@ -516,10 +514,19 @@ closure_function(9, 2, void, sendfile_bh,
            (io_status_handler for linear) in the middle */
         if (bound(offset))
             *bound(offset) += rv;
-        bound(cur_buf) = sg_list_head_remove(bound(sg)); /* initial dequeue */
-        assert(bound(cur_buf) != INVALID_ADDRESS);
-        bound(cur_buf)->misc = 0; /* offset for our use */
         thread_log(t, "   read %ld bytes\n", rv);
+        if (!bound(out)->sg_write) {
+            bound(cur_buf) = sg_list_head_remove(bound(sg)); /* initial dequeue */
+            assert(bound(cur_buf) != INVALID_ADDRESS);
+            bound(cur_buf)->misc = 0; /* offset for our use */
+        }
+    } else if (bound(out)->sg_write) {
+        /* output consumes (and releases) written buffers from the list */
+        bound(written) += rv;
+        if (bound(written) == bound(readlen)) {
+            rv = bound(written);
+            goto out_complete;
+        }
     } else {
         bound(written) += rv;
         bound(cur_buf)->misc += rv;
@@ -537,6 +544,12 @@ closure_function(9, 2, void, sendfile_bh,
     }
 
     /* issue next write */
+    if (bound(out)->sg_write) {
+        u64 n = bound(readlen) - bound(written);
+        thread_log(t, "   writing %ld bytes from sg %p", n, bound(sg));
+        apply(bound(out)->sg_write, bound(sg), n, 0, t, true, (io_completion)closure_self());
+        return;
+    }
     assert(bound(cur_buf));
     void *buf = bound(cur_buf)->buf + bound(cur_buf)->misc;
     u32 n = bound(cur_buf)->length - bound(cur_buf)->misc;
@@ -559,14 +572,18 @@ out_complete:
 
 #define SENDFILE_READ_MAX (64 * KB)
 
-/* requires infile to have sg_read method - so sendfile from special files isn't supported */
+/* requires infile to have sg_read method - so sendfile from special files isn't supported
+
+   If outfile has an sg_write method (TCP sockets), the pagecache pages
+   are transmitted by reference, each held until acknowledged by the
+   peer; otherwise they are written out through a buffer. */
 static sysreturn sendfile(int out_fd, int in_fd, int *offset, bytes count)
 {
     thread_log(current, "%s: out %d, in %d, offset %p, *offset %d, count %ld",
                __func__, out_fd, in_fd, offset, offset ? *offset : 0, count);
     fdesc infile = resolve_fd(current->p, in_fd);
     fdesc outfile = resolve_fd(current->p, out_fd);
-    if (!infile->sg_read || !outfile->write)
+    if (!infile->sg_read || infile->type == FDESC_TYPE_SOCKET || !outfile->write)
         return set_syscall_error(current, EINVAL);
 
     sg_list sg = allocate_sg_list();
@@ -609,9 +626,9 @@ closure_function(2, 6, sysreturn, file_read,
     }
     begin_file_read(t, f);
     filesystem_read_linear(t->p->fs, f->n, dest, length, offset,
-                           closure(heap_general(get_kernel_heaps()),
-                                   file_op_complete, t, f, fsf, is_file_offset,
-                                   completion));
+                           closure_from_pool(heap_general(get_kernel_heaps()),
+                                             file_op_complete, t, f, fsf, is_file_offset,
+                                             completion));
 
     /* possible direct return in top half */
     return bh ? SYSRETURN_CONTINUE_BLOCKING : file_op_maybe_sleep(t);
@@ -638,9 +655,9 @@ closure_function(2, 6, sysreturn, file_sg_read,
 
     begin_file_read(t, f);
     filesystem_read_sg(t->p->fs, f->n, sg, length, offset,
-                       closure(heap_general(get_kernel_heaps()),
-                               file_op_complete_sg, t, f, fsf, sg, is_file_offset,
-                               completion));
+                       closure_from_pool(heap_general(get_kernel_heaps()),
+                                         file_op_complete_sg, t, f, fsf, sg, is_file_offset,
+                                         completion));
 
   out:
     /* possible direct return in top half */
@@ -698,7 +715,7 @@ closure_function(2, 6, sysreturn, file_write,
     }
     file_op_begin(t);
     filesystem_write(t->p->fs, f->n, b, offset,
-                     closure(h, file_op_complete, t, f, fsf, is_file_offset,
+                     closure_from_pool(h, file_op_complete, t, f, fsf, is_file_offset,
                      completion));
 
     /* possible direct return in top half */
@@ -1816,6 +1833,14 @@ sysreturn fcntl(int fd, int cmd, s64 arg)
         fetch_and_add(&f->refcnt, 1);
         return set_syscall_return(current, newfd);
     }
+    case F_GETPIPE_SZ:
+        if (f->type != FDESC_TYPE_PIPE)
+            return set_syscall_error(current, EBADF);
+        return set_syscall_return(current, pipe_get_capacity(f));
+    case F_SETPIPE_SZ:
+        if (f->type != FDESC_TYPE_PIPE)
+            return set_syscall_error(current, EBADF);
+        return set_syscall_return(current, pipe_set_capacity(f, arg));
     default:
         return set_syscall_error(current, ENOSYS);
     }
@@ -1856,6 +1881,7 @@ sysreturn getpid()
 
 sysreturn sched_yield()
 {
+    current->se.yielded = true;
     thread_yield();             /* noreturn */
 }
 
@@ -1908,20 +1934,31 @@ static thread lookup_thread(int pid)
 sysreturn sched_setaffinity(int pid, u64 cpusetsize, cpu_set_t *mask)
 {
     thread t;
-    if (!(t = lookup_thread(pid)) ||
-        (!mask || cpusetsize < sizeof(mask->mask[0])))
-            return set_syscall_error(current, EINVAL);                
-    runtime_memcpy(&t->affinity, mask, sizeof(mask->mask[0]));
+    if (!mask || cpusetsize < sizeof(mask->mask[0]))
+        return set_syscall_error(current, EINVAL);
+    if (!(t = lookup_thread(pid)))
+        return set_syscall_error(current, ESRCH);
+    u64 allowed = mask->mask[0] & MASK(total_processors);
+    if (!allowed)
+        return set_syscall_error(current, EINVAL);
+    t->affinity.mask[0] = allowed;
+    thread_select_queue(t);
+
+    /* migrate now if the calling thread is no longer permitted here */
+    if (t == current && !(allowed & U64_FROM_BIT(current_cpu()->id)))
+        thread_yield();
     return 0;
 }
 
 sysreturn sched_getaffinity(int pid, u64 cpusetsize, cpu_set_t *mask)
 {
     thread t;
-    if (!(t = lookup_thread(pid)) ||
-        (!mask || cpusetsize < sizeof(mask->mask[0])))
-            return set_syscall_error(current, EINVAL);                    
-    runtime_memcpy(mask, &t->affinity, sizeof(mask->mask[0]));        
+    if (!mask || cpusetsize < sizeof(mask->mask[0]))
+        return set_syscall_error(current, EINVAL);
+    if (!(t = lookup_thread(pid)))
+        return set_syscall_error(current, ESRCH);
+    zero(mask, cpusetsize);
+    mask->mask[0] = t->affinity.mask[0];
     return sizeof(mask->mask[0]);
 }
 
@@ -1998,6 +2035,9 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, io_submit, io_submit);
     register_syscall(map, io_getevents, io_getevents);
     register_syscall(map, io_destroy, io_destroy);
+    register_syscall(map, io_uring_setup, io_uring_setup);
+    register_syscall(map, io_uring_enter, io_uring_enter);
+    register_syscall(map, io_uring_register, io_uring_register);
     register_syscall(map, access, access);
     register_syscall(map, lseek, lseek);
     register_syscall(map, fcntl, fcntl);
@@ -2030,6 +2070,9 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, getrandom, getrandom);
     register_syscall(map, pipe, pipe);
     register_syscall(map, pipe2, pipe2);
+    register_syscall(map, splice, splice);
+    register_syscall(map, tee, tee);
+    register_syscall(map, vmsplice, vmsplice);
     register_syscall(map, socketpair, socketpair);
     register_syscall(map, eventfd, eventfd);
     register_syscall(map, eventfd2, eventfd2);
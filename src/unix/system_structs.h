@@ -98,6 +98,7 @@ typedef struct iovec {
 #define ENOTEMPTY       39              /* Directory not empty */
 #define ELOOP           40              /* Too many symbolic links */
 #define ENOPROTOOPT     42              /* Protocol not available */
+#define ETIME           62              /* Timer expired */
 
 #define EDESTADDRREQ    89		/* Destination address required */
 #define EMSGSIZE        90		/* Message too long */
@@ -136,6 +137,8 @@ typedef struct iovec {
 #define F_SETLK         6       /* Set record locking info (non-blocking).  */
 #define F_SETLKW        7       /* Set record locking info (blocking).  */
 #define F_DUPFD_CLOEXEC (F_LINUX_SPECIFIC_BASE + 6)
+#define F_SETPIPE_SZ    (F_LINUX_SPECIFIC_BASE + 7)
+#define F_GETPIPE_SZ    (F_LINUX_SPECIFIC_BASE + 8)
 
 struct flock {
     s16 l_type;
@@ -716,6 +719,25 @@ struct tms {
 #define CLONE_NEWNET		0x40000000	/* New network namespace */
 #define CLONE_IO		0x80000000	/* Clone io context */
 
+/* restartable sequences */
+#define RSEQ_FLAG_UNREGISTER            (1 << 0)
+#define RSEQ_CPU_ID_UNINITIALIZED       -1
+
+struct rseq {
+    u32 cpu_id_start;
+    u32 cpu_id;
+    u64 rseq_cs;                /* struct rseq_cs * */
+    u32 flags;
+} __attribute__((aligned(32)));
+
+struct rseq_cs {
+    u32 version;
+    u32 flags;
+    u64 start_ip;
+    u64 post_commit_offset;
+    u64 abort_ip;
+} __attribute__((aligned(32)));
+
 struct epoll_event {
     u32     events;      /* Epoll events */
     u64 data;
@@ -737,7 +759,7 @@ struct epoll_event {
 #define EPOLLWRBAND	0x00000200
 #define EPOLLMSG	0x00000400
 #define EPOLLRDHUP	0x00002000
-#define EPOLLEXCLUSIVE	(1u << 29)
+#define EPOLLEXCLUSIVE	(1u << 28)
 #define EPOLLWAKEUP	(1u << 29)
 #define EPOLLONESHOT	(1u << 30)
 #define EPOLLET		(1u << 31)
@@ -795,12 +817,164 @@ struct io_event {
 
 typedef struct aio_ring *aio_context_t;
 
+/* io_uring */
+struct io_uring_sqe {
+    u8 opcode;
+    u8 flags;
+    u16 ioprio;
+    s32 fd;
+    union {
+        u64 off;
+        u64 addr2;
+    };
+    u64 addr;
+    u32 len;
+    union {
+        u32 rw_flags;
+        u32 fsync_flags;
+        u16 poll_events;
+        u32 msg_flags;
+        u32 timeout_flags;
+        u32 accept_flags;
+    };
+    u64 user_data;
+    union {
+        u16 buf_index;
+        u64 __pad2[3];
+    };
+};
+
+#define IOSQE_FIXED_FILE        (1U << 0)
+
+enum {
+    IORING_OP_NOP = 0,
+    IORING_OP_READV = 1,
+    IORING_OP_WRITEV = 2,
+    IORING_OP_FSYNC = 3,
+    IORING_OP_READ_FIXED = 4,
+    IORING_OP_WRITE_FIXED = 5,
+    IORING_OP_POLL_ADD = 6,
+    IORING_OP_TIMEOUT = 11,
+    IORING_OP_ACCEPT = 13,
+    IORING_OP_READ = 22,
+    IORING_OP_WRITE = 23,
+    IORING_OP_SEND = 26,
+    IORING_OP_RECV = 27,
+};
+
+#define IORING_FSYNC_DATASYNC   (1U << 0)
+#define IORING_TIMEOUT_ABS      (1U << 0)
+
+struct io_uring_cqe {
+    u64 user_data;
+    s32 res;
+    u32 flags;
+};
+
+#define IORING_OFF_SQ_RING      0ULL
+#define IORING_OFF_CQ_RING      0x8000000ULL
+#define IORING_OFF_SQES         0x10000000ULL
+
+struct io_sqring_offsets {
+    u32 head;
+    u32 tail;
+    u32 ring_mask;
+    u32 ring_entries;
+    u32 flags;
+    u32 dropped;
+    u32 array;
+    u32 resv1;
+    u64 resv2;
+};
+
+#define IORING_SQ_NEED_WAKEUP   (1U << 0)
+
+struct io_cqring_offsets {
+    u32 head;
+    u32 tail;
+    u32 ring_mask;
+    u32 ring_entries;
+    u32 overflow;
+    u32 cqes;
+    u32 flags;
+    u32 resv1;
+    u64 resv2;
+};
+
+#define IORING_SETUP_IOPOLL     (1U << 0)
+#define IORING_SETUP_SQPOLL     (1U << 1)
+#define IORING_SETUP_SQ_AFF     (1U << 2)
+#define IORING_SETUP_CQSIZE     (1U << 3)
+
+#define IORING_ENTER_GETEVENTS  (1U << 0)
+#define IORING_ENTER_SQ_WAKEUP  (1U << 1)
+
+struct io_uring_params {
+    u32 sq_entries;
+    u32 cq_entries;
+    u32 flags;
+    u32 sq_thread_cpu;
+    u32 sq_thread_idle;
+    u32 features;
+    u32 wq_fd;
+    u32 resv[3];
+    struct io_sqring_offsets sq_off;
+    struct io_cqring_offsets cq_off;
+};
+
+#define IORING_FEAT_SINGLE_MMAP     (1U << 0)
+#define IORING_FEAT_SUBMIT_STABLE   (1U << 2)
+#define IORING_FEAT_RW_CUR_POS      (1U << 3)
+
+#define IORING_REGISTER_BUFFERS     0
+#define IORING_UNREGISTER_BUFFERS   1
+#define IORING_REGISTER_FILES       2
+#define IORING_UNREGISTER_FILES     3
+
+/* set/getsockopt levels */
+#define SOL_SOCKET   1
+
 /* set/getsockopt optnames */
 #define SO_DEBUG     1
 #define SO_REUSEADDR 2
 #define SO_TYPE      3
 #define SO_ERROR     4
 #define SO_SNDBUF    7
+#define SO_RCVBUF    8
+#define SO_REUSEPORT 15
+#define SO_ZEROCOPY  60
+
+/* UDP generic segmentation offload */
+#define SOL_UDP      17
+#define UDP_SEGMENT  103
+
+/* socket error queue */
+#define SOL_IP       0
+#define IP_RECVERR   11
+
+#define SO_EE_ORIGIN_ZEROCOPY       5
+#define SO_EE_CODE_ZEROCOPY_COPIED  1
+
+struct sock_extended_err {
+    u32 ee_errno;
+    u8 ee_origin;
+    u8 ee_type;
+    u8 ee_code;
+    u8 ee_pad;
+    u32 ee_info;
+    u32 ee_data;
+};
+
+struct cmsghdr {
+    u64 cmsg_len;
+    int cmsg_level;
+    int cmsg_type;
+};
+
+#define CMSG_ALIGN(len) pad(len, sizeof(u64))
+#define CMSG_LEN(len)   (CMSG_ALIGN(sizeof(struct cmsghdr)) + (len))
+#define CMSG_SPACE(len) (CMSG_ALIGN(sizeof(struct cmsghdr)) + CMSG_ALIGN(len))
+#define CMSG_DATA(c)    ((u8 *)(c) + CMSG_ALIGN(sizeof(struct cmsghdr)))
 
 
 /* eventfd flags */
@@ -814,6 +988,13 @@ typedef struct aio_ring *aio_context_t;
 #define TFD_TIMER_ABSTIME       (1 << 0)
 #define TFD_TIMER_CANCEL_ON_SET (1 << 1)
 
+/* splice flags */
+#define SPLICE_F_MOVE       (1 << 0)
+#define SPLICE_F_NONBLOCK   (1 << 1)
+#define SPLICE_F_MORE       (1 << 2)
+#define SPLICE_F_GIFT       (1 << 3)
+#define SPLICE_F_ALL        (SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT)
+
 /* renameat2 flags */
 #define RENAME_NOREPLACE    (1 << 0)
 #define RENAME_EXCHANGE     (1 << 1)
@@ -828,3 +1009,43 @@ typedef struct aio_ring *aio_context_t;
 #define FALLOC_FL_COLLAPSE_RANGE    0x08
 #define FALLOC_FL_ZERO_RANGE        0x10
 #define FALLOC_FL_INSERT_RANGE      0x20
+
+/* scheduling policies */
+#define SCHED_OTHER         0
+#define SCHED_FIFO          1
+#define SCHED_RR            2
+#define SCHED_BATCH         3
+#define SCHED_IDLE          5
+#define SCHED_RESET_ON_FORK 0x40000000
+
+#define SCHED_RT_PRIO_MIN   1
+#define SCHED_RT_PRIO_MAX   99
+
+struct sched_param {
+    int sched_priority;
+};
+
+/* getpriority / setpriority */
+#define PRIO_PROCESS    0
+#define PRIO_PGRP       1
+#define PRIO_USER       2
+
+#define NICE_MIN        (-20)
+#define NICE_MAX        19
+
+/* madvise advice */
+#define MADV_NORMAL         0
+#define MADV_RANDOM         1
+#define MADV_SEQUENTIAL     2
+#define MADV_WILLNEED       3
+#define MADV_DONTNEED       4
+#define MADV_FREE           8
+#define MADV_REMOVE         9
+#define MADV_DONTFORK       10
+#define MADV_DOFORK         11
+#define MADV_MERGEABLE      12
+#define MADV_UNMERGEABLE    13
+#define MADV_HUGEPAGE       14
+#define MADV_NOHUGEPAGE     15
+#define MADV_DONTDUMP       16
+#define MADV_DODUMP         17
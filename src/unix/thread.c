@@ -56,6 +56,10 @@ sysreturn clone(unsigned long flags, void *child_stack, int *ptid, int *ctid, un
     runtime_memcpy(t->default_frame + FRAME_EXTENDED_SAVE, current->default_frame + FRAME_EXTENDED_SAVE,
                    xsave_frame_size());
     thread_clone_sigmask(t, current);
+    t->affinity = current->affinity;
+    t->last_cpu = current->last_cpu;
+    sched_thread_init(t, current);
+    thread_select_queue(t);
 
     /* clone behaves like fork at the syscall level, returning 0 to the child */
     set_syscall_return(t, 0);
@@ -72,6 +76,48 @@ sysreturn clone(unsigned long flags, void *child_stack, int *ptid, int *ctid, un
 }
 
 
+sysreturn getcpu(unsigned *cpu, unsigned *node, void *tcache)
+{
+    if (cpu)
+        *cpu = current_cpu()->id;
+    if (node)
+        *node = 0;
+    return 0;
+}
+
+sysreturn rseq(struct rseq *rseq, u32 rseq_len, int flags, u32 sig)
+{
+    thread t = current;
+    thread_log(t, "rseq: rseq %p, len %d, flags 0x%x, sig 0x%x", rseq, rseq_len, flags, sig);
+    if (flags & RSEQ_FLAG_UNREGISTER) {
+        if (flags != RSEQ_FLAG_UNREGISTER || t->rseq != rseq || rseq_len != sizeof(struct rseq))
+            return set_syscall_error(t, EINVAL);
+        if (sig != t->rseq_sig)
+            return set_syscall_error(t, EPERM);
+        rseq->cpu_id_start = 0;
+        rseq->cpu_id = RSEQ_CPU_ID_UNINITIALIZED;
+        t->rseq = 0;
+        return 0;
+    }
+    if (flags)
+        return set_syscall_error(t, EINVAL);
+    if (t->rseq) {
+        if (t->rseq != rseq || rseq_len != sizeof(struct rseq))
+            return set_syscall_error(t, EINVAL);
+        if (sig != t->rseq_sig)
+            return set_syscall_error(t, EPERM);
+        return set_syscall_error(t, EBUSY);
+    }
+    if (!rseq)
+        return set_syscall_error(t, EFAULT);
+    if ((u64_from_pointer(rseq) & (sizeof(struct rseq) - 1)) || rseq_len != sizeof(struct rseq))
+        return set_syscall_error(t, EINVAL);
+    t->rseq = rseq;
+    t->rseq_sig = sig;
+    rseq->cpu_id_start = rseq->cpu_id = current_cpu()->id;
+    return 0;
+}
+
 void register_thread_syscalls(struct syscall *map)
 {
     register_syscall(map, futex, futex);
@@ -79,6 +125,8 @@ void register_thread_syscalls(struct syscall *map)
     register_syscall(map, arch_prctl, arch_prctl);
     register_syscall(map, set_tid_address, set_tid_address);
     register_syscall(map, gettid, gettid);
+    register_syscall(map, getcpu, getcpu);
+    register_syscall(map, rseq, rseq);
 }
 
 void thread_log_internal(thread t, const char *desc, ...)
@@ -141,6 +189,8 @@ static inline void run_thread_frame(thread t)
     t->blocked_on = 0;
     t->syscall = -1;
 
+    t->last_cpu = current_cpu()->id;
+
     context f = thread_frame(t);
     f[FRAME_FLAGS] |= U64_FROM_BIT(FLAG_INTERRUPT);
 
@@ -153,10 +203,115 @@ static inline void run_thread_frame(thread t)
     frame_return(f);
 }
 
+/* Publish the cpu id to a registered rseq area and, if the thread was
+   interrupted within a critical section, restart it at the abort
+   handler. This runs ahead of signal dispatch, so that a handler's
+   saved context holds the abort ip. Syscalls are not permitted within
+   a critical section, so only interrupted frames are checked.
+
+   The rseq area and descriptor are user memory, which may not be
+   present yet or may have been unmapped since registration. Missing
+   pages are faulted in through the vmap; if the memory isn't mapped
+   (or the area isn't writable), the area is unregistered and the
+   thread gets a SIGSEGV. */
+static void rseq_segv(thread t)
+{
+    struct siginfo s = {
+        .si_signo = SIGSEGV,
+        .si_errno = 0,
+        .si_code = SI_KERNEL,
+    };
+    deliver_signal_to_thread(t, &s);
+}
+
+static void rseq_resume(thread t)
+{
+    struct rseq *rs = t->rseq;
+    if (!fault_in_user_range(t->p, u64_from_pointer(rs), sizeof(struct rseq), true)) {
+        thread_log(t, "rseq: area %p not mapped; unregistering", rs);
+        goto fault;
+    }
+    u32 cpu = current_cpu()->id;
+    rs->cpu_id_start = cpu;
+    rs->cpu_id = cpu;
+
+    context f = t->default_frame;
+    if (f[FRAME_IS_SYSCALL] || !rs->rseq_cs)
+        return;
+    struct rseq_cs *cs = pointer_from_u64(rs->rseq_cs);
+    if (!fault_in_user_range(t->p, u64_from_pointer(cs), sizeof(struct rseq_cs), false)) {
+        thread_log(t, "rseq: critical section descriptor %p not mapped; unregistering", cs);
+        goto fault;
+    }
+    if (f[FRAME_RIP] - cs->start_ip >= cs->post_commit_offset) {
+        rs->rseq_cs = 0;
+        return;
+    }
+    u32 *sig = pointer_from_u64(cs->abort_ip - sizeof(u32));
+    if (!fault_in_user_range(t->p, u64_from_pointer(sig), sizeof(u32), false)) {
+        thread_log(t, "rseq: abort signature at %p not mapped; unregistering", sig);
+        goto fault;
+    }
+    if (cs->version != 0 || cs->abort_ip - cs->start_ip < cs->post_commit_offset ||
+        *sig != t->rseq_sig) {
+        thread_log(t, "rseq: invalid critical section descriptor %p", cs);
+        rseq_segv(t);
+        return;
+    }
+    thread_log(t, "rseq: abort at 0x%lx, restart at 0x%lx", f[FRAME_RIP], cs->abort_ip);
+    rs->rseq_cs = 0;
+    f[FRAME_RIP] = cs->abort_ip;
+    return;
+  fault:
+    t->rseq = 0;
+    rseq_segv(t);
+}
+
+/* A thread may have been queued ahead of a change to its affinity;
+   requeue it on a permitted cpu rather than run it here. */
+static void thread_check_affinity(thread t)
+{
+    if (t->affinity.mask[0] & U64_FROM_BIT(current_cpu()->id))
+        return;
+    thread_log(t, "not permitted on cpu %d, requeueing", current_cpu()->id);
+    thread_select_queue(t);
+    schedule_frame(thread_frame(t));
+    runloop();
+}
+
+/* Pick the run queue for a thread that is about to become runnable.
+   Threads that may run on any cpu go on the shared queue. Others are
+   bound to one permitted cpu: an idle one, preferring the cpu the
+   thread last ran on, else the last cpu, else the first permitted. */
+void thread_select_queue(thread t)
+{
+    if (t->default_frame[FRAME_QUEUE] == INVALID_PHYSICAL)
+        return;                 /* exiting */
+    u64 allowed = t->affinity.mask[0] & MASK(total_processors);
+    queue q;
+    if (allowed == MASK(total_processors)) {
+        q = thread_queue;
+    } else {
+        u64 idle = allowed & idle_cpu_mask;
+        u64 last = U64_FROM_BIT(t->last_cpu);
+        u64 cpu;
+        if (idle)
+            cpu = (idle & last) ? t->last_cpu : lsb(idle);
+        else
+            cpu = (allowed & last) ? t->last_cpu : lsb(allowed);
+        q = cpuinfo_from_id(cpu)->thread_queue;
+    }
+    t->default_frame[FRAME_QUEUE] = u64_from_pointer(q);
+    t->sighandler_frame[FRAME_QUEUE] = u64_from_pointer(q);
+}
+
 define_closure_function(1, 0, void, run_thread,
                         thread, t)
 {
     thread t = bound(t);
+    thread_check_affinity(t);
+    if (t->rseq)
+        rseq_resume(t);
     dispatch_signals(t);
     run_thread_frame(t);
 }
@@ -164,6 +319,7 @@ define_closure_function(1, 0, void, run_thread,
 define_closure_function(1, 0, void, run_sighandler,
                         thread, t)
 {
+    thread_check_affinity(bound(t));
     run_thread_frame(bound(t));
 }
 
@@ -200,6 +356,7 @@ void thread_yield(void)
     assert(!current->blocked_on);
     current->syscall = -1;
     set_syscall_return(current, 0);
+    thread_select_queue(current);
     schedule_frame(thread_frame(current));
     runloop();
 }
@@ -212,7 +369,9 @@ void thread_wakeup(thread t)
     assert(t->blocked_on);
     t->blocked_on = 0;
     t->syscall = -1;
+    thread_select_queue(t);
     schedule_frame(thread_frame(t));
+    sched_wakeup(t);
 }
 
 boolean thread_attempt_interrupt(thread t)
@@ -266,6 +425,8 @@ thread create_thread(process p)
     t->select_epoll = 0;
     t->tid = tidcount++;
     t->clear_tid = 0;
+    t->rseq = 0;
+    t->rseq_sig = 0;
     t->name[0] = '\0';
 
     t->default_frame = allocate_frame(h);
@@ -281,6 +442,8 @@ thread create_thread(process p)
 
     // xxx another max 64
     t->affinity.mask[0] = MASK(total_processors);
+    t->last_cpu = 0;
+    sched_thread_init(t, 0);
     t->blocked_on = 0;
     t->file_op_is_complete = false;
     init_sigstate(&t->signals);
@@ -347,6 +510,7 @@ void exit_thread(thread t)
     if (t->signal_stack) {
         deallocate((heap)t->p->virtual_page, t->signal_stack, SIGNAL_STACK_SIZE);
     }
+    sched_thread_exit(t);
     t->default_frame[FRAME_RUN] = INVALID_PHYSICAL;
     t->default_frame[FRAME_QUEUE] = INVALID_PHYSICAL;
     t->sighandler_frame[FRAME_RUN] = INVALID_PHYSICAL;
@@ -367,5 +531,4 @@ void init_threads(process p)
 {
     heap h = heap_general((kernel_heaps)p->uh);
     p->threads = allocate_vector(h, 5);
-    init_futices(p);
 }
@@ -257,7 +257,7 @@ process create_process(unix_heaps uh, tuple root, filesystem fs)
         assert(p->virtual32 != INVALID_ADDRESS);
         if (aslr)
             id_heap_set_randomize(p->virtual32, true);
-        mmap_process_init(p);
+        mmap_process_init(p, root);
         init_vdso(p);
     } else {
         p->virtual = p->virtual_page = p->virtual32 = 0;
@@ -357,6 +357,8 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs)
 	goto alloc_fail;
     if (!pipe_init(uh))
 	goto alloc_fail;
+    if (!futex_init(uh))
+	goto alloc_fail;
     if (!unix_timers_init(uh))
         goto alloc_fail;
     if (ftrace_init(uh, fs))
@@ -370,6 +372,8 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs)
 
     for (int i = 0; i < MAX_CPUS; i++)
         cpuinfo_from_id(i)->current_thread = dummy_thread;
+    if (!sched_init(uh))
+	goto alloc_fail;
 
     /* XXX remove once we have http PUT support */
     ftrace_enable();
@@ -397,6 +401,7 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs)
     register_signal_syscalls(linux_syscalls);
     register_mmap_syscalls(linux_syscalls);
     register_thread_syscalls(linux_syscalls);
+    register_sched_syscalls(linux_syscalls);
     register_poll_syscalls(linux_syscalls);
     register_clock_syscalls(linux_syscalls);
     register_timer_syscalls(linux_syscalls);
@@ -199,6 +199,23 @@ declare_closure_struct(1, 1, context, default_fault_handler,
 #define thread_frame(t) ((t)->active_frame)
 #define set_thread_frame(t, f) do { (t)->active_frame = (f); } while(0)
 
+/* per-thread scheduler state, see sched.c */
+typedef struct sched_entity {
+    struct list l;              /* on a run queue */
+    struct sched_rq *rq;        /* 0 if not queued */
+    context frame;              /* context to resume when picked */
+    int policy;
+    int priority;               /* real-time priority */
+    int nice;
+    u32 weight;
+    u64 vruntime;               /* weighted runtime, fair class */
+    timestamp slice_left;       /* SCHED_RR */
+    timestamp start;            /* start of the current run, 0 if not running */
+    u32 cpu;                    /* cpu of the current run */
+    boolean yielded;
+    boolean reset_on_fork;
+} *sched_entity;
+
 typedef struct thread {
     context default_frame;
     context sighandler_frame;
@@ -243,12 +260,18 @@ typedef struct thread {
     void *signal_stack;
     u64 signal_stack_length;
 
+    /* restartable sequences area and abort signature */
+    struct rseq *rseq;
+    u32 rseq_sig;
+
 #ifdef CONFIG_FTRACE
     int graph_idx;
     struct ftrace_graph_entry * graph_stack;
 #endif
     closure_struct(resume_syscall, deferred_syscall);
-    cpu_set_t affinity;    
+    cpu_set_t affinity;
+    u32 last_cpu;
+    struct sched_entity se;
 } *thread;
 
 typedef closure_type(io, sysreturn, void *buf, u64 length, u64 offset, thread t,
@@ -267,6 +290,7 @@ typedef closure_type(sg_io, sysreturn, sg_list sg, u64 length, u64 offset, threa
 #define FDESC_TYPE_SIGNALFD     9
 #define FDESC_TYPE_TIMERFD     10
 #define FDESC_TYPE_SYMLINK     11
+#define FDESC_TYPE_IORING      12
 
 typedef struct fdesc {
     io read, write;
@@ -300,6 +324,19 @@ void epoll_finish(epoll e);
 #define VMAP_FLAG_ANONYMOUS     2
 #define VMAP_FLAG_WRITABLE      4
 #define VMAP_FLAG_EXEC          8
+#define VMAP_FLAG_PREALLOC      16  /* backing pages owned by a kernel object */
+#define VMAP_FLAG_HUGEPAGE      32  /* MADV_HUGEPAGE */
+#define VMAP_FLAG_NOHUGEPAGE    64  /* MADV_NOHUGEPAGE */
+#define VMAP_FLAG_RANDOM        128 /* MADV_RANDOM: no fault-around */
+
+/* process thp_mode, set by the transparent_hugepage manifest option */
+#define THP_ALWAYS      0
+#define THP_MADVISE     1       /* only VMAP_FLAG_HUGEPAGE vmaps */
+#define THP_NEVER       2
+
+/* process fault_around_pages bounds, set by the manifest option of the same name */
+#define FAULT_AROUND_DEFAULT    16
+#define FAULT_AROUND_MAX        64
 
 typedef struct vmap {
     struct rmnode node;
@@ -329,7 +366,6 @@ typedef struct process {
     filesystem        fs;       /* XXX should be underneath tuple operators */
     tuple             process_root;
     tuple             cwd;
-    table             futices;
     fault_handler     handler;
     vector            threads;
     struct syscall   *syscalls;
@@ -340,6 +376,8 @@ typedef struct process {
     vmap              stack_map;
     vmap              heap_map;
     boolean           sysctx;
+    int               thp_mode; /* transparent huge pages for anonymous vmaps */
+    int               fault_around_pages; /* power of 2, up to FAULT_AROUND_MAX */
     timestamp         utime, stime;
     timestamp         start_time;
     struct sigstate   signals;
@@ -432,7 +470,7 @@ void deallocate_fd(process p, int fd);
 
 void init_vdso(process p);
 
-void mmap_process_init(process p);
+void mmap_process_init(process p, tuple root);
 
 static inline u64 get_aslr_offset(u64 range)
 {
@@ -536,7 +574,9 @@ boolean unix_timers_init(unix_heaps uh);
 extern sysreturn syscall_ignore();
 boolean do_demand_page(u64 vaddr, vmap vm);
 vmap vmap_from_vaddr(process p, u64 vaddr);
+boolean fault_in_user_range(process p, u64 addr, u64 length, boolean write);
 void vmap_iterator(process p, vmap_handler vmh);
+void unmap_prealloc(process p, u64 phys, u64 len);
 
 void thread_log_internal(thread t, const char *desc, ...);
 #define thread_log(__t, __desc, ...) thread_log_internal(__t, __desc, ##__VA_ARGS__)
@@ -614,7 +654,15 @@ static inline void file_op_maybe_wake(thread t)
 
 void init_syscalls();
 void init_threads(process p);
-void init_futices(process p);
+boolean futex_init(unix_heaps uh);
+
+void thread_select_queue(thread t);
+
+boolean sched_init(unix_heaps uh);
+void sched_thread_init(thread t, thread parent);
+void sched_thread_exit(thread t);
+void sched_wakeup(thread t);
+void register_sched_syscalls(struct syscall *map);
 
 sysreturn futex(int *uaddr, int futex_op, int val, u64 val2, int *uaddr2, int val3);
 boolean futex_wake_many_by_uaddr(process p, int *uaddr, int val);
@@ -630,9 +678,23 @@ sysreturn io_getevents(aio_context_t ctx_id, long min_nr, long nr,
         struct io_event *events, struct timespec *timeout);
 sysreturn io_destroy(aio_context_t ctx_id);
 
+sysreturn io_uring_setup(unsigned int entries, struct io_uring_params *params);
+sysreturn io_uring_enter(int fd, unsigned int to_submit,
+        unsigned int min_complete, unsigned int flags, sigset_t *sig,
+        u64 sigsz);
+sysreturn io_uring_register(int fd, unsigned int opcode, void *arg,
+        unsigned int nr_args);
+sysreturn io_uring_mmap(fdesc f, u64 len, u64 offset, u64 *phys);
+
 int do_pipe2(int fds[2], int flags);
+sysreturn splice(int fd_in, s64 *off_in, int fd_out, s64 *off_out, u64 len, unsigned int flags);
+sysreturn tee(int fd_in, int fd_out, u64 len, unsigned int flags);
+sysreturn pipe_get_capacity(fdesc f);
+sysreturn pipe_set_capacity(fdesc f, s64 capacity);
 
 sysreturn socketpair(int domain, int type, int protocol, int sv[2]);
+void zerocopy_unmap(range r);
+void tcp_listen_stats(u64 *overflows, u64 *drops);
 
 int do_eventfd2(unsigned int count, int flags);
 
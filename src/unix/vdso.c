@@ -33,11 +33,7 @@ vsyscall_time(time_t * t)
 VSYSCALL sysreturn
 vsyscall_getcpu(unsigned * cpu, unsigned * node, void * tcache)
 {
-    if (cpu)
-        *cpu = 0;
-    if (node)
-        *node = 0;
-    return 0;
+    return do_syscall(SYS_getcpu, cpu, node);
 }
 
 /*
@@ -0,0 +1,384 @@
+/* virtio balloon
+
+   The host sets the balloon's target size, in 4K pages, in num_pages.
+   The driver inflates by taking memory from the physical heap and
+   passing its frames to the host on the inflate queue, and deflates
+   by passing frames back on the deflate queue; deflated memory goes
+   back to the physical heap only once the host has acknowledged it.
+   Memory is taken in 2M blocks while at least a block's worth of
+   pages is outstanding, else as single pages. When the physical heap
+   cannot satisfy an inflation, the page cache is drained of clean
+   pages to make up the difference. Conversely, any page cache drain
+   that releases memory schedules an update, so that a stalled
+   inflation resumes and the released memory is reported without
+   waiting for the next poll.
+
+   With VIRTIO_BALLOON_F_REPORTING, free 2M blocks are reported to the
+   host in batches, leaving REPORT_RESERVE bytes of the heap alone.
+   Candidates come from a scan of the reported map (see page.c),
+   resumed each time from a cursor and bounded to REPORT_SCAN blocks,
+   so a poll neither walks all of free memory nor holds more than a
+   batch of it. The blocks are held for the duration of the report
+   and then returned to the heap marked as reported, so that they are
+   not reported again until some part of them is reused.
+
+   Changes to the target are signalled by a configuration change
+   interrupt, and are also polled for, along with reporting, on a
+   periodic timer. At most one message is in flight on each queue. */
+
+#include <kernel.h>
+#include <page.h>
+#include <pagecache.h>
+
+#include "virtio_internal.h"
+
+//#define VIRTIO_BALLOON_DEBUG
+
+#ifdef VIRTIO_BALLOON_DEBUG
+# define virtio_balloon_debug rprintf
+#else
+# define virtio_balloon_debug(...) do { } while(0)
+#endif /* defined(VIRTIO_BALLOON_DEBUG) */
+
+#define VIRTIO_BALLOON_F_MUST_TELL_HOST         U64_FROM_BIT(0)
+#define VIRTIO_BALLOON_F_STATS_VQ               U64_FROM_BIT(1)
+#define VIRTIO_BALLOON_F_DEFLATE_ON_OOM         U64_FROM_BIT(2)
+#define VIRTIO_BALLOON_F_FREE_PAGE_HINT         U64_FROM_BIT(3)
+#define VIRTIO_BALLOON_F_PAGE_POISON            U64_FROM_BIT(4)
+#define VIRTIO_BALLOON_F_REPORTING              U64_FROM_BIT(5)
+
+// device configuration offsets
+struct virtio_balloon_config {
+    u32 num_pages;
+    u32 actual;
+    u32 free_page_hint_cmd_id;
+    u32 poison_val;
+} __attribute__((packed));
+
+#define VIRTIO_BALLOON_R_NUM_PAGES      (offsetof(struct virtio_balloon_config *, num_pages))
+#define VIRTIO_BALLOON_R_ACTUAL         (offsetof(struct virtio_balloon_config *, actual))
+
+#define VIRTIO_BALLOON_PFN_SHIFT        12
+
+#define BLOCK_PAGES     (PAGESIZE_2M >> VIRTIO_BALLOON_PFN_SHIFT)
+#define MAX_PFNS        BLOCK_PAGES     /* per inflate or deflate message */
+
+#define REPORT_BATCH    16              /* 2M blocks per report */
+#define REPORT_RESERVE  (64 * MB)
+#define REPORT_SCAN     4096            /* 2M blocks examined per report */
+#define POLL_INTERVAL   seconds(2)
+
+typedef struct balloon {
+    vtpci v;
+    heap general;
+    heap physical;
+    struct virtqueue *inflateq;
+    struct virtqueue *deflateq;
+    struct virtqueue *reportq;
+    struct spinlock lock;
+    thunk update;
+
+    u32 actual;                 /* pages held by the host */
+    vector pages;               /* inflated 4K pages */
+    vector blocks;              /* inflated 2M blocks */
+
+    /* one message in flight per queue */
+    boolean inflating;
+    boolean deflating;
+    boolean reporting;
+    u32 *inflate_pfns;
+    u32 *deflate_pfns;
+    u64 report_blocks[REPORT_BATCH];
+    int report_count;
+    u64 report_cursor;          /* next 2M block to examine */
+} *balloon;
+
+static void balloon_write_actual(balloon b)
+{
+    pci_bar_write_4(&b->v->device_config, VIRTIO_BALLOON_R_ACTUAL, b->actual);
+}
+
+static u64 balloon_alloc_phys(balloon b, bytes size)
+{
+    u64 p = allocate_u64(b->physical, size);
+    if (p != INVALID_PHYSICAL)
+        return p;
+    if (pagecache_drain(size) == 0)
+        return INVALID_PHYSICAL;
+    return allocate_u64(b->physical, size);
+}
+
+static void balloon_fill_block_pfns(u32 *pfns, u64 p)
+{
+    for (int i = 0; i < BLOCK_PAGES; i++)
+        pfns[i] = (p >> VIRTIO_BALLOON_PFN_SHIFT) + i;
+}
+
+closure_function(3, 1, void, inflate_complete,
+                 balloon, b, u32, count, boolean, block,
+                 u64, len)
+{
+    balloon b = bound(b);
+    spin_lock(&b->lock);
+    b->actual += bound(count);
+    b->inflating = false;
+    balloon_write_actual(b);
+    spin_unlock(&b->lock);
+    virtio_balloon_debug("%s: %d pages%s, actual %d\n", __func__, bound(count),
+                         bound(block) ? " (block)" : "", b->actual);
+    enqueue(runqueue, b->update);
+    closure_finish();
+}
+
+/* called with lock held */
+static void balloon_inflate(balloon b, u64 n)
+{
+    u32 *pfns = b->inflate_pfns;
+    u32 count = 0;
+    boolean block = false;
+    if (n >= BLOCK_PAGES) {
+        u64 p = balloon_alloc_phys(b, PAGESIZE_2M);
+        if (p != INVALID_PHYSICAL) {
+            balloon_fill_block_pfns(pfns, p);
+            vector_push(b->blocks, pointer_from_u64(p));
+            count = BLOCK_PAGES;
+            block = true;
+        }
+    }
+    if (!block) {
+        while (count < MIN(n, MAX_PFNS)) {
+            u64 p = balloon_alloc_phys(b, PAGESIZE);
+            if (p == INVALID_PHYSICAL)
+                break;
+            pfns[count++] = p >> VIRTIO_BALLOON_PFN_SHIFT;
+            vector_push(b->pages, pointer_from_u64(p));
+        }
+    }
+    if (count == 0) {
+        virtio_balloon_debug("%s: out of memory\n", __func__);
+        return;
+    }
+
+    vqmsg m = allocate_vqmsg(b->inflateq);
+    assert(m != INVALID_ADDRESS);
+    vqmsg_push(b->inflateq, m, pfns, count * sizeof(u32), false);
+    b->inflating = true;
+    vqmsg_commit(b->inflateq, m, closure(b->general, inflate_complete, b, count, block));
+}
+
+closure_function(3, 1, void, deflate_complete,
+                 balloon, b, u32, count, boolean, block,
+                 u64, len)
+{
+    balloon b = bound(b);
+    u32 *pfns = b->deflate_pfns;
+    if (bound(block)) {
+        deallocate_u64(b->physical, (u64)pfns[0] << VIRTIO_BALLOON_PFN_SHIFT, PAGESIZE_2M);
+    } else {
+        for (int i = 0; i < bound(count); i++)
+            deallocate_u64(b->physical, (u64)pfns[i] << VIRTIO_BALLOON_PFN_SHIFT, PAGESIZE);
+    }
+    spin_lock(&b->lock);
+    b->actual -= bound(count);
+    b->deflating = false;
+    balloon_write_actual(b);
+    spin_unlock(&b->lock);
+    virtio_balloon_debug("%s: %d pages%s, actual %d\n", __func__, bound(count),
+                         bound(block) ? " (block)" : "", b->actual);
+    enqueue(runqueue, b->update);
+    closure_finish();
+}
+
+/* called with lock held */
+static void balloon_deflate(balloon b, u64 n)
+{
+    u32 *pfns = b->deflate_pfns;
+    u32 count = 0;
+    boolean block = false;
+    if (n >= BLOCK_PAGES && vector_length(b->blocks) > 0) {
+        balloon_fill_block_pfns(pfns, u64_from_pointer(vector_pop(b->blocks)));
+        count = BLOCK_PAGES;
+        block = true;
+    } else {
+        if (vector_length(b->pages) == 0 && vector_length(b->blocks) > 0) {
+            /* break up a block to return less than its size */
+            u64 p = u64_from_pointer(vector_pop(b->blocks));
+            for (int i = 0; i < BLOCK_PAGES; i++)
+                vector_push(b->pages, pointer_from_u64(p + i * PAGESIZE));
+        }
+        while (count < MIN(n, MAX_PFNS) && vector_length(b->pages) > 0)
+            pfns[count++] = u64_from_pointer(vector_pop(b->pages)) >> VIRTIO_BALLOON_PFN_SHIFT;
+    }
+    if (count == 0)
+        return;
+
+    vqmsg m = allocate_vqmsg(b->deflateq);
+    assert(m != INVALID_ADDRESS);
+    vqmsg_push(b->deflateq, m, pfns, count * sizeof(u32), false);
+    b->deflating = true;
+    vqmsg_commit(b->deflateq, m, closure(b->general, deflate_complete, b, count, block));
+}
+
+closure_function(1, 1, void, report_complete,
+                 balloon, b,
+                 u64, len)
+{
+    balloon b = bound(b);
+    spin_lock(&b->lock);
+    virtio_balloon_debug("%s: %d blocks\n", __func__, b->report_count);
+    for (int i = 0; i < b->report_count; i++)
+        deallocate_reported_physical_block(b->report_blocks[i]);
+    b->report_count = 0;
+    b->reporting = false;
+    spin_unlock(&b->lock);
+    enqueue(runqueue, b->update);
+    closure_finish();
+}
+
+static boolean balloon_report_room(balloon b)
+{
+    return heap_total(b->physical) - heap_allocated(b->physical) >= REPORT_RESERVE + PAGESIZE_2M;
+}
+
+/* called with lock held */
+static void balloon_report(balloon b)
+{
+    int n = 0;
+    u64 budget = REPORT_SCAN;
+    while (n < REPORT_BATCH && balloon_report_room(b)) {
+        u64 p = allocate_unreported_physical_block(&b->report_cursor, &budget);
+        if (p == INVALID_PHYSICAL)
+            break;
+        b->report_blocks[n++] = p;
+    }
+    if (n == 0)
+        return;
+
+    vqmsg m = allocate_vqmsg(b->reportq);
+    assert(m != INVALID_ADDRESS);
+    for (int i = 0; i < n; i++)
+        vqmsg_push_phys(b->reportq, m, b->report_blocks[i], PAGESIZE_2M, true);
+    b->report_count = n;
+    b->reporting = true;
+    vqmsg_commit(b->reportq, m, closure(b->general, report_complete, b));
+}
+
+closure_function(1, 0, void, balloon_update,
+                 balloon, b)
+{
+    balloon b = bound(b);
+    spin_lock(&b->lock);
+    if (!b->inflating && !b->deflating) {
+        u32 target = pci_bar_read_4(&b->v->device_config, VIRTIO_BALLOON_R_NUM_PAGES);
+        if (target > b->actual)
+            balloon_inflate(b, target - b->actual);
+        else if (target < b->actual)
+            balloon_deflate(b, b->actual - target);
+    }
+    if (b->reportq && !b->reporting)
+        balloon_report(b);
+    spin_unlock(&b->lock);
+}
+
+closure_function(1, 0, void, balloon_config_change,
+                 balloon, b)
+{
+    enqueue(runqueue, bound(b)->update);
+}
+
+closure_function(1, 1, void, balloon_timer,
+                 balloon, b,
+                 u64, overruns)
+{
+    apply(bound(b)->update);
+}
+
+/* Queue completions are only signalled through MSI-X, with a table
+   entry per queue; without an entry to spare for config changes, the
+   target is picked up by the poll timer. */
+static boolean virtio_balloon_attach(heap general, heap page_allocator, heap physical, pci_dev d)
+{
+    int msix_count = pci_get_msix_count(d);
+    balloon b = allocate_zero(general, sizeof(struct balloon));
+    assert(b != INVALID_ADDRESS);
+    b->v = attach_vtpci(general, page_allocator, d, VIRTIO_BALLOON_F_MUST_TELL_HOST |
+                        VIRTIO_BALLOON_F_REPORTING | VIRTIO_F_RING_PACKED);
+    b->general = general;
+    b->physical = physical;
+    spin_lock_init(&b->lock);
+    b->pages = allocate_vector(general, MAX_PFNS);
+    b->blocks = allocate_vector(general, 8);
+    b->inflate_pfns = allocate(page_allocator, MAX_PFNS * sizeof(u32));
+    b->deflate_pfns = allocate(page_allocator, MAX_PFNS * sizeof(u32));
+    assert(b->inflate_pfns != INVALID_ADDRESS && b->deflate_pfns != INVALID_ADDRESS);
+    b->update = closure(general, balloon_update, b);
+
+    status s = vtpci_alloc_virtqueue(b->v, "virtio balloon inflate", 0, &b->inflateq);
+    if (is_ok(s))
+        s = vtpci_alloc_virtqueue(b->v, "virtio balloon deflate", 1, &b->deflateq);
+    if (!is_ok(s)) {
+        msg_err("%v\n", s);
+        vtpci_set_status(b->v, VIRTIO_CONFIG_STATUS_FAILED);
+        deallocate_closure(b->update);
+        deallocate(page_allocator, b->deflate_pfns, MAX_PFNS * sizeof(u32));
+        deallocate(page_allocator, b->inflate_pfns, MAX_PFNS * sizeof(u32));
+        deallocate_vector(b->blocks);
+        deallocate_vector(b->pages);
+        deallocate(general, b, sizeof(struct balloon));
+        return false;
+    }
+    int nqueues = 2;
+    if (b->v->features & VIRTIO_BALLOON_F_REPORTING) {
+        /* queues follow those of offered features, negotiated or not */
+        if (b->v->dev_features & VIRTIO_BALLOON_F_STATS_VQ)
+            nqueues++;
+        if (b->v->dev_features & VIRTIO_BALLOON_F_FREE_PAGE_HINT)
+            nqueues++;
+        s = nqueues < msix_count ?
+            vtpci_alloc_virtqueue(b->v, "virtio balloon reporting", nqueues, &b->reportq) :
+            timm("status", "no MSI-X entry for reporting queue");
+        nqueues++;
+        if (is_ok(s)) {
+            init_physical_reporting(general);
+        } else {
+            msg_warn("%v; free page reporting disabled\n", s);
+            b->reportq = 0;
+        }
+    }
+    s = nqueues < msix_count ?
+        vtpci_set_config_handler(b->v, nqueues, closure(general, balloon_config_change, b),
+                                 "virtio balloon config") :
+        timm("status", "no MSI-X entry for config changes");
+    if (!is_ok(s))
+        virtio_balloon_debug("%s: %v; polling only\n", __func__, s);
+    vtpci_set_status(b->v, VIRTIO_CONFIG_STATUS_DRIVER_OK);
+    virtio_balloon_debug("%s: features 0x%lx, target %d pages\n", __func__, b->v->features,
+                         pci_bar_read_4(&b->v->device_config, VIRTIO_BALLOON_R_NUM_PAGES));
+
+    pagecache_set_drain_notify(b->update);
+    register_timer(runloop_timers, CLOCK_ID_MONOTONIC, POLL_INTERVAL, false, POLL_INTERVAL,
+                   closure(general, balloon_timer, b));
+    enqueue(runqueue, b->update);
+    return true;
+}
+
+closure_function(3, 1, boolean, virtio_balloon_probe,
+                 heap, general, heap, page_allocator, heap, physical,
+                 pci_dev, d)
+{
+    if (!vtpci_probe(d, VIRTIO_ID_BALLOON))
+        return false;
+
+    /* e.g. QEMU's virtio-balloon-pci, which has no MSI-X capability */
+    if (pci_get_msix_count(d) < 2) {
+        msg_warn("virtio balloon without MSI-X vectors for its queues; not attaching\n");
+        return false;
+    }
+    return virtio_balloon_attach(bound(general), bound(page_allocator), bound(physical), d);
+}
+
+void init_virtio_balloon(kernel_heaps kh)
+{
+    heap h = heap_general(kh);
+    register_pci_driver(closure(h, virtio_balloon_probe, h, heap_backed(kh), (heap)heap_physical(kh)));
+}
@@ -58,6 +58,9 @@ typedef closure_type(vqfinish, void, u64);
 /* Modern device */
 #define VIRTIO_F_VERSION_1 U64_FROM_BIT(32)
 
+/* Packed virtqueue layout (modern devices only) */
+#define VIRTIO_F_RING_PACKED U64_FROM_BIT(34)
+
 void vtpci_notify_virtqueue(vtpci sc, u16 queue, bytes notify_offset);
 
 status virtqueue_alloc(vtpci dev,
@@ -90,4 +93,6 @@ typedef struct vqmsg *vqmsg;
 vqmsg allocate_vqmsg(virtqueue vq);
 void deallocate_vqmsg(virtqueue vq, vqmsg m);
 void vqmsg_push(virtqueue vq, vqmsg m, void * addr, u32 len, boolean write);
+void vqmsg_push_phys(virtqueue vq, vqmsg m, physical p, u32 len, boolean write);
+void vqmsg_push_pages(virtqueue vq, vqmsg m, void * addr, u32 len, boolean write);
 void vqmsg_commit(virtqueue vq, vqmsg m, vqfinish completion);
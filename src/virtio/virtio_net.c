@@ -95,10 +95,16 @@ static err_t low_level_output(struct netif *netif, struct pbuf *p)
 
     pbuf_ref(p);
 
-    for (struct pbuf * q = p; q != NULL; q = q->next)
-        vqmsg_push(vn->txq, m, q->payload, q->len, false);
+    /* PBUF_ROM / PBUF_REF payloads may reference user memory (zero-copy
+       transmit) and thus cross physically discontiguous pages */
+    for (struct pbuf * q = p; q != NULL; q = q->next) {
+        if (q->type_internal & PBUF_TYPE_FLAG_STRUCT_DATA_CONTIGUOUS)
+            vqmsg_push(vn->txq, m, q->payload, q->len, false);
+        else
+            vqmsg_push_pages(vn->txq, m, q->payload, q->len, false);
+    }
 
-    vqmsg_commit(vn->txq, m, closure(vn->dev->general, tx_complete, p));
+    vqmsg_commit(vn->txq, m, closure_from_pool(vn->dev->general, tx_complete, p));
     
     MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
     if (((u8_t *)p->payload)[0] & 1) {
@@ -165,7 +171,7 @@ static void post_receive(vnet vn)
     vqmsg m = allocate_vqmsg(vn->rxq);
     assert(m != INVALID_ADDRESS);
     vqmsg_push(vn->rxq, m, x+1, vn->rxbuflen, true);
-    vqmsg_commit(vn->rxq, m, closure(vn->dev->general, input, x));
+    vqmsg_commit(vn->rxq, m, closure_from_pool(vn->dev->general, input, x));
 }
 
 void lwip_status_callback(struct netif *netif);
@@ -205,7 +211,7 @@ static void virtio_net_attach(heap general, heap page_allocator, pci_dev d)
     //    VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6 |  VIRTIO_NET_F_GUEST_ECN|
     //    VIRTIO_NET_F_GUEST_UFO | VIRTIO_NET_F_CTRL_VLAN | VIRTIO_NET_F_MQ;
 
-    vtpci dev = attach_vtpci(general, page_allocator, d, VIRTIO_NET_F_MAC);
+    vtpci dev = attach_vtpci(general, page_allocator, d, VIRTIO_NET_F_MAC | VIRTIO_F_RING_PACKED);
     vnet vn = allocate(dev->general, sizeof(struct vnet));
     vn->n = allocate(dev->general, sizeof(struct netif));
     vn->net_header_len = vtpci_is_modern(dev) || (dev->features & VIRTIO_NET_F_MRG_RXBUF) != 0 ?
@@ -220,6 +220,18 @@ status vtpci_alloc_virtqueue(vtpci dev,
     return STATUS_OK;
 }
 
+/* Device configuration changes are signalled through MSI-X table
+   entry msi_slot, which must not be one used by a queue. */
+status vtpci_set_config_handler(vtpci dev, int msi_slot, thunk handler, const char *name)
+{
+    pci_setup_msix(dev->dev, msi_slot, handler, name);
+    pci_bar_write_2(&dev->common_config, dev->regs[VTPCI_REG_CONFIG_MSIX_VECTOR], msi_slot);
+    int check_slot = pci_bar_read_2(&dev->common_config, dev->regs[VTPCI_REG_CONFIG_MSIX_VECTOR]);
+    if (check_slot != msi_slot)
+        return timm("status", "cannot configure config change MSI-X vector");
+    return STATUS_OK;
+}
+
 void vtpci_notify_virtqueue(vtpci dev, u16 queue, bytes notify_offset)
 {
     virtio_pci_debug("%s: queue %d, notify_offset 0x%x\n", __func__, queue, notify_offset);
@@ -232,6 +244,7 @@ static void vtpci_legacy_alloc_resources(vtpci dev)
     dev->regs[VTPCI_REG_QUEUE_SELECT] = VIRTIO_PCI_QUEUE_SEL;
     dev->regs[VTPCI_REG_QUEUE_SIZE] = VIRTIO_PCI_QUEUE_NUM;
     dev->regs[VTPCI_REG_QUEUE_MSIX_VECTOR] = VIRTIO_MSI_QUEUE_VECTOR;
+    dev->regs[VTPCI_REG_CONFIG_MSIX_VECTOR] = VIRTIO_MSI_CONFIG_VECTOR;
 
     pci_bar_init(dev->dev, &dev->common_config, 0, 0, -1);
     runtime_memcpy(&dev->notify_config, &dev->common_config, sizeof(dev->notify_config));
@@ -266,6 +279,7 @@ static void vtpci_modern_alloc_resources(vtpci dev)
     dev->regs[VTPCI_REG_QUEUE_SELECT] = VTPCI_R_QUEUE_SELECT;
     dev->regs[VTPCI_REG_QUEUE_SIZE] = VTPCI_R_QUEUE_SIZE;
     dev->regs[VTPCI_REG_QUEUE_MSIX_VECTOR] = VTPCI_R_QUEUE_MSIX_VECTOR;
+    dev->regs[VTPCI_REG_CONFIG_MSIX_VECTOR] = VTPCI_R_MSIX_CONFIG;
 
     // scan PCI capabilities
     vtpci_modern_find_cap(dev, VIRTIO_PCI_CAP_COMMON_CFG, &dev->common_config);
@@ -44,6 +44,7 @@ enum {
     VTPCI_REG_QUEUE_SELECT,
     VTPCI_REG_QUEUE_SIZE,
     VTPCI_REG_QUEUE_MSIX_VECTOR,
+    VTPCI_REG_CONFIG_MSIX_VECTOR,
     VTPCI_REG_MAX
 };
 
@@ -89,6 +90,7 @@ struct vtpci {
 boolean vtpci_probe(pci_dev d, int virtio_dev_id);
 vtpci attach_vtpci(heap h, heap page_allocator, pci_dev d, u64 feature_mask);
 status vtpci_alloc_virtqueue(vtpci dev, const char *name, int idx, struct virtqueue **result);
+status vtpci_set_config_handler(vtpci dev, int msi_slot, thunk handler, const char *name);
 void vtpci_set_status(vtpci dev, u8 status);
 boolean vtpci_is_modern(vtpci dev);
 
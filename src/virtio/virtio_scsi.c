@@ -432,7 +432,7 @@ static void virtio_scsi_report_luns(virtio_scsi s, storage_attach a, u16 target)
 static void virtio_scsi_attach(heap general, storage_attach a, heap page_allocator, heap pages, pci_dev _dev)
 {
     virtio_scsi s = allocate(general, sizeof(struct virtio_scsi));
-    s->v = attach_vtpci(general, page_allocator, _dev, 0);
+    s->v = attach_vtpci(general, page_allocator, _dev, VIRTIO_F_RING_PACKED);
 
     virtio_scsi_debug("features 0x%lx\n", s->v->features);
 
@@ -160,7 +160,7 @@ closure_function(1, 3, void, storage_read,
 static void virtio_blk_attach(heap general, storage_attach a, heap page_allocator, heap pages, pci_dev d)
 {
     storage s = allocate(general, sizeof(struct storage));
-    s->v = attach_vtpci(general, page_allocator, d, 0);
+    s->v = attach_vtpci(general, page_allocator, d, VIRTIO_F_RING_PACKED);
 
     s->block_size = pci_bar_read_4(&s->v->device_config, VIRTIO_BLK_R_BLOCK_SIZE);
     s->capacity = (pci_bar_read_4(&s->v->device_config, VIRTIO_BLK_R_CAPACITY_LOW) |
@@ -77,6 +77,28 @@ struct vring_used {
     struct vring_used_elem ring[0];
 } __attribute__((packed));
 
+/* Packed ring (VIRTIO_F_RING_PACKED): a single descriptor ring written
+   by both sides, with ownership tracked by the avail/used flag bits
+   relative to each side's wrap counter. */
+#define VRING_PACKED_DESC_F_AVAIL       U64_FROM_BIT(7)
+#define VRING_PACKED_DESC_F_USED        U64_FROM_BIT(15)
+
+#define VRING_PACKED_EVENT_FLAG_ENABLE  0
+#define VRING_PACKED_EVENT_FLAG_DISABLE 1
+#define VRING_PACKED_EVENT_FLAG_DESC    2
+
+struct vring_packed_desc {
+    u64 busaddr;
+    u32 len;
+    u16 id;                     /* buffer id, written on last descriptor of chain by device */
+    u16 flags;
+} __attribute__((packed));
+
+struct vring_packed_desc_event {
+    u16 off_wrap;
+    u16 flags;
+} __attribute__((packed));
+
 typedef struct vqmsg {
     struct list l;              /* vq->msgqueue when queued, or chained for bh process */
     union {
@@ -99,8 +121,16 @@ typedef struct virtqueue {
     volatile struct vring_desc *desc;
     volatile struct vring_avail *avail;
     volatile struct vring_used *used;    
+    volatile struct vring_packed_desc *packed_desc;
+    volatile struct vring_packed_desc_event *driver_event;
+    volatile struct vring_packed_desc_event *device_event;
+    boolean packed;
+    boolean avail_wrap;         /* packed: driver ring wrap counter */
+    boolean used_wrap;          /* packed: device ring wrap counter */
+    u16 next_avail_idx;         /* packed: next descriptor slot to fill */
+    u16 *id_next;               /* packed: buffer id free list links */
     u64 free_cnt;               /* atomic */
-    u16 desc_idx;               /* head of descriptor free list */
+    u16 desc_idx;               /* head of descriptor (or packed buffer id) free list */
     u16 last_used_idx;          /* irq only */
     int max_queued;
     struct list msgqueue;
@@ -133,17 +163,41 @@ void deallocate_vqmsg(virtqueue vq, vqmsg m)
     deallocate(vq->dev->general, m, sizeof(struct vqmsg));
 }
 
-void vqmsg_push(virtqueue vq, vqmsg m, void * addr, u32 len, boolean write)
+void vqmsg_push_phys(virtqueue vq, vqmsg m, physical p, u32 len, boolean write)
 {
     buffer_extend(m->descv, (m->count + 1) * sizeof(struct vring_desc));
     struct vring_desc * d = buffer_ref(m->descv, m->count * sizeof(struct vring_desc));
-    d->busaddr = physical_from_virtual(addr);
+    d->busaddr = p;
     d->len = len;
     d->flags = write ? VRING_DESC_F_WRITE : 0;
     d->next = 0;
     m->count++;
 }
 
+void vqmsg_push(virtqueue vq, vqmsg m, void * addr, u32 len, boolean write)
+{
+    vqmsg_push_phys(vq, m, physical_from_virtual(addr), len, write);
+}
+
+/* For buffers which may not be physically contiguous, such as user pages
+   referenced by zero-copy transmit; adds a descriptor for each run of
+   contiguous physical pages. */
+void vqmsg_push_pages(virtqueue vq, vqmsg m, void * addr, u32 len, boolean write)
+{
+    u64 va = u64_from_pointer(addr);
+    while (len > 0) {
+        physical p = physical_from_virtual(pointer_from_u64(va));
+        assert(p != INVALID_PHYSICAL);
+        u32 seglen = MIN(len, PAGESIZE - (va & PAGEMASK));
+        while (seglen < len &&
+               physical_from_virtual(pointer_from_u64(va + seglen)) == p + seglen)
+            seglen += MIN(len - seglen, PAGESIZE);
+        vqmsg_push_phys(vq, m, p, seglen, write);
+        va += seglen;
+        len -= seglen;
+    }
+}
+
 static void virtqueue_fill(virtqueue vq);
 
 void vqmsg_commit(virtqueue vq, vqmsg m, vqfinish completion)
@@ -154,19 +208,18 @@ void vqmsg_commit(virtqueue vq, vqmsg m, vqfinish completion)
     virtqueue_fill(vq);
 }
 
-closure_function(1, 0, void, vq_interrupt,
-                 virtqueue, vq)
+static inline void virtqueue_complete_msg(virtqueue vq, vqmsg m, u64 len, list q)
+{
+    fetch_and_add(&vq->free_cnt, m->count);
+    m->len = len;
+    virtqueue_debug("add msg %p\n", m);
+    list_insert_before(q, &m->l);
+}
+
+/* called with fill_lock held */
+static int virtqueue_collect_split(virtqueue vq, list q)
 {
-    // ensure we see up-to-date used->idx (updated by host)
-    memory_barrier();
-    virtqueue vq = bound(vq);
-    virtqueue_debug_verbose("%s: ENTRY: vq %s: entries %d, last_used_idx %d, used->idx %d, desc_idx %d\n",
-        __func__, vq->name, vq->entries, vq->last_used_idx, vq->used->idx, vq->desc_idx);
-    
     int processed = 0;
-    struct list q;
-    list_init(&q);
-    spin_lock(&vq->fill_lock);
     while (vq->last_used_idx != vq->used->idx) {
         volatile struct vring_used_elem *uep = vq->used->ring + (vq->last_used_idx & (vq->entries - 1));
         virtqueue_debug_verbose("%s: vq %s: last_used_idx %d, id %d, len %d\n",
@@ -187,12 +240,69 @@ closure_function(1, 0, void, vq_interrupt,
 
         vq->last_used_idx++;
         processed++;
-        fetch_and_add(&vq->free_cnt, m->count);
-        m->len = uep->len;
         vq->msgs[head] = 0;
-        virtqueue_debug("add msg %p\n", m);
-        list_insert_before(&q, &m->l);
+        virtqueue_complete_msg(vq, m, uep->len, q);
+    }
+    return processed;
+}
+
+static inline boolean packed_desc_is_used(virtqueue vq, u16 flags)
+{
+    boolean avail = (flags & VRING_PACKED_DESC_F_AVAIL) != 0;
+    boolean used = (flags & VRING_PACKED_DESC_F_USED) != 0;
+    return avail == used && used == vq->used_wrap;
+}
+
+/* called with fill_lock held */
+static int virtqueue_collect_packed(virtqueue vq, list q)
+{
+    int processed = 0;
+    while (1) {
+        volatile struct vring_packed_desc *d = vq->packed_desc + vq->last_used_idx;
+        if (!packed_desc_is_used(vq, d->flags))
+            break;
+
+        /* don't read id and len before the flags indicating ownership */
+        read_barrier();
+        u16 id = d->id;
+        virtqueue_debug_verbose("%s: vq %s: last_used_idx %d, id %d, len %d\n",
+            __func__, vq->name, vq->last_used_idx, id, d->len);
+        assert(id < vq->entries);
+        vqmsg m = vq->msgs[id];
+        assert(m);
+
+        /* device writes one used descriptor per chain; skip the rest */
+        vq->last_used_idx += m->count;
+        if (vq->last_used_idx >= vq->entries) {
+            vq->last_used_idx -= vq->entries;
+            vq->used_wrap = !vq->used_wrap;
+        }
+
+        /* return buffer id to free list */
+        vq->id_next[id] = vq->desc_idx;
+        vq->desc_idx = id;
+
+        processed++;
+        vq->msgs[id] = 0;
+        virtqueue_complete_msg(vq, m, d->len, q);
     }
+    return processed;
+}
+
+closure_function(1, 0, void, vq_interrupt,
+                 virtqueue, vq)
+{
+    // ensure we see up-to-date used->idx (updated by host)
+    memory_barrier();
+    virtqueue vq = bound(vq);
+    virtqueue_debug_verbose("%s: ENTRY: vq %s: entries %d, last_used_idx %d, desc_idx %d\n",
+        __func__, vq->name, vq->entries, vq->last_used_idx, vq->desc_idx);
+    
+    struct list q;
+    list_init(&q);
+    spin_lock(&vq->fill_lock);
+    int processed = vq->packed ? virtqueue_collect_packed(vq, &q) :
+        virtqueue_collect_split(vq, &q);
     spin_unlock(&vq->fill_lock);
 
     if (processed > 0) {
@@ -240,22 +350,35 @@ status virtqueue_alloc(vtpci dev,
 {
     u64 vq_alloc_size = sizeof(struct virtqueue) + size * sizeof(vqmsg);
     virtqueue vq = allocate(dev->general, vq_alloc_size);
-    vq->avail_offset = size * sizeof(struct vring_desc);
-    vq->used_offset = pad(vq->avail_offset + sizeof(*vq->avail) + sizeof(vq->avail->ring[0]) * size, align);
-    bytes alloc = vq->used_offset + pad(sizeof(*vq->used) + sizeof(vq->used->ring[0]) * size, align);
-    
     if (vq == INVALID_ADDRESS) 
         return timm("status", "cannot allocate virtqueue");
+
+    /* For the packed layout, the "avail" and "used" areas are the driver
+       and device event suppression structures, respectively. */
+    vq->packed = (dev->features & VIRTIO_F_RING_PACKED) != 0;
+    bytes alloc;
+    if (vq->packed) {
+        vq->avail_offset = size * sizeof(struct vring_packed_desc);
+        vq->used_offset = vq->avail_offset + sizeof(struct vring_packed_desc_event);
+        alloc = pad(vq->used_offset + sizeof(struct vring_packed_desc_event), align);
+    } else {
+        vq->avail_offset = size * sizeof(struct vring_desc);
+        vq->used_offset = pad(vq->avail_offset + sizeof(*vq->avail) + sizeof(vq->avail->ring[0]) * size, align);
+        alloc = vq->used_offset + pad(sizeof(*vq->used) + sizeof(vq->used->ring[0]) * size, align);
+    }
     
     vq->dev = dev;
     vq->name = name;
-    virtqueue_debug("%s: vq %s: idx %d, size %d, alloc %d\n",
-                    __func__, vq->name, queue, size, alloc);
+    virtqueue_debug("%s: vq %s: idx %d, size %d, alloc %d, packed %d\n",
+                    __func__, vq->name, queue, size, alloc, vq->packed);
     vq->queue_index = queue;
     vq->notify_offset = notify_offset;
     vq->entries = size;
     vq->free_cnt = size;
     vq->max_queued = 0;
+    vq->id_next = 0;
+    vq->desc_idx = 0;
+    vq->last_used_idx = 0;
     list_init(&vq->msgqueue);
     vq->servicequeue = allocate_queue(dev->general, 512);
     assert(vq->servicequeue != INVALID_ADDRESS);
@@ -267,16 +390,44 @@ status virtqueue_alloc(vtpci dev,
         return(timm("status", "cannot allocate memory for virtqueue ring"));
     }
 
-    vq->desc = (struct vring_desc *) vq->ring_mem;
-    vq->avail = (struct vring_avail *) (vq->ring_mem + vq->avail_offset);
-    vq->used = (struct vring_used *) (vq->ring_mem + vq->used_offset);
-    virtqueue_debug("%s: vq %p: desc %p, avail %p, used %p\n",
-        __func__, vq, vq->desc, vq->avail, vq->used);
-
-    // initialize descriptor chains
-    for (int i = 0; i < vq->entries - 1; i++)
-        vq->desc[i].next = i + 1;
-    vq->desc[vq->entries - 1].next = VQ_RING_DESC_CHAIN_END;
+    if (vq->packed) {
+        vq->id_next = allocate(dev->general, size * sizeof(u16));
+        if (vq->id_next == INVALID_ADDRESS) {
+            deallocate(dev->contiguous, vq->ring_mem, alloc);
+            deallocate(dev->general, vq, vq_alloc_size);
+            return timm("status", "cannot allocate virtqueue buffer ids");
+        }
+        vq->desc = 0;
+        vq->avail = 0;
+        vq->used = 0;
+        vq->packed_desc = (struct vring_packed_desc *) vq->ring_mem;
+        vq->driver_event = (struct vring_packed_desc_event *) (vq->ring_mem + vq->avail_offset);
+        vq->device_event = (struct vring_packed_desc_event *) (vq->ring_mem + vq->used_offset);
+        virtqueue_debug("%s: vq %p: desc %p, driver event %p, device event %p\n",
+            __func__, vq, vq->packed_desc, vq->driver_event, vq->device_event);
+        vq->avail_wrap = true;
+        vq->used_wrap = true;
+        vq->next_avail_idx = 0;
+
+        // initialize buffer id free list
+        for (int i = 0; i < vq->entries - 1; i++)
+            vq->id_next[i] = i + 1;
+        vq->id_next[vq->entries - 1] = VQ_RING_DESC_CHAIN_END;
+    } else {
+        vq->packed_desc = 0;
+        vq->driver_event = 0;
+        vq->device_event = 0;
+        vq->desc = (struct vring_desc *) vq->ring_mem;
+        vq->avail = (struct vring_avail *) (vq->ring_mem + vq->avail_offset);
+        vq->used = (struct vring_used *) (vq->ring_mem + vq->used_offset);
+        virtqueue_debug("%s: vq %p: desc %p, avail %p, used %p\n",
+            __func__, vq, vq->desc, vq->avail, vq->used);
+
+        // initialize descriptor chains
+        for (int i = 0; i < vq->entries - 1; i++)
+            vq->desc[i].next = i + 1;
+        vq->desc[vq->entries - 1].next = VQ_RING_DESC_CHAIN_END;
+    }
 
     *t = closure(dev->general, vq_interrupt, vq);
     *vqp = vq;
@@ -314,17 +465,87 @@ static int virtqueue_notify(virtqueue vq)
     // ensure used->flags update is visible to us
     // and updated avail->idx is visible to host
     memory_barrier();
-    int should_notify = (vq->used->flags & VRING_USED_F_NO_NOTIFY) == 0;
+    int should_notify = vq->packed ?
+        vq->device_event->flags != VRING_PACKED_EVENT_FLAG_DISABLE :
+        (vq->used->flags & VRING_USED_F_NO_NOTIFY) == 0;
     if (should_notify)
         vtpci_notify_virtqueue(vq->dev, vq->queue_index, vq->notify_offset);
     return should_notify;
 }
 
+static void virtqueue_enqueue_split(virtqueue vq, vqmsg m)
+{
+    u16 head = vq->desc_idx;
+    vq->msgs[head] = m;
+
+    for (int i = 0; i < m->count; i++) {
+        struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
+        volatile struct vring_desc *d = vq->desc + vq->desc_idx;
+        d->busaddr = src->busaddr;
+        d->len = src->len;
+        d->flags = src->flags;
+        if (i < m->count - 1)
+            d->flags |= VRING_DESC_F_NEXT;
+        vq->desc_idx = d->next;
+
+        virtqueue_debug_verbose("%s: vq %s: msg %p (count %d): desc->flags 0x%x, desc->next %d\n",
+            __func__, vq->name, m, m->count, d->flags, d->next);
+    }
+
+    u16 avail_idx = vq->avail->idx & (vq->entries - 1);
+    vq->avail->ring[avail_idx] = head;
+    virtqueue_debug_verbose("%s: vq %s: msg %p (count %d): avail->ring[%d] = %d\n",
+        __func__, vq->name, m, m->count, avail_idx, head);
+
+    // ensure desc and avail ring updates above are visible before updating avail->idx
+    write_barrier();
+    vq->avail->idx++;
+}
+
+static void virtqueue_enqueue_packed(virtqueue vq, vqmsg m)
+{
+    u16 id = vq->desc_idx;
+    assert(id != VQ_RING_DESC_CHAIN_END);
+    vq->desc_idx = vq->id_next[id];
+    vq->msgs[id] = m;
+
+    u16 head = vq->next_avail_idx;
+    u16 head_flags = 0;
+    for (int i = 0; i < m->count; i++) {
+        struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
+        volatile struct vring_packed_desc *d = vq->packed_desc + vq->next_avail_idx;
+        d->busaddr = src->busaddr;
+        d->len = src->len;
+        d->id = id;
+        u16 flags = src->flags & VRING_DESC_F_WRITE;
+        if (i < m->count - 1)
+            flags |= VRING_DESC_F_NEXT;
+        flags |= vq->avail_wrap ? VRING_PACKED_DESC_F_AVAIL : VRING_PACKED_DESC_F_USED;
+
+        /* the head is made available last, after the rest of the chain */
+        if (i == 0)
+            head_flags = flags;
+        else
+            d->flags = flags;
+
+        virtqueue_debug_verbose("%s: vq %s: msg %p (count %d): slot %d, id %d, flags 0x%x\n",
+            __func__, vq->name, m, m->count, vq->next_avail_idx, id, flags);
+        if (++vq->next_avail_idx == vq->entries) {
+            vq->next_avail_idx = 0;
+            vq->avail_wrap = !vq->avail_wrap;
+        }
+    }
+
+    // ensure the whole chain is visible before exposing the head descriptor
+    write_barrier();
+    vq->packed_desc[head].flags = head_flags;
+}
+
 /* called from interrupt level or with ints disabled */
 static void virtqueue_fill(virtqueue vq)
 {
-    virtqueue_debug("%s: ENTRY: vq %s: entries %d, desc_idx %d, avail->idx %d, avail->flags 0x%x\n",
-        __func__, vq->name, vq->entries, vq->desc_idx, vq->avail->idx, vq->avail->flags);
+    virtqueue_debug("%s: ENTRY: vq %s: entries %d, desc_idx %d, free_cnt %ld\n",
+        __func__, vq->name, vq->entries, vq->desc_idx, vq->free_cnt);
 
     /* irqs already disabled */
     spin_lock(&vq->fill_lock);
@@ -345,34 +566,13 @@ static void virtqueue_fill(virtqueue vq)
         }
 
         assert(m->completion);
-        u16 head = vq->desc_idx;
-        vq->msgs[head] = m;
-
-        for (int i = 0; i < m->count; i++) {
-            struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
-            volatile struct vring_desc *d = vq->desc + vq->desc_idx;
-            d->busaddr = src->busaddr;
-            d->len = src->len;
-            d->flags = src->flags;
-            if (i < m->count - 1)
-                d->flags |= VRING_DESC_F_NEXT;
-            vq->desc_idx = d->next;
-
-            virtqueue_debug_verbose("%s: vq %s: msg %p (count %d): desc->flags 0x%x, desc->next %d\n",
-                __func__, vq->name, m, m->count, d->flags, d->next);
-        }
-
-        u16 avail_idx = vq->avail->idx & (vq->entries - 1);
-        vq->avail->ring[avail_idx] = head;
-        virtqueue_debug_verbose("%s: vq %s: msg %p (count %d): avail->ring[%d] = %d\n",
-            __func__, vq->name, m, m->count, avail_idx, head);
+        if (vq->packed)
+            virtqueue_enqueue_packed(vq, m);
+        else
+            virtqueue_enqueue_split(vq, m);
         fetch_and_add(&vq->free_cnt, -m->count);
         added++;
 
-        // ensure desc and avail ring updates above are visible before updating avail->idx
-        write_barrier();
-        vq->avail->idx++;
-
         list nn = list_get_next(n);
         list_delete(n);
         n = nn;
@@ -20,5 +20,7 @@ void init_clock(void)
     cpuid(0x80000001, 0, regs);
     __vdso_dat->clock_src = VDSO_CLOCK_SYSCALL;
     __vdso_dat->platform_has_rdtscp = (regs[3] & U64_FROM_BIT(27)) != 0;
+    cpuid(0x7, 0, regs);
+    __vdso_dat->platform_has_rdpid = (regs[2] & U64_FROM_BIT(22)) != 0;
     __vdso_dat->rtc_offset = rtc_gettimeofday() << 32;
 }
@@ -2,54 +2,270 @@
 #include <page.h>
 #include <apic.h>
 
+/* TLB shootdown
+
+   Page table operations collect the addresses they invalidate into a
+   flush entry and finish with page_invalidate_sync(), which
+   invalidates locally and then sends a single ipi to each cpu that
+   may hold stale translations. Past FLUSH_THRESHOLD pages the entry
+   turns into a full flush.
+
+   Idle cpus are not interrupted; they are marked in
+   flush_deferred_mask and flush their whole tlb on the way out of
+   idle (see flush_idle_exit). The submitter takes a snapshot of
+   idle_cpu_mask, sets the deferred bits of the cpus idle in it, and
+   then samples the mask again; only cpus idle in both samples go
+   without an ipi. A waking cpu clears its idle bit before testing the
+   deferred bit, so a cpu leaving idle concurrently either flushes on
+   exit or gets the ipi.
+
+   Entries come from a static pool, as they are released from
+   interrupt context.
+
+   Kernel mappings are global (see map()), so a full flush only
+   reaches them when the entry invalidated a global pte. Where the
+   cpu has PCID and INVPCID, the address space is tagged with
+   ADDRESS_SPACE_PCID and full flushes use INVPCID instead of a cr3
+   reload or a CR4.PGE toggle. */
+
+#define FLUSH_THRESHOLD 32
+#define FLUSH_ENTRIES   16
+
+#define CR4_PGE         U64_FROM_BIT(7)
+#define CR4_PCIDE       U64_FROM_BIT(17)
+
+#define ADDRESS_SPACE_PCID      1
+
+#define INVPCID_SINGLE_CONTEXT  1
+#define INVPCID_ALL_GLOBAL      2
+
+struct flush_entry {
+    struct list l;
+    u64 pending;                /* cpus yet to invalidate */
+    boolean full;
+    boolean global;             /* a global (kernel) pte was invalidated */
+    int npages;
+    u64 pages[FLUSH_THRESHOLD];
+    thunk completion;
+};
+
 // in order to keep SMP_TEST conditionalized
 static boolean initialized = false;
-static queue flush_queue;
+static struct flush_entry flush_entries[FLUSH_ENTRIES];
+static u64 flush_entries_used;
+static struct list flush_pending;
+static struct spinlock flush_lock;
+static u64 flush_deferred_mask;
 static int flush_ipi;
-static heap flush_heap;
-
-typedef struct flush_entry {
-    struct refcount r;
-    u64 page; // or INVALID_ADDRESS for a full flush
-} *flush_entry;
+static boolean invpcid_enabled;
 
 static void invalidate (u64 page)
 {
-    asm volatile("invlpg (%0)" :: "r" (page) : "memory");            
+    asm volatile("invlpg (%0)" :: "r" (page) : "memory");
 }
 
-closure_function(0, 0, void, flush_handler)
+static inline void invpcid(u64 type, u64 pcid, u64 address)
+{
+    struct {
+        u64 pcid;
+        u64 address;
+    } desc = { pcid, address };
+    asm volatile("invpcid %0, %1" :: "m" (desc), "r" (type) : "memory");
+}
+
+/* Drop the non-global translations of the address space. flush_tlb()
+   takes the page table lock, which the submitter may be holding. */
+static void flush_local(void)
 {
-    flush_entry f = queue_peek(flush_queue);
-    if (f->page == INVALID_PHYSICAL) {
-        flush_tlb();
+    if (invpcid_enabled) {
+        invpcid(INVPCID_SINGLE_CONTEXT, ADDRESS_SPACE_PCID, 0);
     } else {
-        invalidate(f->page);
+        u64 base;
+        mov_from_cr("cr3", base);
+        mov_to_cr("cr3", base);
     }
-    if (refcount_release(&f->r))
-        deallocate(flush_heap, dequeue(flush_queue), sizeof(struct flush_entry));
 }
 
-void page_invalidate(u64 p, thunk completion)
+/* Drop all translations, including global ones */
+static void flush_local_global(void)
 {
-    if (initialized) {
-        flush_entry f = allocate(flush_heap, sizeof(struct flush_entry));
-        init_refcount(&f->r, total_processors, completion);
-        enqueue(flush_queue, f);
-        // we can choose to delay/amortize this
-        apic_ipi(TARGET_EXCLUSIVE_BROADCAST, 0, flush_ipi);        
+    if (invpcid_enabled) {
+        invpcid(INVPCID_ALL_GLOBAL, 0, 0);
     } else {
-        invalidate(p);
+        u64 cr4;
+        mov_from_cr("cr4", cr4);
+        if (cr4 & CR4_PGE) {
+            mov_to_cr("cr4", cr4 & ~CR4_PGE);
+            mov_to_cr("cr4", cr4);
+        } else {
+            flush_local();
+        }
+    }
+}
+
+static void flush_entry_invalidate(flush_entry f)
+{
+    if (f->full) {
+        if (f->global)
+            flush_local_global();
+        else
+            flush_local();
+    } else {
+        for (int i = 0; i < f->npages; i++)
+            invalidate(f->pages[i]);
+    }
+}
+
+static void release_flush_entry(flush_entry f)
+{
+    thunk completion = f->completion;
+    atomic_clear_bit(&flush_entries_used, f - flush_entries);
+    if (completion)
         apply(completion);
+}
+
+/* called with interrupts disabled */
+static void service_flush_entries(void)
+{
+    u64 cpu = current_cpu()->id;
+    struct list done;
+    list_init(&done);
+    spin_lock(&flush_lock);
+    list_foreach(&flush_pending, l) {
+        flush_entry f = struct_from_list(l, flush_entry, l);
+        if ((f->pending & U64_FROM_BIT(cpu)) == 0)
+            continue;
+        flush_entry_invalidate(f);
+        f->pending &= ~U64_FROM_BIT(cpu);
+        if (f->pending == 0) {
+            list_delete(&f->l);
+            list_insert_before(&done, &f->l);
+        }
+    }
+    spin_unlock(&flush_lock);
+    list_foreach(&done, l)
+        release_flush_entry(struct_from_list(l, flush_entry, l));
+}
+
+closure_function(0, 0, void, flush_handler)
+{
+    service_flush_entries();
+}
+
+flush_entry get_page_flush_entry(void)
+{
+    while (1) {
+        for (int i = 0; i < FLUSH_ENTRIES; i++) {
+            if (!atomic_test_and_set_bit(&flush_entries_used, i)) {
+                flush_entry f = &flush_entries[i];
+                f->pending = 0;
+                f->full = false;
+                f->global = false;
+                f->npages = 0;
+                f->completion = 0;
+                return f;
+            }
+        }
+        /* all entries are in flight; take care of any that wait on us */
+        u64 flags = irq_disable_save();
+        service_flush_entries();
+        irq_restore(flags);
+        kern_pause();
+    }
+}
+
+void page_invalidate(flush_entry f, u64 p, boolean global)
+{
+    if (global)
+        f->global = true;
+    if (f->full)
+        return;
+    if (f->npages == FLUSH_THRESHOLD) {
+        f->full = true;
+        return;
+    }
+    f->pages[f->npages++] = p;
+}
+
+void page_invalidate_sync(flush_entry f, thunk completion)
+{
+    f->completion = completion;
+    if (f->npages == 0 && !f->full) {
+        release_flush_entry(f);
+        return;
+    }
+
+    u64 flags = irq_disable_save();
+    flush_entry_invalidate(f);
+    if (!initialized) {
+        irq_restore(flags);
+        release_flush_entry(f);
+        return;
+    }
+
+    u64 self = current_cpu()->id;
+    u64 others = MASK(total_processors) & ~U64_FROM_BIT(self);
+    u64 idle = others & idle_cpu_mask;
+    for (u64 m = idle; m; m &= m - 1)
+        atomic_set_bit(&flush_deferred_mask, lsb(m));
+    memory_barrier();
+    idle &= idle_cpu_mask;
+    u64 targets = others & ~idle;
+    if (targets == 0) {
+        irq_restore(flags);
+        release_flush_entry(f);
+        return;
+    }
+
+    f->pending = targets;
+    spin_lock(&flush_lock);
+    list_insert_before(&flush_pending, &f->l);
+    spin_unlock(&flush_lock);
+    if (targets == others) {
+        apic_ipi(TARGET_EXCLUSIVE_BROADCAST, 0, flush_ipi);
+    } else {
+        for (u64 m = targets; m; m &= m - 1)
+            apic_ipi(lsb(m), 0, flush_ipi);
+    }
+    irq_restore(flags);
+}
+
+/* called by a cpu as it clears its bit in idle_cpu_mask */
+void flush_idle_exit(u64 cpu)
+{
+    if (flush_deferred_mask && atomic_test_and_clear_bit(&flush_deferred_mask, cpu))
+        flush_local_global();
+}
+
+/* Called on each cpu as it comes up. The page tables' low bits are
+   clear at this point, as required for setting CR4.PCIDE. */
+void flush_cpu_init(void)
+{
+    u32 v[4];
+    u64 cr4;
+    cpuid(0x1, 0, v);
+    boolean pcid = (v[2] & U64_FROM_BIT(17)) != 0;
+    cpuid(0x7, 0, v);
+    boolean invpcid = (v[1] & U64_FROM_BIT(10)) != 0;
+
+    mov_from_cr("cr4", cr4);
+    cr4 |= CR4_PGE;
+    if (pcid && invpcid)
+        cr4 |= CR4_PCIDE;
+    mov_to_cr("cr4", cr4);
+    if (pcid && invpcid) {
+        u64 base;
+        mov_from_cr("cr3", base);
+        mov_to_cr("cr3", (base & ~PAGEMASK) | ADDRESS_SPACE_PCID);
+        invpcid_enabled = true;
     }
 }
 
 void init_flush(heap h)
 {
-    flush_queue = allocate_queue(h, 128);
+    list_init(&flush_pending);
+    spin_lock_init(&flush_lock);
     flush_ipi = allocate_interrupt();
     register_interrupt(flush_ipi, closure(h, flush_handler), "flush ipi");
-    flush_heap = h; // xxx - not really
     initialized = true;
 }
-
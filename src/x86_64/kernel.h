@@ -10,6 +10,9 @@
 
 typedef u64 *context;
 
+#define ZERO_PAGE_POOL_SIZE     64
+#define ZERO_PAGE_REFILL        16
+
 context allocate_frame(heap h);
 void deallocate_frame(context);
 
@@ -55,6 +58,15 @@ typedef struct cpuinfo {
 
     /* leaky unix stuff */
     void *current_thread;
+
+    /* user contexts bound to this cpu */
+    struct queue *thread_queue;
+
+    /* pre-zeroed physical pages for demand paging, refilled while
+       idle, and the window through which they are zeroed */
+    u64 zero_window;
+    int zero_page_count;
+    u64 zero_pages[ZERO_PAGE_POOL_SIZE];
 } *cpuinfo;
 
 #define cpu_not_present 0
@@ -78,6 +90,17 @@ static inline void cpu_setgs(int cpu)
     write_msr(GS_MSR, addr);
 }
 
+/* rdtscp and rdpid return TSC_AUX, from which the vdso getcpu reads the cpu id */
+static inline void cpu_set_tsc_aux(int cpu)
+{
+    u32 v[4];
+    cpuid(0x80000001, 0, v);
+    boolean rdtscp = (v[3] & U64_FROM_BIT(27)) != 0;
+    cpuid(0x7, 0, v);
+    if (rdtscp || (v[2] & U64_FROM_BIT(22)))
+        write_msr(TSC_AUX_MSR, cpu);
+}
+
 static inline cpuinfo current_cpu(void)
 {
     u64 addr;
@@ -155,6 +178,7 @@ void kernel_delay(timestamp delta);
 
 void init_clock(void);
 boolean init_hpet(kernel_heaps kh);
+void init_zero_page_pools(kernel_heaps kh);
 
 void process_bhqueue();
 void install_fallback_fault_handler(fault_handler h);
@@ -183,8 +207,20 @@ void init_scheduler(heap);
 extern void interrupt_exit(void);
 extern char **state_strings;
 
+void wakeup_cpu(u64 cpu);
+void wakeup_bound_cpus(void);
+
+/* Picks the next user context to run on the calling cpu, taking
+   runnable contexts from the thread queues; installed by the unix
+   layer. Without one, contexts run in arrival order. */
+typedef closure_type(context_scheduler, context);
+void set_context_scheduler(context_scheduler s);
+void set_timeslice(timestamp slice);
+
 // static inline void schedule_frame(context f) stupid header deps
-#define schedule_frame(__f)  do { assert((__f)[FRAME_QUEUE] != INVALID_PHYSICAL); enqueue((queue)pointer_from_u64((__f)[FRAME_QUEUE]), pointer_from_u64((__f)[FRAME_RUN])); } while(0)
+#define schedule_frame(__f)  do { assert((__f)[FRAME_QUEUE] != INVALID_PHYSICAL); \
+        enqueue((queue)pointer_from_u64((__f)[FRAME_QUEUE]), (__f)); \
+        if ((queue)pointer_from_u64((__f)[FRAME_QUEUE]) != thread_queue) wakeup_bound_cpus(); } while(0)
 
 void kernel_unlock();
 
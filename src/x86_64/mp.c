@@ -31,11 +31,13 @@ static void __attribute__((noinline)) ap_new_stack()
     u64 id = apic_id();
     mp_debug_u64(id);
     cpu_setgs(id);
+    cpu_set_tsc_aux(id);
     cpuinfo ci = current_cpu();
 
     set_ist(id, IST_PAGEFAULT, u64_from_pointer(ci->fault_stack));
     set_ist(id, IST_INTERRUPT, u64_from_pointer(ci->int_stack));
     set_running_frame(ci->kernel_frame);
+    flush_cpu_init();
     mp_debug(", install gdt");
     install_gdt64_and_tss(id);
     mp_debug(", enable apic");
@@ -63,6 +65,7 @@ void start_cpu(heap h, heap p, int index, void (*ap_entry)()) {
         asm("sgdt %0": "=m"(ap_gdt_pointer));
         asm("sidt %0": "=m"(ap_idt_pointer));
         mov_from_cr("cr3", ap_pagetable);
+        ap_pagetable = pointer_from_u64(u64_from_pointer(ap_pagetable) & ~PAGEMASK); /* pcid */
         // just one function call
 
         void *rsp = allocate_stack(pages, 4);
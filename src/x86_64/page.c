@@ -31,8 +31,11 @@ static struct spinlock pt_lock;
 static inline page pagebase()
 {
     static page base;
-    if (base == 0)
-        mov_from_cr("cr3", base);
+    if (base == 0) {
+        u64 cr3;
+        mov_from_cr("cr3", cr3);
+        base = pointer_from_u64(cr3 & ~PAGEMASK);  /* drop the pcid */
+    }
     return base;
 }
 
@@ -81,7 +84,16 @@ void flush_tlb()
 }
 
 #ifdef BOOT
-void page_invalidate(u64 address, thunk completion)
+flush_entry get_page_flush_entry(void)
+{
+    return 0;
+}
+
+void page_invalidate(flush_entry f, u64 address, boolean global)
+{
+}
+
+void page_invalidate_sync(flush_entry f, thunk completion)
 {
     flush_tlb();
     apply(completion);
@@ -225,7 +237,7 @@ static boolean force_entry(heap h, page b, u64 v, physical p, int level,
 
 /* called with lock held */
 static inline boolean map_page(page base, u64 v, physical p, heap h,
-                               boolean fat, u64 flags, boolean * invalidate)
+                               boolean fat, u64 flags, flush_entry fe, boolean * invalidate)
 {
     boolean invalidate_entry = false;
 #ifdef PAGE_UPDATE_DEBUG
@@ -235,8 +247,8 @@ static inline boolean map_page(page base, u64 v, physical p, heap h,
     if (!force_entry(h, base, v, p, 1, fat, flags, &invalidate_entry))
 	return false;
     if (invalidate_entry) {
-        // move this up to construct ranges?
-        page_invalidate(v, ignore);
+        /* the old entry isn't at hand; assume it may have been global */
+        page_invalidate(fe, v, true);
         if (invalidate)
             *invalidate = true;
     }
@@ -307,8 +319,8 @@ boolean validate_virtual(void * base, u64 length)
 }
 
 /* called with lock held */
-closure_function(1, 3, boolean, update_pte_flags,
-                 u64, flags,
+closure_function(2, 3, boolean, update_pte_flags,
+                 u64, flags, flush_entry, fe,
                  int, level, u64, addr, u64 *, entry)
 {
     /* we only care about present ptes */
@@ -320,7 +332,7 @@ closure_function(1, 3, boolean, update_pte_flags,
 #ifdef PAGE_UPDATE_DEBUG
     page_debug("update 0x%lx: pte @ 0x%lx, 0x%lx -> 0x%lx\n", addr, entry, old, *entry);
 #endif
-    page_invalidate(addr, ignore);
+    page_invalidate(bound(fe), addr, (old & PAGE_GLOBAL) != 0);
     return true;
 }
 
@@ -330,12 +342,14 @@ void update_map_flags(u64 vaddr, u64 length, u64 flags)
     flags &= ~PAGE_NO_FAT;
     page_debug("vaddr 0x%lx, length 0x%lx, flags 0x%lx\n", vaddr, length, flags);
 
-    traverse_ptes(vaddr, length, stack_closure(update_pte_flags, flags));
+    flush_entry fe = get_page_flush_entry();
+    traverse_ptes(vaddr, length, stack_closure(update_pte_flags, flags, fe));
+    page_invalidate_sync(fe, ignore);
 }
 
 /* called with lock held */
-closure_function(3, 3, boolean, remap_entry,
-                 u64, new, u64, old, heap, h,
+closure_function(4, 3, boolean, remap_entry,
+                 u64, new, u64, old, heap, h, flush_entry, fe,
                  int, level, u64, curr, u64 *, entry)
 {
     u64 offset = curr - bound(old);
@@ -353,13 +367,13 @@ closure_function(3, 3, boolean, remap_entry,
         return true;
 
     /* transpose mapped page */
-    map_page(pagebase(), new_curr, phys, bound(h), pt_entry_is_fat(level, oldentry), flags, 0);
+    map_page(pagebase(), new_curr, phys, bound(h), pt_entry_is_fat(level, oldentry), flags, bound(fe), 0);
 
     /* reset old entry */
     *entry = 0;
 
     /* invalidate old mapping (map_page takes care of new)  */
-    page_invalidate(curr, ignore);
+    page_invalidate(bound(fe), curr, (oldentry & PAGE_GLOBAL) != 0);
 
     return true;
 }
@@ -377,7 +391,9 @@ void remap_pages(u64 vaddr_new, u64 vaddr_old, u64 length, heap h)
         return;
     assert(range_empty(range_intersection(irange(vaddr_new, vaddr_new + length),
                                           irange(vaddr_old, vaddr_old + length))));
-    traverse_ptes(vaddr_old, length, stack_closure(remap_entry, vaddr_new, vaddr_old, h));
+    flush_entry fe = get_page_flush_entry();
+    traverse_ptes(vaddr_old, length, stack_closure(remap_entry, vaddr_new, vaddr_old, h, fe));
+    page_invalidate_sync(fe, ignore);
 }
 
 /* called with lock held */
@@ -401,8 +417,8 @@ void zero_mapped_pages(u64 vaddr, u64 length)
 }
 
 /* called with lock held */
-closure_function(1, 3, boolean, unmap_page,
-                 range_handler, rh,
+closure_function(2, 3, boolean, unmap_page,
+                 range_handler, rh, flush_entry, fe,
                  int, level, u64, vaddr, u64 *, entry)
 {
     range_handler rh = bound(rh);
@@ -413,7 +429,7 @@ closure_function(1, 3, boolean, unmap_page,
                    rh, level, vaddr, entry, *entry);
 #endif
         *entry = 0;
-        page_invalidate(vaddr, ignore);
+        page_invalidate(bound(fe), vaddr, (old_entry & PAGE_GLOBAL) != 0);
         if (rh) {
             u64 phys = phys_from_pte(old_entry);
             range p = irange(phys, phys + (pt_entry_is_fat(level, old_entry) ? PAGESIZE_2M : PAGESIZE));
@@ -423,12 +439,56 @@ closure_function(1, 3, boolean, unmap_page,
     return true;
 }
 
+/* Replace a 2M mapping covering vaddr, if any, with a table of 4K
+   ptes mapping the same pages, so that an operation on part of it
+   leaves the rest alone. */
+boolean split_fat_page(u64 vaddr, heap h)
+{
+    boolean success = true;
+    flush_entry fe = get_page_flush_entry();
+    pagetable_lock();
+    u64 *table = pagebase();
+    u64 e = table[pindex(vaddr, PT1)];
+    if (!pt_entry_is_present(e))
+        goto out;
+    table = page_from_pte(e);
+    e = table[pindex(vaddr, PT2)];
+    if (!pt_entry_is_present(e))
+        goto out;
+    table = page_from_pte(e);
+    u64 *pte = table + pindex(vaddr, PT3);
+    e = *pte;
+    if (!pt_entry_is_present(e) || !pt_entry_is_fat(3, e))
+        goto out;
+
+    page n = allocate_zero(h, PAGESIZE);
+    if (n == INVALID_ADDRESS) {
+        success = false;
+        goto out;
+    }
+    u64 phys = phys_from_pte(e);
+    u64 flags = flags_from_pte(e) & ~PAGE_2M_SIZE;
+    for (int i = 0; i < PAGESIZE / sizeof(u64); i++)
+        n[i] = (phys + i * PAGESIZE) | flags;
+#ifdef PAGE_UPDATE_DEBUG
+    page_debug("vaddr 0x%lx, pte @ %p, 0x%lx -> table %p\n", vaddr, pte, e, n);
+#endif
+    *pte = u64_from_pointer(n) | PAGE_WRITABLE | PAGE_USER | PAGE_PRESENT;
+    page_invalidate(fe, vaddr & ~MASK(PT3), (e & PAGE_GLOBAL) != 0);
+  out:
+    pagetable_unlock();
+    page_invalidate_sync(fe, ignore);
+    return success;
+}
+
 /* Be warned: the page table lock is held when rh is called; don't try
    to modify the page table while traversing it */
 void unmap_pages_with_handler(u64 virtual, u64 length, range_handler rh)
 {
     assert(!((virtual & PAGEMASK) || (length & PAGEMASK)));
-    traverse_ptes(virtual, length, stack_closure(unmap_page, rh));
+    flush_entry fe = get_page_flush_entry();
+    traverse_ptes(virtual, length, stack_closure(unmap_page, rh, fe));
+    page_invalidate_sync(fe, ignore);
 }
 
 // error processing
@@ -438,6 +498,7 @@ static void map_range(u64 virtual, physical p, u64 length, u64 flags, heap h)
     u64 vo = virtual;
     u64 po = p;
 
+    flush_entry fe = get_page_flush_entry();
     pagetable_lock();
     page pb = pagebase();
 
@@ -472,7 +533,7 @@ static void map_range(u64 virtual, physical p, u64 length, u64 flags, heap h)
     for (int i = 0; i < len;) {
 	boolean fat = ((flags & PAGE_NO_FAT) == 0) && !(vo & MASK(PT3)) &&
             !(po & MASK(PT3)) && ((len - i) >= (1ull<<PT3));
-	if (!map_page(pb, vo, po, h, fat, flags & ~PAGE_NO_FAT, &invalidate)) {
+	if (!map_page(pb, vo, po, h, fat, flags & ~PAGE_NO_FAT, fe, &invalidate)) {
             /* may fail if flags == 0 and no mapping, but that's not a problem */
             if (flags)
 		halt("map: ran out of page table memory\n");
@@ -489,13 +550,39 @@ static void map_range(u64 virtual, physical p, u64 length, u64 flags, heap h)
 
     memory_barrier();
     pagetable_unlock();
+    page_invalidate_sync(fe, ignore);
 }
 
+/* Kernel mappings are global so that flushes on behalf of user
+   mappings leave them in the tlb. */
 void map(u64 virtual, physical p, u64 length, u64 flags, heap h)
 {
+    if ((flags & PAGE_USER) == 0)
+        flags |= PAGE_GLOBAL;
     map_range(virtual, p, length, flags | PAGE_PRESENT, h);
 }
 
+/* Map npages pages at virtual, page i to phys[i] unless that is
+   INVALID_PHYSICAL, under one hold of the page table lock and with
+   one flush batch. */
+void map_pages(u64 virtual, u64 *phys, int npages, u64 flags, heap h)
+{
+    if ((flags & PAGE_USER) == 0)
+        flags |= PAGE_GLOBAL;
+    flags = (flags | PAGE_PRESENT) & ~PAGE_NO_FAT;
+    flush_entry fe = get_page_flush_entry();
+    pagetable_lock();
+    page pb = pagebase();
+    for (int i = 0; i < npages; i++) {
+        if (phys[i] == INVALID_PHYSICAL)
+            continue;
+        if (!map_page(pb, virtual + i * PAGESIZE, phys[i], h, false, flags, fe, 0))
+            halt("map_pages: ran out of page table memory\n");
+    }
+    pagetable_unlock();
+    page_invalidate_sync(fe, ignore);
+}
+
 void unmap(u64 virtual, u64 length, heap h)
 {
 #ifdef PAGE_DEBUG
@@ -511,11 +598,104 @@ void unmap(u64 virtual, u64 length, heap h)
 #ifdef STAGE3
 static id_heap phys_internal;
 
+/* Free page reporting
+
+   Free 2M blocks of physical memory may be reported to the host
+   (see virtio_balloon.c), which can then discard their contents. A
+   reported block needs reporting again only after some part of it
+   has been allocated and freed, so every free through the physical
+   heap clears the bits of the blocks it touches. */
+static bitmap phys_reported;
+
+/* called with lock held */
+static inline void phys_unreport(u64 base, u64 length)
+{
+    if (!phys_reported || length == 0)
+        return;
+    for (u64 b = base >> PAGELOG_2M; b <= (base + length - 1) >> PAGELOG_2M; b++) {
+        if (bitmap_get(phys_reported, b))
+            bitmap_set(phys_reported, b, 0);
+    }
+}
+
+/* return a reported 2M block to the physical heap */
+void deallocate_reported_physical_block(u64 phys)
+{
+    pagetable_lock();
+    deallocate_u64((heap)phys_internal, phys, PAGESIZE_2M);
+    if (phys_reported && (phys >> PAGELOG_2M) < phys_reported->maxbits)
+        bitmap_set(phys_reported, phys >> PAGELOG_2M, 1);
+    pagetable_unlock();
+}
+
+/* Take a free 2M block that has not been reported, examining the
+   reported map from *cursor onward, wrapping at the end of physical
+   memory, and charging *budget for each block examined. Runs of
+   reported blocks are skipped a map word at a time; an unreported
+   block is taken only if the physical heap has all of it free. The
+   cursor is left after the last block examined, so a caller polling
+   with a small budget covers all of memory over successive calls
+   without allocating any more than it keeps. */
+u64 allocate_unreported_physical_block(u64 *cursor, u64 *budget)
+{
+    u64 p = INVALID_PHYSICAL;
+    pagetable_lock();
+    if (!phys_reported)
+        goto out;
+    u64 nblocks = phys_reported->maxbits;
+    u64 *map = bitmap_base(phys_reported);
+    u64 b = *cursor;
+    while (*budget > 0) {
+        if (b >= nblocks)
+            b = 0;
+        if ((b & 63) == 0 && b + 64 <= nblocks && map[b >> 6] == -1ull) {
+            b += 64;
+            *budget -= MIN(*budget, 64);
+            continue;
+        }
+        (*budget)--;
+        if (bitmap_get(phys_reported, b++))
+            continue;
+        p = id_heap_alloc_subrange(phys_internal, PAGESIZE_2M, (b - 1) << PAGELOG_2M,
+                                   b << PAGELOG_2M);
+        if (p != INVALID_PHYSICAL)
+            break;
+    }
+    *cursor = b;
+  out:
+    pagetable_unlock();
+    return p;
+}
+
+static u64 physical_end(void)
+{
+    u64 end = 0;
+    pagetable_lock();
+    for (rmnode n = rangemap_first_node(phys_internal->ranges); n != INVALID_ADDRESS;
+         n = rangemap_next_node(phys_internal->ranges, n))
+        end = n->r.end;
+    pagetable_unlock();
+    return end * phys_internal->h.pagesize;
+}
+
+/* The map is sized up front, as it may not grow under the lock. */
+void init_physical_reporting(heap h)
+{
+    u64 blocks = MAX(pad(physical_end(), PAGESIZE_2M) >> PAGELOG_2M, 1);
+    bitmap b = allocate_bitmap(h, h, blocks);
+    assert(b != INVALID_ADDRESS);
+    bitmap_extend(b, blocks - 1);
+    pagetable_lock();
+    phys_reported = b;
+    pagetable_unlock();
+}
+
 closure_function(0, 1, void, dealloc_phys_page,
                  range, r)
 {
     if (!id_heap_set_area(phys_internal, r.start, range_span(r), true, false))
         msg_err("some of physical range %R not allocated in heap\n", r);
+    phys_unreport(r.start, range_span(r));
 }
 
 void unmap_and_free_phys(u64 virtual, u64 length)
@@ -536,9 +716,20 @@ static void wrap_dealloc(heap h, u64 a, bytes b)
 {
     pagetable_lock();
     deallocate_u64((heap)phys_internal, a, b);
+    phys_unreport(a, b);
     pagetable_unlock();
 }
 
+static bytes wrap_allocated(heap h)
+{
+    return heap_allocated((heap)phys_internal);
+}
+
+static bytes wrap_total(heap h)
+{
+    return heap_total((heap)phys_internal);
+}
+
 static boolean wrap_add_range(id_heap i, u64 base, u64 length)
 {
     pagetable_lock();
@@ -551,6 +742,8 @@ static boolean wrap_set_area(id_heap i, u64 base, u64 length, boolean validate,
 {
     pagetable_lock();
     boolean r = id_heap_set_area(phys_internal, base, length, validate, allocate);
+    if (r && !allocate)
+        phys_unreport(base, length);
     pagetable_unlock();
     return r;
 }
@@ -570,6 +763,85 @@ static u64 wrap_alloc_subrange(id_heap i, bytes count, u64 start, u64 end)
     return r;
 }
 
+/* Pre-zeroed page pool
+
+   Demand paging takes pages from a per-cpu pool of zeroed physical
+   pages (allocate_zero_page), which idle cpus replenish from
+   kernel_sleep. Pages are zeroed through a per-cpu window page; as no
+   other cpu touches a window, remapping it only needs a local
+   invalidate. Refills take runs of pages from the physical heap with
+   a single allocation where possible. */
+
+static heap window_pages;
+
+static void zero_physical_page(cpuinfo ci, u64 phys)
+{
+    boolean invalidate = false;
+    u64 v = ci->zero_window;
+    pagetable_lock();
+    boolean mapped = force_entry(window_pages, pagebase(), v, phys, 1, false,
+                                 PAGE_WRITABLE | PAGE_NO_EXEC | PAGE_PRESENT, &invalidate);
+    pagetable_unlock();
+    assert(mapped);
+    if (invalidate)
+        asm volatile("invlpg (%0)" :: "r" (v) : "memory");
+    zero(pointer_from_u64(v), PAGESIZE);
+}
+
+/* Returns a zeroed physical page, or INVALID_PHYSICAL */
+u64 allocate_zero_page(void)
+{
+    u64 flags = irq_disable_save();
+    cpuinfo ci = current_cpu();
+    u64 phys;
+    if (ci->zero_page_count > 0) {
+        phys = ci->zero_pages[--ci->zero_page_count];
+    } else {
+        phys = wrap_alloc(0, PAGESIZE);
+        if (phys != INVALID_PHYSICAL)
+            zero_physical_page(ci, phys);
+    }
+    irq_restore(flags);
+    return phys;
+}
+
+/* Called by a cpu on its way to idle; tops up its pool by at most
+   ZERO_PAGE_REFILL pages so as not to delay waking for long. */
+void refill_zero_pages(void)
+{
+    u64 flags = irq_disable_save();
+    cpuinfo ci = current_cpu();
+    if (ci->zero_window == 0)
+        goto out;
+    u64 n = MIN(ZERO_PAGE_POOL_SIZE - ci->zero_page_count, ZERO_PAGE_REFILL);
+    if (n == 0)
+        goto out;
+    n = U64_FROM_BIT(msb(n));
+    u64 phys;
+    while ((phys = wrap_alloc(0, n * PAGESIZE)) == INVALID_PHYSICAL) {
+        if (n == 1)
+            goto out;
+        n >>= 1;
+    }
+    for (u64 i = 0; i < n; i++) {
+        zero_physical_page(ci, phys + i * PAGESIZE);
+        ci->zero_pages[ci->zero_page_count++] = phys + i * PAGESIZE;
+    }
+  out:
+    irq_restore(flags);
+}
+
+void init_zero_page_pools(kernel_heaps kh)
+{
+    window_pages = heap_pages(kh);
+    for (int i = 0; i < MAX_CPUS; i++) {
+        cpuinfo ci = cpuinfo_from_id(i);
+        ci->zero_page_count = 0;
+        ci->zero_window = allocate_u64((heap)heap_virtual_page(kh), PAGESIZE);
+        assert(ci->zero_window != INVALID_PHYSICAL);
+    }
+}
+
 /* this happens even before moving to the new stack, so ... be cool */
 id_heap init_page_tables(heap h, id_heap physical)
 {
@@ -581,8 +853,8 @@ id_heap init_page_tables(heap h, id_heap physical)
     i->h.alloc = wrap_alloc;
     i->h.dealloc = wrap_dealloc;
     i->h.destroy = 0;
-    i->h.allocated = physical->h.allocated;
-    i->h.total = physical->h.total;
+    i->h.allocated = wrap_allocated;
+    i->h.total = wrap_total;
     i->h.pagesize = physical->h.pagesize;
     i->add_range = wrap_add_range;
     i->set_area = wrap_set_area;
@@ -2,6 +2,7 @@
 
 #define PAGE_NO_EXEC       U64_FROM_BIT(63)
 #define PAGE_NO_FAT        0x0200 /* AVL[0] */
+#define PAGE_GLOBAL        0x0100
 #define PAGE_2M_SIZE       0x0080
 #define PAGE_DIRTY         0x0040
 #define PAGE_ACCESSED      0x0020
@@ -59,6 +60,7 @@ physical physical_from_virtual(void *x);
 #endif
 
 void map(u64 virtual, physical p, u64 length, u64 flags, heap h);
+void map_pages(u64 virtual, u64 *phys, int npages, u64 flags, heap h);
 void unmap(u64 virtual, u64 length, heap h);
 void unmap_pages_with_handler(u64 virtual, u64 length, range_handler rh);
 void unmap_and_free_phys(u64 virtual, u64 length);
@@ -71,13 +73,24 @@ static inline void unmap_pages(u64 virtual, u64 length)
 void update_map_flags(u64 vaddr, u64 length, u64 flags);
 void zero_mapped_pages(u64 vaddr, u64 length);
 void remap_pages(u64 vaddr_new, u64 vaddr_old, u64 length, heap h);
+boolean split_fat_page(u64 vaddr, heap h);
+u64 allocate_zero_page(void);
+void refill_zero_pages(void);
+u64 allocate_unreported_physical_block(u64 *cursor, u64 *budget);
+void deallocate_reported_physical_block(u64 phys);
+void init_physical_reporting(heap h);
 
 void dump_ptes(void *x);
 
 typedef closure_type(entry_handler, boolean /* success */, int /* level */,
         u64 /* vaddr */, u64 * /* entry */);
 boolean traverse_ptes(u64 vaddr, u64 length, entry_handler eh);
-void page_invalidate(u64 p, thunk completion);
+typedef struct flush_entry *flush_entry;
+flush_entry get_page_flush_entry(void);
+void page_invalidate(flush_entry f, u64 p, boolean global);
+void page_invalidate_sync(flush_entry f, thunk completion);
+void flush_idle_exit(u64 cpu);
+void flush_cpu_init(void);
 void flush_tlb();
-void init_flush();
+void init_flush(heap h);
 id_heap init_page_tables(heap h, id_heap physical);
@@ -9,6 +9,11 @@
 #define pagecache_debug(x, ...)
 #endif
 
+/* all pagecaches, for pagecache_drain() */
+static struct list pagecaches = { &pagecaches, &pagecaches };
+static struct spinlock pagecaches_lock;
+static thunk drain_notify;
+
 static inline u64 pagecache_pagesize(pagecache pc)
 {
     return U64_FROM_BIT(pc->page_order);
@@ -35,8 +40,8 @@ static inline void set_page_state_cache_locked(pagecache pc, pagecache_page pp,
         assert(old_state == PAGECACHE_PAGESTATE_ALLOC);
         break;
     case PAGECACHE_PAGESTATE_NEW:
-        /* later we can allow full page writes to move to new list after sync */
-        assert(old_state == PAGECACHE_PAGESTATE_READING);
+        /* full page writes go straight to the new list */
+        assert(old_state == PAGECACHE_PAGESTATE_READING || old_state == PAGECACHE_PAGESTATE_ALLOC);
         list_insert_before(&pc->new, &pp->l);
         break;
     case PAGECACHE_PAGESTATE_ACTIVE:
@@ -312,6 +317,24 @@ static void pagecache_write_page_internal_page_locked(pagecache pc, pagecache_pa
     apply(pc->block_write, dest, blocks, sh);
 }
 
+/* A page is referenced by each write in flight so that it may not be
+   drained while its contents are being written out. */
+closure_function(2, 1, void, pagecache_write_page_complete,
+                 pagecache_page, pp, status_handler, sh,
+                 status, s)
+{
+    pagecache_release_page(bound(pp));
+    apply(bound(sh), s);
+    closure_finish();
+}
+
+static status_handler pagecache_write_page_reserve_cache_locked(pagecache pc, pagecache_page pp,
+                                                                status_handler sh)
+{
+    refcount_reserve(&pp->refcount);
+    return closure(pc->h, pagecache_write_page_complete, pp, sh);
+}
+
 /* cache lock may or may not be held here */
 closure_function(5, 0, void, pagecache_write_io_complete,
                  pagecache, pc, pagecache_page, pp, void *, buf, range, q, status_handler, sh)
@@ -342,8 +365,10 @@ closure_function(4, 1, void, pagecache_write_page_cache_locked,
                  pagecache, pc, void *, buf, range, q, merge, m,
                  rmnode, node)
 {
-    pagecache_write_page_io_check(bound(pc), (pagecache_page)node, bound(buf), bound(q),
-                                  apply_merge(bound(m)));
+    pagecache pc = bound(pc);
+    pagecache_page pp = (pagecache_page)node;
+    status_handler sh = pagecache_write_page_reserve_cache_locked(pc, pp, apply_merge(bound(m)));
+    pagecache_write_page_io_check(pc, pp, bound(buf), bound(q), sh);
 }
 
 closure_function(5, 1, void, pagecache_write_page_filled,
@@ -376,15 +401,16 @@ closure_function(4, 1, void, pagecache_write_gap_cache_locked,
         }
 
         /* if this write covers the entire page, don't bother trying to fill it first */
+        status_handler sh = pagecache_write_page_reserve_cache_locked(pc, pp, apply_merge(bound(m)));
         range i = range_intersection(pp->node.r, bound(q));
         if (i.start == pp->node.r.start && i.end == MIN(pp->node.r.end, pc->length)) {
             spin_lock(&pp->lock);
-            pagecache_write_page_internal_page_locked(pc, pp, bound(buf), bound(q), apply_merge(bound(m)));
+            set_page_state_cache_locked(pc, pp, PAGECACHE_PAGESTATE_NEW);
+            pagecache_write_page_internal_page_locked(pc, pp, bound(buf), bound(q), sh);
             spin_unlock(&pp->lock);
         } else {
             pagecache_page_fill_cache_locked(pc, pp, closure(pc->h, pagecache_write_page_filled,
-                                                             pc, pp, bound(buf), bound(q),
-                                                             apply_merge(bound(m))));
+                                                             pc, pp, bound(buf), bound(q), sh));
         }
     }
 }
@@ -413,6 +439,80 @@ closure_function(1, 3, void, pagecache_write,
     apply(sh, STATUS_OK);
 }
 
+/* move up to remain bytes of reclaimable pages from l to q */
+static u64 pagecache_drain_list_cache_locked(pagecache pc, struct list *l, struct list *q, u64 remain)
+{
+    u64 pagesize = pagecache_pagesize(pc);
+    u64 drained = 0;
+    list_foreach(l, e) {
+        if (drained >= remain)
+            break;
+        pagecache_page pp = struct_from_list(e, pagecache_page, l);
+        if (page_state(pp) != PAGECACHE_PAGESTATE_FREE) {
+            /* referenced by an sg list or a write in flight */
+            if (pp->refcount.c != 1)
+                continue;
+            rangemap_remove_node(pc->pages, &pp->node);
+        }
+        list_delete(&pp->l);
+        list_insert_before(q, &pp->l);
+        drained += pagesize;
+    }
+    return drained;
+}
+
+/* Release free pages and then clean, unreferenced pages, least
+   recently used first, until at least drain_bytes are returned to the
+   backed heap. */
+static u64 pagecache_drain_cache(pagecache pc, u64 drain_bytes)
+{
+    struct list q;
+    list_init(&q);
+    u64 drained = 0;
+    spin_lock(&pc->lock);
+    drained += pagecache_drain_list_cache_locked(pc, &pc->free, &q, drain_bytes - drained);
+    drained += pagecache_drain_list_cache_locked(pc, &pc->new, &q, drain_bytes - drained);
+    drained += pagecache_drain_list_cache_locked(pc, &pc->active, &q, drain_bytes - drained);
+    spin_unlock(&pc->lock);
+
+    list_foreach(&q, e) {
+        pagecache_page pp = struct_from_list(e, pagecache_page, l);
+        list_delete(&pp->l);
+        deallocate(pc->backed, pp->kvirt, pagecache_pagesize(pc));
+        deallocate_vector(pp->completions);
+        deallocate_closure(pp->refcount.completion);
+        deallocate(pc->h, pp, sizeof(struct pagecache_page));
+    }
+    pagecache_debug("%s: pc %p, drained %ld bytes\n", __func__, pc, drained);
+    return drained;
+}
+
+/* Returns the number of bytes released; may exceed drain_bytes by up
+   to a cache page. */
+u64 pagecache_drain(u64 drain_bytes)
+{
+    u64 drained = 0;
+    spin_lock(&pagecaches_lock);
+    list_foreach(&pagecaches, e) {
+        if (drained >= drain_bytes)
+            break;
+        drained += pagecache_drain_cache(struct_from_list(e, pagecache, l), drain_bytes - drained);
+    }
+    thunk t = drained ? drain_notify : 0;
+    spin_unlock(&pagecaches_lock);
+    if (t)
+        enqueue(runqueue, t);
+    return drained;
+}
+
+/* t is queued to run after any drain that released memory */
+void pagecache_set_drain_notify(thunk t)
+{
+    spin_lock(&pagecaches_lock);
+    drain_notify = t;
+    spin_unlock(&pagecaches_lock);
+}
+
 pagecache allocate_pagecache(heap general, heap backed,
                              u64 length, u64 pagesize, u64 block_size,
                              block_mapper mapper, block_io read, block_io write)
@@ -442,5 +542,8 @@ pagecache allocate_pagecache(heap general, heap backed,
     pc->block_write = write;
     pc->sg_read = closure(general, pagecache_read_sg, pc);
     pc->write = closure(general, pagecache_write, pc);
+    spin_lock(&pagecaches_lock);
+    list_insert_before(&pagecaches, &pc->l);
+    spin_unlock(&pagecaches_lock);
     return pc;
 }
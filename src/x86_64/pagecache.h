@@ -2,6 +2,7 @@
 typedef closure_type(block_mapper, u64, u64);
 
 typedef struct pagecache {
+    struct list l;              /* all pagecaches */
     rangemap pages;
     struct spinlock lock;
     struct list free;           /* see state descriptions */
@@ -59,3 +60,5 @@ static inline block_io pagecache_writer(pagecache pc)
 pagecache allocate_pagecache(heap general, heap backed,
                              u64 length, u64 pagesize, u64 block_size,
                              block_mapper mapper, block_io read, block_io write);
+u64 pagecache_drain(u64 drain_bytes);
+void pagecache_set_drain_notify(thunk t);
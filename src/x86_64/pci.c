@@ -226,6 +226,15 @@ u32 pci_find_next_cap(pci_dev dev, u8 cap, u32 cp)
     return _pci_find_cap(dev, cap, pci_cfgread(dev, cp + PCICAP_NEXTPTR, 1));
 }
 
+/* number of MSI-X table entries, or 0 if MSI-X isn't supported */
+int pci_get_msix_count(pci_dev dev)
+{
+    u32 cp = pci_find_cap(dev, PCIY_MSIX);
+    if (cp == 0)
+        return 0;
+    return (pci_cfgread(dev, cp + 2, 2) & 0x7ff) + 1;
+}
+
 void pci_enable_msix(pci_dev dev)
 {
     u32 cp = pci_find_cap(dev, PCIY_MSIX);
@@ -2,6 +2,7 @@
 #include <tfs.h> // needed for unix.h
 #include <unix.h> // some deps
 #include <apic.h>
+#include <page.h>
 
 
 /* Try to keep these within the confines of the runloop lock so we
@@ -35,6 +36,7 @@ timestamp last_timer_update;
 
 static timestamp runloop_timer_min;
 static timestamp runloop_timer_max;
+static context_scheduler context_sched;
 
 static struct spinlock kernel_lock;
 
@@ -66,6 +68,58 @@ void kern_unlock()
     spin_unlock(&kernel_lock);
 }
 
+/* Kick idle cpus that have bound threads waiting to run. The shared
+   thread queue is served by whichever cpu gets to it first (see
+   run_thunk), but a bound thread can only run on its own cpu. */
+void wakeup_bound_cpus(void)
+{
+    cpuinfo ci = current_cpu();
+    u64 mask = idle_cpu_mask;
+    while (mask) {
+        u64 cpu = lsb(mask);
+        mask &= ~U64_FROM_BIT(cpu);
+        if (cpu != ci->id && queue_length(cpuinfo_from_id(cpu)->thread_queue) > 0)
+            wakeup_cpu(cpu);
+    }
+}
+
+/* Bring a cpu out of idle or, if it is running a user context, into
+   the runloop to reconsider what it runs. */
+void wakeup_cpu(u64 cpu)
+{
+    cpuinfo ci = current_cpu();
+    sched_debug("sending wakeup ipi to %d %x\n", cpu, wakeup_vector);
+    atomic_clear_bit(&idle_cpu_mask, cpu);
+    apic_ipi(cpu, 0, wakeup_vector);
+}
+
+void set_context_scheduler(context_scheduler s)
+{
+    context_sched = s;
+}
+
+/* Arm the local timer to end a user timeslice, unless a runloop timer
+   is due sooner. The next update_timer reprograms the timer for the
+   runloop timers. */
+void set_timeslice(timestamp slice)
+{
+    timestamp here = now(CLOCK_ID_MONOTONIC);
+    if (last_timer_update && last_timer_update <= here + slice)
+        return;
+    last_timer_update = 0;
+    runloop_timer(MAX(slice, runloop_timer_min));
+}
+
+static context dequeue_context(cpuinfo ci)
+{
+    context f;
+    if (context_sched)
+        return apply(context_sched);
+    if ((f = dequeue(ci->thread_queue)) != INVALID_ADDRESS)
+        return f;
+    return dequeue(thread_queue);
+}
+
 static void run_thunk(thunk t, int cpustate)
 {
     cpuinfo ci = current_cpu();
@@ -81,11 +135,8 @@ static void run_thunk(thunk t, int cpustate)
         u64 mask_copy = idle_cpu_mask;
         u64 cpu = msb(mask_copy);        
         // this really shouldn't ever be current_cpu() ? 
-        if (cpu != INVALID_PHYSICAL && cpu != current_cpu()->id) {
-            sched_debug("sending wakeup ipi to %d %x\n", cpu, wakeup_vector);
-            atomic_clear_bit(&idle_cpu_mask, cpu);
-            apic_ipi(cpu, 0, wakeup_vector);
-        }
+        if (cpu != INVALID_PHYSICAL && cpu != current_cpu()->id)
+            wakeup_cpu(cpu);
     }
 
     ci->state = cpustate;
@@ -114,11 +165,19 @@ NOTRACE void __attribute__((noreturn)) kernel_sleep(void)
     // handler...we shouldn't return here if we do get interrupted
     cpuinfo ci = get_cpuinfo();
     sched_debug("sleep\n");
+    refill_zero_pages();
     ci->state = cpu_idle;
     atomic_set_bit(&idle_cpu_mask, ci->id);
     if (ci->have_kernel_lock)
         kern_unlock();
 
+    /* a bound thread queued before our idle bit was visible won't get a wakeup ipi */
+    if (queue_length(ci->thread_queue) > 0) {
+        atomic_clear_bit(&idle_cpu_mask, ci->id);
+        flush_idle_exit(ci->id);
+        runloop();
+    }
+
     /* loop to absorb spurious wakeups from hlt - happens on some platforms (e.g. xen) */
     while (1)
         asm volatile("sti; hlt" ::: "memory");
@@ -155,8 +214,9 @@ NOTRACE void __attribute__((noreturn)) runloop_internal()
         kern_unlock();
     }
 
-    if ((t = dequeue(thread_queue)) != INVALID_ADDRESS)
-        run_thunk(t, cpu_user);
+    context f = dequeue_context(ci);
+    if (f != INVALID_ADDRESS)
+        run_thunk(pointer_from_u64(f[FRAME_RUN]), cpu_user);
 
     kernel_sleep();
 }    
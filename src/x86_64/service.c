@@ -253,6 +253,8 @@ static void init_cpuinfos(kernel_heaps kh)
         ci->state = cpu_not_present;
         ci->have_kernel_lock = false;
         ci->frcount = 0;
+        ci->thread_queue = allocate_queue(h, 64);
+        assert(ci->thread_queue != INVALID_ADDRESS);
         /* frame and stacks */
         ci->kernel_frame = allocate_frame(h);
         ci->kernel_stack = allocate_stack(pages, KERNEL_STACK_PAGES);
@@ -263,6 +265,7 @@ static void init_cpuinfos(kernel_heaps kh)
     }
 
     cpu_setgs(0);
+    cpu_set_tsc_aux(0);
 }
 
 u64 total_processors = 1;
@@ -294,6 +297,7 @@ static void __attribute__((noinline)) init_service_new_stack()
     init_debug("in init_service_new_stack");
     init_debug("runtime");    
     init_runtime(misc);
+    flush_cpu_init();
     init_tuples(allocate_tagged_region(kh, tag_tuple));
     init_symbols(allocate_tagged_region(kh, tag_symbol), misc);
     init_sg(misc);
@@ -313,6 +317,9 @@ static void __attribute__((noinline)) init_service_new_stack()
     pci_discover(); // early PCI discover to configure VGA console
     init_debug("init_cpuinfos");
     init_cpuinfos(kh);
+    init_objcache_percpu();
+    init_closure_pools_percpu();
+    init_zero_page_pools(kh);
     current_cpu()->state = cpu_kernel;
 
     /* interrupts */
@@ -373,6 +380,7 @@ static void __attribute__((noinline)) init_service_new_stack()
         init_debug("probing for virtio PV network...");
         /* qemu virtio */
         init_virtio_network(kh);
+        init_virtio_balloon(kh);
     }
 
     init_debug("pci_discover (for virtio & ata)");
@@ -385,6 +393,7 @@ static void __attribute__((noinline)) init_service_new_stack()
 
 #ifdef SMP_ENABLE
     init_debug("starting APs");
+    init_flush(misc);
     start_cpu(misc, pages, TARGET_EXCLUSIVE_BROADCAST, new_cpu);
     kernel_delay(milliseconds(200));   /* temp, til we check tables to know what we have */
     init_debug("total CPUs %d\n", total_processors);
@@ -15,6 +15,7 @@
 #ifndef BUILD_VDSO
 VVAR_DEF(struct vdso_dat_struct, vdso_dat) = {
     .platform_has_rdtscp = 0,
+    .platform_has_rdpid = 0,
     .rtc_offset = 0,
     .pvclock_offset = 0,
     .clock_src = VDSO_CLOCK_SYSCALL
@@ -6,6 +6,8 @@
 
 #include <unix_internal.h>
 
+#define __vdso_dat (&(VVAR_REF(vdso_dat)))
+
 static sysreturn
 fallback_clock_gettime(clockid_t clk_id, struct timespec * tp)
 {
@@ -24,6 +26,12 @@ fallback_time(time_t * t)
     return do_syscall(SYS_time, t, 0);
 }
 
+static sysreturn
+fallback_getcpu(unsigned * cpu, unsigned * node)
+{
+    return do_syscall(SYS_getcpu, cpu, node);
+}
+
 static sysreturn
 do_vdso_clock_gettime(clockid_t clk_id, struct timespec * tp)
 {
@@ -49,8 +57,17 @@ do_vdso_gettimeofday(struct timeval * tv, void * tz)
 static sysreturn
 do_vdso_getcpu(unsigned * cpu, unsigned * node, void * tcache)
 {
+    /* TSC_AUX holds the cpu id */
+    u64 aux;
+    if (__vdso_dat->platform_has_rdpid)
+        asm volatile("rdpid %0" : "=r" (aux));
+    else if (__vdso_dat->platform_has_rdtscp)
+        asm volatile("rdtscp" : "=c" (aux) : : "%rax", "%rdx");
+    else
+        return fallback_getcpu(cpu, node);
+
     if (cpu)
-        *cpu = 0;
+        *cpu = (u32)aux;
     if (node)
         *node = 0;
     return 0;
@@ -22,6 +22,7 @@ struct vdso_dat_struct {
     timestamp rtc_offset;
     u64 pvclock_offset;
     u8 platform_has_rdtscp;
+    u8 platform_has_rdpid;
 } __attribute((packed));
 
 /* VDSO accessible variables */
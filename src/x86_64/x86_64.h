@@ -26,6 +26,7 @@
 #define FS_MSR           0xc0000100
 #define GS_MSR           0xc0000101
 #define KERNEL_GS_MSR    0xc0000102
+#define TSC_AUX_MSR      0xc0000103
 
 #define C0_WP   0x00010000
 
@@ -107,6 +108,20 @@ static inline void atomic_clear_bit(u64 *target, u64 bit)
     asm volatile("lock btrq %1, %0": "+m"(*target):"r"(bit) : "memory");
 }
 
+static inline boolean atomic_test_and_set_bit(u64 *target, u64 bit)
+{
+    u8 oldbit;
+    asm volatile("lock btsq %2, %0": "+m"(*target), "=@ccc"(oldbit): "r"(bit) : "memory");
+    return oldbit;
+}
+
+static inline boolean atomic_test_and_clear_bit(u64 *target, u64 bit)
+{
+    u8 oldbit;
+    asm volatile("lock btrq %2, %0": "+m"(*target), "=@ccc"(oldbit): "r"(bit) : "memory");
+    return oldbit;
+}
+
 #include <lock.h>
 
 extern u64 read_msr(u64);
@@ -0,0 +1,66 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define test_error(msg, ...) do { printf("affinity test failed: " msg "\n", ##__VA_ARGS__); exit(EXIT_FAILURE); } while (0)
+
+static cpu_set_t initial;
+
+/* pin the calling thread to each permitted cpu in turn */
+static void *pin_thread(void *arg)
+{
+    cpu_set_t set;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &initial))
+            continue;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+            test_error("sched_setaffinity to cpu %d: %d", cpu, errno);
+        for (int i = 0; i < 100; i++) {
+            int cur = sched_getcpu();
+            if (cur != cpu)
+                test_error("thread pinned to cpu %d running on cpu %d", cpu, cur);
+            sched_yield();
+        }
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) < 0)
+            test_error("sched_getaffinity: %d", errno);
+        if (CPU_COUNT(&set) != 1 || !CPU_ISSET(cpu, &set))
+            test_error("affinity mask does not match cpu %d", cpu);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    cpu_set_t set;
+    pthread_t pt;
+
+    if (sched_getaffinity(0, sizeof(initial), &initial) < 0)
+        test_error("sched_getaffinity: %d", errno);
+    int ncpus = CPU_COUNT(&initial);
+    if (ncpus < 1)
+        test_error("empty affinity mask");
+    printf("%d cpus permitted\n", ncpus);
+
+    CPU_ZERO(&set);
+    if (sched_setaffinity(0, sizeof(set), &set) != -1 || errno != EINVAL)
+        test_error("empty mask should fail with EINVAL");
+
+    if (pthread_create(&pt, 0, pin_thread, 0))
+        test_error("pthread_create");
+    pthread_join(pt, 0);
+
+    /* main thread affinity is unchanged by the child */
+    if (sched_getaffinity(0, sizeof(set), &set) < 0)
+        test_error("sched_getaffinity: %d", errno);
+    if (!CPU_EQUAL(&set, &initial))
+        test_error("main thread affinity changed");
+    printf("affinity test passed\n");
+    exit(EXIT_SUCCESS);
+}
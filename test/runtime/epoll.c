@@ -60,9 +60,116 @@ void test_ctl()
     exit(EXIT_FAILURE);
 }
 
+/* Level-triggered events are reported until cleared, edge-triggered
+   events once per transition */
+void test_trigger()
+{
+    struct epoll_event event, events[2];
+    int fds[2];
+    char buf[8];
+
+    int efd = epoll_create1(0);
+    if (efd < 0 || pipe(fds)) {
+        printf("Cannot create epoll or pipe\n");
+        goto fail;
+    }
+    event.data.fd = fds[0];
+    event.events = EPOLLIN;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, fds[0], &event)) {
+        printf("Cannot add descriptor to epoll\n");
+        goto fail;
+    }
+    if (epoll_wait(efd, events, 2, 0) != 0) {
+        printf("Unexpected event before write\n");
+        goto fail;
+    }
+    if (write(fds[1], "x", 1) != 1)
+        goto fail;
+    for (int i = 0; i < 2; i++) {
+        if (epoll_wait(efd, events, 2, 0) != 1 || events[0].data.fd != fds[0] ||
+            !(events[0].events & EPOLLIN)) {
+            printf("Level-triggered event not reported (pass %d)\n", i);
+            goto fail;
+        }
+    }
+    if (read(fds[0], buf, sizeof(buf)) != 1)
+        goto fail;
+    if (epoll_wait(efd, events, 2, 0) != 0) {
+        printf("Level-triggered event reported after read\n");
+        goto fail;
+    }
+
+    event.events = EPOLLIN | EPOLLET;
+    if (epoll_ctl(efd, EPOLL_CTL_MOD, fds[0], &event)) {
+        printf("Cannot modify epoll settings for existing descriptor\n");
+        goto fail;
+    }
+    if (write(fds[1], "x", 1) != 1)
+        goto fail;
+    if (epoll_wait(efd, events, 2, 0) != 1) {
+        printf("Edge-triggered event not reported\n");
+        goto fail;
+    }
+    if (epoll_wait(efd, events, 2, 0) != 0) {
+        printf("Edge-triggered event reported twice\n");
+        goto fail;
+    }
+    close(fds[0]);
+    close(fds[1]);
+    close(efd);
+    return;
+  fail:
+    printf("test failed\n");
+    exit(EXIT_FAILURE);
+}
+
+/* EPOLLEXCLUSIVE is accepted only on add, and only with certain events */
+void test_exclusive()
+{
+    struct epoll_event event;
+    int efd = epoll_create1(0);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (efd < 0 || fd < 0) {
+        printf("Cannot create epoll or socket\n");
+        goto fail;
+    }
+
+    event.data.fd = fd;
+    event.events = EPOLLIN | EPOLLEXCLUSIVE | EPOLLONESHOT;
+    if ((epoll_ctl(efd, EPOLL_CTL_ADD, fd, &event) != -1) || (errno != EINVAL)) {
+        printf("EPOLLEXCLUSIVE with EPOLLONESHOT must be rejected\n");
+        goto fail;
+    }
+
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &event)) {
+        printf("Cannot add descriptor with EPOLLEXCLUSIVE\n");
+        goto fail;
+    }
+
+    event.events = EPOLLIN;
+    if ((epoll_ctl(efd, EPOLL_CTL_MOD, fd, &event) != -1) || (errno != EINVAL)) {
+        printf("EPOLL_CTL_MOD of an exclusive registration must be rejected\n");
+        goto fail;
+    }
+
+    if (epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL)) {
+        printf("Cannot remove descriptor from epoll\n");
+        goto fail;
+    }
+    close(fd);
+    close(efd);
+    return;
+  fail:
+    printf("test failed\n");
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char **argv)
 {
     test_ctl();
+    test_trigger();
+    test_exclusive();
 
     printf("test passed\n");
     return EXIT_SUCCESS;
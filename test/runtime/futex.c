@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define test_error(msg, ...) do { printf("futex test failed: " msg "\n", ##__VA_ARGS__); exit(EXIT_FAILURE); } while (0)
+
+#define NR_WAITERS 4
+
+static int word1, word2;
+static volatile int started, done;
+
+static long sys_futex(int *uaddr, int op, int val, unsigned long val2, int *uaddr2, int val3)
+{
+    return syscall(SYS_futex, uaddr, op, val, val2, uaddr2, val3);
+}
+
+static void *waiter(void *arg)
+{
+    __atomic_add_fetch(&started, 1, __ATOMIC_SEQ_CST);
+    if (sys_futex(&word1, FUTEX_WAIT_PRIVATE, 0, 0, 0, 0) < 0 && errno != EAGAIN)
+        test_error("wait: %d", errno);
+    __atomic_add_fetch(&done, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static void *bitset_waiter(void *arg)
+{
+    int bitset = (long)arg;
+    __atomic_add_fetch(&started, 1, __ATOMIC_SEQ_CST);
+    if (sys_futex(&word1, FUTEX_WAIT_BITSET_PRIVATE, 0, 0, 0, bitset) < 0 && errno != EAGAIN)
+        test_error("wait bitset: %d", errno);
+    __atomic_add_fetch(&done, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static void start_waiters(pthread_t *pt, int n, void *(*fn)(void *))
+{
+    started = done = 0;
+    word1 = 0;
+    for (long i = 0; i < n; i++)
+        if (pthread_create(&pt[i], 0, fn, (void *)(1L << i)))
+            test_error("pthread_create");
+    while (started < n)
+        usleep(1000);
+    /* give the waiters time to block */
+    usleep(100000);
+}
+
+static void join_waiters(pthread_t *pt, int n)
+{
+    for (int i = 0; i < n; i++)
+        pthread_join(pt[i], 0);
+}
+
+/* wake with a count, one at a time and then all */
+static void wake_test(void)
+{
+    pthread_t pt[NR_WAITERS];
+    start_waiters(pt, NR_WAITERS, waiter);
+    long rv = sys_futex(&word1, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+    if (rv != 1)
+        test_error("wake one returned %ld", rv);
+    rv = sys_futex(&word1, FUTEX_WAKE_PRIVATE, NR_WAITERS, 0, 0, 0);
+    if (rv != NR_WAITERS - 1)
+        test_error("wake all returned %ld", rv);
+    join_waiters(pt, NR_WAITERS);
+
+    /* no waiters left */
+    rv = sys_futex(&word1, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+    if (rv != 0)
+        test_error("wake with no waiters returned %ld", rv);
+}
+
+/* waiters on bits 0..3; wake only bits 1 and 3 */
+static void bitset_test(void)
+{
+    pthread_t pt[NR_WAITERS];
+    if (sys_futex(&word1, FUTEX_WAIT_BITSET_PRIVATE, 0, 0, 0, 0) != -1 || errno != EINVAL)
+        test_error("wait with empty bitset should fail with EINVAL");
+    start_waiters(pt, NR_WAITERS, bitset_waiter);
+    long rv = sys_futex(&word1, FUTEX_WAKE_BITSET_PRIVATE, NR_WAITERS, 0, 0, 0xa);
+    if (rv != 2)
+        test_error("wake bitset 0xa returned %ld", rv);
+    rv = sys_futex(&word1, FUTEX_WAKE_BITSET_PRIVATE, NR_WAITERS, 0, 0, 0xa);
+    if (rv != 0)
+        test_error("second wake bitset 0xa returned %ld", rv);
+    rv = sys_futex(&word1, FUTEX_WAKE_PRIVATE, NR_WAITERS, 0, 0, 0);
+    if (rv != 2)
+        test_error("wake remaining returned %ld", rv);
+    join_waiters(pt, NR_WAITERS);
+}
+
+/* wake one and move the rest to word2, then wake them there */
+static void requeue_test(void)
+{
+    pthread_t pt[NR_WAITERS];
+    start_waiters(pt, NR_WAITERS, waiter);
+    if (sys_futex(&word1, FUTEX_CMP_REQUEUE_PRIVATE, 1, NR_WAITERS, &word2, 1) != -1 ||
+        errno != EAGAIN)
+        test_error("cmp requeue with stale value should fail with EAGAIN");
+    long rv = sys_futex(&word1, FUTEX_CMP_REQUEUE_PRIVATE, 1, 1, &word2, 0);
+    if (rv != 2)
+        test_error("cmp requeue returned %ld", rv);
+    rv = sys_futex(&word1, FUTEX_REQUEUE_PRIVATE, 0, NR_WAITERS, &word2, 0);
+    if (rv != NR_WAITERS - 2)
+        test_error("requeue returned %ld", rv);
+    rv = sys_futex(&word1, FUTEX_WAKE_PRIVATE, NR_WAITERS, 0, 0, 0);
+    if (rv != 0)
+        test_error("wake after requeue returned %ld", rv);
+    rv = sys_futex(&word2, FUTEX_WAKE_PRIVATE, NR_WAITERS, 0, 0, 0);
+    if (rv != NR_WAITERS - 1)
+        test_error("wake on requeue target returned %ld", rv);
+    join_waiters(pt, NR_WAITERS);
+}
+
+static void timeout_test(void)
+{
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 50000000 };
+    word1 = 0;
+    if (sys_futex(&word1, FUTEX_WAIT_PRIVATE, 0, (unsigned long)&ts, 0, 0) != -1 ||
+        errno != ETIMEDOUT)
+        test_error("relative wait should time out");
+    if (sys_futex(&word1, FUTEX_WAIT_PRIVATE, 1, 0, 0, 0) != -1 || errno != EAGAIN)
+        test_error("wait on changed value should fail with EAGAIN");
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += 50000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    if (sys_futex(&word1, FUTEX_WAIT_BITSET_PRIVATE, 0, (unsigned long)&ts, 0,
+                  FUTEX_BITSET_MATCH_ANY) != -1 || errno != ETIMEDOUT)
+        test_error("absolute wait should time out");
+}
+
+int main(int argc, char **argv)
+{
+    wake_test();
+    bitset_test();
+    requeue_test();
+    timeout_test();
+    printf("futex test passed\n");
+    exit(EXIT_SUCCESS);
+}
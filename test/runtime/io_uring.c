@@ -0,0 +1,413 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SYS_io_uring_setup
+#define SYS_io_uring_setup      425
+#define SYS_io_uring_enter      426
+#define SYS_io_uring_register   427
+#endif
+
+#define RING_ENTRIES    8
+#define BUF_SIZE        4096
+
+#define test_assert(expr) do { \
+    if (!(expr)) { \
+        printf("Error: %s -- failed at %s:%d\n", #expr, __FILE__, __LINE__); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+struct ring {
+    int fd;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+};
+
+static void ring_setup(struct ring *r, unsigned flags)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = flags;
+    r->fd = syscall(SYS_io_uring_setup, RING_ENTRIES, &p);
+    test_assert(r->fd >= 0);
+    test_assert(p.sq_entries == RING_ENTRIES);
+    test_assert(p.cq_entries >= RING_ENTRIES);
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len)
+            r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+    r->sq_ptr = mmap(0, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    test_assert(r->sq_ptr != MAP_FAILED);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(0, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        test_assert(r->cq_ptr != MAP_FAILED);
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(0, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    test_assert(r->sqes != MAP_FAILED);
+
+    r->sq_head = r->sq_ptr + p.sq_off.head;
+    r->sq_tail = r->sq_ptr + p.sq_off.tail;
+    r->sq_mask = r->sq_ptr + p.sq_off.ring_mask;
+    r->sq_array = r->sq_ptr + p.sq_off.array;
+    r->cq_head = r->cq_ptr + p.cq_off.head;
+    r->cq_tail = r->cq_ptr + p.cq_off.tail;
+    r->cq_mask = r->cq_ptr + p.cq_off.ring_mask;
+    r->cqes = r->cq_ptr + p.cq_off.cqes;
+}
+
+static void ring_teardown(struct ring *r)
+{
+    test_assert(munmap(r->sqes, r->sqes_len) == 0);
+    if (r->cq_ptr != r->sq_ptr)
+        test_assert(munmap(r->cq_ptr, r->cq_len) == 0);
+    test_assert(munmap(r->sq_ptr, r->sq_len) == 0);
+    test_assert(close(r->fd) == 0);
+}
+
+static struct io_uring_sqe *ring_get_sqe(struct ring *r)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    test_assert(tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) < RING_ENTRIES);
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+static int ring_enter(struct ring *r, unsigned to_submit, unsigned min_complete)
+{
+    return syscall(SYS_io_uring_enter, r->fd, to_submit, min_complete,
+                   min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static void ring_reap(struct ring *r, __u64 *user_data, int *res)
+{
+    unsigned head = *r->cq_head;
+
+    test_assert(head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE));
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void ring_wait_one(struct ring *r, __u64 user_data, int res)
+{
+    __u64 ud;
+    int rv;
+
+    if (*r->cq_head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        test_assert(ring_enter(r, 0, 1) >= 0);
+    ring_reap(r, &ud, &rv);
+    if (ud != user_data || rv != res) {
+        printf("unexpected completion: user_data %lld res %d, expected %lld res %d\n",
+               (long long)ud, rv, (long long)user_data, res);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void test_nop(void)
+{
+    struct ring r;
+    struct io_uring_sqe *sqe;
+
+    ring_setup(&r, 0);
+    for (int i = 0; i < 3; i++) {
+        sqe = ring_get_sqe(&r);
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = i;
+    }
+    test_assert(ring_enter(&r, 3, 3) == 3);
+    for (int i = 0; i < 3; i++)
+        ring_wait_one(&r, i, 0);
+
+    /* bad opcode and bad descriptor complete with errors */
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = 0xff;
+    sqe->user_data = 10;
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    ring_wait_one(&r, 10, -EINVAL);
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = -1;
+    sqe->user_data = 11;
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    ring_wait_one(&r, 11, -EBADF);
+    ring_teardown(&r);
+}
+
+static void test_file_rw(void)
+{
+    struct ring r;
+    struct io_uring_sqe *sqe;
+    static char wbuf[BUF_SIZE], rbuf[BUF_SIZE];
+    struct iovec iov[2];
+
+    for (int i = 0; i < BUF_SIZE; i++)
+        wbuf[i] = i & 0xff;
+    int fd = open("io_uring_file", O_RDWR | O_CREAT | O_TRUNC, S_IRWXU);
+    test_assert(fd >= 0);
+
+    ring_setup(&r, 0);
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)wbuf;
+    sqe->len = BUF_SIZE;
+    sqe->off = 0;
+    sqe->user_data = 1;
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    ring_wait_one(&r, 1, BUF_SIZE);
+
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->user_data = 2;
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    ring_wait_one(&r, 2, 0);
+
+    /* vectored read from an offset, split across two buffers */
+    iov[0].iov_base = rbuf;
+    iov[0].iov_len = 100;
+    iov[1].iov_base = rbuf + 100;
+    iov[1].iov_len = 200;
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)iov;
+    sqe->len = 2;
+    sqe->off = 10;
+    sqe->user_data = 3;
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    ring_wait_one(&r, 3, 300);
+    test_assert(!memcmp(rbuf, wbuf + 10, 300));
+
+    /* fixed buffer and file */
+    memset(rbuf, 0, sizeof(rbuf));
+    iov[0].iov_base = rbuf;
+    iov[0].iov_len = sizeof(rbuf);
+    test_assert(syscall(SYS_io_uring_register, r.fd, IORING_REGISTER_BUFFERS, iov, 1) == 0);
+    test_assert(syscall(SYS_io_uring_register, r.fd, IORING_REGISTER_FILES, &fd, 1) == 0);
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->addr = (unsigned long)rbuf;
+    sqe->len = BUF_SIZE;
+    sqe->off = 0;
+    sqe->buf_index = 0;
+    sqe->user_data = 4;
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    ring_wait_one(&r, 4, BUF_SIZE);
+    test_assert(!memcmp(rbuf, wbuf, BUF_SIZE));
+
+    /* a fixed read outside of the registered buffer is refused */
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->addr = (unsigned long)wbuf;
+    sqe->len = BUF_SIZE;
+    sqe->buf_index = 0;
+    sqe->user_data = 5;
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    ring_wait_one(&r, 5, -EFAULT);
+
+    test_assert(syscall(SYS_io_uring_register, r.fd, IORING_UNREGISTER_FILES, 0, 0) == 0);
+    test_assert(syscall(SYS_io_uring_register, r.fd, IORING_UNREGISTER_BUFFERS, 0, 0) == 0);
+    ring_teardown(&r);
+    close(fd);
+    unlink("io_uring_file");
+}
+
+static void test_pipe_poll(void)
+{
+    struct ring r;
+    struct io_uring_sqe *sqe;
+    int pfd[2];
+    char buf[16];
+
+    test_assert(pipe(pfd) == 0);
+    ring_setup(&r, 0);
+
+    /* poll and read are queued before any data is available */
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = pfd[0];
+    sqe->poll_events = POLLIN;
+    sqe->user_data = 1;
+    test_assert(ring_enter(&r, 1, 0) == 1);
+    test_assert(*r.cq_head == __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE));
+    test_assert(write(pfd[1], "hello", 5) == 5);
+    ring_wait_one(&r, 1, POLLIN);
+
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = pfd[0];
+    sqe->addr = (unsigned long)buf;
+    sqe->len = sizeof(buf);
+    sqe->off = -1;
+    sqe->user_data = 2;
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    ring_wait_one(&r, 2, 5);
+    test_assert(!memcmp(buf, "hello", 5));
+
+    /* a vectored read waiting for data uses its own copy of the
+       iovecs, which the submitter may reuse (IORING_FEAT_SUBMIT_STABLE) */
+    struct iovec iov[2];
+    char buf2[16];
+    iov[0].iov_base = buf;
+    iov[0].iov_len = 2;
+    iov[1].iov_base = buf2;
+    iov[1].iov_len = sizeof(buf2);
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = pfd[0];
+    sqe->addr = (unsigned long)iov;
+    sqe->len = 2;
+    sqe->off = -1;
+    sqe->user_data = 3;
+    test_assert(ring_enter(&r, 1, 0) == 1);
+    memset(iov, 0, sizeof(iov));
+    test_assert(write(pfd[1], "world", 5) == 5);
+    ring_wait_one(&r, 3, 5);
+    test_assert(!memcmp(buf, "wo", 2) && !memcmp(buf2, "rld", 3));
+
+    ring_teardown(&r);
+    close(pfd[0]);
+    close(pfd[1]);
+}
+
+static void test_send_recv(void)
+{
+    struct ring r;
+    struct io_uring_sqe *sqe;
+    int sv[2];
+    char buf[16];
+
+    test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    ring_setup(&r, 0);
+
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = sv[0];
+    sqe->addr = (unsigned long)"hello";
+    sqe->len = 5;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = 1;
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    ring_wait_one(&r, 1, 5);
+
+    /* a flag is either honored or the request refused, never ignored */
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sv[1];
+    sqe->addr = (unsigned long)buf;
+    sqe->len = sizeof(buf);
+    sqe->msg_flags = MSG_PEEK;
+    sqe->user_data = 2;
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    __u64 user_data;
+    int res;
+    ring_reap(&r, &user_data, &res);
+    test_assert(user_data == 2 && (res == -EINVAL || (res == 5 && !memcmp(buf, "hello", 5))));
+
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sv[1];
+    sqe->addr = (unsigned long)buf;
+    sqe->len = sizeof(buf);
+    sqe->user_data = 3;
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    ring_wait_one(&r, 3, 5);
+    test_assert(!memcmp(buf, "hello", 5));
+
+    ring_teardown(&r);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+static void test_timeout(void)
+{
+    struct ring r;
+    struct io_uring_sqe *sqe;
+    struct __kernel_timespec ts;
+    struct timespec start, end;
+
+    ring_setup(&r, 0);
+
+    /* expiry */
+    ts.tv_sec = 0;
+    ts.tv_nsec = 100 * 1000 * 1000;
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (unsigned long)&ts;
+    sqe->len = 1;
+    sqe->user_data = 1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    test_assert(ring_enter(&r, 1, 1) == 1);
+    ring_wait_one(&r, 1, -ETIME);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 +
+        (end.tv_nsec - start.tv_nsec) / 1000000;
+    test_assert(elapsed_ms >= 90);
+
+    /* completion count satisfied before expiry */
+    ts.tv_sec = 10;
+    ts.tv_nsec = 0;
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (unsigned long)&ts;
+    sqe->len = 1;
+    sqe->off = 1;
+    sqe->user_data = 2;
+    sqe = ring_get_sqe(&r);
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = 3;
+    test_assert(ring_enter(&r, 2, 2) == 2);
+    ring_wait_one(&r, 3, 0);
+    ring_wait_one(&r, 2, 0);
+    ring_teardown(&r);
+}
+
+int main(int argc, char **argv)
+{
+    setbuf(stdout, NULL);
+    test_nop();
+    test_file_rw();
+    test_pipe_poll();
+    test_send_recv();
+    test_timeout();
+    printf("io_uring test passed\n");
+    return EXIT_SUCCESS;
+}
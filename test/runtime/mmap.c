@@ -1,4 +1,4 @@
-/* tests for mmap, munmap, mremap, and mincore */
+/* tests for mmap, munmap, mremap, mincore and madvise */
 
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -528,6 +528,14 @@ static void mincore_test(void)
             exit(EXIT_FAILURE);
         }
 
+        /* a 2M-aligned mapping would otherwise be faulted in whole,
+           and the neighbors of touched pages faulted around */
+        if (madvise(addr, PAGESIZE*512, MADV_NOHUGEPAGE) ||
+            madvise(addr, PAGESIZE*512, MADV_RANDOM)) {
+            perror("madvise failed");
+            exit(EXIT_FAILURE);
+        }
+
         for (i = 0; i < 512; i++) {
             if (i % 5 == 0) {
                 memset(addr + (i << PAGELOG), 0, PAGESIZE);
@@ -641,6 +649,221 @@ void mremap_test(void)
     printf("** all mremap tests passed\n");
 }
 
+#define MADVISE_NR_PAGES 16
+
+static void madvise_test(void)
+{
+    uint8_t vec[MADVISE_NR_PAGES];
+    unsigned long len = MADVISE_NR_PAGES * PAGESIZE;
+    unsigned char * addr;
+    int i;
+
+    printf("** starting madvise tests\n");
+
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        perror("mmap failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /* anonymous memory is prefaulted (Linux only reads ahead files and swap) */
+    if (madvise(addr, len, MADV_WILLNEED)) {
+        perror("madvise(MADV_WILLNEED) failed");
+        exit(EXIT_FAILURE);
+    }
+    if (mincore(addr, len, vec)) {
+        perror("mincore failed");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < MADVISE_NR_PAGES; i++) {
+        if (!vec[i]) {
+            fprintf(stderr, "page %d not resident after MADV_WILLNEED\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* dropped pages read back as zero, others keep their contents */
+    memset(addr, 0xa5, len);
+    if (madvise(addr, len / 2, MADV_DONTNEED)) {
+        perror("madvise(MADV_DONTNEED) failed");
+        exit(EXIT_FAILURE);
+    }
+    if (madvise(addr + len / 2, PAGESIZE, MADV_FREE)) {
+        perror("madvise(MADV_FREE) failed");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < len / 2; i += PAGESIZE) {
+        if (addr[i] != 0) {
+            fprintf(stderr, "page at offset 0x%x not zero after MADV_DONTNEED\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (addr[len / 2] != 0 && addr[len / 2] != 0xa5) {
+        fprintf(stderr, "unexpected contents after MADV_FREE\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = len / 2 + PAGESIZE; i < len; i += PAGESIZE) {
+        if (addr[i] != 0xa5) {
+            fprintf(stderr, "page at offset 0x%x lost its contents\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (madvise(addr, len, MADV_HUGEPAGE) || madvise(addr, PAGESIZE, MADV_NOHUGEPAGE)) {
+        perror("madvise(MADV_HUGEPAGE) failed");
+        exit(EXIT_FAILURE);
+    }
+    if (madvise(addr + 1, PAGESIZE, MADV_DONTNEED) == 0) {
+        fprintf(stderr, "madvise with unaligned address should fail\n");
+        exit(EXIT_FAILURE);
+    }
+    if (madvise(addr, PAGESIZE, 1234) == 0) {
+        fprintf(stderr, "madvise with invalid advice should fail\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* a hole in the range is reported after applying to the rest */
+    __munmap(addr + len - PAGESIZE, PAGESIZE);
+    if (madvise(addr, len, MADV_DONTNEED) == 0) {
+        fprintf(stderr, "madvise over unmapped range should fail\n");
+        exit(EXIT_FAILURE);
+    }
+    if (addr[len - 2 * PAGESIZE] != 0) {
+        fprintf(stderr, "mapped part of range not dropped\n");
+        exit(EXIT_FAILURE);
+    }
+
+    __munmap(addr, len - PAGESIZE);
+    printf("** all madvise tests passed\n");
+}
+
+static void thp_check_page(unsigned char * addr, int page, unsigned char expect)
+{
+    if (addr[page * PAGESIZE] != expect) {
+        fprintf(stderr, "huge page: page %d is 0x%x, expected 0x%x\n",
+                page, addr[page * PAGESIZE], expect);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Operations on part of a (possibly) huge page must leave the rest intact */
+static void thp_test(void)
+{
+    uint8_t vec[512];
+    unsigned char * region, * addr;
+    int i, resident;
+
+    printf("** starting transparent huge page tests\n");
+
+    region = mmap(NULL, 2 * PAGESIZE_2M, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        perror("mmap failed");
+        exit(EXIT_FAILURE);
+    }
+    addr = (unsigned char *)(((unsigned long)region + PAGESIZE_2M - 1) & ~(PAGESIZE_2M - 1));
+    if (madvise(addr, PAGESIZE_2M, MADV_HUGEPAGE)) {
+        perror("madvise(MADV_HUGEPAGE) failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /* a single touch may fault in the whole 2M block */
+    addr[0] = 0;
+    if (mincore(addr, PAGESIZE_2M, vec)) {
+        perror("mincore failed");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0, resident = 0; i < 512; i++)
+        resident += vec[i] & 1;
+    printf("  %d of 512 pages resident after first touch\n", resident);
+
+    for (i = 0; i < 512; i++)
+        thp_check_page(addr, i, 0);
+    for (i = 0; i < 512; i++)
+        addr[i * PAGESIZE] = i & 0xff;
+
+    __munmap(addr + 100 * PAGESIZE, PAGESIZE);
+    thp_check_page(addr, 99, 99);
+    thp_check_page(addr, 101, 101);
+
+    if (mprotect(addr + 200 * PAGESIZE, PAGESIZE, PROT_READ)) {
+        perror("mprotect failed");
+        exit(EXIT_FAILURE);
+    }
+    thp_check_page(addr, 200, 200);
+    addr[201 * PAGESIZE] = 0x5a;
+    thp_check_page(addr, 201, 0x5a);
+
+    if (madvise(addr + 300 * PAGESIZE, PAGESIZE, MADV_DONTNEED)) {
+        perror("madvise(MADV_DONTNEED) failed");
+        exit(EXIT_FAILURE);
+    }
+    thp_check_page(addr, 299, 299 & 0xff);
+    thp_check_page(addr, 300, 0);
+    thp_check_page(addr, 301, 301 & 0xff);
+    thp_check_page(addr, 511, 511 & 0xff);
+
+    __munmap(region, 2 * PAGESIZE_2M);
+    printf("** all transparent huge page tests passed\n");
+}
+
+#define FAULT_AROUND_NR_PAGES 64
+
+static void fault_around_test(void)
+{
+    uint8_t vec[FAULT_AROUND_NR_PAGES];
+    unsigned long len = FAULT_AROUND_NR_PAGES * PAGESIZE;
+    unsigned char * addr;
+    int i, resident;
+
+    printf("** starting fault-around tests\n");
+
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        perror("mmap failed");
+        exit(EXIT_FAILURE);
+    }
+    if (madvise(addr, len, MADV_NOHUGEPAGE)) {
+        perror("madvise(MADV_NOHUGEPAGE) failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /* neighbors may be mapped along with the faulting page */
+    addr[0] = 1;
+    if (mincore(addr, len / 2, vec)) {
+        perror("mincore failed");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0, resident = 0; i < FAULT_AROUND_NR_PAGES / 2; i++)
+        resident += vec[i] & 1;
+    printf("  %d of %d pages resident after first touch\n", resident, FAULT_AROUND_NR_PAGES / 2);
+    for (i = 1; i < FAULT_AROUND_NR_PAGES / 2; i++) {
+        if (addr[i * PAGESIZE] != 0) {
+            fprintf(stderr, "fault-around: page %d not zero\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* ...but not with MADV_RANDOM */
+    if (madvise(addr + len / 2, len / 2, MADV_RANDOM)) {
+        perror("madvise(MADV_RANDOM) failed");
+        exit(EXIT_FAILURE);
+    }
+    addr[len / 2] = 1;
+    if (mincore(addr + len / 2, len / 2, vec)) {
+        perror("mincore failed");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 1; i < FAULT_AROUND_NR_PAGES / 2; i++) {
+        if (vec[i] & 1) {
+            fprintf(stderr, "fault-around: page %d resident despite MADV_RANDOM\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    __munmap(addr, len);
+    printf("** all fault-around tests passed\n");
+}
+
 int main(int argc, char * argv[])
 {
     /*
@@ -661,6 +884,9 @@ int main(int argc, char * argv[])
     mmap_test();
     mincore_test();
     mremap_test();
+    madvise_test();
+    thp_test();
+    fault_around_test();
 
     printf("\n**** all tests passed ****\n");
 
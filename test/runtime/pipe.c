@@ -6,6 +6,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 
 #include <runtime.h>
 
@@ -119,6 +121,88 @@ void blocking_test(heap h, int * fds)
     printf("blocking test passed\n");
 }
 
+void splice_test(heap h, int * fds)
+{
+    char *test_string = "This is a splice test string!";
+    int test_len = strlen(test_string);
+    char buf[64];
+    int fds2[2];
+    ssize_t nbytes;
+
+    if (__pipe(fds2) == -1)
+        handle_error("splice test pipe");
+
+    struct iovec iov = { test_string, test_len };
+    nbytes = vmsplice(fds[1], &iov, 1, 0);
+    if (nbytes != test_len)
+        handle_error("vmsplice");
+
+    /* duplicate into the second pipe, then move it back behind the original */
+    nbytes = tee(fds[0], fds2[1], test_len, 0);
+    if (nbytes != test_len)
+        handle_error("tee");
+    nbytes = splice(fds2[0], NULL, fds[1], NULL, test_len, 0);
+    if (nbytes != test_len)
+        handle_error("splice");
+
+    nbytes = splice(fds2[0], NULL, fds[1], NULL, test_len, SPLICE_F_NONBLOCK);
+    if (nbytes != -1 || errno != EAGAIN) {
+        printf("PIPE-SPLICE - ERROR - expected EAGAIN from empty pipe, got %ld\n", nbytes);
+        exit(EXIT_FAILURE);
+    }
+
+    int nread = 0;
+    do {
+        nbytes = read(fds[0], buf + nread, 2 * test_len - nread);
+        if (nbytes < 0)
+            handle_error("splice test read");
+        nread += nbytes;
+    } while (nread < 2 * test_len);
+
+    if (memcmp(buf, test_string, test_len) || memcmp(buf + test_len, test_string, test_len)) {
+        printf("PIPE-SPLICE - ERROR - data corrupted\n");
+        exit(EXIT_FAILURE);
+    }
+    close(fds2[0]);
+    close(fds2[1]);
+    printf("PIPE-SPLICE - SUCCESS\n");
+}
+
+void capacity_test(heap h, int * fds)
+{
+    int size = fcntl(fds[1], F_GETPIPE_SZ);
+    if (size != 16 * 4096) {
+        printf("PIPE-CAPACITY - ERROR - default capacity %d\n", size);
+        exit(EXIT_FAILURE);
+    }
+
+    /* rounded up to a power of 2 pages */
+    size = fcntl(fds[1], F_SETPIPE_SZ, 100000);
+    if (size != 128 * KB || fcntl(fds[0], F_GETPIPE_SZ) != size) {
+        printf("PIPE-CAPACITY - ERROR - set capacity returned %d\n", size);
+        exit(EXIT_FAILURE);
+    }
+
+    /* cannot shrink below the buffered data */
+    char buf[8192];
+    memset(buf, 'x', sizeof(buf));
+    if (write(fds[1], buf, sizeof(buf)) != sizeof(buf))
+        handle_error("capacity test write");
+    if (fcntl(fds[1], F_SETPIPE_SZ, 4096) != -1 || errno != EBUSY) {
+        printf("PIPE-CAPACITY - ERROR - shrink below buffered data not refused\n");
+        exit(EXIT_FAILURE);
+    }
+    if (read(fds[0], buf, sizeof(buf)) != sizeof(buf))
+        handle_error("capacity test read");
+    if (fcntl(fds[1], F_SETPIPE_SZ, 0) != 4096) {
+        printf("PIPE-CAPACITY - ERROR - minimum capacity not one page\n");
+        exit(EXIT_FAILURE);
+    }
+    if (fcntl(fds[1], F_SETPIPE_SZ, 16 * 4096) < 0)
+        handle_error("capacity test restore");
+    printf("PIPE-CAPACITY - SUCCESS\n");
+}
+
 int main(int argc, char **argv)
 {
     int fds[2] = {0,0};
@@ -137,6 +221,10 @@ int main(int argc, char **argv)
 
     blocking_test(h, fds);
 
+    splice_test(h, fds);
+
+    capacity_test(h, fds);
+
     close(fds[0]);
     close(fds[1]);
     return(EXIT_SUCCESS);
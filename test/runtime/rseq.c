@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+
+#ifndef SYS_rseq
+#define SYS_rseq 334
+#endif
+
+#define RSEQ_FLAG_UNREGISTER    1
+#define RSEQ_SIG                0x53053053
+
+#define test_error(msg, ...) do { printf("rseq test failed: " msg "\n", ##__VA_ARGS__); exit(EXIT_FAILURE); } while (0)
+
+struct test_rseq {
+    unsigned int cpu_id_start;
+    unsigned int cpu_id;
+    unsigned long long rseq_cs;
+    unsigned int flags;
+} __attribute__((aligned(32)));
+
+/* glibc 2.35+ registers an rseq area for each thread */
+extern const ptrdiff_t __rseq_offset __attribute__((weak));
+extern const unsigned int __rseq_size __attribute__((weak));
+
+static __thread struct test_rseq rs;
+static volatile int alarmed;
+
+static int sys_rseq(void *rseq, unsigned int len, int flags, unsigned int sig)
+{
+    return syscall(SYS_rseq, rseq, len, flags, sig);
+}
+
+static void alarm_handler(int sig)
+{
+    alarmed = 1;
+}
+
+/* Spin in a critical section until SIGALRM; the kernel must restart
+   the interrupted sequence at the abort handler. */
+static int cs_spin(struct test_rseq *r)
+{
+    int aborted;
+    __asm__ __volatile__(
+        ".pushsection __rseq_cs, \"aw\"\n"
+        ".balign 32\n"
+        "1: .long 0, 0\n"
+        ".quad 2f, (3f - 2f), 4f\n"
+        ".popsection\n"
+        "leaq 1b(%%rip), %%rax\n"
+        "movq %%rax, %[cs]\n"
+        "2: cmpl $0, %[alarmed]\n"
+        "je 2b\n"
+        "3: movl $0, %[aborted]\n"
+        "jmp 5f\n"
+        ".long 0x53053053\n"
+        "4: movl $1, %[aborted]\n"
+        "5:\n"
+        : [aborted] "=m" (aborted), [cs] "=m" (r->rseq_cs)
+        : [alarmed] "m" (alarmed)
+        : "rax", "memory", "cc");
+    return aborted;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int cpu, node;
+    int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        test_error("getcpu: %s", strerror(errno));
+    if (cpu >= ncpus || node != 0)
+        test_error("getcpu returned cpu %d, node %d", cpu, node);
+    int vcpu = sched_getcpu();
+    if (vcpu < 0 || vcpu >= ncpus)
+        test_error("vdso getcpu returned %d", vcpu);
+    printf("getcpu: cpu %d, vdso cpu %d\n", cpu, vcpu);
+
+    struct test_rseq *r = &rs;
+    int own = 0;
+    if (&__rseq_size && __rseq_size > 0) {
+        r = (struct test_rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+        printf("using rseq area registered by libc\n");
+    } else {
+        if (sys_rseq(r, sizeof(*r), 0, RSEQ_SIG) != 0)
+            test_error("register: %s", strerror(errno));
+        own = 1;
+        if (sys_rseq(r, sizeof(*r), 0, RSEQ_SIG) != -1 || errno != EBUSY)
+            test_error("second registration did not fail with EBUSY");
+        if (sys_rseq(r, 16, 0, RSEQ_SIG) != -1 || errno != EINVAL)
+            test_error("registration with bad length did not fail with EINVAL");
+    }
+    if (r->cpu_id >= ncpus || r->cpu_id != r->cpu_id_start)
+        test_error("cpu_id %d, cpu_id_start %d", r->cpu_id, r->cpu_id_start);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = alarm_handler;
+    if (sigaction(SIGALRM, &sa, NULL) != 0)
+        test_error("sigaction: %s", strerror(errno));
+    struct itimerval it = { .it_value = { .tv_usec = 50000 } };
+    if (setitimer(ITIMER_REAL, &it, NULL) != 0)
+        test_error("setitimer: %s", strerror(errno));
+    if (!cs_spin(r))
+        test_error("critical section was not aborted");
+    if (r->rseq_cs != 0)
+        test_error("rseq_cs not cleared after abort");
+    printf("critical section aborted on signal delivery\n");
+
+    if (own) {
+        if (sys_rseq(r, sizeof(*r), RSEQ_FLAG_UNREGISTER, 0) != -1 || errno != EPERM)
+            test_error("unregister with wrong signature did not fail with EPERM");
+        if (sys_rseq(r, sizeof(*r), RSEQ_FLAG_UNREGISTER, RSEQ_SIG) != 0)
+            test_error("unregister: %s", strerror(errno));
+        if (r->cpu_id != (unsigned int)-1)
+            test_error("cpu_id not reset on unregister");
+    }
+    printf("rseq test passed\n");
+    return EXIT_SUCCESS;
+}
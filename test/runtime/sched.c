@@ -0,0 +1,102 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define test_error(msg, ...) do { printf("sched test failed: " msg "\n", ##__VA_ARGS__); exit(EXIT_FAILURE); } while (0)
+
+static void policy_test(void)
+{
+    struct sched_param sp;
+
+    if (sched_get_priority_min(SCHED_FIFO) != 1 || sched_get_priority_max(SCHED_FIFO) != 99)
+        test_error("SCHED_FIFO priority range");
+    if (sched_get_priority_min(SCHED_OTHER) != 0 || sched_get_priority_max(SCHED_OTHER) != 0)
+        test_error("SCHED_OTHER priority range");
+    if (sched_get_priority_max(1234) != -1 || errno != EINVAL)
+        test_error("invalid policy should fail with EINVAL");
+
+    if (sched_getscheduler(0) != SCHED_OTHER)
+        test_error("initial policy %d", sched_getscheduler(0));
+    sp.sched_priority = 0;
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) != -1 || errno != EINVAL)
+        test_error("SCHED_FIFO with priority 0 should fail with EINVAL");
+    sp.sched_priority = 10;
+    if (sched_setscheduler(0, SCHED_OTHER, &sp) != -1 || errno != EINVAL)
+        test_error("SCHED_OTHER with priority 10 should fail with EINVAL");
+
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+        test_error("sched_setscheduler SCHED_FIFO: %d", errno);
+    if (sched_getscheduler(0) != SCHED_FIFO)
+        test_error("policy not SCHED_FIFO");
+    sp.sched_priority = 20;
+    if (sched_setparam(0, &sp) < 0)
+        test_error("sched_setparam: %d", errno);
+    sp.sched_priority = 0;
+    if (sched_getparam(0, &sp) < 0 || sp.sched_priority != 20)
+        test_error("sched_getparam returned priority %d", sp.sched_priority);
+
+    struct timespec ts;
+    if (sched_setscheduler(0, SCHED_RR, &sp) < 0)
+        test_error("sched_setscheduler SCHED_RR: %d", errno);
+    if (sched_rr_get_interval(0, &ts) < 0 || (ts.tv_sec == 0 && ts.tv_nsec == 0))
+        test_error("sched_rr_get_interval for SCHED_RR");
+
+    sp.sched_priority = 0;
+    if (sched_setscheduler(0, SCHED_OTHER, &sp) < 0)
+        test_error("sched_setscheduler SCHED_OTHER: %d", errno);
+    if (sched_getscheduler(0) != SCHED_OTHER)
+        test_error("policy not restored");
+
+    if (sched_getscheduler(1000000) != -1 || errno != ESRCH)
+        test_error("unknown pid should fail with ESRCH");
+}
+
+static void *nice_thread(void *arg)
+{
+    /* nice is per thread and inherited on creation */
+    errno = 0;
+    int prio = getpriority(PRIO_PROCESS, 0);
+    if (prio != 5 || errno)
+        test_error("thread did not inherit nice 5 (%d)", prio);
+    if (setpriority(PRIO_PROCESS, 0, 10) < 0)
+        test_error("thread setpriority: %d", errno);
+    return 0;
+}
+
+static void nice_test(void)
+{
+    pthread_t pt;
+
+    errno = 0;
+    if (getpriority(PRIO_PROCESS, 0) != 0 || errno)
+        test_error("initial nice %d", getpriority(PRIO_PROCESS, 0));
+    if (setpriority(PRIO_PROCESS, 0, 5) < 0)
+        test_error("setpriority: %d", errno);
+    if (pthread_create(&pt, 0, nice_thread, 0))
+        test_error("pthread_create");
+    pthread_join(pt, 0);
+    if (getpriority(PRIO_PROCESS, 0) != 5)
+        test_error("nice changed by another thread");
+
+    /* out of range values are clamped */
+    if (setpriority(PRIO_PROCESS, 0, 100) < 0 || getpriority(PRIO_PROCESS, 0) != 19)
+        test_error("nice not clamped to 19");
+    if (setpriority(PRIO_PROCESS, 0, 0) < 0)
+        test_error("setpriority 0: %d", errno);
+    if (setpriority(1234, 0, 0) != -1 || errno != EINVAL)
+        test_error("invalid which should fail with EINVAL");
+}
+
+int main(int argc, char **argv)
+{
+    policy_test();
+    nice_test();
+    printf("sched test passed\n");
+    exit(EXIT_SUCCESS);
+}
@@ -888,6 +888,80 @@ void test_signalfd(void)
         fail_error("child failed\n");
 }
 
+static volatile int test_signalfd_epoll_waiting;
+
+static void * test_signalfd_epoll_child(void *arg)
+{
+    int epfd = (long)arg;
+    struct epoll_event rev;
+
+    /* Woken for a signal directed at the parent thread, this waiter
+       must neither report it nor consume the notification. */
+    test_signalfd_epoll_waiting = 1;
+    int nfds = epoll_wait(epfd, &rev, 1, 500);
+    if (nfds < 0)
+        fail_perror("child epoll_wait");
+    if (nfds != 0)
+        fail_error("child epoll_wait reported %d events for another thread\n", nfds);
+    return (void *)EXIT_SUCCESS;
+}
+
+/* A thread-directed signal in a signalfd must be collected by epoll_wait
+   on the target thread even if a waiter on another thread is woken first. */
+void test_signalfd_epoll_threads(void)
+{
+    sigset_t ss;
+    sigemptyset(&ss);
+    sigaddset(&ss, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &ss, 0) < 0)
+        fail_perror("sigprocmask");
+    int fd = signalfd(-1, &ss, SFD_NONBLOCK);
+    if (fd < 0)
+        fail_perror("signalfd");
+    int epfd = epoll_create1(0);
+    if (epfd < 0)
+        fail_perror("epoll_create1");
+    struct epoll_event epev;
+    epev.events = EPOLLIN;
+    epev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &epev) < 0)
+        fail_perror("epoll_ctl");
+
+    test_signalfd_epoll_waiting = 0;
+    pthread_t pt = 0;
+    if (pthread_create(&pt, NULL, test_signalfd_epoll_child, (void *)(long)epfd))
+        fail_perror("pthread_create");
+    yield_for(&test_signalfd_epoll_waiting);
+    usleep(100000);
+
+    if (syscall(SYS_tgkill, __getpid(), syscall(SYS_gettid), SIGUSR1) < 0)
+        fail_perror("tgkill");
+
+    struct epoll_event rev;
+    int nfds = epoll_wait(epfd, &rev, 1, 5000);
+    if (nfds < 0)
+        fail_perror("epoll_wait");
+    if (nfds != 1 || rev.data.fd != fd || !(rev.events & EPOLLIN))
+        fail_error("thread-directed signal not reported to target (nfds %d)\n", nfds);
+
+    struct signalfd_siginfo si;
+    int rv = read(fd, &si, sizeof(si));
+    if (rv < 0)
+        fail_perror("read");
+    if (rv < sizeof(si) || si.ssi_signo != SIGUSR1)
+        fail_error("unexpected signalfd read (rv %d, signo %d)\n", rv, si.ssi_signo);
+
+    void * retval;
+    if (pthread_join(pt, &retval))
+        fail_perror("pthread_join");
+    if (retval != (void*)EXIT_SUCCESS)
+        fail_error("child failed\n");
+    close(epfd);
+    close(fd);
+    if (sigprocmask(SIG_UNBLOCK, &ss, 0) < 0)
+        fail_perror("sigprocmask");
+}
+
 static uint8_t altstack[2048];
 
 static void test_sigaltstack_handler(int sig)
@@ -1001,6 +1075,8 @@ int main(int argc, char * argv[])
 
     test_signalfd();
 
+    test_signalfd_epoll_threads();
+
     test_sigaltstack();
 
     printf("signal test passed\n");
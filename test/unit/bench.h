@@ -0,0 +1,9 @@
+#include <time.h>
+
+/* monotonic timestamp for the unit test benchmarks */
+static inline u64 bench_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
@@ -1,5 +1,7 @@
 #include <runtime.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include "bench.h"
 
 #define TEST_L -1ull
 #define TEST_R -5ull
@@ -42,6 +44,101 @@ closure_function(1, 2, void, test1,
 typedef closure_type(test0_type, u64, u64);
 typedef closure_type(test1_type, void, void *, boolean);
 
+/* Parent heap which counts allocations. It must outlive the closure
+   pools, which hold on to it. */
+static struct counting_heap {
+    struct heap h;
+    heap parent;
+    u64 allocs;
+} ch;
+
+static u64 counting_alloc(heap h, bytes b)
+{
+    struct counting_heap *c = (struct counting_heap *)h;
+    c->allocs++;
+    return allocate_u64(c->parent, b);
+}
+
+static void counting_dealloc(heap h, u64 a, bytes b)
+{
+    deallocate_u64(((struct counting_heap *)h)->parent, a, b);
+}
+
+/* stand-ins for per-packet and per-read completions */
+closure_function(1, 0, void, pkt_complete,
+                 u64 *, done)
+{
+    (*bound(done))++;
+    closure_finish();
+}
+
+closure_function(2, 1, void, read_complete,
+                 u64 *, done, u64, len,
+                 status, s)
+{
+    *bound(done) += bound(len);
+    closure_finish();
+}
+
+#define BENCH_OPS 1000000
+#define BENCH_INFLIGHT 16
+
+/* Run batches of in-flight packet and read completions, allocating
+   closures either directly or from their pools. A read also takes a
+   merge, as block i/o does; its closures are always pooled. */
+static boolean closure_bench(heap h, boolean pooled)
+{
+    ch.h.alloc = counting_alloc;
+    ch.h.dealloc = counting_dealloc;
+    ch.h.pagesize = 1;
+    ch.parent = h;
+    ch.allocs = 0;
+    heap ph = &ch.h;
+    u64 done = 0;
+    thunk pkts[BENCH_INFLIGHT];
+
+    u64 t = bench_ns();
+    for (int i = 0; i < BENCH_OPS; i += BENCH_INFLIGHT) {
+        for (int j = 0; j < BENCH_INFLIGHT; j++)
+            pkts[j] = pooled ? closure_from_pool(ph, pkt_complete, &done) :
+                closure(ph, pkt_complete, &done);
+        for (int j = 0; j < BENCH_INFLIGHT; j++)
+            apply(pkts[j]);
+    }
+    u64 pkt_ns = bench_ns() - t;
+    u64 pkt_allocs = ch.allocs;
+
+    ch.allocs = 0;
+    t = bench_ns();
+    for (int i = 0; i < BENCH_OPS; i += BENCH_INFLIGHT) {
+        for (int j = 0; j < BENCH_INFLIGHT; j++) {
+            status_handler sh = pooled ? closure_from_pool(ph, read_complete, &done, 1) :
+                closure(ph, read_complete, &done, 1);
+            merge m = allocate_merge(ph, sh);
+            status_handler k0 = apply_merge(m);
+            status_handler k1 = apply_merge(m);
+            apply(k1, STATUS_OK);
+            apply(k0, STATUS_OK);
+        }
+    }
+    u64 read_ns = bench_ns() - t;
+    u64 read_allocs = ch.allocs;
+
+    if (done != 2 * BENCH_OPS) {
+        msg_err("%ld completions, expected %d\n", done, 2 * BENCH_OPS);
+        return false;
+    }
+    printf("%s closures: %.2f allocs/packet (%lld ns), %.2f allocs/read (%lld ns)\n",
+           pooled ? "pooled" : "heap  ",
+           (double)pkt_allocs / BENCH_OPS, pkt_ns / BENCH_OPS,
+           (double)read_allocs / BENCH_OPS, read_ns / BENCH_OPS);
+    if (pooled && pkt_allocs > BENCH_INFLIGHT) {
+        msg_err("pooled packet closures not recycled (%ld allocations)\n", pkt_allocs);
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -65,5 +162,7 @@ int main(int argc, char **argv)
                 heap_occupancy, heap_allocated(h));
         return EXIT_FAILURE;
     }
+    if (!closure_bench(h, false) || !closure_bench(h, true))
+        return EXIT_FAILURE;
     return EXIT_SUCCESS;
 }
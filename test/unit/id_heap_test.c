@@ -1,5 +1,6 @@
 #include <runtime.h>
 #include <stdlib.h>
+#include "bench.h"
 #define EXIT_FAILURE 1
 #define EXIT_SUCCESS 0
 
@@ -346,6 +347,68 @@ static boolean alloc_subrange_test(heap h)
     return true;
 }
 
+#define BENCH_PAGES       U64_FROM_BIT(20)
+#define BENCH_BLOCK       512     /* 2M in 4K pages */
+#define BENCH_ITERATIONS  4096
+
+/* Allocation timings on a heap fragmented by single-page allocations,
+   like a physical heap after some uptime: all pages are allocated one
+   at a time, then the front three quarters are freed save for one
+   page per BENCH_BLOCK, and the last quarter is freed entirely. */
+static boolean alloc_bench(heap h)
+{
+    id_heap id = create_id_heap(h, h, 0, BENCH_PAGES * PAGESIZE, PAGESIZE);
+    if (id == INVALID_ADDRESS) {
+        msg_err("cannot create heap\n");
+        return false;
+    }
+    heap ih = (heap)id;
+
+    u64 t = bench_ns();
+    for (u64 p = 0; p < BENCH_PAGES; p++) {
+        if (allocate_u64(ih, PAGESIZE) != p * PAGESIZE) {
+            msg_err("fill failed at page %ld\n", p);
+            return false;
+        }
+    }
+    rprintf("fill:            %ld ns/alloc\n", (bench_ns() - t) / BENCH_PAGES);
+
+    u64 fragmented = BENCH_PAGES / 4 * 3;
+    for (u64 p = 0; p < BENCH_PAGES; p++) {
+        if (p >= fragmented || (p % BENCH_BLOCK) != BENCH_BLOCK - 1)
+            deallocate_u64(ih, p * PAGESIZE, PAGESIZE);
+    }
+
+    /* a single page freed and taken again in the fragmented region,
+       followed by a 2M block, which must be found beyond it */
+    t = bench_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        u64 a = allocate_u64(ih, PAGESIZE);
+        u64 b = allocate_u64(ih, BENCH_BLOCK * PAGESIZE);
+        if (a == INVALID_PHYSICAL || b == INVALID_PHYSICAL || b < fragmented * PAGESIZE) {
+            msg_err("block alloc failed: a 0x%lx, b 0x%lx\n", a, b);
+            return false;
+        }
+        deallocate_u64(ih, b, BENCH_BLOCK * PAGESIZE);
+        deallocate_u64(ih, a, PAGESIZE);
+    }
+    rprintf("fragmented:      %ld ns/(page + 2M block)\n", (bench_ns() - t) / BENCH_ITERATIONS);
+
+    /* exhaust the free pages, then time failing block allocations */
+    while (allocate_u64(ih, PAGESIZE) != INVALID_PHYSICAL);
+    t = bench_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        if (allocate_u64(ih, BENCH_BLOCK * PAGESIZE) != INVALID_PHYSICAL) {
+            msg_err("block alloc should have failed\n");
+            return false;
+        }
+    }
+    rprintf("exhausted:       %ld ns/failed 2M block\n", (bench_ns() - t) / BENCH_ITERATIONS);
+
+    destroy_heap(ih);
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -368,6 +431,9 @@ int main(int argc, char **argv)
     if (!alloc_subrange_test(h))
         goto fail;
 
+    if (!alloc_bench(h))
+        goto fail;
+
     msg_debug("test passed\n");
     exit(EXIT_SUCCESS);
   fail:
@@ -112,6 +112,53 @@ boolean objcache_test(heap meta, heap parent, int objsize)
     return true;
 }
 
+/* Cycle objects through the magazines and depot in uneven batches,
+   tagging each live object to catch any handed out twice. */
+boolean magazine_test(heap meta, heap parent, int objsize)
+{
+    heap h = allocate_objcache(meta, parent, objsize, TEST_PAGESIZE);
+    if (h == INVALID_ADDRESS) {
+	msg_err("tb: failed to allocate objcache heap\n");
+	return false;
+    }
+
+    int n = 1000;
+    u64 *objs[n];
+    int live = 0;
+    for (int round = 0; round < 50; round++) {
+	int target = (round * 337) % n;
+	while (live < target) {
+	    u64 *p = allocate(h, objsize);
+	    if (p == INVALID_ADDRESS) {
+		msg_err("tb: failed to allocate object\n");
+		return false;
+	    }
+	    *p = live;
+	    objs[live++] = p;
+	}
+	for (int i = 0; i < live; i++) {
+	    if (*objs[i] != i) {
+		msg_err("object %p handed out twice (tag %ld, expected %d)\n",
+			objs[i], *objs[i], i);
+		return false;
+	    }
+	}
+	while (live > target / 3)
+	    deallocate(h, objs[--live], objsize);
+	if (!validate(h))
+	    return false;
+    }
+    while (live > 0)
+	deallocate(h, objs[--live], objsize);
+
+    if (heap_allocated(h) > 0) {
+	msg_err("allocated (%d) should be 0; fail\n", heap_allocated(h));
+	return false;
+    }
+    h->destroy(h);
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -125,6 +172,9 @@ int main(int argc, char **argv)
     if (!objcache_test(h, pageheap, 32))
 	exit(EXIT_FAILURE);
 
+    if (!magazine_test(h, pageheap, 64))
+	exit(EXIT_FAILURE);
+
     msg_debug("test passed\n");
     
     exit(EXIT_SUCCESS);
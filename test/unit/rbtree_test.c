@@ -0,0 +1,164 @@
+//#define ENABLE_MSG_DEBUG
+#include <runtime.h>
+#include <stdlib.h>
+#define EXIT_FAILURE 1
+#define EXIT_SUCCESS 0
+
+#define RANDOM_KEYS     4096
+#define RANDOM_PASSES   8
+
+#define test_assert(x) do { if (!(x)) { msg_err("%s failed\n", #x); return false; } } while (0)
+
+typedef struct test_node {
+    struct rbnode node;
+    u64 key;
+    boolean present;
+} *test_node;
+
+#define test_node_from_rbnode(n) struct_from_rbnode(n, test_node, node)
+
+static int compare_keys(rbnode a, rbnode b)
+{
+    u64 ka = test_node_from_rbnode(a)->key;
+    u64 kb = test_node_from_rbnode(b)->key;
+    return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+/* returns the black height of the subtree, or -1 if it is malformed */
+static int validate_subtree(rbtree t, rbnode n, rbnode parent)
+{
+    if (!n)
+        return 1;
+    if (n->parent != parent)
+        return -1;
+    if (n->red && ((n->left && n->left->red) || (n->right && n->right->red)))
+        return -1;
+    if ((n->left && t->key_compare(n->left, n) >= 0) ||
+        (n->right && t->key_compare(n->right, n) <= 0))
+        return -1;
+    int l = validate_subtree(t, n->left, n);
+    int r = validate_subtree(t, n->right, n);
+    if (l < 0 || l != r)
+        return -1;
+    return l + (n->red ? 0 : 1);
+}
+
+static boolean validate(rbtree t)
+{
+    return (!t->root || !t->root->red) && validate_subtree(t, t->root, 0) > 0;
+}
+
+static boolean basic_test(heap h)
+{
+    struct rbtree t;
+    struct test_node nodes[8];
+    init_rbtree(&t, compare_keys);
+    test_assert(rbtree_empty(&t));
+    test_assert(rbtree_find_first(&t) == INVALID_ADDRESS);
+
+    for (int i = 0; i < 8; i++) {
+        nodes[i].key = 10 * (i + 1);
+        test_assert(rbtree_insert_node(&t, &nodes[i].node));
+        test_assert(validate(&t));
+    }
+    struct test_node k;
+    k.key = 30;
+    test_assert(!rbtree_insert_node(&t, &k.node));
+    test_assert(rbtree_lookup(&t, &k.node) == &nodes[2].node);
+    k.key = 35;
+    test_assert(rbtree_lookup(&t, &k.node) == INVALID_ADDRESS);
+    test_assert(rbtree_lookup_max_lte(&t, &k.node) == &nodes[2].node);
+    test_assert(rbtree_lookup_min_gte(&t, &k.node) == &nodes[3].node);
+    k.key = 5;
+    test_assert(rbtree_lookup_max_lte(&t, &k.node) == INVALID_ADDRESS);
+    k.key = 85;
+    test_assert(rbtree_lookup_min_gte(&t, &k.node) == INVALID_ADDRESS);
+
+    test_assert(rbtree_find_first(&t) == &nodes[0].node);
+    test_assert(rbtree_find_last(&t) == &nodes[7].node);
+    int i = 0;
+    for (rbnode n = rbtree_find_first(&t); n != INVALID_ADDRESS; n = rbtree_successor(&t, n))
+        test_assert(n == &nodes[i++].node);
+    test_assert(i == 8);
+    for (rbnode n = rbtree_find_last(&t); n != INVALID_ADDRESS; n = rbtree_predecessor(&t, n))
+        test_assert(n == &nodes[--i].node);
+
+    for (i = 0; i < 8; i++) {
+        rbtree_remove_node(&t, &nodes[(i * 3) % 8].node);
+        test_assert(validate(&t));
+    }
+    test_assert(rbtree_empty(&t));
+    return true;
+}
+
+/* random inserts and removals, checked against a presence array */
+static boolean random_test(heap h)
+{
+    struct rbtree t;
+    test_node nodes = allocate(h, RANDOM_KEYS * sizeof(struct test_node));
+    test_assert(nodes != INVALID_ADDRESS);
+    init_rbtree(&t, compare_keys);
+    for (int i = 0; i < RANDOM_KEYS; i++) {
+        nodes[i].key = 2 * i;
+        nodes[i].present = false;
+    }
+
+    int count = 0;
+    for (int pass = 0; pass < RANDOM_PASSES; pass++) {
+        for (int j = 0; j < RANDOM_KEYS; j++) {
+            test_node n = &nodes[random_u64() % RANDOM_KEYS];
+            if (n->present) {
+                rbtree_remove_node(&t, &n->node);
+                count--;
+            } else {
+                test_assert(rbtree_insert_node(&t, &n->node));
+                count++;
+            }
+            n->present = !n->present;
+        }
+        test_assert(validate(&t));
+
+        int seen = 0;
+        u64 last = 0;
+        for (rbnode n = rbtree_find_first(&t); n != INVALID_ADDRESS; n = rbtree_successor(&t, n)) {
+            test_node tn = test_node_from_rbnode(n);
+            test_assert(tn->present);
+            test_assert(!seen || tn->key > last);
+            last = tn->key;
+            seen++;
+        }
+        test_assert(seen == count);
+
+        for (int j = 0; j < RANDOM_KEYS; j++) {
+            struct test_node k;
+            k.key = 2 * j + 1;
+            rbnode n = rbtree_lookup_min_gte(&t, &k.node);
+            int next = j + 1;
+            while (next < RANDOM_KEYS && !nodes[next].present)
+                next++;
+            test_assert(next < RANDOM_KEYS ? n == &nodes[next].node : n == INVALID_ADDRESS);
+            k.key = 2 * j;
+            test_assert(rbtree_lookup(&t, &k.node) ==
+                        (nodes[j].present ? &nodes[j].node : INVALID_ADDRESS));
+        }
+    }
+    deallocate(h, nodes, RANDOM_KEYS * sizeof(struct test_node));
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+
+    if (!basic_test(h))
+        goto fail;
+
+    if (!random_test(h))
+        goto fail;
+
+    msg_debug("test passed\n");
+    exit(EXIT_SUCCESS);
+  fail:
+    msg_err("test failed\n");
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,236 @@
+#include <tfs_internal.h>
+#include <stdlib.h>
+#include "bench.h"
+#define EXIT_FAILURE 1
+#define EXIT_SUCCESS 0
+
+#define BLOCKSIZE       SECTOR_SIZE
+#define STORAGE_SIZE    (64 * MB)
+#define MAX_ALLOC       (256 * KB)
+#define RANDOM_ALLOCS   4096
+#define CHURN_ROUNDS    32
+#define BENCH_MIN_HOLES 1024
+#define BENCH_MAX_HOLES (64 * 1024)
+#define BENCH_ITERATIONS 4096
+
+#define test_assert(x) do { if (!(x)) { msg_err("%s failed\n", #x); return false; } } while (0)
+
+static boolean basic_test(heap h)
+{
+    heap s = create_storage_heap(h, STORAGE_SIZE, BLOCKSIZE);
+    test_assert(s != INVALID_ADDRESS);
+    test_assert(heap_total(s) == STORAGE_SIZE);
+
+    /* exact sizes, padded to the block size, in address order */
+    test_assert(allocate_u64(s, 1000) == 0);
+    test_assert(allocate_u64(s, 3 * BLOCKSIZE) == 1024);
+    test_assert(allocate_u64(s, 5 * KB) == 1024 + 3 * BLOCKSIZE);
+    test_assert(heap_allocated(s) == 1024 + 3 * BLOCKSIZE + 5 * KB);
+
+    /* the freed hole is reused first-fit */
+    deallocate_u64(s, 1024, 3 * BLOCKSIZE);
+    test_assert(allocate_u64(s, 2 * BLOCKSIZE) == 1024);
+    test_assert(allocate_u64(s, 2 * BLOCKSIZE) == 1024 + 5 * KB + 3 * BLOCKSIZE);
+    test_assert(allocate_u64(s, BLOCKSIZE) == 1024 + 2 * BLOCKSIZE);
+
+    /* nothing larger than the heap */
+    test_assert(allocate_u64(s, STORAGE_SIZE) == INVALID_PHYSICAL);
+    destroy_heap(s);
+    return true;
+}
+
+static boolean hint_test(heap h)
+{
+    heap s = create_storage_heap(h, STORAGE_SIZE, BLOCKSIZE);
+    test_assert(s != INVALID_ADDRESS);
+
+    u64 a = storage_heap_alloc_near(s, 4 * KB, MB);
+    test_assert(a == MB);
+    test_assert(storage_heap_alloc_near(s, 8 * KB, a + 4 * KB) == a + 4 * KB);
+
+    /* taken or too small at the hint: first-fit */
+    test_assert(storage_heap_alloc_near(s, 4 * KB, a) == 0);
+    test_assert(storage_heap_alloc_near(s, MB, 4 * KB) == MB + 12 * KB);
+    destroy_heap(s);
+    return true;
+}
+
+static boolean reserve_test(heap h)
+{
+    heap s = create_storage_heap(h, STORAGE_SIZE, BLOCKSIZE);
+    test_assert(s != INVALID_ADDRESS);
+
+    test_assert(storage_heap_reserve(s, 8 * KB, 4 * KB));
+    test_assert(!storage_heap_reserve(s, 8 * KB, 4 * KB));
+    test_assert(!storage_heap_reserve(s, 4 * KB, 8 * KB));
+    test_assert(!storage_heap_reserve(s, 100, BLOCKSIZE));
+    test_assert(!storage_heap_reserve(s, STORAGE_SIZE - KB, 2 * KB));
+    test_assert(allocate_u64(s, 8 * KB) == 0);
+    test_assert(allocate_u64(s, 8 * KB) == 12 * KB);
+    test_assert(heap_allocated(s) == 20 * KB);
+    destroy_heap(s);
+    return true;
+}
+
+static u64 random_length(void)
+{
+    return BLOCKSIZE * (1 + random_u64() % (MAX_ALLOC / BLOCKSIZE));
+}
+
+/* Mixed sizes in random order must coalesce back to a single free
+   extent spanning the heap. */
+static boolean coalesce_test(heap h)
+{
+    heap s = create_storage_heap(h, STORAGE_SIZE, BLOCKSIZE);
+    test_assert(s != INVALID_ADDRESS);
+
+    u64 *addrs = allocate(h, RANDOM_ALLOCS * sizeof(u64));
+    u64 *lengths = allocate(h, RANDOM_ALLOCS * sizeof(u64));
+    int n;
+    for (n = 0; n < RANDOM_ALLOCS; n++) {
+        lengths[n] = random_length();
+        addrs[n] = allocate_u64(s, lengths[n]);
+        if (addrs[n] == INVALID_PHYSICAL)
+            break;
+    }
+    for (int i = n - 1; i > 0; i--) {
+        int j = random_u64() % (i + 1);
+        u64 a = addrs[i], l = lengths[i];
+        addrs[i] = addrs[j];
+        lengths[i] = lengths[j];
+        addrs[j] = a;
+        lengths[j] = l;
+    }
+    for (int i = 0; i < n; i++)
+        deallocate_u64(s, addrs[i], lengths[i]);
+    test_assert(heap_allocated(s) == 0);
+    test_assert(allocate_u64(s, STORAGE_SIZE) == 0);
+
+    deallocate(h, addrs, RANDOM_ALLOCS * sizeof(u64));
+    deallocate(h, lengths, RANDOM_ALLOCS * sizeof(u64));
+    destroy_heap(s);
+    return true;
+}
+
+/* Fill the heap with mixed-size extents until an allocation fails,
+   then free a random half; repeat, and return the average percentage
+   of the heap holding data at each failure. */
+static u64 churn_utilization(heap h, heap s)
+{
+    u64 max = STORAGE_SIZE / BLOCKSIZE;
+    u64 *addrs = allocate(h, max * sizeof(u64));
+    u64 *lengths = allocate(h, max * sizeof(u64));
+    u64 n = 0, used = 0, sum = 0;
+    for (int round = 0; round < CHURN_ROUNDS; round++) {
+        while (n < max) {
+            u64 l = random_length();
+            u64 a = allocate_u64(s, l);
+            if (a == INVALID_PHYSICAL)
+                break;
+            addrs[n] = a;
+            lengths[n++] = l;
+            used += l;
+        }
+        sum += used * 100 / STORAGE_SIZE;
+        for (u64 i = 0; i < n; ) {
+            if (random_u64() & 1) {
+                deallocate_u64(s, addrs[i], lengths[i]);
+                used -= lengths[i];
+                addrs[i] = addrs[--n];
+                lengths[i] = lengths[n];
+            } else {
+                i++;
+            }
+        }
+    }
+    for (u64 i = 0; i < n; i++)
+        deallocate_u64(s, addrs[i], lengths[i]);
+    deallocate(h, addrs, max * sizeof(u64));
+    deallocate(h, lengths, max * sizeof(u64));
+    return sum / CHURN_ROUNDS;
+}
+
+static boolean utilization_test(heap h)
+{
+    heap id = (heap)create_id_heap(h, h, 0, STORAGE_SIZE, BLOCKSIZE);
+    heap s = create_storage_heap(h, STORAGE_SIZE, BLOCKSIZE);
+    test_assert(id != INVALID_ADDRESS && s != INVALID_ADDRESS);
+    u64 id_util = churn_utilization(h, id);
+    u64 s_util = churn_utilization(h, s);
+    rprintf("utilization at first failure: id heap %ld percent, storage heap %ld percent\n",
+            id_util, s_util);
+    test_assert(heap_allocated(s) == 0);
+    test_assert(s_util > id_util);
+    destroy_heap(id);
+    destroy_heap(s);
+    return true;
+}
+
+/* Time an allocation that must pass over a given number of one-block
+   holes to be placed, plus a free that coalesces with a hole, on
+   heaps of increasing fragmentation. Indexed lookups keep the cost
+   near constant; a walk of the free extents grows with the count. */
+static u64 fragmented_op_ns(heap h, u64 holes)
+{
+    heap s = create_storage_heap(h, (2 * holes + 64) * BLOCKSIZE, BLOCKSIZE);
+    if (s == INVALID_ADDRESS)
+        return INVALID_PHYSICAL;
+    for (u64 i = 0; i < 2 * holes; i++)
+        assert(allocate_u64(s, BLOCKSIZE) == i * BLOCKSIZE);
+    for (u64 i = 0; i < holes; i++)
+        deallocate_u64(s, 2 * i * BLOCKSIZE, BLOCKSIZE);
+
+    u64 t = bench_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        u64 mid = (2 * (random_u64() % (holes - 1)) + 1) * BLOCKSIZE;
+        deallocate_u64(s, mid, BLOCKSIZE);
+        u64 a = allocate_u64(s, 4 * BLOCKSIZE);
+        assert(a >= 2 * holes * BLOCKSIZE);
+        deallocate_u64(s, a, 4 * BLOCKSIZE);
+        assert(storage_heap_reserve(s, mid, BLOCKSIZE));
+    }
+    t = (bench_ns() - t) / BENCH_ITERATIONS;
+    destroy_heap(s);
+    return t;
+}
+
+/* Timings are reported only; wall clock is too noisy on shared
+   machines to assert on. */
+static boolean scaling_bench(heap h)
+{
+    for (u64 holes = BENCH_MIN_HOLES; holes <= BENCH_MAX_HOLES; holes *= 4) {
+        u64 t = fragmented_op_ns(h, holes);
+        test_assert(t != INVALID_PHYSICAL);
+        rprintf("%ld free extents: %ld ns/(free + alloc + free + reserve)\n", holes, t);
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+
+    if (!basic_test(h))
+        goto fail;
+
+    if (!hint_test(h))
+        goto fail;
+
+    if (!reserve_test(h))
+        goto fail;
+
+    if (!coalesce_test(h))
+        goto fail;
+
+    if (!utilization_test(h))
+        goto fail;
+
+    if (!scaling_bench(h))
+        goto fail;
+
+    msg_debug("test passed\n");
+    exit(EXIT_SUCCESS);
+  fail:
+    msg_err("test failed\n");
+    exit(EXIT_FAILURE);
+}